@@ -679,6 +679,7 @@ typedef enum {
     VIR_MIGRATE_AUTO_CONVERGE     = (1 << 13), /* force convergence */
     VIR_MIGRATE_RDMA_PIN_ALL      = (1 << 14), /* RDMA memory pinning */
     VIR_MIGRATE_POSTCOPY          = (1 << 15), /* enable (but do not start) post-copy migration */
+    VIR_MIGRATE_PARALLEL          = (1 << 16), /* send memory pages over multiple connections */
 } virDomainMigrateFlags;
 
 
@@ -845,6 +846,14 @@ typedef enum {
  */
 # define VIR_MIGRATE_PARAM_COMPRESSION_XBZRLE_CACHE "compression.xbzrle.cache"
 
+/**
+ * VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS:
+ *
+ * virDomainMigrate* params field: number of connections used during parallel
+ * migration as VIR_TYPED_PARAM_INT. Requires the VIR_MIGRATE_PARALLEL flag.
+ */
+# define VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS "parallel.connections"
+
 /* Domain migration. */
 virDomainPtr virDomainMigrate (virDomainPtr domain, virConnectPtr dconn,
                                unsigned long flags, const char *dname,
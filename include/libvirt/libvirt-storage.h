@@ -167,6 +167,11 @@ typedef enum {
 # endif
 } virStorageVolWipeAlgorithm;
 
+typedef enum {
+    VIR_STORAGE_VOL_WIPE_BACKGROUND = 1 << 0, /* return before the volume
+                                                 is fully wiped */
+} virStorageVolWipeFlags;
+
 typedef struct _virStorageVolInfo virStorageVolInfo;
 
 struct _virStorageVolInfo {
@@ -328,6 +333,8 @@ const char*             virStorageVolGetKey             (virStorageVolPtr vol);
 typedef enum {
     VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA = 1 << 0,
     VIR_STORAGE_VOL_CREATE_REFLINK = 1 << 1, /* perform a btrfs lightweight copy */
+    VIR_STORAGE_VOL_CREATE_BACKGROUND = 1 << 2, /* return before the volume
+                                                   is fully built */
 } virStorageVolCreateFlags;
 
 virStorageVolPtr        virStorageVolCreateXML          (virStoragePoolPtr pool,
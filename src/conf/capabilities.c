@@ -844,6 +844,40 @@ virCapabilitiesFormatNUMATopology(virBufferPtr buf,
     return 0;
 }
 
+/**
+ * virCapabilitiesFormatHostNUMA:
+ * @caps: capabilities to format
+ *
+ * Format just the host NUMA topology of @caps, as it is embedded in the
+ * document produced by virCapabilitiesFormatXML
+ *
+ * Returns the formatted topology, an empty string if @caps has none, or
+ * NULL on error
+ */
+char *
+virCapabilitiesFormatHostNUMA(virCapsPtr caps)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *ret = NULL;
+
+    if (!caps->host.nnumaCell) {
+        ignore_value(VIR_STRDUP(ret, ""));
+        return ret;
+    }
+
+    virBufferAdjustIndent(&buf, 4);
+    if (virCapabilitiesFormatNUMATopology(&buf, caps->host.nnumaCell,
+                                          caps->host.numaCell) < 0) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
 /**
  * virCapabilitiesFormatXML:
  * @caps: capabilities to format
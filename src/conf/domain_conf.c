@@ -53,6 +53,7 @@
 #include "network_conf.h"
 #include "virtpm.h"
 #include "virstring.h"
+#include "vircrypto.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -2693,6 +2694,7 @@ static void virDomainObjDispose(void *obj)
         (dom->privateDataFreeFunc)(dom->privateData);
 
     virDomainSnapshotObjListFree(dom->snapshots);
+    VIR_FREE(dom->statusDigest);
 }
 
 virDomainObjPtr
@@ -23451,15 +23453,48 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
 
     int ret = -1;
     char *xml;
+    char *digest = NULL;
+    char *statusFile = NULL;
 
     if (!(xml = virDomainObjFormat(xmlopt, obj, caps, flags)))
         goto cleanup;
 
+    if (!statusDir) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256, xml, &digest) < 0)
+        goto cleanup;
+
+    /* Most callers save the status after every job or state change even
+     * if nothing visible in the status XML changed. Skip the atomic
+     * rewrite (and the fsync it implies) if the file on disk already
+     * holds exactly what we would write. */
+    if (obj->statusDigest && STREQ(obj->statusDigest, digest)) {
+        if (!(statusFile = virDomainConfigFile(statusDir, obj->def->name)))
+            goto cleanup;
+
+        if (virFileExists(statusFile)) {
+            VIR_DEBUG("status of domain '%s' unchanged, not rewriting '%s'",
+                      obj->def->name, statusFile);
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    VIR_FREE(obj->statusDigest);
+
     if (virDomainSaveXML(statusDir, obj->def, xml))
         goto cleanup;
 
+    obj->statusDigest = digest;
+    digest = NULL;
+
     ret = 0;
  cleanup:
+    VIR_FREE(statusFile);
+    VIR_FREE(digest);
     VIR_FREE(xml);
     return ret;
 }
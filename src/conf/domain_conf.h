@@ -2322,6 +2322,8 @@ struct _virDomainObj {
 
     unsigned long long original_memlock; /* Original RLIMIT_MEMLOCK, zero if no
                                           * restore will be required later */
+
+    char *statusDigest; /* SHA256 of the status XML last written to disk */
 };
 
 typedef bool (*virDomainObjListACLFilter)(virConnectPtr conn,
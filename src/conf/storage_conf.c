@@ -45,6 +45,7 @@
 #include "virfile.h"
 #include "virstring.h"
 #include "virlog.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -328,6 +329,20 @@ virStorageVolDefFree(virStorageVolDefPtr def)
     VIR_FREE(def);
 }
 
+
+/**
+ * virStorageVolDefJobCancelled:
+ * @def: volume definition
+ *
+ * Check whether the job running on @def, if any, was asked to stop.
+ * Backends call this between chunks of long running work.
+ */
+bool
+virStorageVolDefJobCancelled(virStorageVolDefPtr def)
+{
+    return def->job && virAtomicIntGet(&def->job->cancelled);
+}
+
 static void
 virStoragePoolSourceAdapterClear(virStoragePoolSourceAdapterPtr adapter)
 {
@@ -816,6 +831,9 @@ virStoragePoolDefParseXML(xmlXPathContextPtr ctxt)
     char *type = NULL;
     char *uuid = NULL;
     char *target_path = NULL;
+    char *watch = NULL;
+    char *period = NULL;
+    char *queue = NULL;
 
     if (VIR_ALLOC(ret) < 0)
         return NULL;
@@ -972,10 +990,48 @@ virStoragePoolDefParseXML(xmlXPathContextPtr ctxt)
             goto error;
     }
 
+    if ((watch = virXPathString("string(./refresh/@watch)", ctxt))) {
+        if ((ret->refreshWatch = virTristateBoolTypeFromString(watch)) <= 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid refresh watch value '%s'"), watch);
+            goto error;
+        }
+    }
+
+    if ((period = virXPathString("string(./refresh/stats/@period)", ctxt))) {
+        if (virStrToLong_uip(period, NULL, 10, &ret->refreshStats) < 0 ||
+            ret->refreshStats == 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid refresh stats period '%s'"), period);
+            goto error;
+        }
+    }
+
+    if ((queue = virXPathString("string(./stream/@queue)", ctxt))) {
+        if (ret->type != VIR_STORAGE_POOL_RBD &&
+            ret->type != VIR_STORAGE_POOL_GLUSTER) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("stream queue depth is not supported "
+                             "for pool type '%s'"),
+                           virStoragePoolTypeToString(ret->type));
+            goto error;
+        }
+        if (virStrToLong_uip(queue, NULL, 10, &ret->streamQueue) < 0 ||
+            ret->streamQueue == 0 ||
+            ret->streamQueue > VIR_STORAGE_POOL_STREAM_QUEUE_MAX) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid stream queue depth '%s'"), queue);
+            goto error;
+        }
+    }
+
  cleanup:
     VIR_FREE(uuid);
     VIR_FREE(type);
     VIR_FREE(target_path);
+    VIR_FREE(watch);
+    VIR_FREE(period);
+    VIR_FREE(queue);
     return ret;
 
  error:
@@ -1233,6 +1289,27 @@ virStoragePoolDefFormatBuf(virBufferPtr buf,
         virBufferAdjustIndent(buf, -2);
         virBufferAddLit(buf, "</target>\n");
     }
+
+    if (def->refreshWatch || def->refreshStats) {
+        virBufferAddLit(buf, "<refresh");
+        if (def->refreshWatch)
+            virBufferAsprintf(buf, " watch='%s'",
+                              virTristateBoolTypeToString(def->refreshWatch));
+        if (def->refreshStats) {
+            virBufferAddLit(buf, ">\n");
+            virBufferAdjustIndent(buf, 2);
+            virBufferAsprintf(buf, "<stats period='%u'/>\n",
+                              def->refreshStats);
+            virBufferAdjustIndent(buf, -2);
+            virBufferAddLit(buf, "</refresh>\n");
+        } else {
+            virBufferAddLit(buf, "/>\n");
+        }
+    }
+
+    if (def->streamQueue)
+        virBufferAsprintf(buf, "<stream queue='%u'/>\n", def->streamQueue);
+
     virBufferAdjustIndent(buf, -2);
     virBufferAddLit(buf, "</pool>\n");
 
@@ -1751,45 +1828,213 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 
     VIR_FREE(pool->volumes.objs);
     pool->volumes.count = 0;
+
+    virHashFree(pool->volumes.byKey);
+    virHashFree(pool->volumes.byPath);
+    virHashFree(pool->volumes.byName);
+    pool->volumes.byKey = NULL;
+    pool->volumes.byPath = NULL;
+    pool->volumes.byName = NULL;
+    pool->volumes.nshadowed = 0;
+    pool->volumes.serial = 0;
+}
+
+static int
+virStorageVolDefListIndexInit(virStorageVolDefListPtr list)
+{
+    if (list->byKey)
+        return 0;
+
+    /* The tables only borrow the volume definitions owned by @objs */
+    if (!(list->byKey = virHashCreate(32, NULL)) ||
+        !(list->byPath = virHashCreate(32, NULL)) ||
+        !(list->byName = virHashCreate(32, NULL))) {
+        virHashFree(list->byKey);
+        virHashFree(list->byPath);
+        list->byKey = NULL;
+        list->byPath = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+virStorageVolDefListIndexAdd(virStorageVolDefListPtr list,
+                             virHashTablePtr table,
+                             const char *name,
+                             virStorageVolDefPtr vol)
+{
+    if (!name)
+        return 0;
+
+    /* If several volumes share a value, lookups return the first
+     * one added */
+    if (virHashLookup(table, name)) {
+        vol->shadowed++;
+        list->nshadowed++;
+        return 0;
+    }
+
+    return virHashAddEntry(table, name, vol);
+}
+
+static bool
+virStorageVolDefListIndexRemove(virHashTablePtr table,
+                                const char *name,
+                                virStorageVolDefPtr vol)
+{
+    if (!name || virHashLookup(table, name) != vol)
+        return false;
+
+    ignore_value(virHashRemoveEntry(table, name));
+    return true;
+}
+
+/**
+ * virStoragePoolObjAddVol:
+ * @pool: locked pool object
+ * @vol: volume definition with its name, key and target path filled in
+ *
+ * Append @vol to the volumes of @pool and index it for the
+ * virStorageVolDefFindBy* lookups. On success @pool owns @vol,
+ * on failure the caller keeps it.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr list = &pool->volumes;
+
+    if (virStorageVolDefListIndexInit(list) < 0)
+        return -1;
+
+    vol->slot = list->count;
+    vol->serial = list->serial++;
+    vol->shadowed = 0;
+    if (VIR_APPEND_ELEMENT_COPY(list->objs, list->count, vol) < 0)
+        return -1;
+
+    if (virStorageVolDefListIndexAdd(list, list->byKey, vol->key, vol) < 0 ||
+        virStorageVolDefListIndexAdd(list, list->byPath,
+                                     vol->target.path, vol) < 0 ||
+        virStorageVolDefListIndexAdd(list, list->byName, vol->name, vol) < 0) {
+        virStoragePoolObjRemoveVol(pool, vol);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * virStoragePoolObjRemoveVol:
+ * @pool: locked pool object
+ * @vol: volume definition of @pool
+ *
+ * Remove @vol from the volumes of @pool and from the lookup indexes.
+ * The last volume of the list takes the place of @vol, so the order of
+ * the remaining volumes is not preserved. Lookups still return the
+ * earliest added of the remaining volumes sharing a value with @vol.
+ * The definition itself is not freed.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr list = &pool->volumes;
+    virStorageVolDefPtr byKey = NULL;
+    virStorageVolDefPtr byPath = NULL;
+    virStorageVolDefPtr byName = NULL;
+    bool key, path, name;
+    size_t i;
+
+    if (vol->slot >= list->count || list->objs[vol->slot] != vol)
+        return;
+
+    list->objs[vol->slot] = list->objs[list->count - 1];
+    list->objs[vol->slot]->slot = vol->slot;
+    VIR_DELETE_ELEMENT(list->objs, list->count - 1, list->count);
+
+    if (!list->byKey)
+        return;
+
+    list->nshadowed -= vol->shadowed;
+    vol->shadowed = 0;
+
+    key = virStorageVolDefListIndexRemove(list->byKey, vol->key, vol);
+    path = virStorageVolDefListIndexRemove(list->byPath, vol->target.path, vol);
+    name = virStorageVolDefListIndexRemove(list->byName, vol->name, vol);
+
+    /* Promote the earliest added remaining volume that shared an indexed
+     * value with @vol. Only then is the list scanned, so removal is cheap
+     * in the usual case of unique values. */
+    if (!list->nshadowed || !(key || path || name))
+        return;
+
+    for (i = 0; i < list->count; i++) {
+        virStorageVolDefPtr other = list->objs[i];
+
+        if (!other->shadowed)
+            continue;
+
+        if (key && STREQ_NULLABLE(other->key, vol->key) &&
+            (!byKey || other->serial < byKey->serial))
+            byKey = other;
+        if (path && STREQ_NULLABLE(other->target.path, vol->target.path) &&
+            (!byPath || other->serial < byPath->serial))
+            byPath = other;
+        if (name && STREQ_NULLABLE(other->name, vol->name) &&
+            (!byName || other->serial < byName->serial))
+            byName = other;
+    }
+
+    if (byKey) {
+        ignore_value(virHashAddEntry(list->byKey, vol->key, byKey));
+        byKey->shadowed--;
+        list->nshadowed--;
+    }
+    if (byPath) {
+        ignore_value(virHashAddEntry(list->byPath, vol->target.path, byPath));
+        byPath->shadowed--;
+        list->nshadowed--;
+    }
+    if (byName) {
+        ignore_value(virHashAddEntry(list->byName, vol->name, byName));
+        byName->shadowed--;
+        list->nshadowed--;
+    }
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
                           const char *key)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->key, key))
-            return pool->volumes.objs[i];
+    if (!pool->volumes.byKey)
+        return NULL;
 
-    return NULL;
+    return virHashLookup(pool->volumes.byKey, key);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
                            const char *path)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->target.path, path))
-            return pool->volumes.objs[i];
+    if (!pool->volumes.byPath)
+        return NULL;
 
-    return NULL;
+    return virHashLookup(pool->volumes.byPath, path);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->name, name))
-            return pool->volumes.objs[i];
+    if (!pool->volumes.byName)
+        return NULL;
 
-    return NULL;
+    return virHashLookup(pool->volumes.byName, name);
 }
 
 virStoragePoolObjPtr
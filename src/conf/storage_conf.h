@@ -29,6 +29,7 @@
 # include "virstoragefile.h"
 # include "virbitmap.h"
 # include "virthread.h"
+# include "virhash.h"
 # include "device_conf.h"
 # include "node_device_conf.h"
 
@@ -58,6 +59,33 @@ struct _virStorageVolSource {
 };
 
 
+/*
+ * Identity of the file backing a volume at the time it was last
+ * probed, letting a pool refresh skip files that did not change.
+ */
+typedef struct _virStorageVolStamp virStorageVolStamp;
+typedef virStorageVolStamp *virStorageVolStampPtr;
+struct _virStorageVolStamp {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+/*
+ * State of a long running operation on a volume, shared between the
+ * driver and the backend doing the work.
+ */
+typedef struct _virStorageVolJob virStorageVolJob;
+typedef virStorageVolJob *virStorageVolJobPtr;
+struct _virStorageVolJob {
+    int cancelled; /* set atomically to ask the backend to give up */
+    bool remove; /* delete the volume once the job has stopped */
+    bool background; /* nobody waits for the job to finish */
+};
+
 typedef struct _virStorageVolDef virStorageVolDef;
 typedef virStorageVolDef *virStorageVolDefPtr;
 struct _virStorageVolDef {
@@ -67,9 +95,16 @@ struct _virStorageVolDef {
 
     bool building;
     unsigned int in_use;
+    virStorageVolJobPtr job; /* not owned, set while a job runs */
 
     virStorageVolSource source;
     virStorageSource target;
+
+    virStorageVolStamp stamp;
+
+    size_t slot; /* position in the volume list of its pool */
+    unsigned long long serial; /* order in which it was added to its pool */
+    unsigned int shadowed; /* indexed values taken by another volume */
 };
 
 typedef struct _virStorageVolDefList virStorageVolDefList;
@@ -77,6 +112,15 @@ typedef virStorageVolDefList *virStorageVolDefListPtr;
 struct _virStorageVolDefList {
     size_t count;
     virStorageVolDefPtr *objs;
+
+    /* Lookup indexes over @objs, keyed by volume key, target path and
+     * name. Maintained by virStoragePoolObjAddVol and
+     * virStoragePoolObjRemoveVol. */
+    virHashTablePtr byKey;
+    virHashTablePtr byPath;
+    virHashTablePtr byName;
+    size_t nshadowed; /* sum of the volumes' @shadowed */
+    unsigned long long serial; /* @serial of the next volume added */
 };
 
 VIR_ENUM_DECL(virStorageVol)
@@ -244,6 +288,9 @@ struct _virStoragePoolTarget {
     virStoragePerms perms; /* Default permissions for volumes */
 };
 
+/* Upper bound of the <stream queue=...> pool setting */
+# define VIR_STORAGE_POOL_STREAM_QUEUE_MAX 256
+
 typedef struct _virStoragePoolDef virStoragePoolDef;
 typedef virStoragePoolDef *virStoragePoolDefPtr;
 struct _virStoragePoolDef {
@@ -257,6 +304,14 @@ struct _virStoragePoolDef {
 
     virStoragePoolSource source;
     virStoragePoolTarget target;
+
+    /* Track changes to the target directory while the pool runs */
+    int refreshWatch; /* enum virTristateBool */
+    /* Re-read pool usage from the backend at most this often (s), 0 never */
+    unsigned int refreshStats;
+
+    /* Requests in flight when streaming volumes, 0 for the default */
+    unsigned int streamQueue;
 };
 
 typedef struct _virStoragePoolObj virStoragePoolObj;
@@ -270,6 +325,8 @@ struct _virStoragePoolObj {
     bool active;
     int autostart;
     unsigned int asyncjobs;
+    void *watch; /* directory watch owned by the storage driver */
+    unsigned long long statsTime; /* last read of pool usage (ms) */
 
     virStoragePoolDefPtr def;
     virStoragePoolDefPtr newDef;
@@ -292,6 +349,14 @@ struct _virStorageDriverState {
 
     virStoragePoolObjList pools;
 
+    /* volume key -> name of the pool that last held it */
+    virHashTablePtr volKeyPools;
+
+    /* volume jobs running in the background */
+    size_t njobs;
+    virStorageVolJobPtr *jobs;
+    virCond jobsCond;   /* also signalled when a watch refresh ends */
+
     char *configDir;
     char *autostartDir;
     char *stateDir;
@@ -347,6 +412,10 @@ virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name);
 
 void virStoragePoolObjClearVols(virStoragePoolObjPtr pool);
+int virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol);
+void virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr vol);
 
 virStoragePoolDefPtr virStoragePoolDefParseString(const char *xml);
 virStoragePoolDefPtr virStoragePoolDefParseFile(const char *filename);
@@ -390,6 +459,8 @@ int virStoragePoolObjSaveDef(virStorageDriverStatePtr driver,
 int virStoragePoolObjDeleteDef(virStoragePoolObjPtr pool);
 
 void virStorageVolDefFree(virStorageVolDefPtr def);
+
+bool virStorageVolDefJobCancelled(virStorageVolDefPtr def);
 void virStoragePoolSourceClear(virStoragePoolSourcePtr source);
 void virStoragePoolSourceDeviceClear(virStoragePoolSourceDevicePtr dev);
 void virStoragePoolSourceFree(virStoragePoolSourcePtr source);
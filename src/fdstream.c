@@ -44,16 +44,29 @@
 #include "virstring.h"
 #include "virtime.h"
 #include "virprocess.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
 VIR_LOG_INIT("fdstream");
 
+/* In-process replacement of the I/O helper */
+struct virFDStreamThreadData {
+    virThread thread;
+    int fd;             /* the thread's end of the pipe */
+    virFDStreamThreadFunc func;
+    void *opaque;
+    virFreeCallback freeOpaque;
+    bool failed;
+    virErrorPtr err;    /* error reported by @func */
+};
+
 /* Tunnelled migration stream support */
 struct virFDStreamData {
     int fd;
     int errfd;
     virCommandPtr cmd;
+    struct virFDStreamThreadData *thread;
     unsigned long long offset;
     unsigned long long length;
 
@@ -292,6 +305,36 @@ virFDStreamCloseCommand(struct virFDStreamData *fdst, bool streamAbort)
     return ret;
 }
 
+static int
+virFDStreamCloseThread(struct virFDStreamData *fdst, bool streamAbort)
+{
+    struct virFDStreamThreadData *data = fdst->thread;
+    int ret = 0;
+
+    if (!data)
+        return 0;
+
+    /* Our end of the pipe is closed by now, so the thread either sees
+     * EOF or EPIPE and won't block for much longer */
+    virThreadJoin(&data->thread);
+
+    if (data->failed && !streamAbort) {
+        if (data->err)
+            virSetError(data->err);
+        else
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("I/O thread failed "
+                             "before all data was processed"));
+        ret = -1;
+    }
+
+    if (data->freeOpaque)
+        (data->freeOpaque)(data->opaque);
+    virFreeError(data->err);
+    VIR_FREE(fdst->thread);
+    return ret;
+}
+
 static int
 virFDStreamCloseInt(virStreamPtr st, bool streamAbort)
 {
@@ -338,6 +381,8 @@ virFDStreamCloseInt(virStreamPtr st, bool streamAbort)
     ret = VIR_CLOSE(fdst->fd);
     if (virFDStreamCloseCommand(fdst, streamAbort) < 0)
         ret = -1;
+    if (virFDStreamCloseThread(fdst, streamAbort) < 0)
+        ret = -1;
 
     if (VIR_CLOSE(fdst->errfd) < 0)
         VIR_DEBUG("ignoring failed close on fd %d", fdst->errfd);
@@ -537,6 +582,107 @@ int virFDStreamOpen(virStreamPtr st,
 }
 
 
+static void
+virFDStreamThread(void *opaque)
+{
+    struct virFDStreamThreadData *data = opaque;
+
+    if ((data->func)(data->fd, data->opaque) < 0) {
+        data->failed = true;
+        data->err = virSaveLastError();
+    }
+
+    /* Let the other end see EOF or EPIPE right away */
+    VIR_FORCE_CLOSE(data->fd);
+}
+
+
+/**
+ * virFDStreamOpenThread:
+ * @st: the stream
+ * @length: limit on the data transferred, or 0 for no limit
+ * @oflags: O_RDONLY to read the data produced by @func from @st,
+ *          O_WRONLY to hand the data written to @st over to @func
+ * @func: I/O function to run in a separate thread
+ * @opaque: data for @func
+ * @freeOpaque: callback to free @opaque once the stream is closed
+ *
+ * Open @st on one end of a pipe and run @func in a new thread with
+ * the other end, much like the I/O helper is run for files. An error
+ * returned by @func is reported when the stream is finished.
+ * On success @opaque is owned by the stream.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virFDStreamOpenThread(virStreamPtr st,
+                          unsigned long long length,
+                          int oflags,
+                          virFDStreamThreadFunc func,
+                          void *opaque,
+                          virFreeCallback freeOpaque)
+{
+    struct virFDStreamThreadData *data = NULL;
+    struct virFDStreamData *fdst;
+    int fds[2] = { -1, -1 };
+    int fd;
+
+    VIR_DEBUG("st=%p length=%llu oflags=%x opaque=%p",
+              st, length, oflags, opaque);
+
+    if ((oflags & O_ACCMODE) == O_RDWR) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("I/O thread streams must be read-only "
+                         "or write-only"));
+        return -1;
+    }
+
+    if (VIR_ALLOC(data) < 0)
+        return -1;
+
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create pipe"));
+        goto error;
+    }
+
+    if ((oflags & O_ACCMODE) == O_RDONLY) {
+        fd = fds[0];
+        data->fd = fds[1];
+    } else {
+        fd = fds[1];
+        data->fd = fds[0];
+    }
+
+    data->func = func;
+    data->opaque = opaque;
+    data->freeOpaque = freeOpaque;
+
+    if (virThreadCreate(&data->thread, true, virFDStreamThread, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create I/O thread"));
+        goto error;
+    }
+
+    if (virFDStreamOpenInternal(st, fd, NULL, -1, length) < 0) {
+        /* The thread sees EOF or EPIPE and quits */
+        VIR_FORCE_CLOSE(fd);
+        virThreadJoin(&data->thread);
+        virFreeError(data->err);
+        VIR_FREE(data);
+        return -1;
+    }
+
+    fdst = st->privateData;
+    fdst->thread = data;
+    return 0;
+
+ error:
+    VIR_FORCE_CLOSE(fds[0]);
+    VIR_FORCE_CLOSE(fds[1]);
+    VIR_FREE(data);
+    return -1;
+}
+
+
 #if HAVE_SYS_UN_H
 int virFDStreamConnectUNIX(virStreamPtr st,
                            const char *path,
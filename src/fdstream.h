@@ -36,6 +36,17 @@ typedef void (*virFDStreamInternalCloseCbFreeOpaque)(void *opaque);
 int virFDStreamOpen(virStreamPtr st,
                     int fd);
 
+/* Move data between @fd and wherever it belongs, then return 0, or
+ * -1 with an error reported */
+typedef int (*virFDStreamThreadFunc)(int fd, void *opaque);
+
+int virFDStreamOpenThread(virStreamPtr st,
+                          unsigned long long length,
+                          int oflags,
+                          virFDStreamThreadFunc func,
+                          void *opaque,
+                          virFreeCallback freeOpaque);
+
 int virFDStreamConnectUNIX(virStreamPtr st,
                            const char *path,
                            bool abstract);
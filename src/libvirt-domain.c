@@ -3538,6 +3538,8 @@ virDomainMigrateUnmanaged(virDomainPtr domain,
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
  *   VIR_MIGRATE_OFFLINE Migrate offline
  *   VIR_MIGRATE_POSTCOPY Enable (but do not start) post-copy
+ *   VIR_MIGRATE_PARALLEL Send memory pages over multiple parallel
+ *                        connections (not with VIR_MIGRATE_TUNNELLED)
  *
  * VIR_MIGRATE_TUNNELLED requires that VIR_MIGRATE_PEER2PEER be set.
  * Applications using the VIR_MIGRATE_PEER2PEER flag will probably
@@ -3755,6 +3757,8 @@ virDomainMigrate(virDomainPtr domain,
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
  *   VIR_MIGRATE_OFFLINE Migrate offline
  *   VIR_MIGRATE_POSTCOPY Enable (but do not start) post-copy
+ *   VIR_MIGRATE_PARALLEL Send memory pages over multiple parallel
+ *                        connections (not with VIR_MIGRATE_TUNNELLED)
  *
  * VIR_MIGRATE_TUNNELLED requires that VIR_MIGRATE_PEER2PEER be set.
  * Applications using the VIR_MIGRATE_PEER2PEER flag will probably
@@ -4226,6 +4230,8 @@ int virDomainMigrateUnmanagedCheckCompat(virDomainPtr domain,
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
  *   VIR_MIGRATE_OFFLINE Migrate offline
  *   VIR_MIGRATE_POSTCOPY Enable (but do not start) post-copy
+ *   VIR_MIGRATE_PARALLEL Send memory pages over multiple parallel
+ *                        connections (not with VIR_MIGRATE_TUNNELLED)
  *
  * The operation of this API hinges on the VIR_MIGRATE_PEER2PEER flag.
  * If the VIR_MIGRATE_PEER2PEER flag is NOT set, the duri parameter
@@ -4345,6 +4351,8 @@ virDomainMigrateToURI(virDomainPtr domain,
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
  *   VIR_MIGRATE_OFFLINE Migrate offline
  *   VIR_MIGRATE_POSTCOPY Enable (but do not start) post-copy
+ *   VIR_MIGRATE_PARALLEL Send memory pages over multiple parallel
+ *                        connections (not with VIR_MIGRATE_TUNNELLED)
  *
  * The operation of this API hinges on the VIR_MIGRATE_PEER2PEER flag.
  *
@@ -11361,6 +11369,18 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * "state.state" - state of the VM, returned as int from virDomainState enum
  * "state.reason" - reason for entering given state, returned as int from
  *                  virDomain*Reason enum corresponding to given state.
+ * "state.job.<type>.wait.<bucket>" - number of jobs of <type> that waited
+ *                                    for up to <bucket> ("1ms", "10ms",
+ *                                    "100ms", "1s" or "10s"), but longer
+ *                                    than the previous bucket, before they
+ *                                    started or gave up, as unsigned long
+ *                                    long. Bucket "max" counts longer
+ *                                    waits. <type> is one of "query",
+ *                                    "destroy", "suspend", "modify",
+ *                                    "abort", "migration_op",
+ *                                    "query_shared", "async" and
+ *                                    "async_nested"; types without any
+ *                                    recorded job are omitted.
  *
  * VIR_DOMAIN_STATS_CPU_TOTAL: Return CPU statistics and usage information.
  * The typed parameter keys are in this format:
@@ -11452,6 +11472,22 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * "perf.mbml" - the amount of data (bytes/s) sent through the memory controller
  *               on the socket as unsigned long long. It is produced by mbml
  *               perf event.
+ * "perf.sample.count" - number of periodic vCPU counter samples kept in the
+ *                       history as unsigned int. The "perf.vcpu.*" fields
+ *                       are only present while this is non-zero.
+ * "perf.sample.time" - time (ms since the epoch) the newest sample was
+ *                      taken at as unsigned long long.
+ * "perf.sample.window" - time (ms) between the oldest and the newest kept
+ *                        sample as unsigned long long.
+ * "perf.vcpu.<num>.<counter>" - value of the hardware counter for vCPU <num>
+ *                               in the newest sample as unsigned long long.
+ *                               <counter> is one of "cycles",
+ *                               "instructions", "cache_misses" and
+ *                               "stalled_cycles"; counters the host does
+ *                               not support are omitted.
+ * "perf.vcpu.<num>.<counter>.delta" - increase of the counter over
+ *                                     "perf.sample.window" as unsigned
+ *                                     long long.
  *
  * Note that entire stats groups or individual stat fields may be missing from
  * the output in case they are not supported by the given hypervisor, are not
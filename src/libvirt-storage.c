@@ -1453,6 +1453,12 @@ virStorageVolGetKey(virStorageVolPtr vol)
  * qcow2 image files which don't support full preallocation,
  * by creating a sparse image file with metadata.
  *
+ * If VIR_STORAGE_VOL_CREATE_BACKGROUND is set in flags, the call
+ * returns as soon as the volume is defined and it is built in the
+ * background. Until then the volume refuses other operations, its
+ * allocation as reported by virStorageVolGetInfo reflects progress,
+ * and virStorageVolDelete cancels the build and removes it.
+ *
  * virStorageVolFree should be used to free the resources after the
  * storage volume object is no longer needed.
  *
@@ -1504,6 +1510,12 @@ virStorageVolCreateXML(virStoragePoolPtr pool,
  * qcow2 image files which don't support full preallocation,
  * by creating a sparse image file with metadata.
  *
+ * If VIR_STORAGE_VOL_CREATE_BACKGROUND is set in flags, the call
+ * returns as soon as the volume is defined and it is built in the
+ * background. Until then the volume refuses other operations, its
+ * allocation as reported by virStorageVolGetInfo reflects progress,
+ * and virStorageVolDelete cancels the build and removes it.
+ *
  * virStorageVolFree should be used to free the resources after the
  * storage volume object is no longer needed.
  *
@@ -1688,6 +1700,14 @@ virStorageVolUpload(virStorageVolPtr vol,
  *
  * Delete the storage volume from the pool
  *
+ * If the volume is being built or wiped in the background (see
+ * VIR_STORAGE_VOL_CREATE_BACKGROUND and VIR_STORAGE_VOL_WIPE_BACKGROUND),
+ * the deletion is deferred: the job is asked to stop and the call
+ * returns 0 right away, before anything is deleted. The volume is
+ * removed from the pool once the job has stopped, so it may still be
+ * looked up for a short while, and a failure to delete it is only
+ * logged.
+ *
  * Returns 0 on success, or -1 on error
  */
 int
@@ -1723,7 +1743,7 @@ virStorageVolDelete(virStorageVolPtr vol,
 /**
  * virStorageVolWipe:
  * @vol: pointer to storage volume
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolWipeFlags
  *
  * Ensure data previously on a volume is not accessible to future
  * reads. Also note, that depending on the actual volume
@@ -1732,6 +1752,11 @@ virStorageVolDelete(virStorageVolPtr vol,
  * journaled, log structured, copy-on-write, versioned, and
  * network file systems are known to be problematic.
  *
+ * If VIR_STORAGE_VOL_WIPE_BACKGROUND is set in flags, the call
+ * returns once the wipe has started. The volume stays in use until
+ * it completes, and virStorageVolDelete cancels it and removes the
+ * volume.
+ *
  * Returns 0 on success, or -1 on error
  */
 int
@@ -1768,7 +1793,7 @@ virStorageVolWipe(virStorageVolPtr vol,
  * virStorageVolWipePattern:
  * @vol: pointer to storage volume
  * @algorithm: one of virStorageVolWipeAlgorithm
- * @flags: future flags, use 0 for now
+ * @flags: bitwise-OR of virStorageVolWipeFlags
  *
  * Similar to virStorageVolWipe, but one can choose between
  * different wiping algorithms. Also note, that depending on the
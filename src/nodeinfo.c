@@ -59,6 +59,7 @@
 #include "virtypedparam.h"
 #include "virstring.h"
 #include "virnuma.h"
+#include "virnetlink.h"
 #include "virlog.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -623,27 +624,14 @@ nodeHasValidSubcoreConfiguration(const char *sysfs_prefix,
     return ret;
 }
 
-int
-linuxNodeInfoCPUPopulate(const char *sysfs_prefix,
-                         FILE *cpuinfo,
-                         virArch arch,
-                         virNodeInfoPtr nodeinfo)
+/* Parses the CPU clock speed from /proc/cpuinfo into @nodeinfo */
+static int
+linuxNodeInfoCPUFrequency(FILE *cpuinfo,
+                          virArch arch,
+                          virNodeInfoPtr nodeinfo)
 {
-    const char *prefix = sysfs_prefix ? sysfs_prefix : SYSFS_SYSTEM_PATH;
-    virBitmapPtr present_cpus_map = NULL;
-    virBitmapPtr online_cpus_map = NULL;
     char line[1024];
-    DIR *nodedir = NULL;
-    struct dirent *nodedirent = NULL;
-    int cpus, cores, socks, threads, offline = 0;
-    int threads_per_subcore = 0;
-    unsigned int node;
-    int ret = -1;
-    char *sysfs_nodedir = NULL;
-    char *sysfs_cpudir = NULL;
-    int direrr;
 
-    /* Start with parsing CPU clock speed from /proc/cpuinfo */
     while (fgets(line, sizeof(line), cpuinfo) != NULL) {
         if (ARCH_IS_X86(arch)) {
             char *buf = line;
@@ -658,7 +646,7 @@ linuxNodeInfoCPUPopulate(const char *sysfs_prefix,
                 if (*buf != ':' || !buf[1]) {
                     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                                    _("parsing cpu MHz from cpuinfo"));
-                    goto cleanup;
+                    return -1;
                 }
 
                 if (virStrToLong_ui(buf+1, &p, 10, &ui) == 0 &&
@@ -680,7 +668,7 @@ linuxNodeInfoCPUPopulate(const char *sysfs_prefix,
                 if (*buf != ':' || !buf[1]) {
                     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                                    _("parsing cpu MHz from cpuinfo"));
-                    goto cleanup;
+                    return -1;
                 }
 
                 if (virStrToLong_ui(buf+1, &p, 10, &ui) == 0 &&
@@ -706,7 +694,7 @@ linuxNodeInfoCPUPopulate(const char *sysfs_prefix,
                 if (*buf != ':' || !buf[1]) {
                     virReportError(VIR_ERR_INTERNAL_ERROR,
                                    "%s", _("parsing cpu MHz from cpuinfo"));
-                    goto cleanup;
+                    return -1;
                 }
 
                 if (virStrToLong_ui(buf+1, &p, 10, &ui) == 0
@@ -724,6 +712,32 @@ linuxNodeInfoCPUPopulate(const char *sysfs_prefix,
         }
     }
 
+    return 0;
+}
+
+int
+linuxNodeInfoCPUPopulate(const char *sysfs_prefix,
+                         FILE *cpuinfo,
+                         virArch arch,
+                         virNodeInfoPtr nodeinfo)
+{
+    const char *prefix = sysfs_prefix ? sysfs_prefix : SYSFS_SYSTEM_PATH;
+    virBitmapPtr present_cpus_map = NULL;
+    virBitmapPtr online_cpus_map = NULL;
+    DIR *nodedir = NULL;
+    struct dirent *nodedirent = NULL;
+    int cpus, cores, socks, threads, offline = 0;
+    int threads_per_subcore = 0;
+    unsigned int node;
+    int ret = -1;
+    char *sysfs_nodedir = NULL;
+    char *sysfs_cpudir = NULL;
+    int direrr;
+
+    /* Start with parsing CPU clock speed from /proc/cpuinfo */
+    if (linuxNodeInfoCPUFrequency(cpuinfo, arch, nodeinfo) < 0)
+        goto cleanup;
+
     /* Get information about what CPUs are present in the host and what
      * CPUs are online, so that we don't have to so for each node */
     present_cpus_map = nodeGetPresentCPUBitmap(sysfs_prefix);
@@ -1183,6 +1197,274 @@ virNodeGetSiblingsList(const char *dir, int cpu_id)
 }
 #endif
 
+#ifdef __linux__
+/* Gathering the host topology from sysfs costs a few reads per host CPU,
+ * yet the topology only changes on CPU or memory hotplug. Results for the
+ * real sysfs are therefore cached, but only once a kernel uevent watch is
+ * in place to invalidate them. Every invalidation bumps the generation so
+ * that data gathered while an event arrived is never stored. */
+typedef struct _virNodeTopologyCPU virNodeTopologyCPU;
+typedef virNodeTopologyCPU *virNodeTopologyCPUPtr;
+struct _virNodeTopologyCPU {
+    bool valid;
+    unsigned int socket_id;
+    unsigned int core_id;
+    virBitmapPtr siblings;
+};
+
+static virMutex nodeTopologyLock = VIR_MUTEX_INITIALIZER;
+static unsigned int nodeTopologyGeneration;
+static bool nodeTopologyHaveInfo;
+static virNodeInfo nodeTopologyInfo;
+static virBitmapPtr nodeTopologyOnline;
+static virNodeTopologyCPUPtr nodeTopologyCPUs;
+static size_t nodeTopologyNCPUs;
+
+static virMutex nodeTopologyWatchLock = VIR_MUTEX_INITIALIZER;
+static int nodeTopologyWatch = -1;
+# if defined(HAVE_LIBNL) && defined(NETLINK_KOBJECT_UEVENT)
+static unsigned int nodeTopologyOverruns;
+# endif
+
+/* must be called with nodeTopologyLock held */
+static void
+nodeTopologyClear(void)
+{
+    size_t i;
+
+    for (i = 0; i < nodeTopologyNCPUs; i++)
+        virBitmapFree(nodeTopologyCPUs[i].siblings);
+    VIR_FREE(nodeTopologyCPUs);
+    nodeTopologyNCPUs = 0;
+
+    virBitmapFree(nodeTopologyOnline);
+    nodeTopologyOnline = NULL;
+    nodeTopologyHaveInfo = false;
+    nodeTopologyGeneration++;
+}
+
+# if defined(HAVE_LIBNL) && defined(NETLINK_KOBJECT_UEVENT)
+static void
+nodeTopologyUevent(struct nlmsghdr *msg,
+                   unsigned int length,
+                   struct sockaddr_nl *peer ATTRIBUTE_UNUSED,
+                   bool *handled ATTRIBUTE_UNUSED,
+                   void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *event = (const char *) msg;
+    const char *devpath;
+
+    /* Kernel uevents start with a "ACTION@DEVPATH" string */
+    if (!memchr(event, '\0', length) ||
+        !(devpath = strchr(event, '@')))
+        return;
+    devpath++;
+
+    if (!STRPREFIX(devpath, "/devices/system/cpu/") &&
+        !STRPREFIX(devpath, "/devices/system/memory/") &&
+        !STRPREFIX(devpath, "/devices/system/node/"))
+        return;
+
+    VIR_DEBUG("Host topology changed: %s", event);
+
+    virMutexLock(&nodeTopologyLock);
+    nodeTopologyClear();
+    virMutexUnlock(&nodeTopologyLock);
+}
+# endif
+
+/* Returns true if topology data for @sysfs_prefix can be cached */
+static bool
+nodeTopologyCacheUsable(const char *sysfs_prefix)
+{
+    bool ret;
+
+    if (sysfs_prefix)
+        return false;
+
+    /* The event service calls its clients with its own lock held, so
+     * the watch must not be registered under nodeTopologyLock */
+    virMutexLock(&nodeTopologyWatchLock);
+# if defined(HAVE_LIBNL) && defined(NETLINK_KOBJECT_UEVENT)
+    if (nodeTopologyWatch < 0 &&
+        virNetlinkEventServiceIsRunning(NETLINK_KOBJECT_UEVENT)) {
+        nodeTopologyWatch = virNetlinkEventAddClient(nodeTopologyUevent,
+                                                     NULL, NULL, NULL,
+                                                     NETLINK_KOBJECT_UEVENT);
+        if (nodeTopologyWatch < 0)
+            virResetLastError();
+    }
+
+    /* Hotplug events may have been among those lost to an overrun */
+    if (nodeTopologyWatch >= 0) {
+        unsigned int overruns;
+
+        overruns = virNetlinkEventServiceOverruns(NETLINK_KOBJECT_UEVENT);
+        if (overruns != nodeTopologyOverruns) {
+            VIR_DEBUG("Dropping host topology after uevent overrun");
+            nodeTopologyOverruns = overruns;
+            virMutexLock(&nodeTopologyLock);
+            nodeTopologyClear();
+            virMutexUnlock(&nodeTopologyLock);
+        }
+    }
+# endif
+    ret = nodeTopologyWatch >= 0;
+    virMutexUnlock(&nodeTopologyWatchLock);
+
+    return ret;
+}
+
+/* Fills @info from the cache and returns true on a hit. On a miss the
+ * current generation is stored in @generation for nodeTopologySetInfo. */
+static bool
+nodeTopologyGetInfo(virNodeInfoPtr info,
+                    unsigned int *generation)
+{
+    bool ret;
+
+    virMutexLock(&nodeTopologyLock);
+    if ((ret = nodeTopologyHaveInfo))
+        *info = nodeTopologyInfo;
+    *generation = nodeTopologyGeneration;
+    virMutexUnlock(&nodeTopologyLock);
+
+    return ret;
+}
+
+static void
+nodeTopologySetInfo(const virNodeInfo *info,
+                    unsigned int generation)
+{
+    virMutexLock(&nodeTopologyLock);
+    if (generation == nodeTopologyGeneration) {
+        nodeTopologyInfo = *info;
+        nodeTopologyInfo.mhz = 0;
+        nodeTopologyHaveInfo = true;
+    }
+    virMutexUnlock(&nodeTopologyLock);
+}
+
+/* Returns a copy of the cached online CPU map, or NULL on a miss in
+ * which case @generation is set for nodeTopologySetOnline */
+static virBitmapPtr
+nodeTopologyGetOnline(unsigned int *generation)
+{
+    virBitmapPtr ret = NULL;
+
+    virMutexLock(&nodeTopologyLock);
+    if (nodeTopologyOnline &&
+        !(ret = virBitmapNewCopy(nodeTopologyOnline)))
+        virResetLastError();
+    *generation = nodeTopologyGeneration;
+    virMutexUnlock(&nodeTopologyLock);
+
+    return ret;
+}
+
+static void
+nodeTopologySetOnline(virBitmapPtr online,
+                      unsigned int generation)
+{
+    virMutexLock(&nodeTopologyLock);
+    if (generation == nodeTopologyGeneration && !nodeTopologyOnline &&
+        !(nodeTopologyOnline = virBitmapNewCopy(online)))
+        virResetLastError();
+    virMutexUnlock(&nodeTopologyLock);
+}
+
+/* Fills the topology of @cpu from the cache and returns true on a hit.
+ * On a miss @generation is set for nodeTopologySetCPU. */
+static bool
+nodeTopologyGetCPU(virCapsHostNUMACellCPUPtr cpu,
+                   unsigned int *generation)
+{
+    bool ret = false;
+    virNodeTopologyCPUPtr cached;
+
+    virMutexLock(&nodeTopologyLock);
+    *generation = nodeTopologyGeneration;
+    if (cpu->id >= nodeTopologyNCPUs)
+        goto cleanup;
+
+    cached = &nodeTopologyCPUs[cpu->id];
+    if (!cached->valid)
+        goto cleanup;
+
+    if (!(cpu->siblings = virBitmapNewCopy(cached->siblings))) {
+        virResetLastError();
+        goto cleanup;
+    }
+    cpu->socket_id = cached->socket_id;
+    cpu->core_id = cached->core_id;
+    ret = true;
+
+ cleanup:
+    virMutexUnlock(&nodeTopologyLock);
+    return ret;
+}
+
+static void
+nodeTopologySetCPU(virCapsHostNUMACellCPUPtr cpu,
+                   unsigned int generation)
+{
+    virNodeTopologyCPUPtr cached;
+
+    virMutexLock(&nodeTopologyLock);
+    if (generation != nodeTopologyGeneration)
+        goto cleanup;
+
+    if (cpu->id >= nodeTopologyNCPUs &&
+        VIR_EXPAND_N(nodeTopologyCPUs, nodeTopologyNCPUs,
+                     cpu->id + 1 - nodeTopologyNCPUs) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+
+    cached = &nodeTopologyCPUs[cpu->id];
+    if (cached->valid)
+        goto cleanup;
+
+    if (!(cached->siblings = virBitmapNewCopy(cpu->siblings))) {
+        virResetLastError();
+        goto cleanup;
+    }
+    cached->socket_id = cpu->socket_id;
+    cached->core_id = cpu->core_id;
+    cached->valid = true;
+
+ cleanup:
+    virMutexUnlock(&nodeTopologyLock);
+}
+#endif /* __linux__ */
+
+/**
+ * nodeGetTopologyGeneration:
+ * @generation: filled with the current generation
+ *
+ * The generation changes whenever a CPU, memory or NUMA node hotplug
+ * event is seen, which allows callers to cache data derived from the
+ * host topology.
+ *
+ * Returns 0 on success, -1 if topology changes can't be tracked (no
+ * error is reported in that case).
+ */
+int
+nodeGetTopologyGeneration(unsigned int *generation ATTRIBUTE_UNUSED)
+{
+#ifdef __linux__
+    if (!nodeTopologyCacheUsable(NULL))
+        return -1;
+
+    virMutexLock(&nodeTopologyLock);
+    *generation = nodeTopologyGeneration;
+    virMutexUnlock(&nodeTopologyLock);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 int
 nodeGetInfo(const char *sysfs_prefix ATTRIBUTE_UNUSED,
             virNodeInfoPtr nodeinfo)
@@ -1197,16 +1479,26 @@ nodeGetInfo(const char *sysfs_prefix ATTRIBUTE_UNUSED,
 #ifdef __linux__
     {
     int ret = -1;
-    FILE *cpuinfo = fopen(CPUINFO_PATH, "r");
+    FILE *cpuinfo = NULL;
+    bool cache = nodeTopologyCacheUsable(sysfs_prefix);
+    unsigned int generation = 0;
 
-    if (!cpuinfo) {
+    if (!(cpuinfo = fopen(CPUINFO_PATH, "r"))) {
         virReportSystemError(errno,
                              _("cannot open %s"), CPUINFO_PATH);
         return -1;
     }
 
-    ret = linuxNodeInfoCPUPopulate(sysfs_prefix, cpuinfo,
-                                   hostarch, nodeinfo);
+    /* The clock speed changes with frequency scaling, so only the
+     * topology is taken from the cache */
+    if (cache && nodeTopologyGetInfo(nodeinfo, &generation)) {
+        ret = linuxNodeInfoCPUFrequency(cpuinfo, hostarch, nodeinfo);
+    } else {
+        ret = linuxNodeInfoCPUPopulate(sysfs_prefix, cpuinfo,
+                                       hostarch, nodeinfo);
+        if (ret == 0 && cache)
+            nodeTopologySetInfo(nodeinfo, generation);
+    }
     if (ret < 0)
         goto cleanup;
 
@@ -1451,6 +1743,11 @@ nodeGetOnlineCPUBitmap(const char *sysfs_prefix ATTRIBUTE_UNUSED)
     char *cpudir = NULL;
     virBitmapPtr cpumap;
     int present;
+    bool cache = nodeTopologyCacheUsable(sysfs_prefix);
+    unsigned int generation = 0;
+
+    if (cache && (cpumap = nodeTopologyGetOnline(&generation)))
+        return cpumap;
 
     present = nodeGetCPUCount(sysfs_prefix);
     if (present < 0)
@@ -1482,6 +1779,9 @@ nodeGetOnlineCPUBitmap(const char *sysfs_prefix ATTRIBUTE_UNUSED)
         }
     }
 
+    if (cache && cpumap)
+        nodeTopologySetOnline(cpumap, generation);
+
  cleanup:
     VIR_FREE(online_path);
     VIR_FREE(cpudir);
@@ -1980,14 +2280,21 @@ nodeGetMemoryFake(unsigned long long *mem,
 
 /* returns 1 on success, 0 if the detection failed and -1 on hard error */
 static int
-virNodeCapsFillCPUInfo(const char *cpupath ATTRIBUTE_UNUSED,
+virNodeCapsFillCPUInfo(const char *sysfs_prefix ATTRIBUTE_UNUSED,
+                       const char *cpupath ATTRIBUTE_UNUSED,
                        int cpu_id ATTRIBUTE_UNUSED,
                        virCapsHostNUMACellCPUPtr cpu ATTRIBUTE_UNUSED)
 {
 #ifdef __linux__
     int tmp;
+    bool cache = nodeTopologyCacheUsable(sysfs_prefix);
+    unsigned int generation = 0;
+
     cpu->id = cpu_id;
 
+    if (cache && nodeTopologyGetCPU(cpu, &generation))
+        return 0;
+
     if ((tmp = virNodeGetCpuValue(cpupath, cpu_id,
                                   "topology/physical_package_id", -1)) < 0)
         return 0;
@@ -2003,6 +2310,9 @@ virNodeCapsFillCPUInfo(const char *cpupath ATTRIBUTE_UNUSED,
     if (!(cpu->siblings = virNodeGetSiblingsList(cpupath, cpu_id)))
         return -1;
 
+    if (cache)
+        nodeTopologySetCPU(cpu, generation);
+
     return 0;
 #else
     virReportError(VIR_ERR_NO_SUPPORT, "%s",
@@ -2134,7 +2444,8 @@ nodeCapsInitNUMA(const char *sysfs_prefix,
 
         for (i = 0; i < virBitmapSize(cpumap); i++) {
             if (virBitmapIsBitSet(cpumap, i)) {
-                if (virNodeCapsFillCPUInfo(cpupath, i, cpus + cpu++) < 0) {
+                if (virNodeCapsFillCPUInfo(sysfs_prefix, cpupath, i,
+                                           cpus + cpu++) < 0) {
                     topology_failed = true;
                     virResetLastError();
                 }
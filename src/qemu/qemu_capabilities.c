@@ -365,6 +365,11 @@ struct _virQEMUCaps {
 
     size_t ngicCapabilities;
     virGICCapability *gicCapabilities;
+
+    /* If non-NULL, cpuDefinitions and the machine type arrays are borrowed
+     * from @source (which must never modify them again) and have to be
+     * duplicated by virQEMUCapsUnshare before they can be changed. */
+    virQEMUCapsPtr source;
 };
 
 struct virQEMUCapsSearchData {
@@ -459,6 +464,109 @@ virQEMUCapsProbeCommand(const char *qemu,
 }
 
 
+/**
+ * virQEMUCapsUnshare:
+ * @qemuCaps: capabilities object
+ *
+ * Make a private copy of the CPU model and machine type lists of
+ * @qemuCaps if they are currently shared with the object it was
+ * copied from. Must be called before modifying those lists.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virQEMUCapsUnshare(virQEMUCapsPtr qemuCaps)
+{
+    char **cpuDefinitions = NULL;
+    char **machineTypes = NULL;
+    char **machineAliases = NULL;
+    unsigned int *machineMaxCpus = NULL;
+    size_t i;
+
+    if (!qemuCaps->source)
+        return 0;
+
+    if (VIR_ALLOC_N(cpuDefinitions, qemuCaps->ncpuDefinitions) < 0 ||
+        VIR_ALLOC_N(machineTypes, qemuCaps->nmachineTypes) < 0 ||
+        VIR_ALLOC_N(machineAliases, qemuCaps->nmachineTypes) < 0 ||
+        VIR_ALLOC_N(machineMaxCpus, qemuCaps->nmachineTypes) < 0)
+        goto error;
+
+    for (i = 0; i < qemuCaps->ncpuDefinitions; i++) {
+        if (VIR_STRDUP(cpuDefinitions[i], qemuCaps->cpuDefinitions[i]) < 0)
+            goto error;
+    }
+
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        if (VIR_STRDUP(machineTypes[i], qemuCaps->machineTypes[i]) < 0 ||
+            VIR_STRDUP(machineAliases[i], qemuCaps->machineAliases[i]) < 0)
+            goto error;
+        machineMaxCpus[i] = qemuCaps->machineMaxCpus[i];
+    }
+
+    qemuCaps->cpuDefinitions = cpuDefinitions;
+    qemuCaps->machineTypes = machineTypes;
+    qemuCaps->machineAliases = machineAliases;
+    qemuCaps->machineMaxCpus = machineMaxCpus;
+
+    virObjectUnref(qemuCaps->source);
+    qemuCaps->source = NULL;
+    return 0;
+
+ error:
+    if (cpuDefinitions) {
+        for (i = 0; i < qemuCaps->ncpuDefinitions; i++)
+            VIR_FREE(cpuDefinitions[i]);
+    }
+    if (machineTypes) {
+        for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+            VIR_FREE(machineTypes[i]);
+            VIR_FREE(machineAliases[i]);
+        }
+    }
+    VIR_FREE(cpuDefinitions);
+    VIR_FREE(machineTypes);
+    VIR_FREE(machineAliases);
+    VIR_FREE(machineMaxCpus);
+    return -1;
+}
+
+
+/* Release the CPU model and machine type lists, or just drop the
+ * reference to the object owning them if they are shared. */
+static void
+virQEMUCapsFreeModels(virQEMUCapsPtr qemuCaps)
+{
+    size_t i;
+
+    if (qemuCaps->source) {
+        qemuCaps->cpuDefinitions = NULL;
+        qemuCaps->ncpuDefinitions = 0;
+        qemuCaps->machineTypes = NULL;
+        qemuCaps->machineAliases = NULL;
+        qemuCaps->machineMaxCpus = NULL;
+        qemuCaps->nmachineTypes = 0;
+        virObjectUnref(qemuCaps->source);
+        qemuCaps->source = NULL;
+        return;
+    }
+
+    for (i = 0; i < qemuCaps->ncpuDefinitions; i++)
+        VIR_FREE(qemuCaps->cpuDefinitions[i]);
+    VIR_FREE(qemuCaps->cpuDefinitions);
+    qemuCaps->ncpuDefinitions = 0;
+
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        VIR_FREE(qemuCaps->machineTypes[i]);
+        VIR_FREE(qemuCaps->machineAliases[i]);
+    }
+    VIR_FREE(qemuCaps->machineTypes);
+    VIR_FREE(qemuCaps->machineAliases);
+    VIR_FREE(qemuCaps->machineMaxCpus);
+    qemuCaps->nmachineTypes = 0;
+}
+
+
 static void
 virQEMUCapsSetDefaultMachine(virQEMUCapsPtr qemuCaps,
                              size_t defIdx)
@@ -492,6 +600,9 @@ virQEMUCapsParseMachineTypesStr(const char *output,
     const char *next;
     size_t defIdx = 0;
 
+    if (virQEMUCapsUnshare(qemuCaps) < 0)
+        return -1;
+
     do {
         const char *t;
         char *name;
@@ -727,7 +838,8 @@ virQEMUCapsProbeCPUModels(virQEMUCapsPtr qemuCaps, uid_t runUid, gid_t runGid)
     if (virCommandRun(cmd, NULL) < 0)
         goto cleanup;
 
-    if (parse(output, qemuCaps) < 0)
+    if (virQEMUCapsUnshare(qemuCaps) < 0 ||
+        parse(output, qemuCaps) < 0)
         goto cleanup;
 
     ret = 0;
@@ -2001,10 +2113,21 @@ virQEMUCapsNew(void)
 }
 
 
+/**
+ * virQEMUCapsNewCopy:
+ * @qemuCaps: capabilities object to copy
+ *
+ * Create a copy of @qemuCaps whose flags can be modified independently.
+ * The CPU model and machine type lists are not duplicated; the copy
+ * borrows them from @qemuCaps and only makes its own copy once they
+ * need to be changed (see virQEMUCapsUnshare). This keeps the copy done
+ * for every domain start cheap.
+ *
+ * Returns the new object or NULL on error.
+ */
 virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps)
 {
     virQEMUCapsPtr ret = virQEMUCapsNew();
-    size_t i;
 
     if (!ret)
         return NULL;
@@ -2020,27 +2143,15 @@ virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps)
 
     ret->arch = qemuCaps->arch;
 
-    if (VIR_ALLOC_N(ret->cpuDefinitions, qemuCaps->ncpuDefinitions) < 0)
-        goto error;
+    ret->source = virObjectRef(qemuCaps->source ? qemuCaps->source : qemuCaps);
+
     ret->ncpuDefinitions = qemuCaps->ncpuDefinitions;
-    for (i = 0; i < qemuCaps->ncpuDefinitions; i++) {
-        if (VIR_STRDUP(ret->cpuDefinitions[i], qemuCaps->cpuDefinitions[i]) < 0)
-            goto error;
-    }
+    ret->cpuDefinitions = qemuCaps->cpuDefinitions;
 
-    if (VIR_ALLOC_N(ret->machineTypes, qemuCaps->nmachineTypes) < 0)
-        goto error;
-    if (VIR_ALLOC_N(ret->machineAliases, qemuCaps->nmachineTypes) < 0)
-        goto error;
-    if (VIR_ALLOC_N(ret->machineMaxCpus, qemuCaps->nmachineTypes) < 0)
-        goto error;
     ret->nmachineTypes = qemuCaps->nmachineTypes;
-    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
-        if (VIR_STRDUP(ret->machineTypes[i], qemuCaps->machineTypes[i]) < 0 ||
-            VIR_STRDUP(ret->machineAliases[i], qemuCaps->machineAliases[i]) < 0)
-            goto error;
-        ret->machineMaxCpus[i] = qemuCaps->machineMaxCpus[i];
-    }
+    ret->machineTypes = qemuCaps->machineTypes;
+    ret->machineAliases = qemuCaps->machineAliases;
+    ret->machineMaxCpus = qemuCaps->machineMaxCpus;
 
     return ret;
 
@@ -2053,19 +2164,8 @@ virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps)
 void virQEMUCapsDispose(void *obj)
 {
     virQEMUCapsPtr qemuCaps = obj;
-    size_t i;
 
-    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
-        VIR_FREE(qemuCaps->machineTypes[i]);
-        VIR_FREE(qemuCaps->machineAliases[i]);
-    }
-    VIR_FREE(qemuCaps->machineTypes);
-    VIR_FREE(qemuCaps->machineAliases);
-    VIR_FREE(qemuCaps->machineMaxCpus);
-
-    for (i = 0; i < qemuCaps->ncpuDefinitions; i++)
-        VIR_FREE(qemuCaps->cpuDefinitions[i]);
-    VIR_FREE(qemuCaps->cpuDefinitions);
+    virQEMUCapsFreeModels(qemuCaps);
 
     virBitmapFree(qemuCaps->flags);
 
@@ -2210,6 +2310,9 @@ int virQEMUCapsAddCPUDefinition(virQEMUCapsPtr qemuCaps,
 {
     char *tmp;
 
+    if (virQEMUCapsUnshare(qemuCaps) < 0)
+        return -1;
+
     if (VIR_STRDUP(tmp, name) < 0)
         return -1;
     if (VIR_EXPAND_N(qemuCaps->cpuDefinitions, qemuCaps->ncpuDefinitions, 1) < 0) {
@@ -2490,31 +2593,53 @@ virQEMUCapsProbeQMPMachineTypes(virQEMUCapsPtr qemuCaps,
     int ret = -1;
     size_t i;
     size_t defIdx = 0;
+    char **machineTypes = NULL;
+    char **machineAliases = NULL;
+    unsigned int *machineMaxCpus = NULL;
+    size_t nmachineTypes = 0;
 
     if ((nmachines = qemuMonitorGetMachines(mon, &machines)) < 0)
         return -1;
 
-    if (VIR_ALLOC_N(qemuCaps->machineTypes, nmachines) < 0)
-        goto cleanup;
-    if (VIR_ALLOC_N(qemuCaps->machineAliases, nmachines) < 0)
-        goto cleanup;
-    if (VIR_ALLOC_N(qemuCaps->machineMaxCpus, nmachines) < 0)
+    if (VIR_ALLOC_N(machineTypes, nmachines) < 0 ||
+        VIR_ALLOC_N(machineAliases, nmachines) < 0 ||
+        VIR_ALLOC_N(machineMaxCpus, nmachines) < 0)
         goto cleanup;
 
     for (i = 0; i < nmachines; i++) {
         if (STREQ(machines[i]->name, "none"))
             continue;
-        qemuCaps->nmachineTypes++;
-        if (VIR_STRDUP(qemuCaps->machineAliases[qemuCaps->nmachineTypes -1],
+        nmachineTypes++;
+        if (VIR_STRDUP(machineAliases[nmachineTypes - 1],
                        machines[i]->alias) < 0 ||
-            VIR_STRDUP(qemuCaps->machineTypes[qemuCaps->nmachineTypes - 1],
+            VIR_STRDUP(machineTypes[nmachineTypes - 1],
                        machines[i]->name) < 0)
             goto cleanup;
         if (machines[i]->isDefault)
-            defIdx = qemuCaps->nmachineTypes - 1;
-        qemuCaps->machineMaxCpus[qemuCaps->nmachineTypes - 1] =
-            machines[i]->maxCpus;
+            defIdx = nmachineTypes - 1;
+        machineMaxCpus[nmachineTypes - 1] = machines[i]->maxCpus;
+    }
+
+    /* Only unshare once nothing can fail anymore, the old lists are
+     * replaced as a whole */
+    if (virQEMUCapsUnshare(qemuCaps) < 0)
+        goto cleanup;
+
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        VIR_FREE(qemuCaps->machineTypes[i]);
+        VIR_FREE(qemuCaps->machineAliases[i]);
     }
+    VIR_FREE(qemuCaps->machineTypes);
+    VIR_FREE(qemuCaps->machineAliases);
+    VIR_FREE(qemuCaps->machineMaxCpus);
+
+    qemuCaps->machineTypes = machineTypes;
+    qemuCaps->machineAliases = machineAliases;
+    qemuCaps->machineMaxCpus = machineMaxCpus;
+    qemuCaps->nmachineTypes = nmachineTypes;
+    machineTypes = machineAliases = NULL;
+    machineMaxCpus = NULL;
+    nmachineTypes = 0;
 
     if (defIdx)
         virQEMUCapsSetDefaultMachine(qemuCaps, defIdx);
@@ -2522,6 +2647,13 @@ virQEMUCapsProbeQMPMachineTypes(virQEMUCapsPtr qemuCaps,
     ret = 0;
 
  cleanup:
+    for (i = 0; i < nmachineTypes; i++) {
+        VIR_FREE(machineTypes[i]);
+        VIR_FREE(machineAliases[i]);
+    }
+    VIR_FREE(machineTypes);
+    VIR_FREE(machineAliases);
+    VIR_FREE(machineMaxCpus);
     for (i = 0; i < nmachines; i++)
         qemuMonitorMachineInfoFree(machines[i]);
     VIR_FREE(machines);
@@ -2535,10 +2667,22 @@ virQEMUCapsProbeQMPCPUDefinitions(virQEMUCapsPtr qemuCaps,
 {
     int ncpuDefinitions;
     char **cpuDefinitions;
+    size_t i;
 
     if ((ncpuDefinitions = qemuMonitorGetCPUDefinitions(mon, &cpuDefinitions)) < 0)
         return -1;
 
+    if (virQEMUCapsUnshare(qemuCaps) < 0) {
+        for (i = 0; i < ncpuDefinitions; i++)
+            VIR_FREE(cpuDefinitions[i]);
+        VIR_FREE(cpuDefinitions);
+        return -1;
+    }
+
+    for (i = 0; i < qemuCaps->ncpuDefinitions; i++)
+        VIR_FREE(qemuCaps->cpuDefinitions[i]);
+    VIR_FREE(qemuCaps->cpuDefinitions);
+
     qemuCaps->ncpuDefinitions = ncpuDefinitions;
     qemuCaps->cpuDefinitions = cpuDefinitions;
 
@@ -3161,27 +3305,13 @@ virQEMUCapsRememberCached(virQEMUCapsPtr qemuCaps, const char *cacheDir)
 static void
 virQEMUCapsReset(virQEMUCapsPtr qemuCaps)
 {
-    size_t i;
-
     virBitmapClearAll(qemuCaps->flags);
     qemuCaps->version = qemuCaps->kvmVersion = 0;
     VIR_FREE(qemuCaps->package);
     qemuCaps->arch = VIR_ARCH_NONE;
     qemuCaps->usedQMP = false;
 
-    for (i = 0; i < qemuCaps->ncpuDefinitions; i++)
-        VIR_FREE(qemuCaps->cpuDefinitions[i]);
-    VIR_FREE(qemuCaps->cpuDefinitions);
-    qemuCaps->ncpuDefinitions = 0;
-
-    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
-        VIR_FREE(qemuCaps->machineTypes[i]);
-        VIR_FREE(qemuCaps->machineAliases[i]);
-    }
-    VIR_FREE(qemuCaps->machineTypes);
-    VIR_FREE(qemuCaps->machineAliases);
-    VIR_FREE(qemuCaps->machineMaxCpus);
-    qemuCaps->nmachineTypes = 0;
+    virQEMUCapsFreeModels(qemuCaps);
 
     VIR_FREE(qemuCaps->gicCapabilities);
     qemuCaps->ngicCapabilities = 0;
@@ -3918,6 +4048,8 @@ virQEMUCapsCacheLookup(virQEMUCapsCachePtr cache, const char *binary)
             if (virHashAddEntry(cache->binaries, binary, ret) < 0) {
                 virObjectUnref(ret);
                 ret = NULL;
+            } else {
+                cache->generation++;
             }
         }
     }
@@ -3986,6 +4118,82 @@ virQEMUCapsCacheLookupByArch(virQEMUCapsCachePtr cache,
 }
 
 
+static int
+virQEMUCapsCacheIsStale(const void *payload,
+                        const void *name,
+                        const void *opaque ATTRIBUTE_UNUSED)
+{
+    virQEMUCapsPtr qemuCaps = (virQEMUCapsPtr) payload;
+
+    if (virQEMUCapsIsValid(qemuCaps))
+        return 0;
+
+    VIR_DEBUG("Cached capabilities %p no longer valid for %s",
+              qemuCaps, (const char *) name);
+    return 1;
+}
+
+
+/* Returns a stamp of the directories emulators are searched in, which
+ * changes whenever binaries are installed in or removed from them */
+static unsigned long long
+virQEMUCapsSearchPathStamp(void)
+{
+    const char *path = virGetEnvBlockSUID("PATH");
+    char *dirs = NULL;
+    char *iter;
+    char *dir;
+    struct stat sb;
+    unsigned long long ret = 0;
+
+    /* qemu-kvm lives outside of $PATH on RHEL */
+    if (stat("/usr/libexec", &sb) == 0)
+        ret = sb.st_mtime;
+
+    if (VIR_STRDUP_QUIET(dirs, path ? path : "/bin:/usr/bin") <= 0)
+        return ret;
+
+    iter = dirs;
+    while ((dir = strsep(&iter, ":")) != NULL) {
+        ret *= 31;
+        if (stat(dir, &sb) == 0)
+            ret += sb.st_mtime;
+    }
+
+    VIR_FREE(dirs);
+    return ret;
+}
+
+
+/**
+ * virQEMUCapsCacheValidate:
+ * @cache: capabilities cache
+ *
+ * Drops capabilities of all binaries which changed since they were
+ * probed, so that they get probed again on next lookup.
+ *
+ * Returns the generation of @cache, which changes whenever binaries are
+ * probed or dropped, or emulators may have been installed or removed.
+ */
+unsigned int
+virQEMUCapsCacheValidate(virQEMUCapsCachePtr cache)
+{
+    unsigned long long stamp = virQEMUCapsSearchPathStamp();
+    unsigned int ret;
+
+    virMutexLock(&cache->lock);
+    if (virHashRemoveSet(cache->binaries, virQEMUCapsCacheIsStale, NULL) > 0 ||
+        cache->searchPathStamp != stamp) {
+        cache->searchPathStamp = stamp;
+        cache->generation++;
+    }
+    ret = cache->generation;
+    virMutexUnlock(&cache->lock);
+
+    return ret;
+}
+
+
 void
 virQEMUCapsCacheFree(virQEMUCapsCachePtr cache)
 {
@@ -35,6 +35,11 @@ struct _virQEMUCapsCache {
     char *cacheDir;
     uid_t runUid;
     gid_t runGid;
+
+    /* Bumped whenever binaries are probed or dropped, or the search path
+     * stamp changes */
+    unsigned int generation;
+    unsigned long long searchPathStamp;
 };
 
 virQEMUCapsPtr
@@ -323,9 +323,19 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->keepAliveCount = 5;
     cfg->seccompSandbox = -1;
 
+    cfg->migrationConvergePolicy = QEMU_MIGRATION_CONVERGE_NONE;
+    cfg->migrationConvergeInterval = 1000;
+    cfg->migrationConvergeMaxThrottle = 60;
+
     cfg->logTimestamp = true;
     cfg->stdioLogD = true;
 
+#ifdef HAVE_NUMAD
+    cfg->numaPlacementBuiltin = false;
+#else
+    cfg->numaPlacementBuiltin = true;
+#endif
+
 #ifdef DEFAULT_LOADER_NVRAM
     if (virQEMUDriverConfigLoaderNVRAMParse(cfg, DEFAULT_LOADER_NVRAM) < 0)
         goto error;
@@ -472,6 +482,8 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     int ret = -1;
     size_t i;
     char *stdioHandler = NULL;
+    char *numaPlacement = NULL;
+    char *convergePolicy = NULL;
 
     /* Just check the file is readable before opening it, otherwise
      * libvirt emits an error.
@@ -815,7 +827,26 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         VIR_FREE(stdioHandler);
     }
 
+    GET_VALUE_STR("numa_placement", numaPlacement);
+    if (numaPlacement) {
+        if (STREQ(numaPlacement, "numad")) {
+            cfg->numaPlacementBuiltin = false;
+        } else if (STREQ(numaPlacement, "builtin")) {
+            cfg->numaPlacementBuiltin = true;
+        } else {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("Unknown NUMA placement engine %s"),
+                           numaPlacement);
+            VIR_FREE(numaPlacement);
+            goto cleanup;
+        }
+        VIR_FREE(numaPlacement);
+    }
+    GET_VALUE_ULONG("numa_rebalance_interval", cfg->numaRebalanceInterval);
+
     GET_VALUE_ULONG("max_queued", cfg->maxQueuedJobs);
+    GET_VALUE_ULONG("stats_cache_max_age", cfg->statsCacheMaxAge);
+    GET_VALUE_ULONG("perf_sample_interval", cfg->perfSampleInterval);
 
     GET_VALUE_LONG("keepalive_interval", cfg->keepAliveInterval);
     GET_VALUE_ULONG("keepalive_count", cfg->keepAliveCount);
@@ -846,6 +877,39 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     }
 
+    GET_VALUE_STR("migration_converge_policy", convergePolicy);
+    if (convergePolicy) {
+        if (STREQ(convergePolicy, "none")) {
+            cfg->migrationConvergePolicy = QEMU_MIGRATION_CONVERGE_NONE;
+        } else if (STREQ(convergePolicy, "throttle")) {
+            cfg->migrationConvergePolicy = QEMU_MIGRATION_CONVERGE_THROTTLE;
+        } else if (STREQ(convergePolicy, "postcopy")) {
+            cfg->migrationConvergePolicy = QEMU_MIGRATION_CONVERGE_POSTCOPY;
+        } else {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("Unknown migration convergence policy %s"),
+                           convergePolicy);
+            VIR_FREE(convergePolicy);
+            goto cleanup;
+        }
+        VIR_FREE(convergePolicy);
+    }
+    GET_VALUE_ULONG("migration_converge_interval",
+                    cfg->migrationConvergeInterval);
+    GET_VALUE_ULONG("migration_converge_max_throttle",
+                    cfg->migrationConvergeMaxThrottle);
+    if (cfg->migrationConvergeInterval == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("migration_converge_interval must be greater than 0"));
+        goto cleanup;
+    }
+    if (cfg->migrationConvergeMaxThrottle > 99) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("migration_converge_max_throttle must not be "
+                         "greater than 99"));
+        goto cleanup;
+    }
+
     GET_VALUE_BOOL("log_timestamp", cfg->logTimestamp);
 
     if ((p = virConfGetValue(conf, "nvram"))) {
@@ -1025,6 +1089,118 @@ virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
     return ret;
 }
 
+
+/* Formats the current host NUMA topology on its own */
+static char *
+virQEMUDriverFormatHostNUMA(void)
+{
+    virCapsPtr caps;
+    char *ret;
+
+    if (!(caps = virCapabilitiesNew(virArchFromHost(), false, false)))
+        return NULL;
+
+    if (nodeCapsInitNUMA(NULL, caps) < 0) {
+        virCapabilitiesFreeNUMAInfo(caps);
+        VIR_WARN("Failed to query host NUMA topology, disabling NUMA capabilities");
+    }
+
+    ret = virCapabilitiesFormatHostNUMA(caps);
+    virObjectUnref(caps);
+    return ret;
+}
+
+
+/**
+ * virQEMUDriverGetCapabilitiesXML:
+ *
+ * Get the formatted capabilities of the driver. The document is only
+ * rebuilt if the host topology changed, any of the emulator binaries it
+ * describes changed, or emulators were installed or removed since it was
+ * formatted last time. The host NUMA topology, which includes the
+ * hugepage pool sizes, is not cached and is always formatted afresh.
+ *
+ * Returns: capabilities XML which the caller must free or NULL
+ */
+char *
+virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver)
+{
+    virCapsPtr caps = NULL;
+    unsigned int topology = 0;
+    unsigned int emulators;
+    bool cacheable;
+    char *head = NULL;
+    char *tail = NULL;
+    char *numa = NULL;
+    char *xml = NULL;
+    char *pos;
+    char *ret = NULL;
+
+    /* Binaries are revalidated first so that a changed one is never
+     * served from the cache */
+    cacheable = nodeGetTopologyGeneration(&topology) == 0;
+    emulators = virQEMUCapsCacheValidate(driver->qemuCapsCache);
+
+    qemuDriverLock(driver);
+    if (cacheable && driver->capsXMLHead &&
+        driver->capsXMLTopology == topology &&
+        driver->capsXMLEmulators == emulators) {
+        if (VIR_STRDUP(head, driver->capsXMLHead) < 0 ||
+            VIR_STRDUP(tail, driver->capsXMLTail) < 0) {
+            qemuDriverUnlock(driver);
+            goto cleanup;
+        }
+        qemuDriverUnlock(driver);
+
+        if ((numa = virQEMUDriverFormatHostNUMA()))
+            ignore_value(virAsprintf(&ret, "%s%s%s", head, numa, tail));
+        goto cleanup;
+    }
+    qemuDriverUnlock(driver);
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, true)) ||
+        !(xml = virCapabilitiesFormatXML(caps)) ||
+        !(numa = virCapabilitiesFormatHostNUMA(caps)))
+        goto cleanup;
+
+    /* Keep retrying detection while no guests were found, and only cache
+     * a document the NUMA topology can be located in */
+    if (cacheable && caps->nguests > 0 && *numa &&
+        (pos = strstr(xml, numa))) {
+        if (VIR_STRNDUP(head, xml, pos - xml) < 0 ||
+            VIR_STRDUP(tail, pos + strlen(numa)) < 0)
+            goto cleanup;
+    }
+
+    qemuDriverLock(driver);
+    if (!head ||
+        STRNEQ_NULLABLE(driver->capsXMLHead, head) ||
+        STRNEQ_NULLABLE(driver->capsXMLTail, tail)) {
+        driver->capsXMLGeneration++;
+        VIR_DEBUG("Capabilities changed, generation %u",
+                  driver->capsXMLGeneration);
+    }
+    VIR_FREE(driver->capsXMLHead);
+    VIR_FREE(driver->capsXMLTail);
+    driver->capsXMLHead = head;
+    driver->capsXMLTail = tail;
+    driver->capsXMLTopology = topology;
+    driver->capsXMLEmulators = emulators;
+    head = tail = NULL;
+    qemuDriverUnlock(driver);
+
+    ret = xml;
+    xml = NULL;
+
+ cleanup:
+    VIR_FREE(head);
+    VIR_FREE(tail);
+    VIR_FREE(numa);
+    VIR_FREE(xml);
+    virObjectUnref(caps);
+    return ret;
+}
+
 struct _qemuSharedDeviceEntry {
     size_t ref;
     char **domains; /* array of domain names */
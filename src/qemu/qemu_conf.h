@@ -65,6 +65,13 @@ typedef virQEMUDriver *virQEMUDriverPtr;
 typedef struct _virQEMUDriverConfig virQEMUDriverConfig;
 typedef virQEMUDriverConfig *virQEMUDriverConfigPtr;
 
+/* How far libvirt may escalate to make an outgoing migration converge */
+typedef enum {
+    QEMU_MIGRATION_CONVERGE_NONE = 0, /* leave it to QEMU */
+    QEMU_MIGRATION_CONVERGE_THROTTLE, /* XBZRLE, vCPU throttling */
+    QEMU_MIGRATION_CONVERGE_POSTCOPY, /* all of the above, then post-copy */
+} qemuMigrationConvergePolicy;
+
 /* Main driver config. The data in these object
  * instances is immutable, so can be accessed
  * without locking. Threads must, however, hold
@@ -149,6 +156,9 @@ struct _virQEMUDriverConfig {
 
     int maxQueuedJobs;
 
+    unsigned int statsCacheMaxAge;
+    unsigned int perfSampleInterval;
+
     char **securityDriverNames;
     bool securityDefaultConfined;
     bool securityRequireConfined;
@@ -174,15 +184,40 @@ struct _virQEMUDriverConfig {
     int migrationPortMin;
     int migrationPortMax;
 
+    int migrationConvergePolicy; /* qemuMigrationConvergePolicy */
+    unsigned int migrationConvergeInterval;
+    unsigned int migrationConvergeMaxThrottle;
+
     bool logTimestamp;
     bool stdioLogD;
 
+    bool numaPlacementBuiltin;
+    unsigned int numaRebalanceInterval;
+
     /* Pairs of loader:nvram paths. The list is @nloader items long */
     char **loader;
     char **nvram;
     size_t nloader;
 };
 
+typedef int (*qemuDriverPeriodicCallback)(virQEMUDriverPtr driver,
+                                          virDomainObjPtr vm);
+
+/* Driver thread calling @callback for every domain each @interval
+ * milliseconds. Require driver lock to access the flags */
+typedef struct _qemuDriverPeriodicTask qemuDriverPeriodicTask;
+typedef qemuDriverPeriodicTask *qemuDriverPeriodicTaskPtr;
+struct _qemuDriverPeriodicTask {
+    virQEMUDriverPtr driver;
+    qemuDriverPeriodicCallback callback;
+    unsigned long long interval;
+
+    virThread thread;
+    virCond cond;
+    bool active;
+    bool quit;
+};
+
 /* Main driver state */
 struct _virQEMUDriver {
     virMutex lock;
@@ -221,6 +256,25 @@ struct _virQEMUDriver {
      */
     virCapsPtr caps;
 
+    /* Require lock to access. Formatted capabilities XML before and after
+     * the host NUMA topology together with the host topology and
+     * capabilities cache generations it was built for, and a generation
+     * bumped whenever the formatted document changes */
+    char *capsXMLHead;
+    char *capsXMLTail;
+    unsigned int capsXMLTopology;
+    unsigned int capsXMLEmulators;
+    unsigned int capsXMLGeneration;
+
+    /* Immutable pointer, require lock to access the table. Formatted
+     * domain capabilities XML keyed by the inputs it depends on */
+    virHashTablePtr domCapsCache;
+
+    /* Immutable pointer, require lock to access the table. Host CPU load
+     * of pinned vCPUs of running domains keyed by domain UUID, see
+     * qemuDomainUpdateCPULoad */
+    virHashTablePtr cpuLoad;
+
     /* Immutable pointer, Immutable object */
     virDomainXMLOptionPtr xmlopt;
 
@@ -258,6 +312,12 @@ struct _virQEMUDriver {
 
     /* Immutable pointer, self-locking APIs */
     virHashAtomicPtr migrationErrors;
+
+    /* Periodic perf counter sampling, see perf_sample_interval */
+    qemuDriverPeriodicTask perfSampler;
+
+    /* Periodic NUMA re-placement, see numa_rebalance_interval */
+    qemuDriverPeriodicTask numaRebalancer;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
@@ -284,6 +344,7 @@ virQEMUDriverConfigPtr virQEMUDriverGetConfig(virQEMUDriverPtr driver);
 bool virQEMUDriverIsPrivileged(virQEMUDriverPtr driver);
 
 virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver);
+char *virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver);
 virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh);
 
@@ -43,8 +43,10 @@
 #include "virstoragefile.h"
 #include "virstring.h"
 #include "virthreadjob.h"
+#include "virtypedparam.h"
 #include "viratomic.h"
 #include "virprocess.h"
+#include "virnuma.h"
 #include "vircrypto.h"
 #include "secret_util.h"
 #include "logging/log_manager.h"
@@ -71,6 +73,7 @@ VIR_ENUM_IMPL(qemuDomainJob, QEMU_JOB_LAST,
               "modify",
               "abort",
               "migration operation",
+              "shared query",
               "none",   /* async job is never stored in job.active */
               "async nested",
 );
@@ -202,6 +205,8 @@ qemuDomainObjResetJob(qemuDomainObjPrivatePtr priv)
     job->owner = 0;
     job->ownerAPI = NULL;
     job->started = 0;
+    VIR_FREE(job->holders);
+    job->nholders = 0;
 }
 
 static void
@@ -244,6 +249,7 @@ qemuDomainObjFreeJob(qemuDomainObjPrivatePtr priv)
 {
     VIR_FREE(priv->job.current);
     VIR_FREE(priv->job.completed);
+    VIR_FREE(priv->job.holders);
     virCondDestroy(&priv->job.cond);
     virCondDestroy(&priv->job.asyncCond);
 }
@@ -1239,6 +1245,19 @@ qemuDomainObjPrivateAlloc(void)
     return NULL;
 }
 
+static void
+qemuDomainStatsCacheFree(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    for (i = 0; i < priv->nstatsCache; i++)
+        virTypedParamsFree(priv->statsCache[i].params,
+                           priv->statsCache[i].nparams);
+    VIR_FREE(priv->statsCache);
+    priv->nstatsCache = 0;
+}
+
+
 static void
 qemuDomainObjPrivateFree(void *data)
 {
@@ -1275,6 +1294,9 @@ qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->libDir);
     VIR_FREE(priv->channelTargetDir);
 
+    qemuDomainStatsCacheFree(priv);
+    qemuDomainPerfSamplerFree(priv->perfSampler);
+
     VIR_FREE(priv);
 }
 
@@ -2505,9 +2527,83 @@ qemuDomainObjReleaseAsyncJob(virDomainObjPtr obj)
 static bool
 qemuDomainNestedJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
 {
+    /* Async job masks only ever mention plain query jobs */
+    if (job == QEMU_JOB_QUERY_SHARED)
+        job = QEMU_JOB_QUERY;
+
     return !priv->job.asyncJob || (priv->job.mask & JOB_MASK(job)) != 0;
 }
 
+
+/* Can @job be started while priv->job.active is still running? Threads
+ * waiting for an exclusive job take precedence over new shared holders
+ * so that a steady stream of queries cannot starve them. */
+static bool
+qemuDomainJobCanShare(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
+{
+    return job == QEMU_JOB_QUERY_SHARED &&
+           priv->job.active == QEMU_JOB_QUERY_SHARED &&
+           priv->job.exclusiveWaiters == 0;
+}
+
+
+static void
+qemuDomainJobRecordWait(qemuDomainObjPrivatePtr priv,
+                        qemuDomainJob job,
+                        unsigned long long waited)
+{
+    unsigned long long limit = 1;
+    size_t i;
+
+    for (i = 0; i < QEMU_JOB_WAIT_HIST_BUCKETS - 1; i++) {
+        if (waited < limit)
+            break;
+        limit *= 10;
+    }
+
+    priv->job.waitHist[job][i]++;
+}
+
+
+static qemuDomainJobHolderPtr
+qemuDomainJobFindHolder(qemuDomainObjPrivatePtr priv)
+{
+    unsigned long long self = virThreadSelfID();
+    size_t i;
+
+    for (i = 0; i < priv->job.nholders; i++) {
+        if (priv->job.holders[i].owner == self)
+            return &priv->job.holders[i];
+    }
+
+    return NULL;
+}
+
+
+/* The owner of a shared job is whichever of its holders joined first,
+ * and the monitor counts as occupied since the earliest time one of
+ * them entered it that has not left it yet */
+static void
+qemuDomainJobUpdateShared(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    if (!priv->job.nholders)
+        return;
+
+    priv->job.owner = priv->job.holders[0].owner;
+    priv->job.ownerAPI = priv->job.holders[0].ownerAPI;
+    priv->job.started = priv->job.holders[0].started;
+
+    priv->monStart = 0;
+    for (i = 0; i < priv->job.nholders; i++) {
+        unsigned long long monStart = priv->job.holders[i].monStart;
+
+        if (monStart && (!priv->monStart || monStart < priv->monStart))
+            priv->monStart = monStart;
+    }
+}
+
 bool
 qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
 {
@@ -2524,19 +2620,23 @@ static int ATTRIBUTE_NONNULL(1)
 qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               qemuDomainJob job,
-                              qemuDomainAsyncJob asyncJob)
+                              qemuDomainAsyncJob asyncJob,
+                              bool nowait)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
     unsigned long long now;
     unsigned long long then;
+    unsigned long long waitStart;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
     bool async = job == QEMU_JOB_ASYNC;
+    bool shared = job == QEMU_JOB_QUERY_SHARED;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     const char *blocker = NULL;
     int ret = -1;
     unsigned long long duration = 0;
     unsigned long long asyncDuration = 0;
     const char *jobStr;
+    qemuDomainJobHolder holder = { 0 };
 
     if (async)
         jobStr = qemuDomainAsyncJobTypeToString(asyncJob);
@@ -2554,6 +2654,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     }
 
     priv->jobs_queued++;
+    waitStart = now;
     then = now + QEMU_JOB_WAIT_TIME;
 
  retry:
@@ -2563,25 +2664,62 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     }
 
     while (!nested && !qemuDomainNestedJobAllowed(priv, job)) {
+        if (nowait)
+            goto cleanup;
+
         VIR_DEBUG("Waiting for async job (vm=%p name=%s)", obj, obj->def->name);
         if (virCondWaitUntil(&priv->job.asyncCond, &obj->parent.lock, then) < 0)
             goto error;
     }
 
-    while (priv->job.active) {
+    if (!shared)
+        priv->job.exclusiveWaiters++;
+
+    while (priv->job.active && !qemuDomainJobCanShare(priv, job)) {
+        if (nowait) {
+            if (!shared)
+                priv->job.exclusiveWaiters--;
+            goto cleanup;
+        }
+
         VIR_DEBUG("Waiting for job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0)
+        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0) {
+            if (!shared)
+                priv->job.exclusiveWaiters--;
             goto error;
+        }
     }
 
+    if (!shared)
+        priv->job.exclusiveWaiters--;
+
     /* No job is active but a new async job could have been started while obj
      * was unlocked, so we need to recheck it. */
     if (!nested && !qemuDomainNestedJobAllowed(priv, job))
         goto retry;
 
-    qemuDomainObjResetJob(priv);
-
     ignore_value(virTimeMillisNow(&now));
+    qemuDomainJobRecordWait(priv, job, now - waitStart);
+
+    if (shared) {
+        holder.owner = virThreadSelfID();
+        holder.ownerAPI = virThreadJobGet();
+        holder.started = now;
+    }
+
+    if (priv->job.active == QEMU_JOB_QUERY_SHARED) {
+        if (VIR_APPEND_ELEMENT(priv->job.holders, priv->job.nholders,
+                               holder) < 0)
+            goto cleanup;
+        VIR_DEBUG("Joined shared job: %s (holders=%zu async=%s vm=%p name=%s)",
+                  qemuDomainJobTypeToString(job), priv->job.nholders,
+                  qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                  obj, obj->def->name);
+        virObjectUnref(cfg);
+        return 0;
+    }
+
+    qemuDomainObjResetJob(priv);
 
     if (job != QEMU_JOB_ASYNC) {
         VIR_DEBUG("Started job: %s (async=%s vm=%p name=%s)",
@@ -2592,6 +2730,13 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
         priv->job.owner = virThreadSelfID();
         priv->job.ownerAPI = virThreadJobGet();
         priv->job.started = now;
+        if (shared &&
+            VIR_APPEND_ELEMENT(priv->job.holders, priv->job.nholders,
+                               holder) < 0) {
+            qemuDomainObjResetJob(priv);
+            virCondBroadcast(&priv->job.cond);
+            goto cleanup;
+        }
     } else {
         VIR_DEBUG("Started async job: %s (vm=%p name=%s)",
                   qemuDomainAsyncJobTypeToString(asyncJob),
@@ -2619,6 +2764,8 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     if (priv->job.asyncJob && priv->job.asyncStarted)
         asyncDuration = now - priv->job.asyncStarted;
 
+    qemuDomainJobRecordWait(priv, job, now - waitStart);
+
     VIR_WARN("Cannot start job (%s, %s) for domain %s; "
              "current job is (%s, %s) owned by (%llu %s, %llu %s) "
              "for (%llus, %llus)",
@@ -2683,7 +2830,24 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           qemuDomainJob job)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, job,
-                                      QEMU_ASYNC_JOB_NONE) < 0)
+                                      QEMU_ASYNC_JOB_NONE, false) < 0)
+        return -1;
+    else
+        return 0;
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Like qemuDomainObjBeginJob, but fails right away without reporting
+ * an error if the job cannot be started without waiting
+ */
+int qemuDomainObjBeginJobNowait(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj,
+                                qemuDomainJob job)
+{
+    if (qemuDomainObjBeginJobInternal(driver, obj, job,
+                                      QEMU_ASYNC_JOB_NONE, true) < 0)
         return -1;
     else
         return 0;
@@ -2694,7 +2858,7 @@ int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                qemuDomainAsyncJob asyncJob)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_ASYNC,
-                                      asyncJob) < 0)
+                                      asyncJob, false) < 0)
         return -1;
     else
         return 0;
@@ -2720,7 +2884,8 @@ qemuDomainObjBeginNestedJob(virQEMUDriverPtr driver,
 
     return qemuDomainObjBeginJobInternal(driver, obj,
                                          QEMU_JOB_ASYNC_NESTED,
-                                         QEMU_ASYNC_JOB_NONE);
+                                         QEMU_ASYNC_JOB_NONE,
+                                         false);
 }
 
 
@@ -2738,15 +2903,33 @@ qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 
     priv->jobs_queued--;
 
+    if (job == QEMU_JOB_QUERY_SHARED && priv->job.nholders > 1) {
+        qemuDomainJobHolderPtr holder = qemuDomainJobFindHolder(priv);
+
+        ignore_value(VIR_DELETE_ELEMENT(priv->job.holders,
+                                        holder ? holder - priv->job.holders : 0,
+                                        priv->job.nholders));
+        qemuDomainJobUpdateShared(priv);
+        VIR_DEBUG("Leaving shared job: %s (holders=%zu vm=%p name=%s)",
+                  qemuDomainJobTypeToString(job), priv->job.nholders,
+                  obj, obj->def->name);
+        return;
+    }
+
     VIR_DEBUG("Stopping job: %s (async=%s vm=%p name=%s)",
               qemuDomainJobTypeToString(job),
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    /* Anything but a query may have changed what the stats report */
+    if (job != QEMU_JOB_QUERY && job != QEMU_JOB_QUERY_SHARED)
+        qemuDomainStatsCacheInvalidate(obj);
+
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
-    virCondSignal(&priv->job.cond);
+    /* Wake up everyone so that all waiting shared jobs can start at once */
+    virCondBroadcast(&priv->job.cond);
 }
 
 void
@@ -2760,6 +2943,7 @@ qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    qemuDomainStatsCacheInvalidate(obj);
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
     virCondBroadcast(&priv->job.asyncCond);
@@ -2793,6 +2977,7 @@ qemuDomainObjEnterMonitorInternal(virQEMUDriverPtr driver,
                                   qemuDomainAsyncJob asyncJob)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
+    qemuDomainJobHolderPtr holder;
 
     if (asyncJob != QEMU_ASYNC_JOB_NONE) {
         int ret;
@@ -2813,7 +2998,13 @@ qemuDomainObjEnterMonitorInternal(virQEMUDriverPtr driver,
               priv->mon, obj, obj->def->name);
     virObjectLock(priv->mon);
     virObjectRef(priv->mon);
-    ignore_value(virTimeMillisNow(&priv->monStart));
+    if (priv->job.active == QEMU_JOB_QUERY_SHARED &&
+        (holder = qemuDomainJobFindHolder(priv))) {
+        ignore_value(virTimeMillisNow(&holder->monStart));
+        qemuDomainJobUpdateShared(priv);
+    } else {
+        ignore_value(virTimeMillisNow(&priv->monStart));
+    }
     virObjectUnlock(obj);
 
     return 0;
@@ -2824,6 +3015,7 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
                                  virDomainObjPtr obj)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
+    qemuDomainJobHolderPtr holder;
     bool hasRefs;
 
     hasRefs = virObjectUnref(priv->mon);
@@ -2835,7 +3027,13 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
     VIR_DEBUG("Exited monitor (mon=%p vm=%p name=%s)",
               priv->mon, obj, obj->def->name);
 
-    priv->monStart = 0;
+    if (priv->job.active == QEMU_JOB_QUERY_SHARED &&
+        (holder = qemuDomainJobFindHolder(priv))) {
+        holder->monStart = 0;
+        qemuDomainJobUpdateShared(priv);
+    } else {
+        priv->monStart = 0;
+    }
     if (!hasRefs)
         priv->mon = NULL;
 
@@ -5471,3 +5669,414 @@ qemuDomainDefValidateDiskLunSource(const virStorageSource *src)
 
     return 0;
 }
+
+
+/**
+ * qemuDomainStatsCacheLookup:
+ * @vm: domain object
+ * @stats: VIR_DOMAIN_STATS_* group to look up
+ * @now: current time in milliseconds
+ * @maxAge: maximum acceptable age of the entry in milliseconds
+ *
+ * Returns the cached stats group of @vm if it was collected no more than
+ * @maxAge milliseconds before @now, NULL otherwise. An entry collected
+ * after @now, by a thread that ran while the caller waited, is fresh.
+ */
+qemuDomainStatsCacheEntryPtr
+qemuDomainStatsCacheLookup(virDomainObjPtr vm,
+                           unsigned int stats,
+                           unsigned long long now,
+                           unsigned long long maxAge)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t i;
+
+    for (i = 0; i < priv->nstatsCache; i++) {
+        qemuDomainStatsCacheEntryPtr entry = &priv->statsCache[i];
+
+        if (entry->stats != stats)
+            continue;
+
+        if (now > entry->collected && now - entry->collected > maxAge)
+            return NULL;
+
+        return entry;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * qemuDomainStatsCacheStore:
+ * @vm: domain object
+ * @stats: VIR_DOMAIN_STATS_* group being stored
+ * @flags: driver private flags the group was collected with
+ * @now: time of collection in milliseconds
+ * @params: typed parameters produced for the group
+ * @nparams: number of items in @params
+ *
+ * Remembers a copy of @params as the latest value of the @stats group,
+ * replacing any previous entry.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainStatsCacheStore(virDomainObjPtr vm,
+                          unsigned int stats,
+                          unsigned int flags,
+                          unsigned long long now,
+                          virTypedParameterPtr params,
+                          int nparams)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatsCacheEntryPtr entry = NULL;
+    virTypedParameterPtr copy = NULL;
+    size_t i;
+
+    if (nparams > 0 &&
+        virTypedParamsCopy(&copy, params, nparams) < 0)
+        return -1;
+
+    for (i = 0; i < priv->nstatsCache; i++) {
+        if (priv->statsCache[i].stats == stats) {
+            entry = &priv->statsCache[i];
+            virTypedParamsFree(entry->params, entry->nparams);
+            break;
+        }
+    }
+
+    if (!entry) {
+        if (VIR_EXPAND_N(priv->statsCache, priv->nstatsCache, 1) < 0) {
+            virTypedParamsFree(copy, nparams);
+            return -1;
+        }
+        entry = &priv->statsCache[priv->nstatsCache - 1];
+    }
+
+    entry->stats = stats;
+    entry->flags = flags;
+    entry->collected = now;
+    entry->params = copy;
+    entry->nparams = nparams;
+
+    return 0;
+}
+
+
+/**
+ * qemuDomainStatsCacheInvalidate:
+ * @vm: domain object
+ *
+ * Drops all cached stats of @vm. Needs to be called whenever the domain
+ * changes in a way that would make the cached values misleading.
+ */
+void
+qemuDomainStatsCacheInvalidate(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (!priv->nstatsCache)
+        return;
+
+    VIR_DEBUG("Invalidating cached stats of domain %s", vm->def->name);
+    qemuDomainStatsCacheFree(priv);
+}
+
+
+void
+qemuDomainPerfSamplerFree(qemuDomainPerfSamplerPtr sampler)
+{
+    size_t i;
+
+    if (!sampler)
+        return;
+
+    for (i = 0; i < sampler->nvcpus; i++)
+        virPerfCountersFree(sampler->counters[i]);
+    for (i = 0; i < QEMU_DOMAIN_PERF_HISTORY; i++)
+        VIR_FREE(sampler->values[i]);
+
+    VIR_FREE(sampler->counters);
+    VIR_FREE(sampler->tids);
+    VIR_FREE(sampler);
+}
+
+
+static qemuDomainPerfSamplerPtr
+qemuDomainPerfSamplerNew(size_t nvcpus)
+{
+    qemuDomainPerfSamplerPtr sampler;
+    size_t i;
+
+    if (VIR_ALLOC(sampler) < 0)
+        return NULL;
+
+    sampler->nvcpus = nvcpus;
+    if (VIR_ALLOC_N(sampler->tids, nvcpus) < 0 ||
+        VIR_ALLOC_N(sampler->counters, nvcpus) < 0)
+        goto error;
+
+    for (i = 0; i < QEMU_DOMAIN_PERF_HISTORY; i++) {
+        if (VIR_ALLOC_N(sampler->values[i],
+                        nvcpus * VIR_PERF_COUNTER_LAST) < 0)
+            goto error;
+    }
+
+    return sampler;
+
+ error:
+    qemuDomainPerfSamplerFree(sampler);
+    return NULL;
+}
+
+
+/**
+ * qemuDomainPerfSample:
+ * @vm: domain object
+ *
+ * Reads the hardware counters of all online vCPU threads of @vm into the
+ * next slot of its sample ring buffer. The counters are opened on the
+ * first sample and follow vCPU hotplug. The domain must be locked.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainPerfSample(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainPerfSamplerPtr sampler = priv->perfSampler;
+    size_t nvcpus = virDomainDefGetVcpusMax(vm->def);
+    uint64_t *values;
+    size_t i;
+
+    if (!virDomainObjIsActive(vm) || !qemuDomainHasVcpuPids(vm)) {
+        qemuDomainPerfSamplerFree(priv->perfSampler);
+        priv->perfSampler = NULL;
+        return 0;
+    }
+
+    if (sampler && sampler->nvcpus != nvcpus) {
+        qemuDomainPerfSamplerFree(sampler);
+        priv->perfSampler = sampler = NULL;
+    }
+
+    if (!sampler &&
+        !(priv->perfSampler = sampler = qemuDomainPerfSamplerNew(nvcpus)))
+        return -1;
+
+    values = sampler->values[sampler->next];
+    memset(values, 0, sizeof(*values) * nvcpus * VIR_PERF_COUNTER_LAST);
+
+    if (virTimeMillisNow(&sampler->times[sampler->next]) < 0)
+        return -1;
+
+    for (i = 0; i < nvcpus; i++) {
+        virDomainVcpuInfoPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+        pid_t tid = vcpu->online ? qemuDomainGetVcpuPid(vm, i) : 0;
+
+        if (sampler->tids[i] != tid) {
+            virPerfCountersFree(sampler->counters[i]);
+            sampler->counters[i] = NULL;
+            sampler->tids[i] = tid;
+
+            /* Missing counters only leave a gap in the stats */
+            if (tid && !(sampler->counters[i] = virPerfCountersNew(tid)))
+                virResetLastError();
+        }
+
+        if (!sampler->counters[i])
+            continue;
+
+        if (virPerfCountersRead(sampler->counters[i],
+                                values + i * VIR_PERF_COUNTER_LAST) < 0) {
+            virPerfCountersFree(sampler->counters[i]);
+            sampler->counters[i] = NULL;
+            virResetLastError();
+        }
+    }
+
+    sampler->next = (sampler->next + 1) % QEMU_DOMAIN_PERF_HISTORY;
+    if (sampler->nsamples < QEMU_DOMAIN_PERF_HISTORY)
+        sampler->nsamples++;
+
+    return 0;
+}
+
+
+void
+qemuDomainCPULoadFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    qemuDomainCPULoadPtr load = payload;
+
+    if (!load)
+        return;
+
+    VIR_FREE(load->load);
+    VIR_FREE(load);
+}
+
+
+/**
+ * qemuDomainUpdateCPULoad:
+ * @driver: qemu driver data
+ * @vm: domain object
+ *
+ * Records which host CPUs the online vCPUs of @vm are pinned to, for the
+ * builtin NUMA placement of other domains. Must be called whenever the
+ * vCPUs of a running domain are (re-)pinned or hotplugged. Failures are
+ * not fatal, the domain is just not accounted for.
+ */
+void
+qemuDomainUpdateCPULoad(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainCPULoadPtr load = NULL;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
+    virBitmapPtr cpumask;
+    size_t count;
+    ssize_t cpu;
+    size_t i;
+    int rc;
+
+    if (VIR_ALLOC(load) < 0)
+        goto error;
+
+    load->ncpus = virNumaGetMaxCPUs();
+    if (VIR_ALLOC_N(load->load, load->ncpus) < 0)
+        goto error;
+
+    for (i = 0; i < maxvcpus; i++) {
+        virDomainVcpuInfoPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+
+        if (!vcpu->online)
+            continue;
+
+        /* same order of precedence as qemuProcessSetupVcpu */
+        if (vcpu->cpumask)
+            cpumask = vcpu->cpumask;
+        else if (vm->def->placement_mode == VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO)
+            cpumask = priv->autoCpuset;
+        else
+            cpumask = vm->def->cpumask;
+
+        /* unpinned vCPUs load all host CPUs alike */
+        if (!cpumask || !(count = virBitmapCountBits(cpumask)))
+            continue;
+
+        cpu = -1;
+        while ((cpu = virBitmapNextSetBit(cpumask, cpu)) >= 0 &&
+               cpu < load->ncpus)
+            load->load[cpu] += VIR_NUMA_PLACEMENT_LOAD_SCALE / count;
+    }
+
+    virUUIDFormat(vm->def->uuid, uuidstr);
+
+    virMutexLock(&driver->lock);
+    rc = virHashUpdateEntry(driver->cpuLoad, uuidstr, load);
+    virMutexUnlock(&driver->lock);
+
+    if (rc < 0)
+        goto error;
+    return;
+
+ error:
+    VIR_DEBUG("Failed to account CPU load of domain %s", vm->def->name);
+    virResetLastError();
+    qemuDomainCPULoadFree(load, NULL);
+}
+
+
+void
+qemuDomainRemoveCPULoad(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(vm->def->uuid, uuidstr);
+
+    virMutexLock(&driver->lock);
+    ignore_value(virHashRemoveEntry(driver->cpuLoad, uuidstr));
+    virMutexUnlock(&driver->lock);
+}
+
+
+struct qemuDomainCPULoadSumData {
+    const char *skip;
+    unsigned int *load;
+    size_t ncpus;
+};
+
+static int
+qemuDomainCPULoadSum(void *payload,
+                     const void *name,
+                     void *opaque)
+{
+    qemuDomainCPULoadPtr load = payload;
+    struct qemuDomainCPULoadSumData *data = opaque;
+    size_t i;
+
+    if (STREQ(name, data->skip))
+        return 0;
+
+    for (i = 0; i < load->ncpus && i < data->ncpus; i++)
+        data->load[i] += load->load[i];
+
+    return 0;
+}
+
+
+/**
+ * qemuDomainGetBuiltinPlacement:
+ * @driver: qemu driver data
+ * @vm: domain object
+ * @current: nodes @vm currently runs on if it is being re-placed, or NULL
+ *
+ * Picks host NUMA nodes for @vm using the builtin placement engine,
+ * taking into account the vCPU pinning of all other running domains.
+ *
+ * Returns the nodeset or NULL on error.
+ */
+virBitmapPtr
+qemuDomainGetBuiltinPlacement(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              virBitmapPtr current)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    struct qemuDomainCPULoadSumData data = { .skip = uuidstr };
+    unsigned long long pagesize = 0;
+    virBitmapPtr ret = NULL;
+    size_t i;
+
+    if (vm->def->mem.nhugepages) {
+        pagesize = vm->def->mem.hugepages[0].size;
+
+        for (i = 0; !pagesize && i < cfg->nhugetlbfs; i++) {
+            if (cfg->hugetlbfs[i].deflt)
+                pagesize = cfg->hugetlbfs[i].size;
+        }
+    }
+
+    data.ncpus = virNumaGetMaxCPUs();
+    if (VIR_ALLOC_N(data.load, data.ncpus) < 0)
+        goto cleanup;
+
+    virUUIDFormat(vm->def->uuid, uuidstr);
+
+    virMutexLock(&driver->lock);
+    virHashForEach(driver->cpuLoad, qemuDomainCPULoadSum, &data);
+    virMutexUnlock(&driver->lock);
+
+    ret = virNumaGetPlacement(virDomainDefGetVcpus(vm->def),
+                              virDomainDefGetMemoryActual(vm->def),
+                              pagesize, data.load, data.ncpus, current);
+
+ cleanup:
+    VIR_FREE(data.load);
+    virObjectUnref(cfg);
+    return ret;
+}
@@ -61,7 +61,8 @@
     (JOB_MASK(QEMU_JOB_DESTROY) |       \
      JOB_MASK(QEMU_JOB_ASYNC))
 
-/* Only 1 job is allowed at any time
+/* Only 1 job is allowed at any time, except for QEMU_JOB_QUERY_SHARED
+ * which may be held by several threads at once.
  * A job includes *all* monitor commands, even those just querying
  * information, not merely actions */
 typedef enum {
@@ -72,6 +73,9 @@ typedef enum {
     QEMU_JOB_MODIFY,        /* May change state */
     QEMU_JOB_ABORT,         /* Abort current async job */
     QEMU_JOB_MIGRATION_OP,  /* Operation influencing outgoing migration */
+    QEMU_JOB_QUERY_SHARED,  /* Like QEMU_JOB_QUERY, but may run concurrently
+                               with other QEMU_JOB_QUERY_SHARED jobs; allowed
+                               whenever QEMU_JOB_QUERY is allowed */
 
     /* The following two items must always be the last items before JOB_LAST */
     QEMU_JOB_ASYNC,         /* Asynchronous job */
@@ -121,12 +125,34 @@ struct _qemuDomainJobInfo {
     qemuMonitorMigrationStats stats;
 };
 
+/* Buckets of job wait time histograms: <1ms, <10ms, <100ms, <1s, <10s
+ * and anything longer */
+# define QEMU_JOB_WAIT_HIST_BUCKETS 6
+
+/* A thread holding the active QEMU_JOB_QUERY_SHARED job */
+typedef struct _qemuDomainJobHolder qemuDomainJobHolder;
+typedef qemuDomainJobHolder *qemuDomainJobHolderPtr;
+struct _qemuDomainJobHolder {
+    unsigned long long owner;           /* Thread id of the holder */
+    const char *ownerAPI;               /* The API which holds the job */
+    unsigned long long started;         /* When it joined the job */
+    unsigned long long monStart;        /* When it entered the monitor */
+};
+
 struct qemuDomainJobObj {
     virCond cond;                       /* Use to coordinate jobs */
     qemuDomainJob active;               /* Currently running job */
     unsigned long long owner;           /* Thread id which set current job */
     const char *ownerAPI;               /* The API which owns the job */
     unsigned long long started;         /* When the current job started */
+    qemuDomainJobHolderPtr holders;     /* Threads holding active
+                                           QEMU_JOB_QUERY_SHARED job, the
+                                           one joined first leads */
+    size_t nholders;
+    unsigned int exclusiveWaiters;      /* Threads waiting for a job which
+                                           cannot be shared */
+    unsigned long long waitHist[QEMU_JOB_LAST][QEMU_JOB_WAIT_HIST_BUCKETS];
+                                        /* How long jobs waited to start */
 
     virCond asyncCond;                  /* Use to coordinate with async jobs */
     qemuDomainAsyncJob asyncJob;        /* Currently active async job */
@@ -165,6 +191,37 @@ struct _qemuDomainUnpluggingDevice {
     qemuDomainUnpluggingDeviceStatus status;
 };
 
+/* One group of bulk stats (VIR_DOMAIN_STATS_*) remembered for reuse by
+ * subsequent virConnectGetAllDomainStats calls */
+typedef struct _qemuDomainStatsCacheEntry qemuDomainStatsCacheEntry;
+typedef qemuDomainStatsCacheEntry *qemuDomainStatsCacheEntryPtr;
+struct _qemuDomainStatsCacheEntry {
+    unsigned int stats;             /* VIR_DOMAIN_STATS_* group */
+    unsigned int flags;             /* driver private flags used to collect */
+    unsigned long long collected;   /* when the entry was gathered (ms) */
+    virTypedParameterPtr params;
+    int nparams;
+};
+
+/* Number of perf counter samples kept per domain */
+# define QEMU_DOMAIN_PERF_HISTORY 16
+
+/* Hardware counters of all vCPU threads of a domain sampled periodically
+ * into a ring buffer, see perf_sample_interval in qemu.conf */
+typedef struct _qemuDomainPerfSampler qemuDomainPerfSampler;
+typedef qemuDomainPerfSampler *qemuDomainPerfSamplerPtr;
+struct _qemuDomainPerfSampler {
+    size_t nvcpus;
+    pid_t *tids;                    /* thread the counters of a vCPU follow */
+    virPerfCountersPtr *counters;   /* NULL for offline vCPUs */
+
+    /* ring buffer, @next is where the next sample is stored */
+    unsigned long long times[QEMU_DOMAIN_PERF_HISTORY];
+    uint64_t *values[QEMU_DOMAIN_PERF_HISTORY]; /* nvcpus * VIR_PERF_COUNTER_LAST */
+    size_t nsamples;
+    size_t next;
+};
+
 typedef struct _qemuDomainObjPrivate qemuDomainObjPrivate;
 typedef qemuDomainObjPrivate *qemuDomainObjPrivatePtr;
 struct _qemuDomainObjPrivate {
@@ -236,6 +293,11 @@ struct _qemuDomainObjPrivate {
     /* private XML) - need to restore at process reconnect */
     uint8_t *masterKey;
     size_t masterKeyLen;
+
+    qemuDomainStatsCacheEntryPtr statsCache;
+    size_t nstatsCache;
+
+    qemuDomainPerfSamplerPtr perfSampler;
 };
 
 /* Type of domain secret */
@@ -365,6 +427,10 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           virDomainObjPtr obj,
                           qemuDomainJob job)
     ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjBeginJobNowait(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj,
+                                qemuDomainJob job)
+    ATTRIBUTE_RETURN_CHECK;
 int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                virDomainObjPtr obj,
                                qemuDomainAsyncJob asyncJob)
@@ -681,4 +747,51 @@ int qemuDomainSecretPrepare(virConnectPtr conn, virDomainObjPtr vm)
 int qemuDomainDefValidateDiskLunSource(const virStorageSource *src)
     ATTRIBUTE_NONNULL(1);
 
+qemuDomainStatsCacheEntryPtr
+qemuDomainStatsCacheLookup(virDomainObjPtr vm,
+                           unsigned int stats,
+                           unsigned long long now,
+                           unsigned long long maxAge)
+    ATTRIBUTE_NONNULL(1);
+
+int qemuDomainStatsCacheStore(virDomainObjPtr vm,
+                              unsigned int stats,
+                              unsigned int flags,
+                              unsigned long long now,
+                              virTypedParameterPtr params,
+                              int nparams)
+    ATTRIBUTE_NONNULL(1);
+
+void qemuDomainStatsCacheInvalidate(virDomainObjPtr vm)
+    ATTRIBUTE_NONNULL(1);
+
+int qemuDomainPerfSample(virDomainObjPtr vm)
+    ATTRIBUTE_NONNULL(1);
+
+void qemuDomainPerfSamplerFree(qemuDomainPerfSamplerPtr sampler);
+
+/* Load the pinned vCPUs of a running domain put on each host CPU, in
+ * units of VIR_NUMA_PLACEMENT_LOAD_SCALE */
+typedef struct _qemuDomainCPULoad qemuDomainCPULoad;
+typedef qemuDomainCPULoad *qemuDomainCPULoadPtr;
+struct _qemuDomainCPULoad {
+    size_t ncpus;
+    unsigned int *load;
+};
+
+void qemuDomainCPULoadFree(void *payload, const void *name);
+
+void qemuDomainUpdateCPULoad(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+void qemuDomainRemoveCPULoad(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+virBitmapPtr qemuDomainGetBuiltinPlacement(virQEMUDriverPtr driver,
+                                           virDomainObjPtr vm,
+                                           virBitmapPtr current)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 #endif /* __QEMU_DOMAIN_H__ */
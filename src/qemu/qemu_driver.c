@@ -622,6 +622,173 @@ qemuDomainFindMaxID(virDomainObjPtr vm,
 }
 
 
+/* Formatted domain capabilities, valid as long as the emulator's
+ * capabilities are not replaced in the capabilities cache */
+typedef struct _qemuDomainCapsCacheEntry qemuDomainCapsCacheEntry;
+typedef qemuDomainCapsCacheEntry *qemuDomainCapsCacheEntryPtr;
+struct _qemuDomainCapsCacheEntry {
+    virQEMUCapsPtr qemuCaps;
+    char *xml;
+};
+
+
+static void
+qemuDomainCapsCacheEntryFree(void *payload,
+                             const void *name ATTRIBUTE_UNUSED)
+{
+    qemuDomainCapsCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    virObjectUnref(entry->qemuCaps);
+    VIR_FREE(entry->xml);
+    VIR_FREE(entry);
+}
+
+
+struct qemuPeriodicTaskData {
+    virDomainObjPtr *vms;
+    size_t nvms;
+};
+
+
+static int
+qemuPeriodicTaskCollect(virDomainObjPtr vm,
+                        void *opaque)
+{
+    struct qemuPeriodicTaskData *data = opaque;
+    virDomainObjPtr ref = vm;
+
+    /* The list is locked, so just take a reference and process the
+     * domain once it is released */
+    virObjectRef(ref);
+    if (VIR_APPEND_ELEMENT(data->vms, data->nvms, ref) < 0) {
+        virObjectUnref(ref);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * qemuPeriodicTaskWorker:
+ *
+ * Calls the task's callback for all domains each interval until the
+ * task is stopped.
+ */
+static void
+qemuPeriodicTaskWorker(void *opaque)
+{
+    qemuDriverPeriodicTaskPtr task = opaque;
+    virQEMUDriverPtr driver = task->driver;
+    unsigned long long now;
+    struct qemuPeriodicTaskData data;
+    size_t i;
+
+    virMutexLock(&driver->lock);
+    while (!task->quit) {
+        if (virTimeMillisNow(&now) < 0)
+            break;
+
+        if (virCondWaitUntil(&task->cond, &driver->lock,
+                             now + task->interval) < 0 &&
+            errno != ETIMEDOUT)
+            break;
+
+        if (task->quit)
+            break;
+        virMutexUnlock(&driver->lock);
+
+        memset(&data, 0, sizeof(data));
+        if (virDomainObjListForEach(driver->domains,
+                                    qemuPeriodicTaskCollect, &data) < 0)
+            virResetLastError();
+
+        for (i = 0; i < data.nvms; i++) {
+            virObjectLock(data.vms[i]);
+            if (task->callback(driver, data.vms[i]) < 0) {
+                VIR_DEBUG("Periodic task failed for %s",
+                          data.vms[i]->def->name);
+                virResetLastError();
+            }
+            virObjectUnlock(data.vms[i]);
+        }
+        virObjectListFreeCount(data.vms, data.nvms);
+
+        virMutexLock(&driver->lock);
+    }
+    virMutexUnlock(&driver->lock);
+}
+
+
+static int
+qemuPeriodicTaskStart(virQEMUDriverPtr driver,
+                      qemuDriverPeriodicTaskPtr task,
+                      unsigned long long interval,
+                      qemuDriverPeriodicCallback callback)
+{
+    if (!interval)
+        return 0;
+
+    task->driver = driver;
+    task->callback = callback;
+    task->interval = interval;
+
+    if (virCondInit(&task->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition"));
+        return -1;
+    }
+
+    if (virThreadCreate(&task->thread, true,
+                        qemuPeriodicTaskWorker, task) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create periodic task thread"));
+        virCondDestroy(&task->cond);
+        return -1;
+    }
+
+    task->active = true;
+    return 0;
+}
+
+
+static void
+qemuPeriodicTaskStop(virQEMUDriverPtr driver,
+                     qemuDriverPeriodicTaskPtr task)
+{
+    if (!task->active)
+        return;
+
+    virMutexLock(&driver->lock);
+    task->quit = true;
+    virCondSignal(&task->cond);
+    virMutexUnlock(&driver->lock);
+
+    virThreadJoin(&task->thread);
+    virCondDestroy(&task->cond);
+    task->active = false;
+}
+
+
+static int
+qemuPerfSamplerCallback(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr vm)
+{
+    return qemuDomainPerfSample(vm);
+}
+
+
+static int
+qemuNumaRebalancerCallback(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm)
+{
+    return qemuProcessNumaRebalance(driver, vm);
+}
+
+
 /**
  * qemuStateInitialize:
  *
@@ -773,6 +940,12 @@ qemuStateInitialize(bool privileged,
     if (!(qemu_driver->sharedDevices = virHashCreate(30, qemuSharedDeviceEntryFree)))
         goto error;
 
+    if (!(qemu_driver->domCapsCache = virHashCreate(5, qemuDomainCapsCacheEntryFree)))
+        goto error;
+
+    if (!(qemu_driver->cpuLoad = virHashCreate(30, qemuDomainCPULoadFree)))
+        goto error;
+
     if (qemuMigrationErrorInit(qemu_driver) < 0)
         goto error;
 
@@ -938,6 +1111,17 @@ qemuStateInitialize(bool privileged,
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (qemuPeriodicTaskStart(qemu_driver, &qemu_driver->perfSampler,
+                              cfg->perfSampleInterval * 1000ull,
+                              qemuPerfSamplerCallback) < 0)
+        goto error;
+
+    if (cfg->numaPlacementBuiltin &&
+        qemuPeriodicTaskStart(qemu_driver, &qemu_driver->numaRebalancer,
+                              cfg->numaRebalanceInterval * 1000ull,
+                              qemuNumaRebalancerCallback) < 0)
+        goto error;
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
@@ -1080,11 +1264,18 @@ qemuStateCleanup(void)
     if (!qemu_driver)
         return -1;
 
+    qemuPeriodicTaskStop(qemu_driver, &qemu_driver->perfSampler);
+    qemuPeriodicTaskStop(qemu_driver, &qemu_driver->numaRebalancer);
+
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
     virHashFree(qemu_driver->sharedDevices);
+    virHashFree(qemu_driver->domCapsCache);
+    virHashFree(qemu_driver->cpuLoad);
     virObjectUnref(qemu_driver->caps);
+    VIR_FREE(qemu_driver->capsXMLHead);
+    VIR_FREE(qemu_driver->capsXMLTail);
     virQEMUCapsCacheFree(qemu_driver->qemuCapsCache);
 
     virObjectUnref(qemu_driver->domains);
@@ -1336,97 +1527,182 @@ qemuConnectGetMaxVcpus(virConnectPtr conn ATTRIBUTE_UNUSED, const char *type)
 
 static char *qemuConnectGetCapabilities(virConnectPtr conn) {
     virQEMUDriverPtr driver = conn->privateData;
-    virCapsPtr caps = NULL;
-    char *xml = NULL;
 
     if (virConnectGetCapabilitiesEnsureACL(conn) < 0)
         return NULL;
 
-    if (!(caps = virQEMUDriverGetCapabilities(driver, true)))
-        goto cleanup;
+    return virQEMUDriverGetCapabilitiesXML(driver);
+}
 
-    xml = virCapabilitiesFormatXML(caps);
-    virObjectUnref(caps);
 
- cleanup:
+/* Size of the buffer the per-thread /proc readers below work in. It is
+ * allocated once per query and reused for every thread. */
+#define QEMU_PROC_BUF_LEN (16 * 1024)
 
-    return xml;
+/* Reads @path into @buf without any allocation. If @optional, a file
+ * that cannot be opened reads as empty. Returns the number of bytes read,
+ * or -1 with errno set. */
+static ssize_t
+qemuReadProcFile(const char *path, char *buf, size_t buflen, bool optional)
+{
+    int fd;
+    ssize_t got;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (!optional)
+            return -1;
+        buf[0] = '\0';
+        return 0;
+    }
+
+    got = saferead(fd, buf, buflen - 1);
+    VIR_FORCE_CLOSE(fd);
+    if (got < 0)
+        return -1;
+
+    buf[got] = '\0';
+    return got;
 }
 
 
+/* Builds the path of @file of @pid, or of its thread @tid if non-zero */
 static int
-qemuGetSchedInfo(unsigned long long *cpuWait,
-                 pid_t pid, pid_t tid)
+qemuFormatProcPath(char *path, size_t pathlen,
+                   pid_t pid, pid_t tid, const char *file)
 {
-    char *proc = NULL;
-    char *data = NULL;
-    char **lines = NULL;
-    size_t i;
-    int ret = -1;
-    double val;
-
-    *cpuWait = 0;
+    int len;
 
     /* In general, we cannot assume pid_t fits in int; but /proc parsing
      * is specific to Linux where int works fine.  */
     if (tid)
-        ret = virAsprintf(&proc, "/proc/%d/task/%d/sched", (int)pid, (int)tid);
+        len = snprintf(path, pathlen, "/proc/%d/task/%d/%s",
+                       (int) pid, (int) tid, file);
     else
-        ret = virAsprintf(&proc, "/proc/%d/sched", (int)pid);
-    if (ret < 0)
-        goto cleanup;
-    ret = -1;
+        len = snprintf(path, pathlen, "/proc/%d/%s", (int) pid, file);
 
-    /* The file is not guaranteed to exist (needs CONFIG_SCHED_DEBUG) */
-    if (access(proc, R_OK) < 0) {
-        ret = 0;
-        goto cleanup;
+    if (len < 0 || len >= pathlen) {
+        errno = ENAMETOOLONG;
+        return -1;
     }
+    return 0;
+}
 
-    if (virFileReadAll(proc, (1<<16), &data) < 0)
-        goto cleanup;
 
-    lines = virStringSplit(data, "\n", 0);
-    if (!lines)
-        goto cleanup;
+static int
+qemuGetSchedInfo(unsigned long long *cpuWait,
+                 pid_t pid, pid_t tid,
+                 char *buf, size_t buflen)
+{
+    char proc[64];
+    const char *line;
+    const char *eol;
+    double val;
+
+    *cpuWait = 0;
+
+    /* The file is not guaranteed to exist (needs CONFIG_SCHED_DEBUG) nor
+     * to be readable, its statistics are only collected on a best-effort
+     * basis */
+    if (qemuFormatProcPath(proc, sizeof(proc), pid, tid, "sched") < 0 ||
+        qemuReadProcFile(proc, buf, buflen, true) < 0) {
+        virReportSystemError(errno, _("Failed to read %s"), proc);
+        return -1;
+    }
+
+    for (line = buf; line && *line; line = eol ? eol + 1 : NULL) {
+        const char *p;
+        char *end;
 
-    for (i = 0; lines[i] != NULL; i++) {
-        const char *line = lines[i];
+        eol = strchr(line, '\n');
 
         /* Needs CONFIG_SCHEDSTATS. The second check
          * is the old name the kernel used in past */
-        if (STRPREFIX(line, "se.statistics.wait_sum") ||
-            STRPREFIX(line, "se.wait_sum")) {
-            line = strchr(line, ':');
-            if (!line) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Missing separator in sched info '%s'"),
-                               lines[i]);
-                goto cleanup;
-            }
-            line++;
-            while (*line == ' ')
-                line++;
+        if (!STRPREFIX(line, "se.statistics.wait_sum") &&
+            !STRPREFIX(line, "se.wait_sum"))
+            continue;
 
-            if (virStrToDouble(line, NULL, &val) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Unable to parse sched info value '%s'"),
-                               line);
-                goto cleanup;
-            }
+        p = strchr(line, ':');
+        if (!p || (eol && p > eol)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Missing separator in sched info of %s"),
+                           proc);
+            return -1;
+        }
+        p++;
+        while (*p == ' ')
+            p++;
 
-            *cpuWait = (unsigned long long)(val * 1000000);
-            break;
+        if (virStrToDouble(p, &end, &val) < 0 ||
+            (*end != '\n' && *end != '\0')) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to parse sched info value of %s"),
+                           proc);
+            return -1;
         }
+
+        *cpuWait = (unsigned long long)(val * 1000000);
+        break;
     }
 
-    ret = 0;
+    return 0;
+}
 
- cleanup:
-    VIR_FREE(data);
-    VIR_FREE(proc);
-    virStringFreeList(lines);
-    return ret;
+
+/* Extracts the fields we care about from the content of a /proc stat
+ * file. See 'man proc' for what all the fields are. */
+static int
+qemuParseProcessStat(const char *buf,
+                     unsigned long long *usertime,
+                     unsigned long long *systime,
+                     long *rss,
+                     int *cpu)
+{
+    const char *p;
+    char *end;
+    int field;
+
+    /* The command name may contain spaces and parentheses */
+    if (!(p = strrchr(buf, ')')))
+        return -1;
+    p++;
+
+    /* field 3 (state) follows the command name */
+    for (field = 3; field <= 39; field++) {
+        while (*p == ' ')
+            p++;
+        if (!*p)
+            return -1;
+
+        switch (field) {
+        case 14:
+            if (virStrToLong_ull(p, &end, 10, usertime) < 0)
+                return -1;
+            p = end;
+            break;
+        case 15:
+            if (virStrToLong_ull(p, &end, 10, systime) < 0)
+                return -1;
+            p = end;
+            break;
+        case 24:
+            if (virStrToLong_l(p, &end, 10, rss) < 0)
+                return -1;
+            p = end;
+            break;
+        case 39:
+            if (virStrToLong_i(p, &end, 10, cpu) < 0)
+                return -1;
+            p = end;
+            break;
+        default:
+            break;
+        }
+
+        while (*p && *p != ' ')
+            p++;
+    }
+
+    return 0;
 }
 
 
@@ -1434,37 +1710,19 @@ static int
 qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
                    pid_t pid, int tid)
 {
-    char *proc;
-    FILE *pidinfo;
+    char proc[64];
+    char buf[1024];
     unsigned long long usertime = 0, systime = 0;
     long rss = 0;
     int cpu = 0;
-    int ret;
 
-    /* In general, we cannot assume pid_t fits in int; but /proc parsing
-     * is specific to Linux where int works fine.  */
-    if (tid)
-        ret = virAsprintf(&proc, "/proc/%d/task/%d/stat", (int) pid, tid);
-    else
-        ret = virAsprintf(&proc, "/proc/%d/stat", (int) pid);
-    if (ret < 0)
-        return -1;
-
-    pidinfo = fopen(proc, "r");
-    VIR_FREE(proc);
-
-    /* See 'man proc' for information about what all these fields are. We're
-     * only interested in a very few of them */
-    if (!pidinfo ||
-        fscanf(pidinfo,
-               /* pid -> stime */
-               "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
-               /* cutime -> endcode */
-               "%*d %*d %*d %*d %*d %*d %*u %*u %ld %*u %*u %*u"
-               /* startstack -> processor */
-               "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
-               &usertime, &systime, &rss, &cpu) != 4) {
+    if (qemuFormatProcPath(proc, sizeof(proc), pid, tid, "stat") < 0 ||
+        qemuReadProcFile(proc, buf, sizeof(buf), false) < 0 ||
+        qemuParseProcessStat(buf, &usertime, &systime, &rss, &cpu) < 0) {
         VIR_WARN("cannot parse process status data");
+        usertime = systime = 0;
+        rss = 0;
+        cpu = 0;
     }
 
     /* We got jiffies
@@ -1485,8 +1743,6 @@ qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
     VIR_DEBUG("Got status for %d/%d user=%llu sys=%llu cpu=%d rss=%ld",
               (int) pid, tid, usertime, systime, cpu, rss);
 
-    VIR_FORCE_FCLOSE(pidinfo);
-
     return 0;
 }
 
@@ -1501,6 +1757,8 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
 {
     size_t ncpuinfo = 0;
     size_t i;
+    char *buf = NULL;
+    int ret = -1;
 
     if (maxinfo == 0)
         return 0;
@@ -1511,6 +1769,9 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
         return -1;
     }
 
+    if (cpuwait && VIR_ALLOC_N(buf, QEMU_PROC_BUF_LEN) < 0)
+        return -1;
+
     if (info)
         memset(info, 0, sizeof(*info) * maxinfo);
 
@@ -1532,7 +1793,7 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
                                    vm->pid, vcpupid) < 0) {
                 virReportSystemError(errno, "%s",
                                      _("cannot get vCPU placement & pCPU time"));
-                return -1;
+                goto cleanup;
             }
         }
 
@@ -1541,21 +1802,26 @@ qemuDomainHelperGetVcpus(virDomainObjPtr vm,
             virBitmapPtr map = NULL;
 
             if (!(map = virProcessGetAffinity(vcpupid)))
-                return -1;
+                goto cleanup;
 
             virBitmapToDataBuf(map, cpumap, maplen);
             virBitmapFree(map);
         }
 
         if (cpuwait) {
-            if (qemuGetSchedInfo(&(cpuwait[i]), vm->pid, vcpupid) < 0)
-                return -1;
+            if (qemuGetSchedInfo(&(cpuwait[i]), vm->pid, vcpupid,
+                                 buf, QEMU_PROC_BUF_LEN) < 0)
+                goto cleanup;
         }
 
         ncpuinfo++;
     }
 
-    return ncpuinfo;
+    ret = ncpuinfo;
+
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
 }
 
 
@@ -4679,6 +4945,8 @@ qemuDomainHotplugAddVcpu(virQEMUDriverPtr driver,
     if (qemuProcessSetupVcpu(vm, vcpu) < 0)
         goto cleanup;
 
+    qemuDomainUpdateCPULoad(driver, vm);
+
     ret = 0;
 
  cleanup:
@@ -4733,6 +5001,8 @@ qemuDomainHotplugDelVcpu(virQEMUDriverPtr driver,
 
     virDomainAuditVcpu(vm, oldvcpus, oldvcpus - 1, "update", true);
 
+    qemuDomainUpdateCPULoad(driver, vm);
+
     if (qemuDomainDelCgroupForThread(priv->cgroup,
                                      VIR_CGROUP_THREAD_VCPU, vcpu) < 0)
         goto cleanup;
@@ -5000,6 +5270,8 @@ qemuDomainPinVcpuLive(virDomainObjPtr vm,
     vcpuinfo->cpumask = tmpmap;
     tmpmap = NULL;
 
+    qemuDomainUpdateCPULoad(driver, vm);
+
     if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
         goto cleanup;
 
@@ -10635,7 +10907,7 @@ qemuDomainBlockStats(virDomainPtr dom,
     if (virDomainBlockStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY_SHARED) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10692,7 +10964,7 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     if (virDomainBlockStatsFlagsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY_SHARED) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -11119,7 +11391,7 @@ qemuDomainMemoryStats(virDomainPtr dom,
     if (virDomainMemoryStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY_SHARED) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -11502,12 +11774,8 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
     }
 
     qemuDomainObjEnterMonitor(driver, vm);
-    rc = qemuMonitorGetAllBlockStatsInfo(qemuDomainGetMonitor(vm),
-                                         &stats, false);
-    if (rc >= 0)
-        rc = qemuMonitorBlockStatsUpdateCapacity(qemuDomainGetMonitor(vm),
-                                                 stats, false);
-
+    rc = qemuMonitorGetAllBlockStats(qemuDomainGetMonitor(vm), &stats,
+                                     false, true);
     if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
         goto endjob;
 
@@ -11720,6 +11988,7 @@ qemuDomainMigratePrepare2(virConnectPtr dconn,
     virDomainDefPtr def = NULL;
     char *origname = NULL;
     qemuMigrationCompressionPtr compression = NULL;
+    int parallelConnections;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
@@ -11734,7 +12003,9 @@ qemuDomainMigratePrepare2(virConnectPtr dconn,
         goto cleanup;
     }
 
-    if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
+    if (qemuMigrationParallelParse(NULL, 0, flags,
+                                   &parallelConnections) < 0 ||
+        !(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
         goto cleanup;
 
     if (virLockManagerPluginUsesState(driver->lockManager)) {
@@ -11758,7 +12029,7 @@ qemuDomainMigratePrepare2(virConnectPtr dconn,
                                      NULL, 0, NULL, NULL, /* No cookies */
                                      uri_in, uri_out,
                                      &def, origname, NULL, 0, NULL, 0,
-                                     compression, flags);
+                                     parallelConnections, compression, flags);
 
  cleanup:
     VIR_FREE(compression);
@@ -11783,6 +12054,7 @@ qemuDomainMigratePerform(virDomainPtr dom,
     int ret = -1;
     const char *dconnuri = NULL;
     qemuMigrationCompressionPtr compression = NULL;
+    int parallelConnections;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
 
@@ -11793,7 +12065,9 @@ qemuDomainMigratePerform(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
+    if (qemuMigrationParallelParse(NULL, 0, flags,
+                                   &parallelConnections) < 0 ||
+        !(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
         goto cleanup;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
@@ -11817,7 +12091,8 @@ qemuDomainMigratePerform(virDomainPtr dom,
      */
     ret = qemuMigrationPerform(driver, dom->conn, vm, NULL,
                                NULL, dconnuri, uri, NULL, NULL, 0, NULL, 0,
-                               compression, cookie, cookielen,
+                               parallelConnections, compression,
+                               cookie, cookielen,
                                NULL, NULL, /* No output cookies in v2 */
                                flags, dname, resource, false);
 
@@ -11967,6 +12242,7 @@ qemuDomainMigratePrepare3(virConnectPtr dconn,
     virDomainDefPtr def = NULL;
     char *origname = NULL;
     qemuMigrationCompressionPtr compression = NULL;
+    int parallelConnections;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
@@ -11981,7 +12257,9 @@ qemuDomainMigratePrepare3(virConnectPtr dconn,
         goto cleanup;
     }
 
-    if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
+    if (qemuMigrationParallelParse(NULL, 0, flags,
+                                   &parallelConnections) < 0 ||
+        !(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
         goto cleanup;
 
     if (!(def = qemuMigrationPrepareDef(driver, dom_xml, dname, &origname)))
@@ -11995,7 +12273,7 @@ qemuDomainMigratePrepare3(virConnectPtr dconn,
                                      cookieout, cookieoutlen,
                                      uri_in, uri_out,
                                      &def, origname, NULL, 0, NULL, 0,
-                                     compression, flags);
+                                     parallelConnections, compression, flags);
 
  cleanup:
     VIR_FREE(compression);
@@ -12027,6 +12305,7 @@ qemuDomainMigratePrepare3Params(virConnectPtr dconn,
     const char **migrate_disks = NULL;
     char *origname = NULL;
     qemuMigrationCompressionPtr compression = NULL;
+    int parallelConnections;
     int ret = -1;
 
     virCheckFlagsGoto(QEMU_MIGRATION_FLAGS, cleanup);
@@ -12057,7 +12336,9 @@ qemuDomainMigratePrepare3Params(virConnectPtr dconn,
     if (nmigrate_disks < 0)
         goto cleanup;
 
-    if (!(compression = qemuMigrationCompressionParse(params, nparams, flags)))
+    if (qemuMigrationParallelParse(params, nparams, flags,
+                                   &parallelConnections) < 0 ||
+        !(compression = qemuMigrationCompressionParse(params, nparams, flags)))
         goto cleanup;
 
     if (flags & VIR_MIGRATE_TUNNELLED) {
@@ -12082,7 +12363,7 @@ qemuDomainMigratePrepare3Params(virConnectPtr dconn,
                                      uri_in, uri_out,
                                      &def, origname, listenAddress,
                                      nmigrate_disks, migrate_disks, nbdPort,
-                                     compression, flags);
+                                     parallelConnections, compression, flags);
 
  cleanup:
     VIR_FREE(compression);
@@ -12206,11 +12487,14 @@ qemuDomainMigratePerform3(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     qemuMigrationCompressionPtr compression = NULL;
+    int parallelConnections;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
 
-    if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
+    if (qemuMigrationParallelParse(NULL, 0, flags,
+                                   &parallelConnections) < 0 ||
+        !(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
         return -1;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
@@ -12223,7 +12507,7 @@ qemuDomainMigratePerform3(virDomainPtr dom,
 
     ret = qemuMigrationPerform(driver, dom->conn, vm, xmlin, NULL,
                                dconnuri, uri, NULL, NULL, 0, NULL, 0,
-                               compression,
+                               parallelConnections, compression,
                                cookiein, cookieinlen,
                                cookieout, cookieoutlen,
                                flags, dname, resource, true);
@@ -12257,6 +12541,7 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     unsigned long long bandwidth = 0;
     int nbdPort = 0;
     qemuMigrationCompressionPtr compression = NULL;
+    int parallelConnections;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
@@ -12296,7 +12581,9 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     if (nmigrate_disks < 0)
         goto cleanup;
 
-    if (!(compression = qemuMigrationCompressionParse(params, nparams, flags)))
+    if (qemuMigrationParallelParse(params, nparams, flags,
+                                   &parallelConnections) < 0 ||
+        !(compression = qemuMigrationCompressionParse(params, nparams, flags)))
         goto cleanup;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
@@ -12310,7 +12597,7 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     ret = qemuMigrationPerform(driver, dom->conn, vm, dom_xml, persist_xml,
                                dconnuri, uri, graphicsuri, listenAddress,
                                nmigrate_disks, migrate_disks, nbdPort,
-                               compression,
+                               parallelConnections, compression,
                                cookiein, cookieinlen, cookieout, cookieoutlen,
                                flags, dname, bandwidth, true);
  cleanup:
@@ -18462,6 +18749,10 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
     virDomainCapsPtr domCaps = NULL;
     int arch = virArchFromHost(); /* virArch */
     virQEMUDriverConfigPtr cfg = NULL;
+    virBuffer key = VIR_BUFFER_INITIALIZER;
+    char *keystr = NULL;
+    qemuDomainCapsCacheEntryPtr entry = NULL;
+    size_t i;
 
     virCheckFlags(0, ret);
 
@@ -18537,6 +18828,29 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
         machine = virQEMUCapsGetDefaultMachine(qemuCaps);
     }
 
+    /* Apart from the emulator, the result depends on the host's device
+     * assignment support and on which firmware images are installed */
+    virBufferAsprintf(&key, "%s:%s:%s:%s:%d:%d:",
+                      emulatorbin, NULLSTR(machine), virArchToString(arch),
+                      virDomainVirtTypeToString(virttype),
+                      qemuHostdevHostSupportsPassthroughLegacy(),
+                      qemuHostdevHostSupportsPassthroughVFIO());
+    for (i = 0; i < cfg->nloader; i++)
+        virBufferAddChar(&key, virFileExists(cfg->loader[i]) ? '1' : '0');
+    if (virBufferCheckError(&key) < 0)
+        goto cleanup;
+    keystr = virBufferContentAndReset(&key);
+
+    virMutexLock(&driver->lock);
+    entry = virHashLookup(driver->domCapsCache, keystr);
+    if (entry && entry->qemuCaps == qemuCaps) {
+        ignore_value(VIR_STRDUP(ret, entry->xml));
+        virMutexUnlock(&driver->lock);
+        goto cleanup;
+    }
+    virMutexUnlock(&driver->lock);
+    entry = NULL;
+
     if (!(domCaps = virDomainCapsNew(emulatorbin, machine, arch, virttype)))
         goto cleanup;
 
@@ -18544,8 +18858,28 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
                                   cfg->loader, cfg->nloader) < 0)
         goto cleanup;
 
-    ret = virDomainCapsFormat(domCaps);
+    if (!(ret = virDomainCapsFormat(domCaps)))
+        goto cleanup;
+
+    /* Failing to cache the result is not fatal */
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_STRDUP(entry->xml, ret) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+    entry->qemuCaps = virObjectRef(qemuCaps);
+
+    virMutexLock(&driver->lock);
+    if (virHashUpdateEntry(driver->domCapsCache, keystr, entry) < 0)
+        virResetLastError();
+    else
+        entry = NULL;
+    virMutexUnlock(&driver->lock);
+
  cleanup:
+    qemuDomainCapsCacheEntryFree(entry, NULL);
+    virBufferFreeAndReset(&key);
+    VIR_FREE(keystr);
     virObjectUnref(cfg);
     virObjectUnref(domCaps);
     virObjectUnref(qemuCaps);
@@ -18553,12 +18887,78 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
 }
 
 
+/* Data gathered once per bulk stats query and shared by all domains */
+typedef struct _qemuDomainGetStatsData qemuDomainGetStatsData;
+typedef qemuDomainGetStatsData *qemuDomainGetStatsDataPtr;
+struct _qemuDomainGetStatsData {
+    virHashTablePtr ifstats; /* host interface counters, may be NULL */
+};
+
+
+/* Upper bounds of the buckets of job wait time histograms */
+static const char *qemuDomainJobWaitBuckets[QEMU_JOB_WAIT_HIST_BUCKETS] = {
+    "1ms", "10ms", "100ms", "1s", "10s", "max",
+};
+
+static int
+qemuDomainGetStatsJobWait(virDomainObjPtr dom,
+                          virDomainStatsRecordPtr record,
+                          int *maxparams)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    const char *name;
+    unsigned long long total;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < QEMU_JOB_LAST; i++) {
+        total = 0;
+        for (j = 0; j < QEMU_JOB_WAIT_HIST_BUCKETS; j++)
+            total += priv->job.waitHist[i][j];
+        if (!total)
+            continue;
+
+        switch ((qemuDomainJob) i) {
+        case QEMU_JOB_QUERY_SHARED:
+            name = "query_shared";
+            break;
+        case QEMU_JOB_MIGRATION_OP:
+            name = "migration_op";
+            break;
+        case QEMU_JOB_ASYNC:
+            name = "async";
+            break;
+        case QEMU_JOB_ASYNC_NESTED:
+            name = "async_nested";
+            break;
+        default:
+            name = qemuDomainJobTypeToString(i);
+            break;
+        }
+
+        for (j = 0; j < QEMU_JOB_WAIT_HIST_BUCKETS; j++) {
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "state.job.%s.wait.%s", name,
+                     qemuDomainJobWaitBuckets[j]);
+            if (virTypedParamsAddULLong(&record->params, &record->nparams,
+                                        maxparams, param_name,
+                                        priv->job.waitHist[i][j]) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 static int
 qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
-                        unsigned int privflags ATTRIBUTE_UNUSED)
+                        unsigned int privflags ATTRIBUTE_UNUSED,
+                        qemuDomainGetStatsDataPtr data ATTRIBUTE_UNUSED)
 {
     if (virTypedParamsAddInt(&record->params,
                              &record->nparams,
@@ -18574,6 +18974,9 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                              dom->state.reason) < 0)
         return -1;
 
+    if (qemuDomainGetStatsJobWait(dom, record, maxparams) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -18594,7 +18997,8 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                       virDomainObjPtr dom,
                       virDomainStatsRecordPtr record,
                       int *maxparams,
-                      unsigned int privflags ATTRIBUTE_UNUSED)
+                      unsigned int privflags ATTRIBUTE_UNUSED,
+                      qemuDomainGetStatsDataPtr data ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     unsigned long long cpu_time = 0;
@@ -18635,7 +19039,8 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
-                          unsigned int privflags ATTRIBUTE_UNUSED)
+                          unsigned int privflags ATTRIBUTE_UNUSED,
+                          qemuDomainGetStatsDataPtr data ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     unsigned long long cur_balloon = 0;
@@ -18672,7 +19077,8 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
-                       unsigned int privflags ATTRIBUTE_UNUSED)
+                       unsigned int privflags ATTRIBUTE_UNUSED,
+                       qemuDomainGetStatsDataPtr data ATTRIBUTE_UNUSED)
 {
     size_t i;
     int ret = -1;
@@ -18789,7 +19195,8 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                             virDomainObjPtr dom,
                             virDomainStatsRecordPtr record,
                             int *maxparams,
-                            unsigned int privflags ATTRIBUTE_UNUSED)
+                            unsigned int privflags ATTRIBUTE_UNUSED,
+                            qemuDomainGetStatsDataPtr data)
 {
     size_t i;
     struct _virDomainInterfaceStats tmp;
@@ -18810,7 +19217,14 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
         QEMU_ADD_NAME_PARAM(record, maxparams,
                             "net", "name", i, dom->def->nets[i]->ifname);
 
-        if (virNetInterfaceStats(dom->def->nets[i]->ifname, &tmp) < 0) {
+        if (data->ifstats) {
+            if (virNetInterfaceStatsLookup(data->ifstats,
+                                           dom->def->nets[i]->ifname,
+                                           &tmp) < 0) {
+                virResetLastError();
+                continue;
+            }
+        } else if (virNetInterfaceStats(dom->def->nets[i]->ifname, &tmp) < 0) {
             virResetLastError();
             continue;
         }
@@ -19004,7 +19418,8 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
-                        unsigned int privflags)
+                        unsigned int privflags,
+                        qemuDomainGetStatsDataPtr data ATTRIBUTE_UNUSED)
 {
     size_t i;
     int ret = -1;
@@ -19018,11 +19433,9 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
 
     if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
         qemuDomainObjEnterMonitor(driver, dom);
-        rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &stats,
-                                             visitBacking);
-        if (rc >= 0)
-            ignore_value(qemuMonitorBlockStatsUpdateCapacity(priv->mon, stats,
-                                                             visitBacking));
+        /* Sizes are best effort, the I/O counters are still useful */
+        rc = qemuMonitorGetAllBlockStats(priv->mon, &stats, visitBacking,
+                                         false);
         if (qemuDomainObjExitMonitor(driver, dom) < 0)
             goto cleanup;
 
@@ -19095,12 +19508,76 @@ qemuDomainGetStatsPerfRdt(virPerfPtr perf,
     return 0;
 }
 
+/* Reports the newest vCPU counter sample of the perf sampler together
+ * with the change of each counter over the whole kept history */
+static int
+qemuDomainGetStatsPerfSamples(qemuDomainPerfSamplerPtr sampler,
+                              virDomainStatsRecordPtr record,
+                              int *maxparams)
+{
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t newest;
+    size_t oldest;
+    size_t i;
+    size_t j;
+
+    if (!sampler || !sampler->nsamples)
+        return 0;
+
+    newest = (sampler->next + QEMU_DOMAIN_PERF_HISTORY - 1) %
+        QEMU_DOMAIN_PERF_HISTORY;
+    oldest = (sampler->next + QEMU_DOMAIN_PERF_HISTORY - sampler->nsamples) %
+        QEMU_DOMAIN_PERF_HISTORY;
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "perf.sample.count", sampler->nsamples) < 0 ||
+        virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "perf.sample.time",
+                                sampler->times[newest]) < 0 ||
+        virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "perf.sample.window",
+                                sampler->times[newest] -
+                                sampler->times[oldest]) < 0)
+        return -1;
+
+    for (i = 0; i < sampler->nvcpus; i++) {
+        uint64_t *last = sampler->values[newest] + i * VIR_PERF_COUNTER_LAST;
+        uint64_t *first = sampler->values[oldest] + i * VIR_PERF_COUNTER_LAST;
+
+        if (!sampler->counters[i])
+            continue;
+
+        for (j = 0; j < VIR_PERF_COUNTER_LAST; j++) {
+            if (!virPerfCountersHas(sampler->counters[i], j))
+                continue;
+
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "perf.vcpu.%zu.%s", i, virPerfCounterTypeToString(j));
+            if (virTypedParamsAddULLong(&record->params, &record->nparams,
+                                        maxparams, param_name, last[j]) < 0)
+                return -1;
+
+            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                     "perf.vcpu.%zu.%s.delta", i,
+                     virPerfCounterTypeToString(j));
+            if (virTypedParamsAddULLong(&record->params, &record->nparams,
+                                        maxparams, param_name,
+                                        last[j] >= first[j] ?
+                                        last[j] - first[j] : 0) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
 static int
 qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
-                       unsigned int privflags ATTRIBUTE_UNUSED)
+                       unsigned int privflags ATTRIBUTE_UNUSED,
+                       qemuDomainGetStatsDataPtr data ATTRIBUTE_UNUSED)
 {
     size_t i;
     qemuDomainObjPrivatePtr priv = dom->privateData;
@@ -19120,6 +19597,9 @@ qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
         }
     }
 
+    if (qemuDomainGetStatsPerfSamples(priv->perfSampler, record, maxparams) < 0)
+        goto cleanup;
+
     ret = 0;
 
  cleanup:
@@ -19131,23 +19611,25 @@ typedef int
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
-                          unsigned int flags);
+                          unsigned int flags,
+                          qemuDomainGetStatsDataPtr data);
 
 struct qemuDomainGetStatsWorker {
     qemuDomainGetStatsFunc func;
     unsigned int stats;
     bool monitor;
+    bool cacheable; /* results may be reused within stats_cache_max_age */
 };
 
 static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
-    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
-    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
-    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
-    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, false },
-    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
-    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
-    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
-    { NULL, 0, false }
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false, false },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false, true },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true, true },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, false, true },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false, true },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true, true },
+    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false, false },
+    { NULL, 0, false, false }
 };
 
 
@@ -19193,15 +19675,119 @@ qemuDomainGetStatsNeedMonitor(unsigned int stats)
 }
 
 
+/**
+ * qemuDomainGetStatsCacheFind:
+ * @dom: domain object
+ * @worker: stats worker the cached data would replace
+ * @flags: private flags of the current query
+ * @now: current time in milliseconds
+ * @maxAge: maximum acceptable age of cached data in milliseconds
+ *
+ * Returns the cache entry of @dom which can stand in for calling
+ * @worker with @flags, or NULL if the group has to be gathered again.
+ */
+static qemuDomainStatsCacheEntryPtr
+qemuDomainGetStatsCacheFind(virDomainObjPtr dom,
+                            struct qemuDomainGetStatsWorker *worker,
+                            unsigned int flags,
+                            unsigned long long now,
+                            unsigned long long maxAge)
+{
+    qemuDomainStatsCacheEntryPtr entry;
+
+    if (!maxAge || !worker->cacheable || !virDomainObjIsActive(dom))
+        return NULL;
+
+    if (!(entry = qemuDomainStatsCacheLookup(dom, worker->stats, now, maxAge)))
+        return NULL;
+
+    if ((entry->flags & QEMU_DOMAIN_STATS_BACKING) !=
+        (flags & QEMU_DOMAIN_STATS_BACKING))
+        return NULL;
+
+    /* data gathered without access to the monitor is incomplete */
+    if (worker->monitor && HAVE_JOB(flags) && !HAVE_JOB(entry->flags))
+        return NULL;
+
+    return entry;
+}
+
+
+/**
+ * qemuDomainGetStatsCacheCovers:
+ *
+ * Returns true if every requested stats group that needs the monitor can
+ * be served from the cache of @dom, so that no job has to be acquired.
+ */
+static bool
+qemuDomainGetStatsCacheCovers(virDomainObjPtr dom,
+                              unsigned int stats,
+                              unsigned int flags,
+                              unsigned long long now,
+                              unsigned long long maxAge)
+{
+    size_t i;
+
+    if (!maxAge)
+        return false;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (!(stats & qemuDomainGetStatsWorkers[i].stats) ||
+            !qemuDomainGetStatsWorkers[i].monitor)
+            continue;
+
+        if (!qemuDomainGetStatsCacheFind(dom, &qemuDomainGetStatsWorkers[i],
+                                         flags, now, maxAge))
+            return false;
+    }
+
+    return true;
+}
+
+
+static int
+qemuDomainGetStatsAppend(virDomainStatsRecordPtr record,
+                         int *maxparams,
+                         virTypedParameterPtr params,
+                         int nparams)
+{
+    virTypedParameterPtr copy = NULL;
+    size_t max = *maxparams;
+
+    if (nparams == 0)
+        return 0;
+
+    if (virTypedParamsCopy(&copy, params, nparams) < 0)
+        return -1;
+
+    if (VIR_RESIZE_N(record->params, max, record->nparams, nparams) < 0) {
+        virTypedParamsFree(copy, nparams);
+        return -1;
+    }
+    *maxparams = max;
+
+    /* the strings are now owned by @record, free just the array */
+    memcpy(record->params + record->nparams, copy, sizeof(*copy) * nparams);
+    record->nparams += nparams;
+    VIR_FREE(copy);
+    return 0;
+}
+
+
 static int
 qemuDomainGetStats(virConnectPtr conn,
                    virDomainObjPtr dom,
                    unsigned int stats,
                    virDomainStatsRecordPtr *record,
-                   unsigned int flags)
+                   unsigned int flags,
+                   qemuDomainGetStatsDataPtr data,
+                   unsigned long long now,
+                   unsigned long long maxAge)
 {
     int maxparams = 0;
     virDomainStatsRecordPtr tmp;
+    qemuDomainStatsCacheEntryPtr entry;
+    unsigned long long collected;
     size_t i;
     int ret = -1;
 
@@ -19209,11 +19795,32 @@ qemuDomainGetStats(virConnectPtr conn,
         goto cleanup;
 
     for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
-        if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
+        struct qemuDomainGetStatsWorker *worker = &qemuDomainGetStatsWorkers[i];
+        int start = tmp->nparams;
+
+        if (!(stats & worker->stats))
+            continue;
+
+        if ((entry = qemuDomainGetStatsCacheFind(dom, worker, flags,
+                                                 now, maxAge))) {
+            if (qemuDomainGetStatsAppend(tmp, &maxparams, entry->params,
+                                         entry->nparams) < 0)
                 goto cleanup;
+            continue;
         }
+
+        if (worker->func(conn->privateData, dom, tmp, &maxparams,
+                         flags, data) < 0)
+            goto cleanup;
+
+        /* Stamp the entry with the time the data was gathered at, which
+         * may be well past @now when the worker waited for the monitor */
+        if (maxAge && worker->cacheable && virDomainObjIsActive(dom) &&
+            virTimeMillisNow(&collected) == 0 &&
+            qemuDomainStatsCacheStore(dom, worker->stats, flags, collected,
+                                      tmp->params + start,
+                                      tmp->nparams - start) < 0)
+            goto cleanup;
     }
 
     if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
@@ -19252,6 +19859,10 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     int ret = -1;
     unsigned int privflags = 0;
     unsigned int domflags = 0;
+    virQEMUDriverConfigPtr cfg = NULL;
+    unsigned long long maxAge;
+    unsigned long long now = 0;
+    qemuDomainGetStatsData data = { 0 };
     unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
@@ -19286,21 +19897,43 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     if (qemuDomainGetStatsNeedMonitor(stats))
         privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
 
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
+        privflags |= QEMU_DOMAIN_STATS_BACKING;
+
+    cfg = virQEMUDriverGetConfig(driver);
+    maxAge = cfg->statsCacheMaxAge;
+
+    /* Read the counters of all host interfaces at once rather than
+     * scanning them again for every NIC of every domain */
+    if (stats & VIR_DOMAIN_STATS_INTERFACE &&
+        !(data.ifstats = virNetInterfaceStatsGetAll()))
+        virResetLastError();
+
     for (i = 0; i < nvms; i++) {
         virDomainStatsRecordPtr tmp = NULL;
-        domflags = 0;
+        domflags = privflags & QEMU_DOMAIN_STATS_BACKING;
         vm = vms[i];
 
         virObjectLock(vm);
 
+        if (maxAge && virTimeMillisNow(&now) < 0)
+            maxAge = 0;
+
+        /* The domain stays locked for the whole query if no job is taken,
+         * so the cached data checked here can't go away meanwhile */
         if (HAVE_JOB(privflags) &&
-            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
+            !qemuDomainGetStatsCacheCovers(vm, stats, privflags, now, maxAge) &&
+            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY_SHARED) == 0)
             domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
         /* else: without a job it's still possible to gather some data */
 
-        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
-            domflags |= QEMU_DOMAIN_STATS_BACKING;
-        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags) < 0) {
+        /* Waiting for the job may have taken a while, and other callers
+         * may have refreshed the cache meanwhile */
+        if (HAVE_JOB(domflags) && maxAge && virTimeMillisNow(&now) < 0)
+            maxAge = 0;
+
+        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags, &data,
+                               now, maxAge) < 0) {
             if (HAVE_JOB(domflags) && vm)
                 qemuDomainObjEndJob(driver, vm);
 
@@ -19325,6 +19958,8 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
  cleanup:
     virDomainStatsRecordListFree(tmpstats);
     virObjectListFreeCount(vms, nvms);
+    virObjectUnref(cfg);
+    virHashFree(data.ifstats);
 
     return ret;
 }
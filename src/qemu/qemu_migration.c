@@ -32,6 +32,7 @@
 #include <poll.h>
 
 #include "qemu_migration.h"
+#include "qemu_migrationpriv.h"
 #include "qemu_monitor.h"
 #include "qemu_domain.h"
 #include "qemu_process.h"
@@ -59,6 +60,7 @@
 #include "virstring.h"
 #include "virtypedparam.h"
 #include "virprocess.h"
+#include "nodeinfo.h"
 #include "nwfilter_conf.h"
 #include "storage/storage_driver.h"
 
@@ -2731,15 +2733,414 @@ qemuMigrationCompleted(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * Convergence controller for outgoing live migration.
+ *
+ * Every @interval milliseconds the migration statistics are sampled. A
+ * sample is stalled when the guest dirties memory nearly as fast as it
+ * can be sent or when the amount of remaining RAM did not shrink since
+ * the previous sample. Once QEMU_MIGRATION_CONVERGE_PATIENCE samples in
+ * a row are stalled and QEMU started a new pass over guest memory since
+ * the last decision, the controller escalates to the next step allowed
+ * by the policy. Each decision is recorded in the domain log.
+ */
+#define QEMU_MIGRATION_CONVERGE_PATIENCE 3
+#define QEMU_MIGRATION_CONVERGE_THROTTLE_STEP 20
+
+VIR_ENUM_IMPL(qemuMigrationConvergeStep, QEMU_MIGRATION_CONVERGE_STEP_LAST,
+              "xbzrle",
+              "throttle",
+              "postcopy",
+);
+
+
+void
+qemuMigrationConvergeInit(qemuMigrationConvergePtr conv,
+                          virQEMUDriverConfigPtr cfg,
+                          qemuMigrationCompressionPtr compression,
+                          unsigned long flags)
+{
+    memset(conv, 0, sizeof(*conv));
+
+    conv->policy = cfg->migrationConvergePolicy;
+    conv->interval = cfg->migrationConvergeInterval;
+    conv->maxThrottle = cfg->migrationConvergeMaxThrottle;
+    conv->xbzrle = !!(compression->methods &
+                      (1ULL << QEMU_MIGRATION_COMPRESS_XBZRLE));
+    /* QEMU is already throttling the guest by itself */
+    conv->throttle = !(flags & VIR_MIGRATE_AUTO_CONVERGE);
+
+    conv->step = QEMU_MIGRATION_CONVERGE_STEP_XBZRLE;
+    conv->remaining = ULLONG_MAX;
+    if (virTimeMillisNow(&conv->next) == 0)
+        conv->next += conv->interval;
+}
+
+
+/**
+ * qemuMigrationConvergeUpdate:
+ * @conv: convergence controller
+ * @stats: current migration statistics
+ * @pagesize: size of the guest pages counted in the dirty rate
+ *
+ * Feeds a sample into @conv.
+ *
+ * Returns true if the migration stalled long enough for the controller
+ * to escalate.
+ */
+bool
+qemuMigrationConvergeUpdate(qemuMigrationConvergePtr conv,
+                            qemuMonitorMigrationStatsPtr stats,
+                            unsigned long long pagesize)
+{
+    /* Nothing to judge before QEMU finished its first pass over RAM */
+    if (stats->status != QEMU_MONITOR_MIGRATION_STATUS_ACTIVE ||
+        stats->ram_iteration < 2 || !stats->ram_bps)
+        return false;
+
+    if (stats->ram_dirty_rate * pagesize * 10 >= stats->ram_bps * 9 ||
+        stats->ram_remaining >= conv->remaining)
+        conv->stalled++;
+    else
+        conv->stalled = 0;
+    conv->remaining = stats->ram_remaining;
+
+    return conv->stalled >= QEMU_MIGRATION_CONVERGE_PATIENCE &&
+        stats->ram_iteration > conv->iteration;
+}
+
+
+/**
+ * qemuMigrationConvergeNextStep:
+ * @conv: convergence controller
+ * @stats: current migration statistics
+ * @canThrottle: whether the vCPUs of the domain can be throttled
+ * @postcopyEnabled: whether post-copy was enabled for the migration
+ *
+ * Moves @conv past the steps which have nothing (more) to offer. A step
+ * which was applied stays current so that it can be applied again.
+ *
+ * Returns the step to apply, or QEMU_MIGRATION_CONVERGE_STEP_LAST if the
+ * policy allows no further steps.
+ */
+int
+qemuMigrationConvergeNextStep(qemuMigrationConvergePtr conv,
+                              qemuMonitorMigrationStatsPtr stats,
+                              bool canThrottle,
+                              bool postcopyEnabled)
+{
+    for (; conv->step < QEMU_MIGRATION_CONVERGE_STEP_LAST; conv->step++) {
+        switch ((qemuMigrationConvergeStep) conv->step) {
+        case QEMU_MIGRATION_CONVERGE_STEP_XBZRLE:
+            /* Beyond a quarter of guest RAM a bigger cache rarely pays off */
+            if (conv->xbzrle && stats->xbzrle_set &&
+                stats->xbzrle_cache_size &&
+                stats->xbzrle_cache_size * 2 <= stats->ram_total / 4)
+                return conv->step;
+            break;
+
+        case QEMU_MIGRATION_CONVERGE_STEP_THROTTLE:
+            if (conv->throttle && canThrottle &&
+                conv->throttlePct < conv->maxThrottle)
+                return conv->step;
+            break;
+
+        case QEMU_MIGRATION_CONVERGE_STEP_POSTCOPY:
+            if (conv->policy == QEMU_MIGRATION_CONVERGE_POSTCOPY &&
+                postcopyEnabled)
+                return conv->step;
+            break;
+
+        case QEMU_MIGRATION_CONVERGE_STEP_LAST:
+            break;
+        }
+    }
+
+    return QEMU_MIGRATION_CONVERGE_STEP_LAST;
+}
+
+
+/* Records that a decision was taken on @stats, the next escalation
+ * waits for new stalled samples and a new pass over guest memory */
+void
+qemuMigrationConvergeDecided(qemuMigrationConvergePtr conv,
+                             qemuMonitorMigrationStatsPtr stats)
+{
+    /* Switching to post-copy is the last resort */
+    if (conv->step == QEMU_MIGRATION_CONVERGE_STEP_POSTCOPY)
+        conv->step = QEMU_MIGRATION_CONVERGE_STEP_LAST;
+
+    conv->stalled = 0;
+    conv->iteration = stats->ram_iteration;
+}
+
+
+static void
+qemuMigrationConvergeTrace(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           qemuMigrationConvergePtr conv,
+                           qemuMonitorMigrationStatsPtr stats,
+                           const char *action)
+{
+    char *timestamp;
+
+    VIR_INFO("Migration of domain %s is not converging (dirty rate %llu "
+             "pages/s, sent %llu B/s, remaining %llu B, pass %llu): %s",
+             vm->def->name, stats->ram_dirty_rate, stats->ram_bps,
+             stats->ram_remaining, stats->ram_iteration, action);
+
+    if (!conv->logCtxt &&
+        !(conv->logCtxt = qemuDomainLogContextNew(driver, vm,
+                                                  QEMU_DOMAIN_LOG_CONTEXT_MODE_ATTACH))) {
+        virResetLastError();
+        return;
+    }
+
+    if (!(timestamp = virTimeStringNow())) {
+        virResetLastError();
+        return;
+    }
+
+    ignore_value(qemuDomainLogContextWrite(conv->logCtxt,
+                                           "%s: migration not converging: "
+                                           "dirty rate %llu pages/s, "
+                                           "sent %llu B/s, "
+                                           "remaining %llu B, pass %llu: "
+                                           "%s\n",
+                                           timestamp, stats->ram_dirty_rate,
+                                           stats->ram_bps,
+                                           stats->ram_remaining,
+                                           stats->ram_iteration, action));
+    VIR_FREE(timestamp);
+}
+
+
+/* The step helpers below apply their step and describe it in @action.
+ * They return 0 on success and -1 on error. */
+static int
+qemuMigrationConvergeXBZRLE(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            qemuDomainAsyncJob asyncJob,
+                            qemuMonitorMigrationStatsPtr stats,
+                            char *action,
+                            size_t actionlen)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long cache = stats->xbzrle_cache_size * 2;
+    int rc;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return -1;
+    rc = qemuMonitorSetMigrationCacheSize(priv->mon, cache);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        return -1;
+
+    snprintf(action, actionlen, "XBZRLE cache size %llu -> %llu bytes",
+             stats->xbzrle_cache_size, cache);
+    return 0;
+}
+
+
+static int
+qemuMigrationConvergeThrottle(virDomainObjPtr vm,
+                              qemuMigrationConvergePtr conv,
+                              char *action,
+                              size_t actionlen)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr cgroup_vcpu = NULL;
+    unsigned int pct;
+    unsigned long long period;
+    long long quota;
+    size_t i;
+    int ret = -1;
+
+    if (!conv->quotas) {
+        conv->nquotas = virDomainDefGetVcpusMax(vm->def);
+        if (VIR_ALLOC_N(conv->quotas, conv->nquotas) < 0)
+            return -1;
+    }
+
+    pct = MIN(conv->throttlePct + QEMU_MIGRATION_CONVERGE_THROTTLE_STEP,
+              conv->maxThrottle);
+
+    for (i = 0; i < conv->nquotas; i++) {
+        virDomainVcpuInfoPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+
+        if (!vcpu->online)
+            continue;
+
+        if (virCgroupNewThread(priv->cgroup, VIR_CGROUP_THREAD_VCPU, i,
+                               false, &cgroup_vcpu) < 0 ||
+            virCgroupGetCpuCfsPeriod(cgroup_vcpu, &period) < 0)
+            goto cleanup;
+
+        if (!conv->quotas[i] &&
+            virCgroupGetCpuCfsQuota(cgroup_vcpu, &conv->quotas[i]) < 0)
+            goto cleanup;
+
+        quota = period * (100 - pct) / 100;
+        /* never loosen a limit the domain was configured with */
+        if (conv->quotas[i] > 0 && conv->quotas[i] < quota)
+            quota = conv->quotas[i];
+
+        if (virCgroupSetCpuCfsQuota(cgroup_vcpu, quota) < 0)
+            goto cleanup;
+
+        virCgroupFree(&cgroup_vcpu);
+    }
+
+    snprintf(action, actionlen, "vCPU throttle %u%% -> %u%%",
+             conv->throttlePct, pct);
+    conv->throttlePct = pct;
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup_vcpu);
+    return ret;
+}
+
+
+static int
+qemuMigrationConvergePostCopy(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              qemuDomainAsyncJob asyncJob,
+                              char *action,
+                              size_t actionlen)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int rc;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return -1;
+    rc = qemuMonitorMigrateStartPostCopy(priv->mon);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        return -1;
+
+    snprintf(action, actionlen, "switching to post-copy");
+    return 0;
+}
+
+
+static void
+qemuMigrationConvergeCheck(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           qemuDomainAsyncJob asyncJob,
+                           qemuMigrationConvergePtr conv)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainJobInfo info = *priv->job.current;
+    qemuMonitorMigrationStatsPtr stats = &info.stats;
+    unsigned long long now;
+    unsigned long long pagesize;
+    bool canThrottle;
+    char action[128];
+    int rc = 0;
+
+    if (conv->step == QEMU_MIGRATION_CONVERGE_STEP_LAST)
+        return;
+
+    if (virTimeMillisNow(&now) < 0 || now < conv->next)
+        return;
+    conv->next = now + conv->interval;
+
+    if (qemuMigrationFetchJobStatus(driver, vm, asyncJob, &info) < 0)
+        goto error;
+
+    if (stats->ram_normal)
+        pagesize = stats->ram_normal_bytes / stats->ram_normal;
+    else
+        pagesize = virGetSystemPageSize();
+
+    if (!qemuMigrationConvergeUpdate(conv, stats, pagesize))
+        return;
+
+    canThrottle = virCgroupHasController(priv->cgroup,
+                                         VIR_CGROUP_CONTROLLER_CPU);
+
+    switch ((qemuMigrationConvergeStep)
+            qemuMigrationConvergeNextStep(conv, stats, canThrottle,
+                                          priv->job.postcopyEnabled)) {
+    case QEMU_MIGRATION_CONVERGE_STEP_XBZRLE:
+        rc = qemuMigrationConvergeXBZRLE(driver, vm, asyncJob, stats,
+                                         action, sizeof(action));
+        break;
+    case QEMU_MIGRATION_CONVERGE_STEP_THROTTLE:
+        rc = qemuMigrationConvergeThrottle(vm, conv,
+                                           action, sizeof(action));
+        break;
+    case QEMU_MIGRATION_CONVERGE_STEP_POSTCOPY:
+        rc = qemuMigrationConvergePostCopy(driver, vm, asyncJob,
+                                           action, sizeof(action));
+        break;
+    case QEMU_MIGRATION_CONVERGE_STEP_LAST:
+        break;
+    }
+
+    if (rc < 0)
+        goto error;
+
+    if (conv->step == QEMU_MIGRATION_CONVERGE_STEP_LAST)
+        qemuMigrationConvergeTrace(driver, vm, conv, stats,
+                                   "no further steps allowed by policy");
+    else
+        qemuMigrationConvergeTrace(driver, vm, conv, stats, action);
+
+    qemuMigrationConvergeDecided(conv, stats);
+    return;
+
+ error:
+    /* Failing to help must not fail the migration itself */
+    VIR_WARN("Convergence step '%s' failed for domain %s: %s",
+             NULLSTR(qemuMigrationConvergeStepTypeToString(conv->step)),
+             vm->def->name, virGetLastErrorMessage());
+    virResetLastError();
+    if (conv->step < QEMU_MIGRATION_CONVERGE_STEP_LAST)
+        conv->step++;
+}
+
+
+/* Undoes vCPU throttling and releases the controller's resources */
+static void
+qemuMigrationConvergeFinish(virDomainObjPtr vm,
+                            qemuMigrationConvergePtr conv)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr cgroup_vcpu = NULL;
+    size_t i;
+
+    for (i = 0; i < conv->nquotas && virDomainObjIsActive(vm); i++) {
+        if (!conv->quotas[i])
+            continue;
+
+        if (virCgroupNewThread(priv->cgroup, VIR_CGROUP_THREAD_VCPU, i,
+                               false, &cgroup_vcpu) < 0 ||
+            virCgroupSetCpuCfsQuota(cgroup_vcpu, conv->quotas[i]) < 0) {
+            VIR_WARN("Unable to restore CPU quota of vCPU %zu of domain %s",
+                     i, vm->def->name);
+            virResetLastError();
+        }
+        virCgroupFree(&cgroup_vcpu);
+    }
+
+    VIR_FREE(conv->quotas);
+    conv->nquotas = 0;
+    qemuDomainLogContextFree(conv->logCtxt);
+    conv->logCtxt = NULL;
+}
+
+
 /* Returns 0 on success, -2 when migration needs to be cancelled, or -1 when
- * QEMU reports failed migration.
+ * QEMU reports failed migration. When @converge is non-NULL the
+ * convergence controller is run while waiting.
  */
 static int
 qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
                                virDomainObjPtr vm,
                                qemuDomainAsyncJob asyncJob,
                                virConnectPtr dconn,
-                               unsigned int flags)
+                               unsigned int flags,
+                               qemuMigrationConvergePtr converge)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr jobInfo = priv->job.current;
@@ -2754,7 +3155,19 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
         if (rv < 0)
             return rv;
 
-        if (events) {
+        if (events && converge) {
+            /* Wake up in time for the next convergence sample */
+            if (virDomainObjWaitUntil(vm, converge->next) < 0) {
+                jobInfo->type = VIR_DOMAIN_JOB_FAILED;
+                return -2;
+            }
+            if (!virDomainObjIsActive(vm)) {
+                virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                               _("domain is not running"));
+                jobInfo->type = VIR_DOMAIN_JOB_FAILED;
+                return -2;
+            }
+        } else if (events) {
             if (virDomainObjWait(vm) < 0) {
                 jobInfo->type = VIR_DOMAIN_JOB_FAILED;
                 return -2;
@@ -2767,6 +3180,9 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
             nanosleep(&ts, NULL);
             virObjectLock(vm);
         }
+
+        if (converge)
+            qemuMigrationConvergeCheck(driver, vm, asyncJob, converge);
     }
 
     qemuDomainJobInfoUpdateDowntime(jobInfo);
@@ -3447,6 +3863,36 @@ qemuMigrationSetCompression(virQEMUDriverPtr driver,
     return ret;
 }
 
+
+static int
+qemuMigrationSetParallel(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         qemuDomainAsyncJob job,
+                         bool state,
+                         int connections)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int ret = -1;
+
+    if (qemuMigrationSetOption(driver, vm,
+                               QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
+                               state, job) < 0)
+        return -1;
+
+    if (!state || !connections)
+        return 0;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, job) < 0)
+        return -1;
+
+    ret = qemuMonitorSetMigrationParallelConnections(priv->mon, connections);
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        ret = -1;
+
+    return ret;
+}
+
 static int
 qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                         virConnectPtr dconn,
@@ -3464,6 +3910,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                         size_t nmigrate_disks,
                         const char **migrate_disks,
                         int nbdPort,
+                        int parallelConnections,
                         qemuMigrationCompressionPtr compression,
                         unsigned long flags)
 {
@@ -3666,6 +4113,11 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                                     compression) < 0)
         goto stopjob;
 
+    if (qemuMigrationSetParallel(driver, vm, QEMU_ASYNC_JOB_MIGRATION_IN,
+                                 flags & VIR_MIGRATE_PARALLEL,
+                                 parallelConnections) < 0)
+        goto stopjob;
+
     if (STREQ_NULLABLE(protocol, "rdma") &&
         virProcessSetMaxMemLock(vm->pid, vm->def->mem.hard_limit << 10) < 0) {
         goto stopjob;
@@ -3802,6 +4254,7 @@ qemuMigrationPrepareTunnel(virQEMUDriverPtr driver,
                            unsigned long flags)
 {
     qemuMigrationCompressionPtr compression = NULL;
+    int parallelConnections;
     int ret;
 
     VIR_DEBUG("driver=%p, dconn=%p, cookiein=%s, cookieinlen=%d, "
@@ -3816,13 +4269,14 @@ qemuMigrationPrepareTunnel(virQEMUDriverPtr driver,
         return -1;
     }
 
-    if (!(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
+    if (qemuMigrationParallelParse(NULL, 0, flags, &parallelConnections) < 0 ||
+        !(compression = qemuMigrationCompressionParse(NULL, 0, flags)))
         return -1;
 
     ret = qemuMigrationPrepareAny(driver, dconn, cookiein, cookieinlen,
                                   cookieout, cookieoutlen, def, origname,
                                   st, NULL, 0, false, NULL, 0, NULL, 0,
-                                  compression, flags);
+                                  parallelConnections, compression, flags);
     VIR_FREE(compression);
     return ret;
 }
@@ -3866,6 +4320,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                            size_t nmigrate_disks,
                            const char **migrate_disks,
                            int nbdPort,
+                           int parallelConnections,
                            qemuMigrationCompressionPtr compression,
                            unsigned long flags)
 {
@@ -3990,7 +4445,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                                   NULL, uri ? uri->scheme : "tcp",
                                   port, autoPort, listenAddress,
                                   nmigrate_disks, migrate_disks, nbdPort,
-                                  compression, flags);
+                                  parallelConnections, compression, flags);
  cleanup:
     virURIFree(uri);
     VIR_FREE(hostname);
@@ -4500,6 +4955,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                  const char *graphicsuri,
                  size_t nmigrate_disks,
                  const char **migrate_disks,
+                 int parallelConnections,
                  qemuMigrationCompressionPtr compression)
 {
     int ret = -1;
@@ -4516,6 +4972,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     bool inPostCopy = false;
     unsigned int waitFlags;
     virDomainDefPtr persistDef = NULL;
+    virQEMUDriverConfigPtr cfg = NULL;
+    qemuMigrationConverge converge;
+    qemuMigrationConvergePtr conv = NULL;
     int rc;
 
     VIR_DEBUG("driver=%p, vm=%p, cookiein=%s, cookieinlen=%d, "
@@ -4600,6 +5059,11 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                                     compression) < 0)
         goto cleanup;
 
+    if (qemuMigrationSetParallel(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT,
+                                 flags & VIR_MIGRATE_PARALLEL,
+                                 parallelConnections) < 0)
+        goto cleanup;
+
     if (qemuMigrationSetOption(driver, vm,
                                QEMU_MONITOR_MIGRATION_CAPS_AUTO_CONVERGE,
                                flags & VIR_MIGRATE_AUTO_CONVERGE,
@@ -4718,9 +5182,16 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     if (flags & VIR_MIGRATE_POSTCOPY)
         waitFlags |= QEMU_MIGRATION_COMPLETED_POSTCOPY;
 
+    cfg = virQEMUDriverGetConfig(driver);
+    if (cfg->migrationConvergePolicy != QEMU_MIGRATION_CONVERGE_NONE &&
+        flags & VIR_MIGRATE_LIVE) {
+        conv = &converge;
+        qemuMigrationConvergeInit(conv, cfg, compression, flags);
+    }
+
     rc = qemuMigrationWaitForCompletion(driver, vm,
                                         QEMU_ASYNC_JOB_MIGRATION_OUT,
-                                        dconn, waitFlags);
+                                        dconn, waitFlags, conv);
     if (rc == -2)
         goto cancel;
     else if (rc == -1)
@@ -4768,6 +5239,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     }
     VIR_FORCE_CLOSE(fd);
 
+    if (conv)
+        qemuMigrationConvergeFinish(vm, conv);
+
     if (priv->job.completed) {
         qemuDomainJobInfoUpdateTime(priv->job.completed);
         qemuDomainJobInfoUpdateDowntime(priv->job.completed);
@@ -4794,6 +5268,8 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     if (events)
         priv->signalIOError = false;
 
+    virObjectUnref(cfg);
+
     if (orig_err) {
         virSetError(orig_err);
         virFreeError(orig_err);
@@ -4842,6 +5318,7 @@ static int doNativeMigrate(virQEMUDriverPtr driver,
                            const char *graphicsuri,
                            size_t nmigrate_disks,
                            const char **migrate_disks,
+                           int parallelConnections,
                            qemuMigrationCompressionPtr compression)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
@@ -4881,7 +5358,9 @@ static int doNativeMigrate(virQEMUDriverPtr driver,
         }
     }
 
-    if (STRNEQ(uribits->scheme, "rdma"))
+    /* QEMU has to open the parallel connections itself, a single socket
+     * connected by libvirt would not do */
+    if (STRNEQ(uribits->scheme, "rdma") && !(flags & VIR_MIGRATE_PARALLEL))
         spec.destType = MIGRATION_DEST_CONNECT_HOST;
     else
         spec.destType = MIGRATION_DEST_HOST;
@@ -4893,7 +5372,7 @@ static int doNativeMigrate(virQEMUDriverPtr driver,
     ret = qemuMigrationRun(driver, vm, persist_xml, cookiein, cookieinlen, cookieout,
                            cookieoutlen, flags, resource, &spec, dconn,
                            graphicsuri, nmigrate_disks, migrate_disks,
-                           compression);
+                           parallelConnections, compression);
 
     if (spec.destType == MIGRATION_DEST_FD)
         VIR_FORCE_CLOSE(spec.dest.fd.qemu);
@@ -4957,7 +5436,7 @@ static int doTunnelMigrate(virQEMUDriverPtr driver,
     ret = qemuMigrationRun(driver, vm, persist_xml, cookiein, cookieinlen,
                            cookieout, cookieoutlen, flags, resource, &spec,
                            dconn, graphicsuri, nmigrate_disks, migrate_disks,
-                           compression);
+                           0, compression);
 
  cleanup:
     if (spec.destType == MIGRATION_DEST_FD) {
@@ -5077,7 +5556,8 @@ static int doPeer2PeerMigrate2(virQEMUDriverPtr driver,
         ret = doNativeMigrate(driver, vm, NULL, uri_out,
                               cookie, cookielen,
                               NULL, NULL, /* No out cookie with v2 migration */
-                              flags, resource, dconn, NULL, 0, NULL, compression);
+                              flags, resource, dconn, NULL, 0, NULL, 0,
+                              compression);
 
     /* Perform failed. Make sure Finish doesn't overwrite the error */
     if (ret < 0)
@@ -5144,6 +5624,7 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
                     size_t nmigrate_disks,
                     const char **migrate_disks,
                     int nbdPort,
+                    int parallelConnections,
                     qemuMigrationCompressionPtr compression,
                     unsigned long long bandwidth,
                     bool useParams,
@@ -5227,6 +5708,11 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
                                  VIR_MIGRATE_PARAM_DISKS_PORT,
                                  nbdPort) < 0)
             goto cleanup;
+        if (parallelConnections &&
+            virTypedParamsAddInt(&params, &nparams, &maxparams,
+                                 VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                                 parallelConnections) < 0)
+            goto cleanup;
 
         if (qemuMigrationCompressionDump(compression, &params, &nparams,
                                          &maxparams, &flags) < 0)
@@ -5322,7 +5808,8 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
                               cookiein, cookieinlen,
                               &cookieout, &cookieoutlen,
                               flags, bandwidth, dconn, graphicsuri,
-                              nmigrate_disks, migrate_disks, compression);
+                              nmigrate_disks, migrate_disks,
+                              parallelConnections, compression);
     }
 
     /* Perform failed. Make sure Finish doesn't overwrite the error */
@@ -5499,6 +5986,7 @@ static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
                               size_t nmigrate_disks,
                               const char **migrate_disks,
                               int nbdPort,
+                              int parallelConnections,
                               qemuMigrationCompressionPtr compression,
                               unsigned long flags,
                               const char *dname,
@@ -5623,8 +6111,8 @@ static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
         ret = doPeer2PeerMigrate3(driver, sconn, dconn, dconnuri, vm, xmlin,
                                   persist_xml, dname, uri, graphicsuri,
                                   listenAddress, nmigrate_disks, migrate_disks,
-                                  nbdPort, compression, resource, useParams,
-                                  flags);
+                                  nbdPort, parallelConnections, compression,
+                                  resource, useParams, flags);
     } else {
         ret = doPeer2PeerMigrate2(driver, sconn, dconn, vm,
                                   dconnuri, flags, dname, resource);
@@ -5663,6 +6151,7 @@ qemuMigrationPerformJob(virQEMUDriverPtr driver,
                         size_t nmigrate_disks,
                         const char **migrate_disks,
                         int nbdPort,
+                        int parallelConnections,
                         qemuMigrationCompressionPtr compression,
                         const char *cookiein,
                         int cookieinlen,
@@ -5700,13 +6189,14 @@ qemuMigrationPerformJob(virQEMUDriverPtr driver,
         ret = doPeer2PeerMigrate(driver, conn, vm, xmlin, persist_xml,
                                  dconnuri, uri, graphicsuri, listenAddress,
                                  nmigrate_disks, migrate_disks, nbdPort,
-                                 compression, flags, dname, resource, &v3proto);
+                                 parallelConnections, compression, flags,
+                                 dname, resource, &v3proto);
     } else {
         qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PERFORM2);
         ret = doNativeMigrate(driver, vm, persist_xml, uri, cookiein, cookieinlen,
                               cookieout, cookieoutlen,
                               flags, resource, NULL, NULL, 0, NULL,
-                              compression);
+                              parallelConnections, compression);
     }
     if (ret < 0)
         goto endjob;
@@ -5768,6 +6258,7 @@ qemuMigrationPerformPhase(virQEMUDriverPtr driver,
                           const char *graphicsuri,
                           size_t nmigrate_disks,
                           const char **migrate_disks,
+                          int parallelConnections,
                           qemuMigrationCompressionPtr compression,
                           const char *cookiein,
                           int cookieinlen,
@@ -5794,7 +6285,8 @@ qemuMigrationPerformPhase(virQEMUDriverPtr driver,
     ret = doNativeMigrate(driver, vm, persist_xml, uri, cookiein, cookieinlen,
                           cookieout, cookieoutlen,
                           flags, resource, NULL, graphicsuri,
-                          nmigrate_disks, migrate_disks, compression);
+                          nmigrate_disks, migrate_disks,
+                          parallelConnections, compression);
 
     if (ret < 0) {
         if (qemuMigrationRestoreDomainState(conn, vm)) {
@@ -5838,6 +6330,7 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
                      size_t nmigrate_disks,
                      const char **migrate_disks,
                      int nbdPort,
+                     int parallelConnections,
                      qemuMigrationCompressionPtr compression,
                      const char *cookiein,
                      int cookieinlen,
@@ -5869,7 +6362,8 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
         return qemuMigrationPerformJob(driver, conn, vm, xmlin, persist_xml, dconnuri, uri,
                                        graphicsuri, listenAddress,
                                        nmigrate_disks, migrate_disks, nbdPort,
-                                       compression, cookiein, cookieinlen,
+                                       parallelConnections, compression,
+                                       cookiein, cookieinlen,
                                        cookieout, cookieoutlen,
                                        flags, dname, resource, v3proto);
     } else {
@@ -5883,14 +6377,16 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
             return qemuMigrationPerformPhase(driver, conn, vm, persist_xml, uri,
                                              graphicsuri,
                                              nmigrate_disks, migrate_disks,
-                                             compression, cookiein, cookieinlen,
+                                             parallelConnections, compression,
+                                             cookiein, cookieinlen,
                                              cookieout, cookieoutlen,
                                              flags, resource);
         } else {
             return qemuMigrationPerformJob(driver, conn, vm, xmlin, persist_xml, NULL,
                                            uri, graphicsuri, listenAddress,
                                            nmigrate_disks, migrate_disks, nbdPort,
-                                           compression, cookiein, cookieinlen,
+                                           parallelConnections, compression,
+                                           cookiein, cookieinlen,
                                            cookieout, cookieoutlen, flags,
                                            dname, resource, v3proto);
         }
@@ -6380,7 +6876,7 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (rc < 0)
         goto cleanup;
 
-    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL, 0);
+    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL, 0, NULL);
 
     if (rc < 0) {
         if (rc == -2) {
@@ -6730,6 +7226,49 @@ qemuMigrationCompressionParse(virTypedParameterPtr params,
     return NULL;
 }
 
+
+/* don't ever pass NULL params with non zero nparams */
+int
+qemuMigrationParallelParse(virTypedParameterPtr params,
+                           int nparams,
+                           unsigned long flags,
+                           int *connections)
+{
+    int rc = 0;
+
+    *connections = 0;
+
+    if (params &&
+        (rc = virTypedParamsGetInt(params, nparams,
+                                   VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                                   connections)) < 0)
+        return -1;
+
+    if (rc == 1 && !(flags & VIR_MIGRATE_PARALLEL)) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("Turn parallel migration on to tune it"));
+        return -1;
+    }
+
+    if (rc == 1 && *connections < 1) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("The number of parallel connections must be "
+                         "greater than 0"));
+        return -1;
+    }
+
+    /* QEMU opens the extra connections by itself, there is no way to
+     * feed them through the single stream of a tunnelled migration */
+    if ((flags & VIR_MIGRATE_PARALLEL) && (flags & VIR_MIGRATE_TUNNELLED)) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("parallel migration is not supported with "
+                         "tunnelled migration"));
+        return -1;
+    }
+
+    return 0;
+}
+
 int
 qemuMigrationCompressionDump(qemuMigrationCompressionPtr compression,
                              virTypedParameterPtr *params,
@@ -45,7 +45,8 @@ typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
      VIR_MIGRATE_ABORT_ON_ERROR |               \
      VIR_MIGRATE_AUTO_CONVERGE |                \
      VIR_MIGRATE_RDMA_PIN_ALL |                 \
-     VIR_MIGRATE_POSTCOPY)
+     VIR_MIGRATE_POSTCOPY |                     \
+     VIR_MIGRATE_PARALLEL)
 
 /* All supported migration parameters and their types. */
 # define QEMU_MIGRATION_PARAMETERS                                \
@@ -65,6 +66,7 @@ typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
     VIR_MIGRATE_PARAM_COMPRESSION_MT_DTHREADS,      VIR_TYPED_PARAM_INT,    \
     VIR_MIGRATE_PARAM_COMPRESSION_XBZRLE_CACHE,     VIR_TYPED_PARAM_ULLONG, \
     VIR_MIGRATE_PARAM_PERSIST_XML,      VIR_TYPED_PARAM_STRING,   \
+    VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,         VIR_TYPED_PARAM_INT,    \
     NULL
 
 
@@ -105,6 +107,10 @@ qemuMigrationCompressionPtr
 qemuMigrationCompressionParse(virTypedParameterPtr params,
                               int nparams,
                               unsigned long flags);
+int qemuMigrationParallelParse(virTypedParameterPtr params,
+                               int nparams,
+                               unsigned long flags,
+                               int *connections);
 int qemuMigrationCompressionDump(qemuMigrationCompressionPtr compression,
                                  virTypedParameterPtr *params,
                                  int *nparams,
@@ -174,6 +180,7 @@ int qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                                size_t nmigrate_disks,
                                const char **migrate_disks,
                                int nbdPort,
+                               int parallelConnections,
                                qemuMigrationCompressionPtr compression,
                                unsigned long flags);
 
@@ -189,6 +196,7 @@ int qemuMigrationPerform(virQEMUDriverPtr driver,
                          size_t nmigrate_disks,
                          const char **migrate_disks,
                          int nbdPort,
+                         int parallelConnections,
                          qemuMigrationCompressionPtr compression,
                          const char *cookiein,
                          int cookieinlen,
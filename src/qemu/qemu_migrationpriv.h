@@ -0,0 +1,84 @@
+/*
+ * qemu_migrationpriv.h: private declarations for QEMU migration handling
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __QEMU_MIGRATIONPRIV_H__
+# define __QEMU_MIGRATIONPRIV_H__
+
+# include "qemu_conf.h"
+# include "qemu_domain.h"
+# include "qemu_migration.h"
+# include "qemu_monitor.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+typedef enum {
+    QEMU_MIGRATION_CONVERGE_STEP_XBZRLE,
+    QEMU_MIGRATION_CONVERGE_STEP_THROTTLE,
+    QEMU_MIGRATION_CONVERGE_STEP_POSTCOPY,
+
+    QEMU_MIGRATION_CONVERGE_STEP_LAST
+} qemuMigrationConvergeStep;
+
+VIR_ENUM_DECL(qemuMigrationConvergeStep)
+
+typedef struct _qemuMigrationConverge qemuMigrationConverge;
+typedef qemuMigrationConverge *qemuMigrationConvergePtr;
+struct _qemuMigrationConverge {
+    int policy;                     /* qemuMigrationConvergePolicy */
+    unsigned int interval;          /* sampling period in ms */
+    unsigned int maxThrottle;       /* highest vCPU throttle in percent */
+    bool xbzrle;                    /* XBZRLE is enabled for the migration */
+    bool throttle;                  /* vCPUs may be throttled by us */
+
+    int step;                       /* qemuMigrationConvergeStep */
+    unsigned long long next;        /* when to take the next sample */
+    unsigned int stalled;           /* number of stalled samples in a row */
+    unsigned long long remaining;   /* ram_remaining of the last sample */
+    unsigned long long iteration;   /* memory pass of the last decision */
+
+    unsigned int throttlePct;       /* current vCPU throttle in percent */
+    long long *quotas;              /* per-vCPU CFS quota before throttling,
+                                       0 if untouched */
+    size_t nquotas;
+
+    qemuDomainLogContextPtr logCtxt;
+};
+
+void qemuMigrationConvergeInit(qemuMigrationConvergePtr conv,
+                               virQEMUDriverConfigPtr cfg,
+                               qemuMigrationCompressionPtr compression,
+                               unsigned long flags);
+
+bool qemuMigrationConvergeUpdate(qemuMigrationConvergePtr conv,
+                                 qemuMonitorMigrationStatsPtr stats,
+                                 unsigned long long pagesize);
+
+int qemuMigrationConvergeNextStep(qemuMigrationConvergePtr conv,
+                                  qemuMonitorMigrationStatsPtr stats,
+                                  bool canThrottle,
+                                  bool postcopyEnabled);
+
+void qemuMigrationConvergeDecided(qemuMigrationConvergePtr conv,
+                                  qemuMonitorMigrationStatsPtr stats);
+
+#endif /* __QEMU_MIGRATIONPRIV_H__ */
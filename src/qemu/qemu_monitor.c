@@ -94,6 +94,9 @@ struct _qemuMonitor {
     /* If found, path to the virtio memballoon driver */
     char *balloonpath;
     bool ballooninit;
+    /* The balloon path lookup is in progress in another thread sharing
+     * a query job, wait on @notify for it to finish */
+    bool balloonlookup;
 
     /* Log file context of the qemu process to dig for usable info */
     qemuMonitorReportDomainLogError logFunc;
@@ -169,7 +172,7 @@ VIR_ENUM_IMPL(qemuMonitorMigrationStatus,
 VIR_ENUM_IMPL(qemuMonitorMigrationCaps,
               QEMU_MONITOR_MIGRATION_CAPS_LAST,
               "xbzrle", "auto-converge", "rdma-pin-all", "events",
-              "postcopy-ram", "compress")
+              "postcopy-ram", "compress", "multifd")
 
 VIR_ENUM_IMPL(qemuMonitorVMStatus,
               QEMU_MONITOR_VM_STATUS_LAST,
@@ -743,7 +746,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
          * then wakeup that waiter */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -757,7 +760,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering EOF callback");
         (eofNotify)(mon, vm, mon->callbackOpaque);
@@ -767,7 +770,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering error callback");
         (errorNotify)(mon, vm, mon->callbackOpaque);
@@ -961,7 +964,7 @@ qemuMonitorClose(qemuMonitorPtr mon)
             }
         }
         mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
     }
 
     /* Propagate existing monitor error in case the current thread has no
@@ -991,6 +994,16 @@ qemuMonitorSend(qemuMonitorPtr mon,
 {
     int ret = -1;
 
+    /* Another thread sharing a query job with us may be waiting for
+     * a reply to its own command; only one command can be in flight. */
+    while (mon->msg) {
+        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return -1;
+        }
+    }
+
     /* Check whether qemu quit unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
         VIR_DEBUG("Attempt to send command while error is set %s",
@@ -1026,6 +1039,7 @@ qemuMonitorSend(qemuMonitorPtr mon,
  cleanup:
     mon->msg = NULL;
     qemuMonitorUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
@@ -1076,6 +1090,16 @@ qemuMonitorInitBalloonObjectPath(qemuMonitorPtr mon)
     char *path = NULL;
     qemuMonitorJSONListPathPtr *bprops = NULL;
 
+    /* The commands below drop the monitor lock while waiting for their
+     * replies, so another thread may get here before they are done */
+    while (mon->balloonlookup) {
+        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return;
+        }
+    }
+
     if (mon->balloonpath) {
         return;
     } else if (mon->ballooninit) {
@@ -1083,15 +1107,15 @@ qemuMonitorInitBalloonObjectPath(qemuMonitorPtr mon)
                        _("Cannot determine balloon device path"));
         return;
     }
-    mon->ballooninit = true;
+    mon->balloonlookup = true;
 
     flp_ret = qemuMonitorJSONFindLinkPath(mon, "virtio-balloon-pci", &path);
     if (flp_ret == -2) {
         /* pci object was not found retry search for ccw object */
         if (qemuMonitorJSONFindLinkPath(mon, "virtio-balloon-ccw", &path) < 0)
-            return;
+            goto cleanup;
     } else if (flp_ret < 0) {
-        return;
+        goto cleanup;
     }
 
     nprops = qemuMonitorJSONGetObjectListPaths(mon, path, &bprops);
@@ -1118,6 +1142,9 @@ qemuMonitorInitBalloonObjectPath(qemuMonitorPtr mon)
         qemuMonitorJSONListPathFree(bprops[i]);
     VIR_FREE(bprops);
     VIR_FREE(path);
+    mon->ballooninit = true;
+    mon->balloonlookup = false;
+    virCondBroadcast(&mon->notify);
     return;
 }
 
@@ -1877,6 +1904,42 @@ qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetAllBlockStats:
+ * @mon: monitor object
+ * @ret_stats: pointer that is filled with a hash table containing the stats
+ * @backingChain: recurse into the backing chain of devices
+ * @needCapacity: fail if the sizes of the images can't be fetched
+ *
+ * Same as qemuMonitorGetAllBlockStatsInfo followed by
+ * qemuMonitorBlockStatsUpdateCapacity, but both replies are fetched in
+ * one go and parsed into a single table. With the text monitor only the
+ * I/O statistics are filled in and the sizes are left zeroed. Unless
+ * @needCapacity is set, the sizes are also left zeroed if they can't be
+ * fetched.
+ *
+ * Returns < 0 on error, count of supported block stats fields on success.
+ */
+int
+qemuMonitorGetAllBlockStats(qemuMonitorPtr mon,
+                            virHashTablePtr *ret_stats,
+                            bool backingChain,
+                            bool needCapacity)
+{
+    VIR_DEBUG("ret_stats=%p, backing=%d, needCapacity=%d",
+              ret_stats, backingChain, needCapacity);
+
+    QEMU_CHECK_MONITOR(mon);
+
+    if (!mon->json)
+        return qemuMonitorGetAllBlockStatsInfo(mon, ret_stats, backingChain);
+
+    *ret_stats = NULL;
+    return qemuMonitorJSONGetAllBlockStats(mon, ret_stats, backingChain,
+                                           needCapacity);
+}
+
+
 /* Updates "stats" to fill virtual and physical size of the image */
 int
 qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
@@ -2182,6 +2245,18 @@ qemuMonitorSetMigrationCompression(qemuMonitorPtr mon,
 }
 
 
+int
+qemuMonitorSetMigrationParallelConnections(qemuMonitorPtr mon,
+                                           int connections)
+{
+    VIR_DEBUG("connections=%d", connections);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONSetMigrationParallelConnections(mon, connections);
+}
+
+
 int
 qemuMonitorGetMigrationStats(qemuMonitorPtr mon,
                              qemuMonitorMigrationStatsPtr stats)
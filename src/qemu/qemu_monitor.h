@@ -430,6 +430,12 @@ int qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon,
                                     bool backingChain)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
+int qemuMonitorGetAllBlockStats(qemuMonitorPtr mon,
+                                virHashTablePtr *ret_stats,
+                                bool backingChain,
+                                bool needCapacity)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 int qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                         virHashTablePtr stats,
                                         bool backingChain)
@@ -502,6 +508,9 @@ int qemuMonitorGetMigrationCompression(qemuMonitorPtr mon,
 int qemuMonitorSetMigrationCompression(qemuMonitorPtr mon,
                                        qemuMonitorMigrationCompressionPtr compress);
 
+int qemuMonitorSetMigrationParallelConnections(qemuMonitorPtr mon,
+                                               int connections);
+
 typedef enum {
     QEMU_MONITOR_MIGRATION_STATUS_INACTIVE,
     QEMU_MONITOR_MIGRATION_STATUS_SETUP,
@@ -567,6 +576,7 @@ typedef enum {
     QEMU_MONITOR_MIGRATION_CAPS_EVENTS,
     QEMU_MONITOR_MIGRATION_CAPS_POSTCOPY,
     QEMU_MONITOR_MIGRATION_CAPS_COMPRESS,
+    QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
 
     QEMU_MONITOR_MIGRATION_CAPS_LAST
 } qemuMonitorMigrationCaps;
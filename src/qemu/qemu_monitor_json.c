@@ -1928,33 +1928,14 @@ qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr dev,
 }
 
 
-int
-qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
-                                    virHashTablePtr hash,
-                                    bool backingChain)
+static int
+qemuMonitorJSONParseBlockStats(virJSONValuePtr devices,
+                               virHashTablePtr hash,
+                               bool backingChain)
 {
-    int ret = -1;
     int nstats = 0;
     int rc;
     size_t i;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
-    virJSONValuePtr devices;
-
-    if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
-        return -1;
-
-    if ((rc = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
-        goto cleanup;
-
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
-
-    if (!(devices = virJSONValueObjectGetArray(reply, "return"))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("blockstats reply was missing device list"));
-        goto cleanup;
-    }
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
         virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
@@ -1964,30 +1945,100 @@ qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         if (!(dev_name = virJSONValueObjectGetString(dev, "device"))) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         rc = qemuMonitorJSONGetOneBlockStatsInfo(dev, dev_name, 0, hash,
                                                  backingChain);
 
         if (rc < 0)
-            goto cleanup;
+            return -1;
 
         if (rc > nstats)
             nstats = rc;
     }
 
-    ret = nstats;
+    return nstats;
+}
+
+
+/* Counts the entries that parsing @devices from query-blockstats will
+ * produce, so that the hash table can be sized upfront. */
+static size_t
+qemuMonitorJSONCountBlockStats(virJSONValuePtr devices,
+                               bool backingChain)
+{
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < virJSONValueArraySize(devices); i++) {
+        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
+
+        while (dev) {
+            count++;
+            if (!backingChain)
+                break;
+            dev = virJSONValueObjectGetObject(dev, "backing");
+        }
+    }
+
+    return count;
+}
+
+
+static virJSONValuePtr
+qemuMonitorJSONQueryBlockDevices(qemuMonitorPtr mon,
+                                 const char *cmdname,
+                                 virJSONValuePtr *reply)
+{
+    virJSONValuePtr cmd;
+    virJSONValuePtr devices = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand(cmdname, NULL)))
+        return NULL;
+
+    if (qemuMonitorJSONCommand(mon, cmd, reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, *reply) < 0)
+        goto cleanup;
+
+    if (!(devices = virJSONValueObjectGetArray(*reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s reply was missing device list"), cmdname);
+        goto cleanup;
+    }
 
  cleanup:
     virJSONValueFree(cmd);
+    return devices;
+}
+
+
+int
+qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                    virHashTablePtr hash,
+                                    bool backingChain)
+{
+    int ret;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr devices;
+
+    if (!(devices = qemuMonitorJSONQueryBlockDevices(mon, "query-blockstats",
+                                                     &reply))) {
+        virJSONValueFree(reply);
+        return -1;
+    }
+
+    ret = qemuMonitorJSONParseBlockStats(devices, hash, backingChain);
+
     virJSONValueFree(reply);
     return ret;
 }
@@ -2042,32 +2093,12 @@ qemuMonitorJSONBlockStatsUpdateCapacityOne(virJSONValuePtr image,
 }
 
 
-int
-qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
-                                        virHashTablePtr stats,
-                                        bool backingChain)
+static int
+qemuMonitorJSONParseBlockCapacity(virJSONValuePtr devices,
+                                  virHashTablePtr stats,
+                                  bool backingChain)
 {
-    int ret = -1;
-    int rc;
     size_t i;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
-    virJSONValuePtr devices;
-
-    if (!(cmd = qemuMonitorJSONMakeCommand("query-block", NULL)))
-        return -1;
-
-    if ((rc = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
-        goto cleanup;
-
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
-
-    if (!(devices = virJSONValueObjectGetArray(reply, "return"))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("query-block reply was missing device list"));
-        goto cleanup;
-    }
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
         virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
@@ -2079,14 +2110,14 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("query-block device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         if (!(dev_name = virJSONValueObjectGetString(dev, "device"))) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("query-block device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         /* drive may be empty */
@@ -2097,14 +2128,98 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
         if (qemuMonitorJSONBlockStatsUpdateCapacityOne(image, dev_name, 0,
                                                        stats,
                                                        backingChain) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int
+qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr stats,
+                                        bool backingChain)
+{
+    int ret;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr devices;
+
+    if (!(devices = qemuMonitorJSONQueryBlockDevices(mon, "query-block",
+                                                     &reply))) {
+        virJSONValueFree(reply);
+        return -1;
+    }
+
+    ret = qemuMonitorJSONParseBlockCapacity(devices, stats, backingChain);
+
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+/**
+ * qemuMonitorJSONGetAllBlockStats:
+ * @mon: monitor object
+ * @ret_stats: filled with a hash table containing the stats
+ * @backingChain: recurse into the backing chain of devices
+ * @needCapacity: fail if query-block fails
+ *
+ * Issues query-blockstats and query-block back to back and parses both
+ * replies exactly once into a single table that is sized from the
+ * number of entries in the blockstats reply, so that it never has to
+ * grow while being filled. Unless @needCapacity is set, a failure of
+ * query-block only leaves the sizes out of the table.
+ *
+ * Returns < 0 on error, count of supported block stats fields on success.
+ */
+int
+qemuMonitorJSONGetAllBlockStats(qemuMonitorPtr mon,
+                                virHashTablePtr *ret_stats,
+                                bool backingChain,
+                                bool needCapacity)
+{
+    int ret = -1;
+    int nstats;
+    size_t count;
+    virJSONValuePtr statsReply = NULL;
+    virJSONValuePtr blockReply = NULL;
+    virJSONValuePtr statsDevices;
+    virJSONValuePtr blockDevices;
+    virHashTablePtr stats = NULL;
+
+    if (!(statsDevices = qemuMonitorJSONQueryBlockDevices(mon,
+                                                          "query-blockstats",
+                                                          &statsReply)))
+        goto cleanup;
+
+    count = qemuMonitorJSONCountBlockStats(statsDevices, backingChain);
+    if (!(stats = virHashCreate(MAX(count, 1), virHashValueFree)))
+        goto cleanup;
+
+    if ((nstats = qemuMonitorJSONParseBlockStats(statsDevices, stats,
+                                                 backingChain)) < 0)
+        goto cleanup;
+
+    if (!(blockDevices = qemuMonitorJSONQueryBlockDevices(mon, "query-block",
+                                                          &blockReply)) ||
+        qemuMonitorJSONParseBlockCapacity(blockDevices, stats,
+                                          backingChain) < 0) {
+        if (needCapacity)
             goto cleanup;
+
+        VIR_DEBUG("Ignoring failure to query image sizes: %s",
+                  virGetLastErrorMessage());
+        virResetLastError();
     }
 
-    ret = 0;
+    *ret_stats = stats;
+    stats = NULL;
+    ret = nstats;
 
  cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
+    virHashFree(stats);
+    virJSONValueFree(statsReply);
+    virJSONValueFree(blockReply);
     return ret;
 }
 
@@ -2646,6 +2761,33 @@ qemuMonitorJSONSetMigrationCompression(qemuMonitorPtr mon,
 }
 
 
+int
+qemuMonitorJSONSetMigrationParallelConnections(qemuMonitorPtr mon,
+                                               int connections)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("migrate-set-parameters",
+                                           "i:multifd-channels", connections,
+                                           NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
 static int
 qemuMonitorJSONGetMigrationStatsReply(virJSONValuePtr reply,
                                       qemuMonitorMigrationStatsPtr stats)
@@ -85,6 +85,10 @@ int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                             virHashTablePtr stats,
                                             bool backingChain);
+int qemuMonitorJSONGetAllBlockStats(qemuMonitorPtr mon,
+                                    virHashTablePtr *ret_stats,
+                                    bool backingChain,
+                                    bool needCapacity);
 int qemuMonitorJSONBlockResize(qemuMonitorPtr mon,
                                const char *devce,
                                unsigned long long size);
@@ -135,6 +139,8 @@ int qemuMonitorJSONGetMigrationCompression(qemuMonitorPtr mon,
                                            qemuMonitorMigrationCompressionPtr compress);
 int qemuMonitorJSONSetMigrationCompression(qemuMonitorPtr mon,
                                            qemuMonitorMigrationCompressionPtr compress);
+int qemuMonitorJSONSetMigrationParallelConnections(qemuMonitorPtr mon,
+                                                   int connections);
 
 int qemuMonitorJSONGetMigrationStats(qemuMonitorPtr mon,
                                      qemuMonitorMigrationStatsPtr stats);
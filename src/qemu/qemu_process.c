@@ -1256,6 +1256,7 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     VIR_DEBUG("Updating balloon from %lld to %lld kb",
               vm->def->mem.cur_balloon, actual);
     vm->def->mem.cur_balloon = actual;
+    qemuDomainStatsCacheInvalidate(vm);
 
     if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
         VIR_WARN("unable to save domain status with balloon change");
@@ -3059,6 +3060,7 @@ qemuProcessRecoverJob(virQEMUDriverPtr driver,
      */
     switch (job->active) {
     case QEMU_JOB_QUERY:
+    case QEMU_JOB_QUERY_SHARED:
         /* harmless */
         break;
 
@@ -3324,6 +3326,8 @@ qemuProcessReconnect(void *opaque)
     if (qemuProcessUpdateDevices(driver, obj) < 0)
         goto error;
 
+    qemuDomainUpdateCPULoad(driver, obj);
+
     /* Failure to connect to agent shouldn't be fatal */
     if ((ret = qemuConnectAgent(driver, obj)) < 0) {
         if (ret == -2)
@@ -4680,6 +4684,173 @@ qemuProcessSetupVcpus(virDomainObjPtr vm)
 }
 
 
+static int
+qemuProcessNumaRebalanceThread(virCgroupPtr cgroup,
+                               virCgroupThreadName nameval,
+                               int id,
+                               pid_t pid,
+                               virBitmapPtr cpumask,
+                               const char *mem_mask)
+{
+    virCgroupPtr cgroup_thread = NULL;
+    int ret = -1;
+
+    if (virCgroupHasController(cgroup, VIR_CGROUP_CONTROLLER_CPUSET)) {
+        if (virCgroupNewThread(cgroup, nameval, id, false, &cgroup_thread) < 0)
+            goto cleanup;
+
+        /* memory_migrate is enabled on the domain cgroup, so changing
+         * the nodes moves the memory already allocated too */
+        if (mem_mask && virCgroupSetCpusetMems(cgroup_thread, mem_mask) < 0)
+            goto cleanup;
+
+        if (cpumask && qemuSetupCgroupCpusetCpus(cgroup_thread, cpumask) < 0)
+            goto cleanup;
+    }
+
+    if (cpumask && pid > 0 && virProcessSetAffinity(pid, cpumask) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup_thread);
+    return ret;
+}
+
+
+/**
+ * qemuProcessNumaRebalance:
+ * @driver: qemu driver data
+ * @vm: domain object, locked
+ *
+ * Runs the builtin placement engine again for a running domain which uses
+ * automatic placement. If it picks different host nodes, the threads
+ * following the automatic placement are re-pinned to the CPUs of the new
+ * nodes and, with strict memory mode, the domain's memory is migrated.
+ * Domains busy with another job are skipped until the next pass.
+ *
+ * Returns 0 on success (including when nothing had to be done), -1 on
+ * error.
+ */
+int
+qemuProcessNumaRebalance(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
+    virCapsPtr caps = NULL;
+    virBitmapPtr nodeset = NULL;
+    virBitmapPtr cpuset = NULL;
+    virBitmapPtr cpumask;
+    virDomainNumatuneMemMode mode;
+    char *mem_mask = NULL;
+    bool autoCpus = vm->def->placement_mode == VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO;
+    size_t i;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(vm) || !priv->autoNodeset)
+        return 0;
+
+    /* Only the cgroups of the domain are touched, not its definition nor
+     * the monitor. A query job is enough and doesn't throw away the
+     * cached stats of the domain on every pass. */
+    if (priv->job.asyncJob ||
+        qemuDomainObjBeginJobNowait(driver, vm, QEMU_JOB_QUERY) < 0) {
+        VIR_DEBUG("Domain %s is busy, not rebalancing", vm->def->name);
+        return 0;
+    }
+
+    if (!virDomainObjIsActive(vm)) {
+        ret = 0;
+        goto endjob;
+    }
+
+    cfg = virQEMUDriverGetConfig(driver);
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        goto endjob;
+
+    if (!(nodeset = qemuDomainGetBuiltinPlacement(driver, vm,
+                                                  priv->autoNodeset)))
+        goto endjob;
+
+    if (virBitmapEqual(nodeset, priv->autoNodeset)) {
+        ret = 0;
+        goto endjob;
+    }
+
+    if (!(cpuset = virCapabilitiesGetCpusForNodemask(caps, nodeset)))
+        goto endjob;
+
+    if (virDomainNumatuneGetMode(vm->def->numa, -1, &mode) == 0 &&
+        mode == VIR_DOMAIN_NUMATUNE_MEM_STRICT &&
+        virDomainNumatuneMaybeFormatNodeset(vm->def->numa, nodeset,
+                                            &mem_mask, -1) < 0)
+        goto endjob;
+
+    VIR_DEBUG("Moving domain %s to host nodes %s",
+              vm->def->name, NULLSTR(mem_mask));
+
+    cpumask = autoCpus && !vm->def->cputune.emulatorpin ? cpuset : NULL;
+    if (qemuProcessNumaRebalanceThread(priv->cgroup,
+                                       VIR_CGROUP_THREAD_EMULATOR, 0,
+                                       vm->pid, cpumask, mem_mask) < 0)
+        goto endjob;
+
+    for (i = 0; qemuDomainHasVcpuPids(vm) &&
+                i < virDomainDefGetVcpusMax(vm->def); i++) {
+        virDomainVcpuInfoPtr vcpu = virDomainDefGetVcpu(vm->def, i);
+
+        if (!vcpu->online)
+            continue;
+
+        cpumask = autoCpus && !vcpu->cpumask ? cpuset : NULL;
+        if (qemuProcessNumaRebalanceThread(priv->cgroup,
+                                           VIR_CGROUP_THREAD_VCPU, i,
+                                           qemuDomainGetVcpuPid(vm, i),
+                                           cpumask, mem_mask) < 0)
+            goto endjob;
+    }
+
+    for (i = 0; i < vm->def->niothreadids; i++) {
+        virDomainIOThreadIDDefPtr iothread = vm->def->iothreadids[i];
+
+        cpumask = autoCpus && !iothread->cpumask ? cpuset : NULL;
+        if (qemuProcessNumaRebalanceThread(priv->cgroup,
+                                           VIR_CGROUP_THREAD_IOTHREAD,
+                                           iothread->iothread_id,
+                                           iothread->thread_id,
+                                           cpumask, mem_mask) < 0)
+            goto endjob;
+    }
+
+    virBitmapFree(priv->autoNodeset);
+    priv->autoNodeset = nodeset;
+    nodeset = NULL;
+    virBitmapFree(priv->autoCpuset);
+    priv->autoCpuset = cpuset;
+    cpuset = NULL;
+
+    qemuDomainUpdateCPULoad(driver, vm);
+    qemuDomainStatsCacheInvalidate(vm);
+
+    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, caps) < 0)
+        goto endjob;
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+    VIR_FREE(mem_mask);
+    virBitmapFree(nodeset);
+    virBitmapFree(cpuset);
+    virObjectUnref(caps);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
 /**
  * qemuProcessSetupIOThread:
  * @vm: domain object
@@ -4829,20 +5000,27 @@ qemuProcessPrepareDomain(virConnectPtr conn,
         }
         virDomainAuditSecurityLabel(vm, true);
 
-        /* Get the advisory nodeset from numad if 'placement' of
-         * either <vcpu> or <numatune> is 'auto'.
+        /* Get the advisory nodeset from numad or the builtin placement
+         * engine if 'placement' of either <vcpu> or <numatune> is 'auto'.
          */
         if (virDomainDefNeedsPlacementAdvice(vm->def)) {
-            nodeset = virNumaGetAutoPlacementAdvice(virDomainDefGetVcpus(vm->def),
-                                                    virDomainDefGetMemoryActual(vm->def));
-            if (!nodeset)
-                goto cleanup;
+            if (cfg->numaPlacementBuiltin) {
+                if (!(priv->autoNodeset = qemuDomainGetBuiltinPlacement(driver,
+                                                                        vm,
+                                                                        NULL)))
+                    goto cleanup;
+            } else {
+                nodeset = virNumaGetAutoPlacementAdvice(virDomainDefGetVcpus(vm->def),
+                                                        virDomainDefGetMemoryActual(vm->def));
+                if (!nodeset)
+                    goto cleanup;
 
-            VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
+                VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
 
-            if (virBitmapParse(nodeset, 0, &priv->autoNodeset,
-                               VIR_DOMAIN_CPUMASK_LEN) < 0)
-                goto cleanup;
+                if (virBitmapParse(nodeset, 0, &priv->autoNodeset,
+                                   VIR_DOMAIN_CPUMASK_LEN) < 0)
+                    goto cleanup;
+            }
 
             if (!(priv->autoCpuset = virCapabilitiesGetCpusForNodemask(caps,
                                                                        priv->autoNodeset)))
@@ -5017,6 +5195,67 @@ qemuProcessPrepareHost(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * Startup latency accounting. Each qemuProcessStartTimerMark() call
+ * closes the phase that began at the previous mark; the collected
+ * per-phase durations are logged once startup finishes so that slow
+ * phases can be identified without tracing the whole daemon.
+ */
+typedef struct _qemuProcessStartTimer qemuProcessStartTimer;
+typedef qemuProcessStartTimer *qemuProcessStartTimerPtr;
+struct _qemuProcessStartTimer {
+    unsigned long long start;
+    unsigned long long last;
+    virBuffer phases;
+};
+
+
+static void
+qemuProcessStartTimerInit(qemuProcessStartTimerPtr timer)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    timer->phases = buf;
+    if (virTimeMillisNowRaw(&timer->start) < 0)
+        timer->start = 0;
+    timer->last = timer->start;
+}
+
+
+static void
+qemuProcessStartTimerMark(qemuProcessStartTimerPtr timer,
+                          const char *phase)
+{
+    unsigned long long now;
+
+    if (!timer->start || virTimeMillisNowRaw(&now) < 0)
+        return;
+
+    virBufferAsprintf(&timer->phases, " %s=%llu", phase, now - timer->last);
+    timer->last = now;
+}
+
+
+static void
+qemuProcessStartTimerReport(qemuProcessStartTimerPtr timer,
+                            virDomainObjPtr vm,
+                            const char *what,
+                            int ret)
+{
+    const char *phases = virBufferCurrentContent(&timer->phases);
+    unsigned long long now;
+
+    /* On failure the last phase was never marked, so take the total
+     * from a fresh timestamp rather than from the last mark */
+    if (timer->start && virTimeMillisNowRaw(&now) == 0)
+        VIR_INFO("%s of domain %s %s after %llums, phases [ms]:%s",
+                 what, vm->def->name, ret < 0 ? "failed" : "finished",
+                 now - timer->start, phases ? phases : "");
+
+    virBufferFreeAndReset(&timer->phases);
+}
+
+
 /**
  * qemuProcessLaunch:
  *
@@ -5052,6 +5291,7 @@ qemuProcessLaunch(virConnectPtr conn,
     size_t nnicindexes = 0;
     int *nicindexes = NULL;
     size_t i;
+    qemuProcessStartTimer timer;
 
     VIR_DEBUG("vm=%p name=%s id=%d asyncJob=%d "
               "incoming.launchURI=%s incoming.deferredURI=%s "
@@ -5070,6 +5310,8 @@ qemuProcessLaunch(virConnectPtr conn,
                   VIR_QEMU_PROCESS_START_PAUSED |
                   VIR_QEMU_PROCESS_START_AUTODESTROY, -1);
 
+    qemuProcessStartTimerInit(&timer);
+
     cfg = virQEMUDriverGetConfig(driver);
 
     hookData.conn = conn;
@@ -5102,6 +5344,8 @@ qemuProcessLaunch(virConnectPtr conn,
                                      priv->channelTargetDir)))
         goto cleanup;
 
+    qemuProcessStartTimerMark(&timer, "cmdline");
+
     if (incoming && incoming->fd != -1)
         virCommandPassFD(cmd, incoming->fd, 0);
 
@@ -5148,6 +5392,8 @@ qemuProcessLaunch(virConnectPtr conn,
     rv = virCommandRun(cmd, NULL);
     virSecurityManagerPostFork(driver->securityManager);
 
+    qemuProcessStartTimerMark(&timer, "spawn");
+
     /* wait for qemu process to show up */
     if (rv == 0) {
         if (virPidFileReadPath(priv->pidfile, &vm->pid) < 0) {
@@ -5178,6 +5424,8 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuSetupCgroup(driver, vm, nnicindexes, nicindexes) < 0)
         goto cleanup;
 
+    qemuProcessStartTimerMark(&timer, "cgroup");
+
     if (!(priv->perf = virPerfNew()))
         goto cleanup;
 
@@ -5203,6 +5451,8 @@ qemuProcessLaunch(virConnectPtr conn,
                                       incoming ? incoming->path : NULL) < 0)
         goto cleanup;
 
+    qemuProcessStartTimerMark(&timer, "labelling");
+
     /* Security manager labeled all devices, therefore
      * if any operation from now on fails, we need to ask the caller to
      * restore labels.
@@ -5243,6 +5493,8 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuProcessWaitForMonitor(driver, vm, asyncJob, priv->qemuCaps, logCtxt) < 0)
         goto cleanup;
 
+    qemuProcessStartTimerMark(&timer, "monitor");
+
     /* Failure to connect to agent shouldn't be fatal */
     if ((rv = qemuConnectAgent(driver, vm)) < 0) {
         if (rv == -2)
@@ -5278,10 +5530,14 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuProcessSetupVcpus(vm) < 0)
         goto cleanup;
 
+    qemuDomainUpdateCPULoad(driver, vm);
+
     VIR_DEBUG("Setting IOThread tuning/settings");
     if (qemuProcessSetupIOThreads(vm) < 0)
         goto cleanup;
 
+    qemuProcessStartTimerMark(&timer, "tuning");
+
     VIR_DEBUG("Setting any required VM passwords");
     if (qemuProcessInitPasswords(conn, driver, vm, asyncJob) < 0)
         goto cleanup;
@@ -5324,9 +5580,12 @@ qemuProcessLaunch(virConnectPtr conn,
         qemuProcessAutoDestroyAdd(driver, vm, conn) < 0)
         goto cleanup;
 
+    qemuProcessStartTimerMark(&timer, "devices");
+
     ret = 0;
 
  cleanup:
+    qemuProcessStartTimerReport(&timer, vm, "Launch", ret);
     qemuDomainSecretDestroy(vm);
     virCommandFree(cmd);
     qemuDomainLogContextFree(logCtxt);
@@ -5402,6 +5661,7 @@ qemuProcessStart(virConnectPtr conn,
     bool relabel = false;
     int ret = -1;
     int rv;
+    qemuProcessStartTimer timer;
 
     VIR_DEBUG("conn=%p driver=%p vm=%p name=%s id=%d asyncJob=%s "
               "migrateFrom=%s migrateFd=%d migratePath=%s "
@@ -5411,6 +5671,8 @@ qemuProcessStart(virConnectPtr conn,
               NULLSTR(migrateFrom), migrateFd, NULLSTR(migratePath),
               snapshot, vmop, flags);
 
+    qemuProcessStartTimerInit(&timer);
+
     virCheckFlagsGoto(VIR_QEMU_PROCESS_START_COLD |
                       VIR_QEMU_PROCESS_START_PAUSED |
                       VIR_QEMU_PROCESS_START_AUTODESTROY, cleanup);
@@ -5419,6 +5681,8 @@ qemuProcessStart(virConnectPtr conn,
                         !!snapshot, flags) < 0)
         goto cleanup;
 
+    qemuProcessStartTimerMark(&timer, "init");
+
     if (migrateFrom) {
         incoming = qemuProcessIncomingDefNew(priv->qemuCaps, NULL, migrateFrom,
                                              migrateFd, migratePath);
@@ -5429,9 +5693,13 @@ qemuProcessStart(virConnectPtr conn,
     if (qemuProcessPrepareDomain(conn, driver, vm, flags) < 0)
         goto stop;
 
+    qemuProcessStartTimerMark(&timer, "prepare-domain");
+
     if (qemuProcessPrepareHost(driver, vm, !!incoming) < 0)
         goto stop;
 
+    qemuProcessStartTimerMark(&timer, "prepare-host");
+
     if ((rv = qemuProcessLaunch(conn, driver, vm, asyncJob, incoming,
                                 snapshot, vmop, flags)) < 0) {
         if (rv == -2)
@@ -5440,6 +5708,8 @@ qemuProcessStart(virConnectPtr conn,
     }
     relabel = true;
 
+    qemuProcessStartTimerMark(&timer, "launch");
+
     if (incoming &&
         incoming->deferredURI &&
         qemuMigrationRunIncoming(driver, vm, incoming->deferredURI, asyncJob) < 0)
@@ -5457,9 +5727,12 @@ qemuProcessStart(virConnectPtr conn,
     if (!incoming)
         qemuMonitorSetDomainLog(priv->mon, NULL, NULL, NULL);
 
+    qemuProcessStartTimerMark(&timer, "finish");
+
     ret = 0;
 
  cleanup:
+    qemuProcessStartTimerReport(&timer, vm, "Startup", ret);
     qemuProcessIncomingDefFree(incoming);
     return ret;
 
@@ -5816,6 +6089,9 @@ void qemuProcessStop(virQEMUDriverPtr driver,
 
     virPerfFree(priv->perf);
     priv->perf = NULL;
+    qemuDomainPerfSamplerFree(priv->perfSampler);
+    priv->perfSampler = NULL;
+    qemuDomainRemoveCPULoad(driver, vm);
 
     qemuProcessRemoveDomainStatus(driver, vm);
 
@@ -5866,6 +6142,7 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     VIR_FREE(priv->vcpupids);
     priv->nvcpupids = 0;
+    qemuDomainStatsCacheInvalidate(vm);
     for (i = 0; i < vm->def->niothreadids; i++)
         vm->def->iothreadids[i]->thread_id = 0;
     virObjectUnref(priv->qemuCaps);
@@ -186,6 +186,9 @@ int qemuProcessSetupVcpu(virDomainObjPtr vm,
 int qemuProcessSetupIOThread(virDomainObjPtr vm,
                              virDomainIOThreadIDDefPtr iothread);
 
+int qemuProcessNumaRebalance(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm);
+
 int qemuRefreshVirtioChannelState(virQEMUDriverPtr driver,
                                   virDomainObjPtr vm);
 
@@ -50,6 +50,10 @@
 # include <linux/btrfs.h>
 #endif
 
+#if !HAVE_COPY_FILE_RANGE && HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+
 #include "datatypes.h"
 #include "virerror.h"
 #include "viralloc.h"
@@ -58,12 +62,14 @@
 #include "viruuid.h"
 #include "virstoragefile.h"
 #include "storage_backend.h"
+#include "storage_backendpriv.h"
 #include "virlog.h"
 #include "virfile.h"
 #include "stat-time.h"
 #include "virstring.h"
 #include "virxml.h"
 #include "fdstream.h"
+#include "virthread.h"
 
 #if WITH_STORAGE_LVM
 # include "storage_backend_logical.h"
@@ -155,25 +161,271 @@ static virStorageFileBackendPtr fileBackends[] = {
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
 /*
- * Perform the O(1) btrfs clone operation, if possible.
+ * Perform the O(1) reflink clone operation, if possible. FICLONE is
+ * the generic name of the btrfs ioctl and is also honoured by XFS.
  * Upon success, return 0.  Otherwise, return -1 and set errno.
  */
-#if HAVE_LINUX_BTRFS_H
+#if defined(__linux__) && defined(FICLONE)
+static inline int
+reflinkCloneFile(int dest_fd, int src_fd)
+{
+    return ioctl(dest_fd, FICLONE, src_fd);
+}
+#elif HAVE_LINUX_BTRFS_H
 static inline int
-btrfsCloneFile(int dest_fd, int src_fd)
+reflinkCloneFile(int dest_fd, int src_fd)
 {
     return ioctl(dest_fd, BTRFS_IOC_CLONE, src_fd);
 }
 #else
 static inline int
-btrfsCloneFile(int dest_fd ATTRIBUTE_UNUSED,
-               int src_fd ATTRIBUTE_UNUSED)
+reflinkCloneFile(int dest_fd ATTRIBUTE_UNUSED,
+                 int src_fd ATTRIBUTE_UNUSED)
 {
     errno = ENOTSUP;
     return -1;
 }
 #endif
 
+/*
+ * Copy @len bytes between the given offsets inside the kernel.
+ * Returns the number of bytes copied, or -1 and sets errno.
+ */
+#if HAVE_COPY_FILE_RANGE
+static inline ssize_t
+virStorageBackendCopyFileRange(int src_fd, off_t *src_off,
+                               int dest_fd, off_t *dest_off,
+                               size_t len)
+{
+    return copy_file_range(src_fd, src_off, dest_fd, dest_off, len, 0);
+}
+#elif HAVE_SYS_SYSCALL_H && defined(__NR_copy_file_range)
+static inline ssize_t
+virStorageBackendCopyFileRange(int src_fd, off_t *src_off,
+                               int dest_fd, off_t *dest_off,
+                               size_t len)
+{
+    loff_t src = *src_off;
+    loff_t dest = *dest_off;
+    ssize_t ret;
+
+    ret = syscall(__NR_copy_file_range, src_fd, &src, dest_fd, &dest, len, 0);
+    *src_off = src;
+    *dest_off = dest;
+    return ret;
+}
+#else
+static inline ssize_t
+virStorageBackendCopyFileRange(int src_fd ATTRIBUTE_UNUSED,
+                               off_t *src_off ATTRIBUTE_UNUSED,
+                               int dest_fd ATTRIBUTE_UNUSED,
+                               off_t *dest_off ATTRIBUTE_UNUSED,
+                               size_t len ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+
+/*
+ * Report an error and return true if the job running on @vol was
+ * cancelled through virStorageVolDelete meanwhile.
+ */
+static bool
+virStorageBackendVolCancelled(virStorageVolDefPtr vol)
+{
+    if (!virStorageVolDefJobCancelled(vol))
+        return false;
+
+    virReportError(VIR_ERR_OPERATION_ABORTED,
+                   _("operation on volume '%s' was cancelled"),
+                   vol->name);
+    return true;
+}
+
+
+/*
+ * Copy the data in [@offset, @offset + @len) of @inputfd to the same
+ * place in @fd, inside the kernel if @use_copy_range still says it is
+ * possible, otherwise through @buf. @use_copy_range is cleared once
+ * copy_file_range turns out not to work for this pair of files.
+ */
+int
+virStorageBackendCopyRange(virStorageVolDefPtr vol,
+                           virStorageVolDefPtr inputvol,
+                           int inputfd,
+                           int fd,
+                           off_t offset,
+                           off_t len,
+                           bool *use_copy_range,
+                           char *buf,
+                           size_t buflen)
+{
+    off_t src_off = offset;
+    off_t dest_off = offset;
+    off_t end = offset + len;
+
+    while (src_off < end) {
+        size_t want = MIN(end - src_off, SSIZE_MAX);
+        ssize_t done;
+
+        if (virStorageBackendVolCancelled(vol))
+            return -ECANCELED;
+
+        if (*use_copy_range) {
+            if ((done = virStorageBackendCopyFileRange(inputfd, &src_off,
+                                                       fd, &dest_off,
+                                                       want)) > 0)
+                continue;
+
+            if (done < 0 && errno == EINTR)
+                continue;
+
+            if (done < 0 &&
+                errno != EXDEV && errno != ENOSYS &&
+                errno != EOPNOTSUPP && errno != EINVAL) {
+                virReportSystemError(errno,
+                                     _("failed to copy data from '%s' to '%s'"),
+                                     inputvol->target.path, vol->target.path);
+                return -errno;
+            }
+
+            /* Not supported between these two files, or the source
+             * turned out shorter than expected: do it by hand */
+            *use_copy_range = false;
+            continue;
+        }
+
+        want = MIN(want, buflen);
+        if ((done = pread(inputfd, buf, want, src_off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno,
+                                 _("failed reading from file '%s'"),
+                                 inputvol->target.path);
+            return -errno;
+        }
+
+        /* Source shrank under us; the rest of @fd is already a hole */
+        if (done == 0)
+            break;
+
+        if (lseek(fd, dest_off, SEEK_SET) < 0 ||
+            safewrite(fd, buf, done) < 0) {
+            virReportSystemError(errno,
+                                 _("failed writing to file '%s'"),
+                                 vol->target.path);
+            return -errno;
+        }
+
+        src_off += done;
+        dest_off += done;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Clone a whole regular file into a freshly created regular file
+ * without dragging every byte through userspace: use copy_file_range,
+ * or a chunked copy where it does not work. Unless @want_sparse is
+ * false, only the data extents reported by SEEK_DATA/SEEK_HOLE are
+ * copied and holes are left in place.
+ *
+ * copy_file_range may share extents with the source on file systems
+ * which can clone them, such as XFS, btrfs or NFS 4.2, instead of
+ * writing the data. A volume asked to be fully allocated is therefore
+ * always copied by hand, sharing would drop its preallocation.
+ *
+ * Returns 1 if the data was copied, 0 if the files are not suitable
+ * and the caller should fall back to its own copy loop, or -errno on
+ * failure.
+ */
+static int
+virStorageBackendCopyToFDFast(virStorageVolDefPtr vol,
+                              virStorageVolDefPtr inputvol,
+                              int inputfd,
+                              int fd,
+                              unsigned long long *total,
+                              bool want_sparse)
+{
+    struct stat inputst;
+    struct stat st;
+    bool use_copy_range;
+    char *buf = NULL;
+    off_t offset = 0;
+    int ret = -1;
+
+    /* Same test as the sparse copy in createRawFile */
+    use_copy_range = vol->target.allocation < inputvol->target.capacity;
+
+    if (fstat(inputfd, &inputst) < 0 || fstat(fd, &st) < 0 ||
+        !S_ISREG(inputst.st_mode) || !S_ISREG(st.st_mode) ||
+        inputst.st_size <= 0 || inputst.st_size != *total ||
+        lseek(inputfd, 0, SEEK_CUR) != 0 || lseek(fd, 0, SEEK_CUR) != 0)
+        return 0;
+
+    if (VIR_ALLOC_N(buf, READ_BLOCK_SIZE_DEFAULT) < 0)
+        return -ENOMEM;
+
+    while (offset < inputst.st_size) {
+        off_t data = offset;
+        off_t hole = inputst.st_size;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        if (want_sparse) {
+            if ((data = lseek(inputfd, offset, SEEK_DATA)) < 0) {
+                if (errno == ENXIO)
+                    break;
+                /* SEEK_DATA not supported, treat the rest as data */
+                data = offset;
+            } else if ((hole = lseek(inputfd, data, SEEK_HOLE)) < 0) {
+                hole = inputst.st_size;
+            }
+            hole = MIN(hole, inputst.st_size);
+        }
+#endif
+
+        if ((ret = virStorageBackendCopyRange(vol, inputvol, inputfd, fd,
+                                              data, hole - data,
+                                              &use_copy_range,
+                                              buf,
+                                              READ_BLOCK_SIZE_DEFAULT)) < 0)
+            goto cleanup;
+
+        offset = hole;
+    }
+
+    /* Skipped trailing holes leave the target short, put back the
+     * requested size */
+    if (fstat(fd, &st) < 0) {
+        ret = -errno;
+        virReportSystemError(errno, _("stat of '%s' failed"),
+                             vol->target.path);
+        goto cleanup;
+    }
+    if (st.st_size < MAX(inputst.st_size, vol->target.capacity) &&
+        ftruncate(fd, MAX(inputst.st_size, vol->target.capacity)) < 0) {
+        ret = -errno;
+        virReportSystemError(errno, _("cannot extend file '%s'"),
+                             vol->target.path);
+        goto cleanup;
+    }
+
+    VIR_INFO("cloned '%s' to '%s' using %s",
+             inputvol->target.path, vol->target.path,
+             use_copy_range ? "copy_file_range" : "chunked copy");
+
+    *total -= inputst.st_size;
+    ret = 1;
+
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -220,21 +472,35 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     }
 
     if (reflink_copy) {
-        if (btrfsCloneFile(fd, inputfd) < 0) {
+        if (reflinkCloneFile(fd, inputfd) < 0) {
             ret = -errno;
             virReportSystemError(errno,
                                  _("failed to clone files from '%s'"),
                                  inputvol->target.path);
             goto cleanup;
         } else {
-            VIR_DEBUG("btrfs clone finished.");
+            VIR_INFO("cloned '%s' to '%s' using reflink",
+                     inputvol->target.path, vol->target.path);
             goto cleanup;
         }
     }
 
+    if ((ret = virStorageBackendCopyToFDFast(vol, inputvol, inputfd, fd,
+                                             total, want_sparse)) < 0)
+        goto cleanup;
+    if (ret > 0) {
+        ret = 0;
+        goto sync;
+    }
+
     while (amtread != 0) {
         int amtleft;
 
+        if (virStorageBackendVolCancelled(vol)) {
+            ret = -ECANCELED;
+            goto cleanup;
+        }
+
         if (*total < rbytes)
             rbytes = *total;
 
@@ -273,6 +539,7 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
         } while ((amtleft -= interval) > 0);
     }
 
+ sync:
     if (fdatasync(fd) < 0) {
         ret = -errno;
         virReportSystemError(errno, _("cannot sync data to file '%s'"),
@@ -2076,6 +2343,211 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+#define VIR_STORAGE_STREAM_AIO_BUF_SIZE (1024 * 1024)
+
+typedef struct _virStorageBackendStreamAIOSlot virStorageBackendStreamAIOSlot;
+struct _virStorageBackendStreamAIOSlot {
+    char *buf;
+    size_t len;
+    bool busy;
+};
+
+static virStorageBackendStreamAIOSlot *
+virStorageBackendStreamAIONew(virStorageBackendStreamAIOPtr aio)
+{
+    virStorageBackendStreamAIOSlot *slots;
+    size_t i;
+
+    if (VIR_ALLOC_N(slots, aio->depth) < 0)
+        return NULL;
+
+    for (i = 0; i < aio->depth; i++) {
+        if (VIR_ALLOC_N(slots[i].buf, VIR_STORAGE_STREAM_AIO_BUF_SIZE) < 0) {
+            while (i--)
+                VIR_FREE(slots[i].buf);
+            VIR_FREE(slots);
+            return NULL;
+        }
+    }
+
+    return slots;
+}
+
+/* Wait for whatever is still in flight, then release the buffers */
+static void
+virStorageBackendStreamAIOFree(virStorageBackendStreamAIOPtr aio,
+                               virStorageBackendStreamAIOSlot *slots)
+{
+    size_t i;
+
+    if (!slots)
+        return;
+
+    for (i = 0; i < aio->depth; i++) {
+        if (slots[i].busy)
+            ignore_value(aio->wait(aio->opaque, i));
+        VIR_FREE(slots[i].buf);
+    }
+    VIR_FREE(slots);
+}
+
+
+/*
+ * Write everything that can be read from @fd to the volume, starting
+ * at @aio->offset, with up to @aio->depth writes in flight. Fails if
+ * @fd holds more data than fits before @aio->end.
+ */
+int
+virStorageBackendStreamAIOUpload(int fd,
+                                 virStorageBackendStreamAIOPtr aio)
+{
+    virStorageBackendStreamAIOSlot *slots;
+    unsigned long long pos = aio->offset;
+    size_t i = 0;
+    ssize_t r;
+    bool eof = false;
+    int ret = -1;
+
+    if (!(slots = virStorageBackendStreamAIONew(aio)))
+        return -1;
+
+    while (!eof) {
+        virStorageBackendStreamAIOSlot *slot = &slots[i];
+        size_t want = MIN(VIR_STORAGE_STREAM_AIO_BUF_SIZE, aio->end - pos);
+        ssize_t got;
+
+        if (slot->busy) {
+            slot->busy = false;
+            if ((r = aio->wait(aio->opaque, i)) < 0) {
+                virReportSystemError(-r, _("failed writing to volume '%s'"),
+                                     aio->path);
+                goto cleanup;
+            }
+        }
+
+        /* Once the volume is full, any byte left is one too many */
+        if ((got = saferead(fd, slot->buf, want ? want : 1)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed reading from stream"));
+            goto cleanup;
+        }
+
+        if (!want && got) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("data does not fit in volume '%s'"),
+                           aio->path);
+            goto cleanup;
+        }
+
+        if ((size_t) got < want || !want)
+            eof = true;
+        if (!got)
+            break;
+
+        if ((r = aio->submit(aio->opaque, i, true, slot->buf, got, pos)) < 0) {
+            virReportSystemError(-r, _("failed writing to volume '%s'"),
+                                 aio->path);
+            goto cleanup;
+        }
+        slot->busy = true;
+        pos += got;
+        i = (i + 1) % aio->depth;
+    }
+
+    for (i = 0; i < aio->depth; i++) {
+        if (!slots[i].busy)
+            continue;
+        slots[i].busy = false;
+        if ((r = aio->wait(aio->opaque, i)) < 0) {
+            virReportSystemError(-r, _("failed writing to volume '%s'"),
+                                 aio->path);
+            goto cleanup;
+        }
+    }
+
+    VIR_DEBUG("Uploaded %llu bytes to volume '%s'", pos - aio->offset,
+              aio->path);
+    ret = 0;
+
+ cleanup:
+    virStorageBackendStreamAIOFree(aio, slots);
+    return ret;
+}
+
+
+/*
+ * Write the data in [@aio->offset, @aio->end) of the volume to @fd,
+ * with up to @aio->depth reads in flight.
+ */
+int
+virStorageBackendStreamAIODownload(int fd,
+                                   virStorageBackendStreamAIOPtr aio)
+{
+    virStorageBackendStreamAIOSlot *slots;
+    unsigned long long pos = aio->offset;
+    size_t i;
+    ssize_t r;
+    int ret = -1;
+
+    if (!(slots = virStorageBackendStreamAIONew(aio)))
+        return -1;
+
+    for (i = 0; i < aio->depth && pos < aio->end; i++) {
+        slots[i].len = MIN(VIR_STORAGE_STREAM_AIO_BUF_SIZE, aio->end - pos);
+        if ((r = aio->submit(aio->opaque, i, false,
+                             slots[i].buf, slots[i].len, pos)) < 0) {
+            virReportSystemError(-r, _("failed reading from volume '%s'"),
+                                 aio->path);
+            goto cleanup;
+        }
+        slots[i].busy = true;
+        pos += slots[i].len;
+    }
+
+    /* Requests complete in the order they were issued in */
+    for (i = 0; slots[i].busy; i = (i + 1) % aio->depth) {
+        virStorageBackendStreamAIOSlot *slot = &slots[i];
+
+        slot->busy = false;
+        if ((r = aio->wait(aio->opaque, i)) < 0) {
+            virReportSystemError(-r, _("failed reading from volume '%s'"),
+                                 aio->path);
+            goto cleanup;
+        }
+
+        if (safewrite(fd, slot->buf, r) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed writing to stream"));
+            goto cleanup;
+        }
+
+        /* The volume shrank under us */
+        if ((size_t) r < slot->len)
+            break;
+
+        if (pos < aio->end) {
+            slot->len = MIN(VIR_STORAGE_STREAM_AIO_BUF_SIZE, aio->end - pos);
+            if ((r = aio->submit(aio->opaque, i, false,
+                                 slot->buf, slot->len, pos)) < 0) {
+                virReportSystemError(-r,
+                                     _("failed reading from volume '%s'"),
+                                     aio->path);
+                goto cleanup;
+            }
+            slot->busy = true;
+            pos += slot->len;
+        }
+    }
+
+    VIR_DEBUG("Downloaded volume '%s' up to offset %llu", aio->path, pos);
+    ret = 0;
+
+ cleanup:
+    virStorageBackendStreamAIOFree(aio, slots);
+    return ret;
+}
+
+
 /* If the volume we're wiping is already a sparse file, we simply
  * truncate and extend it to its original size, filling it with
  * zeroes.  This behavior is guaranteed by POSIX:
@@ -2115,48 +2587,263 @@ virStorageBackendVolZeroSparseFileLocal(virStorageVolDefPtr vol,
 }
 
 
+/* Threads writing zeroes when the storage cannot zero itself */
+#define VIR_STORAGE_WIPE_WORKERS 4
+/* Size (and alignment) of the buffer each of them writes at once */
+#define VIR_STORAGE_WIPE_BUF_SIZE (1024 * 1024)
+#define VIR_STORAGE_WIPE_BUF_ALIGN 4096
+/* Range of the volume a worker claims at a time */
+#define VIR_STORAGE_WIPE_CHUNK_SIZE (64ULL * 1024 * 1024)
+
+
+/* Whether @err means the kernel cannot offload the request */
+static bool
+virStorageBackendWipeUnsupported(int err)
+{
+    return err == EOPNOTSUPP || err == ENOTTY || err == EINVAL ||
+        err == ENOSYS;
+}
+
+
+/*
+ * Let the kernel zero the first @len bytes of @fd, without pushing the
+ * zeroes through the page cache ourselves. Returns 0 on success, -2 if
+ * the device or filesystem cannot do that and -1 on error.
+ */
+static int
+virStorageBackendWipeOffloadLocal(virStorageVolDefPtr vol,
+                                  int fd,
+                                  const struct stat *st,
+                                  unsigned long long len)
+{
+#ifdef __linux__
+    if (S_ISBLK(st->st_mode) && len % 512 == 0) {
+# ifdef BLKZEROOUT
+        uint64_t range[2] = { 0, len };
+
+        if (ioctl(fd, BLKZEROOUT, range) == 0) {
+            VIR_DEBUG("Zeroed '%s' with BLKZEROOUT", vol->target.path);
+            return 0;
+        }
+        if (!virStorageBackendWipeUnsupported(errno)) {
+            virReportSystemError(errno,
+                                 _("Failed to zero out volume with path '%s'"),
+                                 vol->target.path);
+            return -1;
+        }
+# endif /* BLKZEROOUT */
+# if defined(BLKDISCARD) && defined(BLKDISCARDZEROES)
+        unsigned int zeroes = 0;
+
+        /* Only trust a discard to zero if the device says so */
+        if (ioctl(fd, BLKDISCARDZEROES, &zeroes) == 0 && zeroes) {
+            uint64_t discard[2] = { 0, len };
+
+            if (ioctl(fd, BLKDISCARD, discard) == 0) {
+                VIR_DEBUG("Zeroed '%s' with BLKDISCARD", vol->target.path);
+                return 0;
+            }
+            if (!virStorageBackendWipeUnsupported(errno)) {
+                virReportSystemError(errno,
+                                     _("Failed to discard volume with path '%s'"),
+                                     vol->target.path);
+                return -1;
+            }
+        }
+# endif /* BLKDISCARD && BLKDISCARDZEROES */
+    } else if (S_ISREG(st->st_mode)) {
+# if defined(FALLOC_FL_ZERO_RANGE) && defined(FALLOC_FL_KEEP_SIZE)
+        /* Unlike punching a hole, this keeps the blocks allocated */
+        if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                      0, len) == 0) {
+            VIR_DEBUG("Zeroed '%s' with FALLOC_FL_ZERO_RANGE",
+                      vol->target.path);
+            return 0;
+        }
+        if (!virStorageBackendWipeUnsupported(errno)) {
+            virReportSystemError(errno,
+                                 _("Failed to zero range of volume with "
+                                   "path '%s'"),
+                                 vol->target.path);
+            return -1;
+        }
+# endif /* FALLOC_FL_ZERO_RANGE && FALLOC_FL_KEEP_SIZE */
+    }
+#endif /* __linux__ */
+
+    return -2;
+}
+
+
+typedef struct _virStorageBackendWipeJob virStorageBackendWipeJob;
+typedef virStorageBackendWipeJob *virStorageBackendWipeJobPtr;
+struct _virStorageBackendWipeJob {
+    virMutex lock;
+    int fd;
+    unsigned long long len;
+    unsigned long long next;    /* start of the next unclaimed range */
+    unsigned long long done;    /* bytes written so far */
+    unsigned int progress;      /* last logged percentage */
+    int err;                    /* errno of the first failed write */
+    virStorageVolDefPtr vol;
+};
+
+
+static void
+virStorageBackendWipeWorker(void *opaque)
+{
+    virStorageBackendWipeJobPtr job = opaque;
+    void *buf = NULL;
+    int err = 0;
+
+    if ((err = posix_memalign(&buf, VIR_STORAGE_WIPE_BUF_ALIGN,
+                              VIR_STORAGE_WIPE_BUF_SIZE)))
+        goto cleanup;
+    memset(buf, 0, VIR_STORAGE_WIPE_BUF_SIZE);
+
+    while (true) {
+        unsigned long long offset;
+        unsigned long long claimed;
+        unsigned long long remaining;
+
+        virMutexLock(&job->lock);
+        if (job->err || job->next >= job->len) {
+            virMutexUnlock(&job->lock);
+            break;
+        }
+        if (virStorageVolDefJobCancelled(job->vol)) {
+            job->err = ECANCELED;
+            virMutexUnlock(&job->lock);
+            break;
+        }
+        offset = job->next;
+        claimed = MIN(VIR_STORAGE_WIPE_CHUNK_SIZE, job->len - offset);
+        job->next += claimed;
+        virMutexUnlock(&job->lock);
+
+        remaining = claimed;
+
+        while (remaining > 0) {
+            size_t size = MIN(VIR_STORAGE_WIPE_BUF_SIZE, remaining);
+            ssize_t written = pwrite(job->fd, buf, size, offset);
+
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                err = errno;
+                goto cleanup;
+            }
+
+            offset += written;
+            remaining -= written;
+        }
+
+        virMutexLock(&job->lock);
+        job->done += claimed;
+        if (job->done * 100 / job->len >= job->progress + 10) {
+            job->progress = job->done * 100 / job->len;
+            VIR_DEBUG("Wiped %u%% of volume with path '%s'",
+                      job->progress, job->vol->target.path);
+        }
+        virMutexUnlock(&job->lock);
+    }
+
+ cleanup:
+    if (err) {
+        virMutexLock(&job->lock);
+        if (!job->err)
+            job->err = err;
+        virMutexUnlock(&job->lock);
+    }
+    VIR_FREE(buf);
+}
+
+
+/*
+ * Write zeroes over the first @wipe_len bytes of the volume. The
+ * aligned bulk is written by a few threads in parallel, bypassing the
+ * host page cache where possible, and the unaligned tail through @fd.
+ */
 static int
 virStorageBackendWipeLocal(virStorageVolDefPtr vol,
                            int fd,
-                           unsigned long long wipe_len,
-                           size_t writebuf_length)
+                           unsigned long long wipe_len)
 {
-    int ret = -1, written = 0;
-    unsigned long long remaining = 0;
-    size_t write_size = 0;
-    char *writebuf = NULL;
+    virStorageBackendWipeJob job;
+    virThread workers[VIR_STORAGE_WIPE_WORKERS];
+    size_t nworkers = 0;
+    size_t i;
+    char zeroes[512] = { 0 };
+    unsigned long long tail;
+    int directfd = -1;
+    int ret = -1;
 
     VIR_DEBUG("wiping start: 0 len: %llu", wipe_len);
 
-    if (VIR_ALLOC_N(writebuf, writebuf_length) < 0)
-        goto cleanup;
+    memset(&job, 0, sizeof(job));
+    if (virMutexInit(&job.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
 
-    if (lseek(fd, 0, SEEK_SET) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to seek to the start in volume "
-                               "with path '%s'"),
+    /* Not every filesystem supports O_DIRECT, the page cache will do */
+    if (O_DIRECT &&
+        (directfd = open(vol->target.path, O_WRONLY | O_DIRECT)) < 0)
+        VIR_DEBUG("Cannot open '%s' with O_DIRECT, using cached writes",
+                  vol->target.path);
+
+    job.fd = directfd >= 0 ? directfd : fd;
+    job.len = wipe_len - wipe_len % VIR_STORAGE_WIPE_BUF_ALIGN;
+    job.vol = vol;
+
+    for (i = 0; i < VIR_STORAGE_WIPE_WORKERS - 1 &&
+         (i + 1) * VIR_STORAGE_WIPE_CHUNK_SIZE < job.len; i++) {
+        if (virThreadCreate(&workers[nworkers], true,
+                            virStorageBackendWipeWorker, &job) < 0) {
+            virResetLastError();
+            break;
+        }
+        nworkers++;
+    }
+
+    /* Also covers the case where no thread could be started */
+    virStorageBackendWipeWorker(&job);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (job.err == ECANCELED) {
+        virReportError(VIR_ERR_OPERATION_ABORTED,
+                       _("wiping of volume '%s' was cancelled"),
+                       vol->name);
+        goto cleanup;
+    } else if (job.err) {
+        virReportSystemError(job.err,
+                             _("Failed to write zeroes to "
+                               "storage volume with path '%s'"),
                              vol->target.path);
         goto cleanup;
     }
 
-    remaining = wipe_len;
-    while (remaining > 0) {
+    for (tail = job.len; tail < wipe_len; ) {
+        size_t size = MIN(sizeof(zeroes), wipe_len - tail);
+        ssize_t written = pwrite(fd, zeroes, size, tail);
 
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
         if (written < 0) {
+            if (errno == EINTR)
+                continue;
             virReportSystemError(errno,
                                  _("Failed to write %zu bytes to "
                                    "storage volume with path '%s'"),
-                                 write_size, vol->target.path);
-
+                                 size, vol->target.path);
             goto cleanup;
         }
-
-        remaining -= written;
+        tail += written;
     }
 
-    if (fdatasync(fd) < 0) {
+    if (fdatasync(fd) < 0 ||
+        (directfd >= 0 && fdatasync(directfd) < 0)) {
         virReportSystemError(errno,
                              _("cannot sync data to volume with path '%s'"),
                              vol->target.path);
@@ -2169,11 +2856,59 @@ virStorageBackendWipeLocal(virStorageVolDefPtr vol,
     ret = 0;
 
  cleanup:
-    VIR_FREE(writebuf);
+    VIR_FORCE_CLOSE(directfd);
+    virMutexDestroy(&job.lock);
     return ret;
 }
 
 
+/*
+ * Discard the content of the volume, letting the storage reclaim
+ * the space.
+ */
+static int
+virStorageBackendVolTrimLocal(virStorageVolDefPtr vol,
+                              int fd,
+                              const struct stat *st)
+{
+#ifdef __linux__
+# ifdef BLKDISCARD
+    if (S_ISBLK(st->st_mode)) {
+        uint64_t range[2] = { 0, vol->target.capacity };
+
+        if (ioctl(fd, BLKDISCARD, range) == 0)
+            return 0;
+        if (!virStorageBackendWipeUnsupported(errno)) {
+            virReportSystemError(errno,
+                                 _("Failed to discard volume with path '%s'"),
+                                 vol->target.path);
+            return -1;
+        }
+    }
+# endif /* BLKDISCARD */
+# if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+    if (S_ISREG(st->st_mode)) {
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      0, st->st_size) == 0)
+            return 0;
+        if (!virStorageBackendWipeUnsupported(errno)) {
+            virReportSystemError(errno,
+                                 _("Failed to punch hole in volume with "
+                                   "path '%s'"),
+                                 vol->target.path);
+            return -1;
+        }
+    }
+# endif /* FALLOC_FL_PUNCH_HOLE && FALLOC_FL_KEEP_SIZE */
+#endif /* __linux__ */
+
+    virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                   _("'trim' algorithm not supported for volume '%s'"),
+                   vol->target.path);
+    return -1;
+}
+
+
 int
 virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
                               virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
@@ -2241,8 +2976,7 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
         alg_char = "random";
         break;
     case VIR_STORAGE_VOL_WIPE_ALG_TRIM:
-        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
-                       _("'trim' algorithm not supported"));
+        ret = virStorageBackendVolTrimLocal(vol, fd, &st);
         goto cleanup;
     case VIR_STORAGE_VOL_WIPE_ALG_LAST:
         virReportError(VIR_ERR_INVALID_ARG,
@@ -2264,11 +2998,11 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     } else {
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = virStorageBackendVolZeroSparseFileLocal(vol, st.st_size, fd);
-        } else {
+        } else if ((ret = virStorageBackendWipeOffloadLocal(vol, fd, &st,
+                                                            vol->target.allocation)) == -2) {
             ret = virStorageBackendWipeLocal(vol,
                                              fd,
-                                             vol->target.allocation,
-                                             st.st_blksize);
+                                             vol->target.allocation);
         }
     }
 
@@ -152,6 +152,35 @@ int virStorageBackendVolDownloadLocal(virConnectPtr conn,
                                       unsigned long long len,
                                       unsigned int flags);
 
+/* Requests kept in flight when streaming a network volume, unless the
+ * pool says otherwise */
+# define VIR_STORAGE_BACKEND_STREAM_QUEUE_DEFAULT 16
+
+/* Asynchronous I/O on a network volume. Each request is identified by
+ * a slot below @depth and a slot has at most one request in flight. */
+typedef struct _virStorageBackendStreamAIO virStorageBackendStreamAIO;
+typedef virStorageBackendStreamAIO *virStorageBackendStreamAIOPtr;
+struct _virStorageBackendStreamAIO {
+    const char *path;           /* volume name for error messages */
+    unsigned long long offset;  /* first byte to transfer */
+    unsigned long long end;     /* the transfer stops here */
+    size_t depth;               /* number of slots */
+
+    /* Start reading (@write is false) or writing @len bytes at @offset
+     * of the volume into or from @buf. Returns 0 or -errno. */
+    int (*submit)(void *opaque, size_t slot, bool write,
+                  char *buf, size_t len, unsigned long long offset);
+    /* Wait for the request in @slot to complete. Returns the number of
+     * bytes transferred or -errno. */
+    ssize_t (*wait)(void *opaque, size_t slot);
+    void *opaque;
+};
+
+int virStorageBackendStreamAIOUpload(int fd,
+                                     virStorageBackendStreamAIOPtr aio);
+int virStorageBackendStreamAIODownload(int fd,
+                                       virStorageBackendStreamAIOPtr aio);
+
 int virStorageBackendVolWipeLocal(virConnectPtr conn,
                                   virStoragePoolObjPtr pool,
                                   virStorageVolDefPtr vol,
@@ -171,6 +200,13 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool; /* Must be non-NULL */
+    /* Refresh an active pool, reusing the volumes it already holds.
+     * Called with an async job registered on the pool, so the pool
+     * lock may be dropped while scanning. */
+    virStorageBackendRefreshPool updatePool;
+    /* Re-read only the capacity, allocation and available space of an
+     * active pool, leaving its volumes alone. Must be cheap. */
+    virStorageBackendRefreshPool statPool;
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
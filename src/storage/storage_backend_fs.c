@@ -43,6 +43,7 @@
 
 #include "virerror.h"
 #include "storage_backend_fs.h"
+#include "storage_backend_fspriv.h"
 #include "storage_conf.h"
 #include "virstoragefile.h"
 #include "vircommand.h"
@@ -51,6 +52,8 @@
 #include "virfile.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -883,98 +886,525 @@ virStorageBackendFileSystemBuild(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
-/**
- * Iterate over the pool's directory and enumerate all disk images
- * within it. This is non-recursive.
+/* Number of threads probing volume metadata during a pool refresh */
+#define VIR_STORAGE_FS_PROBE_WORKERS 8
+
+int
+virStorageBackendFileSystemScanInit(virStorageBackendFileSystemScanPtr scan,
+                                    const char *path)
+{
+    memset(scan, 0, sizeof(*scan));
+    if (virMutexInit(&scan->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (VIR_STRDUP(scan->path, path) < 0) {
+        virMutexDestroy(&scan->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void
+virStorageBackendFileSystemScanFree(virStorageBackendFileSystemScanPtr scan)
+{
+    size_t i;
+
+    for (i = 0; i < scan->nentries; i++) {
+        VIR_FREE(scan->entries[i].name);
+        virStorageVolDefFree(scan->entries[i].vol);
+        virFreeError(scan->entries[i].error);
+    }
+    VIR_FREE(scan->entries);
+    virHashFree(scan->byName);
+    VIR_FREE(scan->path);
+    virMutexDestroy(&scan->lock);
+}
+
+
+static void
+virStorageBackendFileSystemStampSet(virStorageVolStampPtr stamp,
+                                    const struct stat *sb)
+{
+    stamp->valid = true;
+    stamp->dev = sb->st_dev;
+    stamp->ino = sb->st_ino;
+    stamp->size = sb->st_size;
+    stamp->mtime = get_stat_mtime(sb);
+    stamp->ctime = get_stat_ctime(sb);
+}
+
+
+static bool
+virStorageBackendFileSystemStampMatch(const virStorageVolStamp *stamp,
+                                      const struct stat *sb)
+{
+    struct timespec mtime = get_stat_mtime(sb);
+    struct timespec ctime = get_stat_ctime(sb);
+
+    return stamp->valid &&
+        stamp->dev == sb->st_dev &&
+        stamp->ino == sb->st_ino &&
+        stamp->size == sb->st_size &&
+        stamp->mtime.tv_sec == mtime.tv_sec &&
+        stamp->mtime.tv_nsec == mtime.tv_nsec &&
+        stamp->ctime.tv_sec == ctime.tv_sec &&
+        stamp->ctime.tv_nsec == ctime.tv_nsec;
+}
+
+
+/*
+ * Probe the file backing @entry. On success @entry->vol holds the
+ * new volume, or NULL if the file is not something we expose as a
+ * volume.
  */
 static int
-virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
-                                   virStoragePoolObjPtr pool)
+virStorageBackendFileSystemProbeVol(const char *poolpath,
+                                    virStorageBackendFileSystemScanEntryPtr entry)
+{
+    virStorageVolDefPtr vol = NULL;
+    int err;
+    int ret = -1;
+
+    if (VIR_ALLOC(vol) < 0)
+        goto cleanup;
+
+    if (VIR_STRDUP(vol->name, entry->name) < 0)
+        goto cleanup;
+
+    vol->type = VIR_STORAGE_VOL_FILE;
+    vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
+    if (virAsprintf(&vol->target.path, "%s/%s",
+                    poolpath, vol->name) == -1)
+        goto cleanup;
+
+    if (VIR_STRDUP(vol->key, vol->target.path) < 0)
+        goto cleanup;
+
+    if ((err = virStorageBackendProbeTarget(&vol->target,
+                                            &vol->target.encryption)) < 0) {
+        if (err == -2) {
+            /* Silently ignore non-regular files,
+             * eg '.' '..', 'lost+found', dangling symbolic link */
+            ret = 0;
+            goto cleanup;
+        } else if (err == -3) {
+            /* The backing file is currently unavailable, its format is not
+             * explicitly specified, the probe to auto detect the format
+             * failed: continue with faked RAW format, since AUTO will
+             * break virStorageVolTargetDefFormat() generating the line
+             * <format type='...'/>. */
+        } else {
+            goto cleanup;
+        }
+    }
+
+    /* directory based volume */
+    if (vol->target.format == VIR_STORAGE_FILE_DIR)
+        vol->type = VIR_STORAGE_VOL_DIR;
+
+    if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
+        vol->type = VIR_STORAGE_VOL_PLOOP;
+
+    if (vol->target.backingStore) {
+        ignore_value(virStorageBackendUpdateVolTargetInfo(vol->target.backingStore,
+                                                          false,
+                                                          VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
+        /* If this failed, the backing file is currently unavailable,
+         * the capacity, allocation, owner, group and mode are unknown.
+         * An error message was raised, but we just continue. */
+    }
+
+    /* The stat was taken before probing, so a file changing under
+     * us is simply probed again on the next refresh */
+    if (entry->stated)
+        virStorageBackendFileSystemStampSet(&vol->stamp, &entry->sb);
+
+    entry->vol = vol;
+    vol = NULL;
+    ret = 0;
+
+ cleanup:
+    virStorageVolDefFree(vol);
+    return ret;
+}
+
+
+static void
+virStorageBackendFileSystemProbeWorker(void *opaque)
+{
+    virStorageBackendFileSystemScanPtr scan = opaque;
+
+    while (true) {
+        virStorageBackendFileSystemScanEntryPtr entry = NULL;
+
+        virMutexLock(&scan->lock);
+        while (scan->next < scan->nentries && !entry) {
+            if (!scan->entries[scan->next].reuse)
+                entry = &scan->entries[scan->next];
+            scan->next++;
+        }
+        virMutexUnlock(&scan->lock);
+
+        if (!entry)
+            break;
+
+        if (virStorageBackendFileSystemProbeVol(scan->path, entry) < 0)
+            entry->error = virSaveLastError();
+        entry->probed = true;
+    }
+}
+
+
+/*
+ * Remember what @pool currently holds (name -> stamp) so that unchanged
+ * files can keep their volume.
+ */
+virHashTablePtr
+virStorageBackendFileSystemKnownVols(virStoragePoolObjPtr pool)
+{
+    virHashTablePtr known;
+    size_t i;
+
+    if (!(known = virHashCreate(pool->volumes.count + 1, virHashValueFree)))
+        return NULL;
+
+    for (i = 0; i < pool->volumes.count; i++) {
+        virStorageVolDefPtr vol = pool->volumes.objs[i];
+        virStorageVolStampPtr stamp;
+
+        if (VIR_ALLOC(stamp) < 0)
+            goto error;
+        *stamp = vol->stamp;
+
+        if (virHashUpdateEntry(known, vol->name, stamp) < 0) {
+            VIR_FREE(stamp);
+            goto error;
+        }
+    }
+
+    return known;
+
+ error:
+    virHashFree(known);
+    return NULL;
+}
+
+
+/*
+ * List the pool directory into @scan, marking entries whose file is
+ * unchanged according to the stamps in @known (name -> stamp) so they
+ * need no probing.
+ */
+int
+virStorageBackendFileSystemScanDir(virStorageBackendFileSystemScanPtr scan,
+                                   virHashTablePtr known)
 {
     DIR *dir;
     struct dirent *ent;
-    struct statvfs sb;
-    struct stat statbuf;
-    virStorageVolDefPtr vol = NULL;
-    virStorageSourcePtr target = NULL;
     int direrr;
-    int fd = -1, ret = -1;
+    size_t i;
+    int ret = -1;
 
-    if (!(dir = opendir(pool->def->target.path))) {
+    if (!(dir = opendir(scan->path))) {
         virReportSystemError(errno,
                              _("cannot open path '%s'"),
-                             pool->def->target.path);
-        goto cleanup;
+                             scan->path);
+        return -1;
     }
 
-    while ((direrr = virDirRead(dir, &ent, pool->def->target.path)) > 0) {
-        int err;
+    while ((direrr = virDirRead(dir, &ent, scan->path)) > 0) {
+        virStorageBackendFileSystemScanEntryPtr entry;
+        virStorageVolStampPtr stamp;
+        char *path = NULL;
 
         if (virStringHasControlChars(ent->d_name)) {
             VIR_WARN("Ignoring file with control characters under '%s'",
-                     pool->def->target.path);
+                     scan->path);
             continue;
         }
 
-        if (VIR_ALLOC(vol) < 0)
+        if (VIR_RESIZE_N(scan->entries, scan->nentries_max,
+                         scan->nentries, 1) < 0)
             goto cleanup;
+        entry = &scan->entries[scan->nentries++];
 
-        if (VIR_STRDUP(vol->name, ent->d_name) < 0)
+        if (VIR_STRDUP(entry->name, ent->d_name) < 0 ||
+            virAsprintf(&path, "%s/%s", scan->path, ent->d_name) < 0)
             goto cleanup;
 
-        vol->type = VIR_STORAGE_VOL_FILE;
-        vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
-        if (virAsprintf(&vol->target.path, "%s/%s",
-                        pool->def->target.path,
-                        vol->name) == -1)
-            goto cleanup;
+        entry->stated = stat(path, &entry->sb) == 0;
+        VIR_FREE(path);
 
-        if (VIR_STRDUP(vol->key, vol->target.path) < 0)
+        if (entry->stated &&
+            (stamp = virHashLookup(known, entry->name)) &&
+            virStorageBackendFileSystemStampMatch(stamp, &entry->sb))
+            entry->reuse = true;
+    }
+    if (direrr < 0)
+        goto cleanup;
+
+    if (!(scan->byName = virHashCreate(scan->nentries + 1, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < scan->nentries; i++) {
+        if (virHashAddEntry(scan->byName, scan->entries[i].name,
+                            &scan->entries[i]) < 0)
             goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    closedir(dir);
+    return ret;
+}
+
+
+/*
+ * Probe all changed entries of @scan, spreading the work over a few
+ * threads as probing is dominated by I/O latency on network filesystems.
+ */
+int
+virStorageBackendFileSystemScanProbe(virStorageBackendFileSystemScanPtr scan)
+{
+    virThread workers[VIR_STORAGE_FS_PROBE_WORKERS];
+    size_t nworkers = 0;
+    size_t nprobe = 0;
+    size_t i;
+
+    for (i = 0; i < scan->nentries; i++) {
+        if (!scan->entries[i].reuse)
+            nprobe++;
+    }
 
-        if ((err = virStorageBackendProbeTarget(&vol->target,
-                                                &vol->target.encryption)) < 0) {
-            if (err == -2) {
-                /* Silently ignore non-regular files,
-                 * eg '.' '..', 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
+    VIR_DEBUG("Probing %zu of %zu entries under '%s'",
+              nprobe, scan->nentries, scan->path);
+
+    /* The calling thread takes its share of the queue too, and drains
+     * it alone if no worker could be started */
+    while (nprobe > 1 &&
+           nworkers < nprobe - 1 &&
+           nworkers < VIR_STORAGE_FS_PROBE_WORKERS - 1) {
+        if (virThreadCreate(&workers[nworkers], true,
+                            virStorageBackendFileSystemProbeWorker, scan) < 0) {
+            VIR_WARN("Failed to start probe worker for '%s'", scan->path);
+            virResetLastError();
+            break;
+        }
+        nworkers++;
+    }
+
+    virStorageBackendFileSystemProbeWorker(scan);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    for (i = 0; i < scan->nentries; i++) {
+        if (scan->entries[i].error) {
+            virSetError(scan->entries[i].error);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Decide whether @vol, known to the pool before the scan, stays in it.
+ * @known holds the names the pool had when the scan started.
+ */
+static bool
+virStorageBackendFileSystemKeepVol(virStorageBackendFileSystemScanPtr scan,
+                                   virHashTablePtr known,
+                                   virStorageVolDefPtr vol)
+{
+    virStorageBackendFileSystemScanEntryPtr entry;
+
+    /* Never pull a volume from under a running job */
+    if (vol->building || vol->in_use)
+        return true;
+
+    if (!(entry = virHashLookup(scan->byName, vol->name))) {
+        /* Either the file is gone, or the volume was created
+         * after the directory was listed */
+        return !virHashLookup(known, vol->name);
+    }
+
+    return entry->reuse;
+}
+
+
+/*
+ * Whether the file behind @entry still exists now that the pool is
+ * locked again. A volume created and deleted through the pool while the
+ * directory was scanned must not come back.
+ */
+static bool
+virStorageBackendFileSystemEntryExists(virStorageBackendFileSystemScanPtr scan,
+                                       virStorageBackendFileSystemScanEntryPtr entry)
+{
+    struct stat sb;
+    char *path = NULL;
+    bool ret = true;
+
+    if (virAsprintf(&path, "%s/%s", scan->path, entry->name) < 0) {
+        virResetLastError();
+        return true;
+    }
+
+    if (stat(path, &sb) < 0 && errno == ENOENT)
+        ret = false;
+
+    VIR_FREE(path);
+    return ret;
+}
+
+
+/*
+ * Replace the volumes of @pool with the result of @scan. The pool must
+ * be locked; it may have changed since @known was taken from it.
+ */
+int
+virStorageBackendFileSystemMergeVols(virStoragePoolObjPtr pool,
+                                     virStorageBackendFileSystemScanPtr scan,
+                                     virHashTablePtr known)
+{
+    virStorageVolDefPtr *old = pool->volumes.objs;
+    size_t nold = pool->volumes.count;
+    size_t i;
+    int ret = 0;
+
+    /* A volume the pool knew before the scan but lacks now was deleted
+     * meanwhile, whatever the directory listing still says */
+    for (i = 0; i < scan->nentries; i++) {
+        virStorageBackendFileSystemScanEntryPtr entry = &scan->entries[i];
+
+        if (entry->vol &&
+            virHashLookup(known, entry->name) &&
+            !virStorageVolDefFindByName(pool, entry->name)) {
+            VIR_DEBUG("Volume '%s' was deleted during the scan", entry->name);
+            virStorageVolDefFree(entry->vol);
+            entry->vol = NULL;
+        }
+    }
+
+    pool->volumes.objs = NULL;
+    pool->volumes.count = 0;
+    virStoragePoolObjClearVols(pool);
+
+    for (i = 0; i < nold; i++) {
+        if (ret == 0 &&
+            virStorageBackendFileSystemKeepVol(scan, known, old[i])) {
+            if (virStoragePoolObjAddVol(pool, old[i]) == 0)
                 continue;
-            } else if (err == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-            } else {
-                goto cleanup;
-            }
+            ret = -1;
         }
+        virStorageVolDefFree(old[i]);
+    }
+    VIR_FREE(old);
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
+    for (i = 0; i < scan->nentries && ret == 0; i++) {
+        virStorageBackendFileSystemScanEntryPtr entry = &scan->entries[i];
 
-        if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
-            vol->type = VIR_STORAGE_VOL_PLOOP;
+        if (!entry->vol ||
+            virStorageVolDefFindByName(pool, entry->name) ||
+            !virStorageBackendFileSystemEntryExists(scan, entry))
+            continue;
 
-        if (vol->target.backingStore) {
-            ignore_value(virStorageBackendUpdateVolTargetInfo(vol->target.backingStore,
-                                                              false,
-                                                              VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
-            /* If this failed, the backing file is currently unavailable,
-             * the capacity, allocation, owner, group and mode are unknown.
-             * An error message was raised, but we just continue. */
+        if (virStoragePoolObjAddVol(pool, entry->vol) < 0) {
+            ret = -1;
+            break;
         }
+        entry->vol = NULL;
+    }
 
-        if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
-            goto cleanup;
+    return ret;
+}
+
+
+static int
+virStorageBackendFileSystemRefreshVols(virStoragePoolObjPtr pool,
+                                       bool unlock)
+{
+    virStorageBackendFileSystemScan scan;
+    virHashTablePtr known = NULL;
+    bool unlocked = false;
+    int ret = -1;
+
+    if (virStorageBackendFileSystemScanInit(&scan, pool->def->target.path) < 0)
+        return -1;
+
+    if (!(known = virStorageBackendFileSystemKnownVols(pool)))
+        goto cleanup;
+
+    /* Scanning only touches @scan, so other callers can keep using
+     * the current volume list meanwhile */
+    if (unlock) {
+        virStoragePoolObjUnlock(pool);
+        unlocked = true;
     }
-    if (direrr < 0)
+
+    if (virStorageBackendFileSystemScanDir(&scan, known) < 0 ||
+        virStorageBackendFileSystemScanProbe(&scan) < 0)
+        goto cleanup;
+
+    if (unlocked) {
+        virStoragePoolObjLock(pool);
+        unlocked = false;
+    }
+
+    ret = virStorageBackendFileSystemMergeVols(pool, &scan, known);
+
+ cleanup:
+    if (unlocked)
+        virStoragePoolObjLock(pool);
+    virHashFree(known);
+    virStorageBackendFileSystemScanFree(&scan);
+    return ret;
+}
+
+
+/**
+ * Read the capacity and usage of the filesystem holding the pool.
+ */
+static int
+virStorageBackendFileSystemStat(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                virStoragePoolObjPtr pool)
+{
+    struct statvfs sb;
+
+    if (statvfs(pool->def->target.path, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("cannot statvfs path '%s'"),
+                             pool->def->target.path);
+        return -1;
+    }
+
+    pool->def->capacity = ((unsigned long long)sb.f_frsize *
+                           (unsigned long long)sb.f_blocks);
+    pool->def->available = ((unsigned long long)sb.f_bfree *
+                            (unsigned long long)sb.f_frsize);
+    pool->def->allocation = pool->def->capacity - pool->def->available;
+    return 0;
+}
+
+
+static int
+virStorageBackendFileSystemRefreshCommon(virStoragePoolObjPtr pool,
+                                         bool unlock)
+{
+    struct stat statbuf;
+    virStorageSourcePtr target = NULL;
+    int fd = -1, ret = -1;
+
+    if (virStorageBackendFileSystemRefreshVols(pool, unlock) < 0)
         goto cleanup;
-    closedir(dir);
-    dir = NULL;
-    vol = NULL;
 
     if (VIR_ALLOC(target))
         goto cleanup;
@@ -997,18 +1427,8 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
         goto cleanup;
 
     /* VolTargetInfoFD doesn't update capacity correctly for the pool case */
-    if (statvfs(pool->def->target.path, &sb) < 0) {
-        virReportSystemError(errno,
-                             _("cannot statvfs path '%s'"),
-                             pool->def->target.path);
+    if (virStorageBackendFileSystemStat(NULL, pool) < 0)
         goto cleanup;
-    }
-
-    pool->def->capacity = ((unsigned long long)sb.f_frsize *
-                           (unsigned long long)sb.f_blocks);
-    pool->def->available = ((unsigned long long)sb.f_bfree *
-                            (unsigned long long)sb.f_frsize);
-    pool->def->allocation = pool->def->capacity - pool->def->available;
 
     pool->def->target.perms.mode = target->perms->mode;
     pool->def->target.perms.uid = target->perms->uid;
@@ -1019,10 +1439,7 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     ret = 0;
  cleanup:
-    if (dir)
-        closedir(dir);
     VIR_FORCE_CLOSE(fd);
-    virStorageVolDefFree(vol);
     virStorageSourceFree(target);
     if (ret < 0)
         virStoragePoolObjClearVols(pool);
@@ -1030,6 +1447,31 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+/**
+ * Iterate over the pool's directory and enumerate all disk images
+ * within it. This is non-recursive.
+ */
+static int
+virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                   virStoragePoolObjPtr pool)
+{
+    return virStorageBackendFileSystemRefreshCommon(pool, false);
+}
+
+
+/**
+ * Like virStorageBackendFileSystemRefresh, but only probe files that
+ * changed since the pool last saw them. The pool lock is dropped while
+ * the directory is scanned.
+ */
+static int
+virStorageBackendFileSystemUpdate(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                  virStoragePoolObjPtr pool)
+{
+    return virStorageBackendFileSystemRefreshCommon(pool, true);
+}
+
+
 /**
  * @conn connection to report errors against
  * @pool storage pool to stop
@@ -1397,6 +1839,8 @@ virStorageBackend virStorageBackendDirectory = {
     .buildPool = virStorageBackendFileSystemBuild,
     .checkPool = virStorageBackendFileSystemCheck,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .updatePool = virStorageBackendFileSystemUpdate,
+    .statPool = virStorageBackendFileSystemStat,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
     .buildVolFrom = virStorageBackendFileSystemVolBuildFrom,
@@ -1417,6 +1861,8 @@ virStorageBackend virStorageBackendFileSystem = {
     .checkPool = virStorageBackendFileSystemCheck,
     .startPool = virStorageBackendFileSystemStart,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .updatePool = virStorageBackendFileSystemUpdate,
+    .statPool = virStorageBackendFileSystemStat,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
@@ -1437,6 +1883,8 @@ virStorageBackend virStorageBackendNetFileSystem = {
     .startPool = virStorageBackendFileSystemStart,
     .findPoolSources = virStorageBackendFileSystemNetFindPoolSources,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .updatePool = virStorageBackendFileSystemUpdate,
+    .statPool = virStorageBackendFileSystemStat,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
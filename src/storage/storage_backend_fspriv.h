@@ -0,0 +1,79 @@
+/*
+ * storage_backend_fspriv.h: private declarations for the file system
+ *                           storage backend
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_STORAGE_BACKEND_FSPRIV_H__
+# define __VIR_STORAGE_BACKEND_FSPRIV_H__
+
+# include <sys/stat.h>
+
+# include "storage_conf.h"
+# include "virerror.h"
+# include "virhash.h"
+# include "virthread.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+typedef struct _virStorageBackendFileSystemScanEntry virStorageBackendFileSystemScanEntry;
+typedef virStorageBackendFileSystemScanEntry *virStorageBackendFileSystemScanEntryPtr;
+struct _virStorageBackendFileSystemScanEntry {
+    char *name;
+    bool stated;
+    struct stat sb;
+
+    bool reuse;                 /* unchanged since the pool last saw it */
+    bool probed;
+    virStorageVolDefPtr vol;    /* result of the probe, NULL if no volume */
+    virErrorPtr error;
+};
+
+typedef struct _virStorageBackendFileSystemScan virStorageBackendFileSystemScan;
+typedef virStorageBackendFileSystemScan *virStorageBackendFileSystemScanPtr;
+struct _virStorageBackendFileSystemScan {
+    virMutex lock;
+    char *path;
+    size_t next;
+
+    size_t nentries;
+    size_t nentries_max;
+    virStorageBackendFileSystemScanEntryPtr entries;
+    virHashTablePtr byName;     /* name -> entry */
+};
+
+int virStorageBackendFileSystemScanInit(virStorageBackendFileSystemScanPtr scan,
+                                        const char *path);
+
+void virStorageBackendFileSystemScanFree(virStorageBackendFileSystemScanPtr scan);
+
+virHashTablePtr virStorageBackendFileSystemKnownVols(virStoragePoolObjPtr pool);
+
+int virStorageBackendFileSystemScanDir(virStorageBackendFileSystemScanPtr scan,
+                                       virHashTablePtr known);
+
+int virStorageBackendFileSystemScanProbe(virStorageBackendFileSystemScanPtr scan);
+
+int virStorageBackendFileSystemMergeVols(virStoragePoolObjPtr pool,
+                                         virStorageBackendFileSystemScanPtr scan,
+                                         virHashTablePtr known);
+
+#endif /* __VIR_STORAGE_BACKEND_FSPRIV_H__ */
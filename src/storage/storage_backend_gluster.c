@@ -21,6 +21,7 @@
 
 #include <config.h>
 
+#include <fcntl.h>
 #include <glusterfs/api/glfs.h>
 
 #include "storage_backend_gluster.h"
@@ -30,7 +31,9 @@
 #include "virlog.h"
 #include "virstoragefile.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "viruri.h"
+#include "fdstream.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -387,9 +390,10 @@ virStorageBackendGlusterRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 
         if (okay < 0)
             goto cleanup;
-        if (vol && VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count,
-                                      vol) < 0)
+        if (vol && virStoragePoolObjAddVol(pool, vol) < 0) {
+            virStorageVolDefFree(vol);
             goto cleanup;
+        }
     }
     if (errno) {
         virReportSystemError(errno, _("failed to read directory '%s' in '%s'"),
@@ -531,6 +535,265 @@ virStorageBackendGlusterFindPoolSources(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+typedef struct _virStorageBackendGlusterStream virStorageBackendGlusterStream;
+typedef virStorageBackendGlusterStream *virStorageBackendGlusterStreamPtr;
+
+typedef struct _virStorageBackendGlusterStreamReq virStorageBackendGlusterStreamReq;
+typedef virStorageBackendGlusterStreamReq *virStorageBackendGlusterStreamReqPtr;
+struct _virStorageBackendGlusterStreamReq {
+    virStorageBackendGlusterStreamPtr stream;
+    bool done;
+    ssize_t ret;
+};
+
+struct _virStorageBackendGlusterStream {
+    virStorageBackendGlusterStatePtr state;
+    glfs_fd_t *fd;
+    char *name;
+
+    virMutex lock;
+    virCond cond;
+    virStorageBackendGlusterStreamReqPtr reqs;  /* one per slot */
+
+    virStorageBackendStreamAIO aio;
+};
+
+static void
+virStorageBackendGlusterStreamFree(void *opaque)
+{
+    virStorageBackendGlusterStreamPtr data = opaque;
+
+    if (!data)
+        return;
+
+    if (data->fd)
+        glfs_close(data->fd);
+    virStorageBackendGlusterClose(data->state);
+    virMutexDestroy(&data->lock);
+    virCondDestroy(&data->cond);
+    VIR_FREE(data->reqs);
+    VIR_FREE(data->name);
+    VIR_FREE(data);
+}
+
+/* Runs in a libgfapi thread */
+static void
+virStorageBackendGlusterStreamDone(glfs_fd_t *fd ATTRIBUTE_UNUSED,
+                                   ssize_t ret,
+                                   void *opaque)
+{
+    virStorageBackendGlusterStreamReqPtr req = opaque;
+    virStorageBackendGlusterStreamPtr data = req->stream;
+    int err = errno;
+
+    virMutexLock(&data->lock);
+    req->ret = ret < 0 ? -(err ? err : EIO) : ret;
+    req->done = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+static int
+virStorageBackendGlusterStreamSubmit(void *opaque,
+                                     size_t slot,
+                                     bool write,
+                                     char *buf,
+                                     size_t len,
+                                     unsigned long long offset)
+{
+    virStorageBackendGlusterStreamPtr data = opaque;
+    virStorageBackendGlusterStreamReqPtr req = &data->reqs[slot];
+    int r;
+
+    req->stream = data;
+    req->done = false;
+
+    if (write)
+        r = glfs_pwrite_async(data->fd, buf, len, offset, 0,
+                              virStorageBackendGlusterStreamDone, req);
+    else
+        r = glfs_pread_async(data->fd, buf, len, offset, 0,
+                             virStorageBackendGlusterStreamDone, req);
+
+    return r < 0 ? -errno : 0;
+}
+
+static ssize_t
+virStorageBackendGlusterStreamWait(void *opaque,
+                                   size_t slot)
+{
+    virStorageBackendGlusterStreamPtr data = opaque;
+    virStorageBackendGlusterStreamReqPtr req = &data->reqs[slot];
+    ssize_t ret;
+
+    virMutexLock(&data->lock);
+    while (!req->done)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+    ret = req->ret;
+    virMutexUnlock(&data->lock);
+
+    return ret;
+}
+
+static int
+virStorageBackendGlusterStreamUpload(int fd,
+                                     void *opaque)
+{
+    virStorageBackendGlusterStreamPtr data = opaque;
+
+    if (virStorageBackendStreamAIOUpload(fd, &data->aio) < 0)
+        return -1;
+
+    if (glfs_fsync(data->fd) < 0) {
+        virReportSystemError(errno, _("cannot sync gluster volume file '%s'"),
+                             data->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+virStorageBackendGlusterStreamDownload(int fd,
+                                       void *opaque)
+{
+    virStorageBackendGlusterStreamPtr data = opaque;
+
+    return virStorageBackendStreamAIODownload(fd, &data->aio);
+}
+
+/*
+ * Stream the volume with libgfapi's asynchronous I/O, keeping the
+ * pool's queue depth worth of requests in flight. The connection is
+ * set up here and handed over to the stream thread.
+ */
+static int
+virStorageBackendGlusterVolStream(virStoragePoolObjPtr pool,
+                                  virStorageVolDefPtr vol,
+                                  virStreamPtr stream,
+                                  unsigned long long offset,
+                                  unsigned long long len,
+                                  bool upload)
+{
+    virStorageBackendGlusterStreamPtr data = NULL;
+    size_t depth = pool->def->streamQueue;
+    struct stat st;
+
+    if (vol->type != VIR_STORAGE_VOL_NETWORK) {
+        virReportError(VIR_ERR_NO_SUPPORT,
+                       _("streaming of '%s' volumes is not supported "
+                         "by the gluster backend: %s"),
+                       virStorageVolTypeToString(vol->type),
+                       vol->target.path);
+        return -1;
+    }
+
+    if (!depth)
+        depth = VIR_STORAGE_BACKEND_STREAM_QUEUE_DEFAULT;
+
+    if (VIR_ALLOC(data) < 0)
+        return -1;
+
+    if (virMutexInit(&data->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(data);
+        return -1;
+    }
+
+    if (virCondInit(&data->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        virMutexDestroy(&data->lock);
+        VIR_FREE(data);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(data->reqs, depth) < 0 ||
+        VIR_STRDUP(data->name, vol->name) < 0)
+        goto error;
+
+    if (!(data->state = virStorageBackendGlusterOpen(pool)))
+        goto error;
+
+    if (!(data->fd = glfs_open(data->state->vol, vol->name,
+                               upload ? O_WRONLY : O_RDONLY))) {
+        virReportSystemError(errno, _("cannot open volume '%s'"),
+                             vol->name);
+        goto error;
+    }
+
+    if (glfs_fstat(data->fd, &st) < 0) {
+        virReportSystemError(errno, _("cannot stat volume '%s'"),
+                             vol->name);
+        goto error;
+    }
+
+    data->aio.path = data->name;
+    data->aio.offset = offset;
+    data->aio.depth = depth;
+    data->aio.submit = virStorageBackendGlusterStreamSubmit;
+    data->aio.wait = virStorageBackendGlusterStreamWait;
+    data->aio.opaque = data;
+
+    /* Files grow on upload, but a download ends with the file */
+    if (upload) {
+        data->aio.end = len ? offset + len : ULLONG_MAX;
+    } else {
+        data->aio.end = MAX(offset, st.st_size);
+        if (len && len < data->aio.end - offset)
+            data->aio.end = offset + len;
+    }
+
+    VIR_DEBUG("Streaming gluster volume %s from offset %llu "
+              "with %zu requests in flight", vol->name, offset, depth);
+
+    if (virFDStreamOpenThread(stream, len, upload ? O_WRONLY : O_RDONLY,
+                              upload ? virStorageBackendGlusterStreamUpload :
+                                       virStorageBackendGlusterStreamDownload,
+                              data, virStorageBackendGlusterStreamFree) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virStorageBackendGlusterStreamFree(data);
+    return -1;
+}
+
+
+static int
+virStorageBackendGlusterVolUpload(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                  virStoragePoolObjPtr pool,
+                                  virStorageVolDefPtr vol,
+                                  virStreamPtr stream,
+                                  unsigned long long offset,
+                                  unsigned long long len,
+                                  unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    return virStorageBackendGlusterVolStream(pool, vol, stream,
+                                             offset, len, true);
+}
+
+
+static int
+virStorageBackendGlusterVolDownload(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                    virStoragePoolObjPtr pool,
+                                    virStorageVolDefPtr vol,
+                                    virStreamPtr stream,
+                                    unsigned long long offset,
+                                    unsigned long long len,
+                                    unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    return virStorageBackendGlusterVolStream(pool, vol, stream,
+                                             offset, len, false);
+}
+
+
 virStorageBackend virStorageBackendGluster = {
     .type = VIR_STORAGE_POOL_GLUSTER,
 
@@ -538,6 +801,8 @@ virStorageBackend virStorageBackendGluster = {
     .findPoolSources = virStorageBackendGlusterFindPoolSources,
 
     .deleteVol = virStorageBackendGlusterVolDelete,
+    .uploadVol = virStorageBackendGlusterVolUpload,
+    .downloadVol = virStorageBackendGlusterVolDownload,
 };
 
 
@@ -38,7 +38,10 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virfile.h"
+#include "virhash.h"
+#include "virjson.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -300,9 +303,11 @@ virStorageBackendLogicalMakeVol(char **const groups,
     if (virStorageBackendLogicalParseVolExtents(vol, groups) < 0)
         goto cleanup;
 
-    if (is_new_vol &&
-        VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
-        goto cleanup;
+    if (is_new_vol) {
+        if (virStoragePoolObjAddVol(pool, vol) < 0)
+            goto cleanup;
+        vol = NULL;
+    }
 
     ret = 0;
 
@@ -756,6 +761,496 @@ virStorageBackendLogicalBuildPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+/*
+ * LVM's JSON reporting mode (lvm2 >= 2.02.158) lets a refresh avoid
+ * the separator based parsing above and run vgs alongside lvs. Pools
+ * naming the same volume group share one report: a refresh requested
+ * while another is running waits for it and then runs once on behalf
+ * of everyone who asked in the meantime, so its result never predates
+ * the request.
+ */
+#define VIR_STORAGE_VOL_LOGICAL_FIELDS \
+    "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr"
+
+/* JSON member names of the fields above, in the order the regex
+ * groups handed to virStorageBackendLogicalMakeVol use */
+static const char *virStorageBackendLogicalJSONKeys[] = {
+    "lv_name", "origin", "lv_uuid", "devices", "segtype", "stripes",
+    "seg_size", "vg_extent_size", "lv_size", "lv_attr",
+};
+verify(ARRAY_CARDINALITY(virStorageBackendLogicalJSONKeys) ==
+       VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT);
+
+typedef struct _virStorageBackendLogicalReport virStorageBackendLogicalReport;
+typedef virStorageBackendLogicalReport *virStorageBackendLogicalReportPtr;
+struct _virStorageBackendLogicalReport {
+    size_t refs;
+    bool done;
+    virCond cond;
+
+    int ret; /* 0 on success, -1 on error, -2 if JSON is unusable */
+    virErrorPtr error;
+
+    virJSONValuePtr lvs;  /* the whole lvs document */
+    virJSONValuePtr segs; /* its array of segment rows */
+    unsigned long long capacity;
+    unsigned long long available;
+};
+
+typedef struct _virStorageBackendLogicalVGRefresh virStorageBackendLogicalVGRefresh;
+typedef virStorageBackendLogicalVGRefresh *virStorageBackendLogicalVGRefreshPtr;
+struct _virStorageBackendLogicalVGRefresh {
+    virStorageBackendLogicalReportPtr running;
+    virStorageBackendLogicalReportPtr queued;
+};
+
+struct virStorageBackendLogicalVGSData {
+    const char *vgname;
+    int ret;
+    virErrorPtr error;
+    virJSONValuePtr doc;
+    virJSONValuePtr rows;
+};
+
+/* Guards everything below as well as the reports' refs and done */
+static virMutex virStorageBackendLogicalReportLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageBackendLogicalRefreshes;
+static bool virStorageBackendLogicalNoJSON;
+
+
+/**
+ * virStorageBackendLogicalParseReport:
+ * @output: JSON output of lvs or vgs
+ * @doc: filled with the parsed document
+ * @rows: filled with the rows of its first report
+ *
+ * The rows stay owned by the document returned in @doc.
+ *
+ * Returns 0 on success and -2 without reporting an error if @output
+ * can't be used.
+ */
+int
+virStorageBackendLogicalParseReport(const char *output,
+                                    virJSONValuePtr *doc,
+                                    virJSONValuePtr *rows)
+{
+    virJSONValuePtr report;
+
+    *rows = NULL;
+
+    if (!(*doc = virJSONValueFromString(output))) {
+        VIR_DEBUG("unable to parse LVM JSON report");
+        virResetLastError();
+        return -2;
+    }
+
+    /* {"report": [{"lv": [{"lv_name": "...", ...}, ...]}]} */
+    if (!(report = virJSONValueObjectGetArray(*doc, "report")) ||
+        virJSONValueArraySize(report) < 1 ||
+        !(report = virJSONValueArrayGet(report, 0)) ||
+        virJSONValueObjectKeysNumber(report) < 1 ||
+        !(*rows = virJSONValueObjectGetValue(report, 0)) ||
+        !virJSONValueIsArray(*rows)) {
+        VIR_DEBUG("unexpected layout of LVM JSON report");
+        virJSONValueFree(*doc);
+        *doc = NULL;
+        *rows = NULL;
+        return -2;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Run @cmd and hand back in @rows the rows of the first report of its
+ * JSON output, which stay owned by the document returned in @doc.
+ *
+ * Returns 0 on success, -1 on error and -2 without reporting an error
+ * if the output can't be used. A failure of the command itself counts
+ * as the latter. Only if LVM rejected --reportformat is the JSON mode
+ * given up on for good, anything else may be transient, such as a
+ * locked volume group.
+ */
+static int
+virStorageBackendLogicalRunJSON(virCommandPtr cmd,
+                                virJSONValuePtr *doc,
+                                virJSONValuePtr *rows)
+{
+    char *output = NULL;
+    char *errbuf = NULL;
+    int exitstatus;
+    int ret = -2;
+
+    *doc = NULL;
+    *rows = NULL;
+
+    virCommandSetOutputBuffer(cmd, &output);
+    virCommandSetErrorBuffer(cmd, &errbuf);
+    if (virCommandRun(cmd, &exitstatus) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (exitstatus != 0) {
+        VIR_DEBUG("LVM JSON report failed with status %d: %s",
+                  exitstatus, NULLSTR(errbuf));
+
+        if (errbuf && strstr(errbuf, "reportformat")) {
+            virMutexLock(&virStorageBackendLogicalReportLock);
+            if (!virStorageBackendLogicalNoJSON) {
+                VIR_INFO("LVM JSON reporting unavailable, using text output");
+                virStorageBackendLogicalNoJSON = true;
+            }
+            virMutexUnlock(&virStorageBackendLogicalReportLock);
+        }
+        goto cleanup;
+    }
+
+    ret = virStorageBackendLogicalParseReport(output, doc, rows);
+
+ cleanup:
+    VIR_FREE(output);
+    VIR_FREE(errbuf);
+    return ret;
+}
+
+
+static void
+virStorageBackendLogicalVGSWorker(void *opaque)
+{
+    struct virStorageBackendLogicalVGSData *data = opaque;
+    virCommandPtr cmd;
+
+    cmd = virCommandNewArgList(VGS,
+                               "--reportformat", "json",
+                               "--units", "b",
+                               "--nosuffix",
+                               "--options", "vg_size,vg_free",
+                               data->vgname,
+                               NULL);
+
+    if ((data->ret = virStorageBackendLogicalRunJSON(cmd, &data->doc,
+                                                     &data->rows)) == -1)
+        data->error = virSaveLastError();
+
+    virCommandFree(cmd);
+}
+
+
+static int
+virStorageBackendLogicalReportFetch(virStorageBackendLogicalReportPtr report,
+                                    const char *vgname)
+{
+    struct virStorageBackendLogicalVGSData vgs = { .vgname = vgname };
+    virJSONValuePtr vg;
+    virCommandPtr cmd = NULL;
+    virThread thread;
+    bool threaded = true;
+    const char *size;
+    const char *avail;
+    int ret;
+
+    if (virThreadCreate(&thread, true,
+                        virStorageBackendLogicalVGSWorker, &vgs) < 0) {
+        VIR_WARN("Failed to start vgs for volume group '%s'", vgname);
+        virResetLastError();
+        threaded = false;
+    }
+
+    cmd = virCommandNewArgList(LVS,
+                               "--reportformat", "json",
+                               "--units", "b",
+                               "--nosuffix",
+                               "--options", VIR_STORAGE_VOL_LOGICAL_FIELDS,
+                               vgname,
+                               NULL);
+    ret = virStorageBackendLogicalRunJSON(cmd, &report->lvs, &report->segs);
+
+    if (threaded)
+        virThreadJoin(&thread);
+    else
+        virStorageBackendLogicalVGSWorker(&vgs);
+
+    if (ret == -1)
+        goto cleanup;
+
+    if (vgs.ret == -1) {
+        virSetError(vgs.error);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (ret == -2 || vgs.ret == -2) {
+        ret = -2;
+        goto cleanup;
+    }
+
+    if (virJSONValueArraySize(vgs.rows) != 1 ||
+        !(vg = virJSONValueArrayGet(vgs.rows, 0)) ||
+        !(size = virJSONValueObjectGetString(vg, "vg_size")) ||
+        !(avail = virJSONValueObjectGetString(vg, "vg_free")) ||
+        virStrToLong_ull(size, NULL, 10, &report->capacity) < 0 ||
+        virStrToLong_ull(avail, NULL, 10, &report->available) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("malformed vgs output for volume group '%s'"),
+                       vgname);
+        ret = -1;
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCommandFree(cmd);
+    virJSONValueFree(vgs.doc);
+    virFreeError(vgs.error);
+    return ret;
+}
+
+
+static virStorageBackendLogicalReportPtr
+virStorageBackendLogicalReportNew(void)
+{
+    virStorageBackendLogicalReportPtr report;
+
+    if (VIR_ALLOC(report) < 0)
+        return NULL;
+
+    if (virCondInit(&report->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        VIR_FREE(report);
+        return NULL;
+    }
+
+    report->refs = 1;
+    return report;
+}
+
+
+/* Must be called with virStorageBackendLogicalReportLock held */
+static void
+virStorageBackendLogicalReportUnref(virStorageBackendLogicalReportPtr report)
+{
+    if (!report || --report->refs > 0)
+        return;
+
+    virCondDestroy(&report->cond);
+    virFreeError(report->error);
+    virJSONValueFree(report->lvs);
+    VIR_FREE(report);
+}
+
+
+static void
+virStorageBackendLogicalReportRelease(virStorageBackendLogicalReportPtr report)
+{
+    virMutexLock(&virStorageBackendLogicalReportLock);
+    virStorageBackendLogicalReportUnref(report);
+    virMutexUnlock(&virStorageBackendLogicalReportLock);
+}
+
+
+/*
+ * Get a JSON report on @vgname reflecting LVM's state at some point
+ * after this call was made, sharing it with concurrent callers.
+ *
+ * Returns 0 and a reference in @report on success, -1 on error, and
+ * -2 if the JSON reporting mode can't be used.
+ */
+static int
+virStorageBackendLogicalReportGet(const char *vgname,
+                                  virStorageBackendLogicalReportPtr *report)
+{
+    virStorageBackendLogicalVGRefreshPtr refresh;
+    virStorageBackendLogicalReportPtr rep = NULL;
+    virStorageBackendLogicalReportPtr prev;
+    bool leader = false;
+    int ret = -1;
+
+    *report = NULL;
+
+    virMutexLock(&virStorageBackendLogicalReportLock);
+
+    if (virStorageBackendLogicalNoJSON) {
+        ret = -2;
+        goto cleanup;
+    }
+
+    if (!virStorageBackendLogicalRefreshes &&
+        !(virStorageBackendLogicalRefreshes = virHashCreate(8, virHashValueFree)))
+        goto cleanup;
+
+    if (!(refresh = virHashLookup(virStorageBackendLogicalRefreshes, vgname))) {
+        if (VIR_ALLOC(refresh) < 0)
+            goto cleanup;
+        if (virHashAddEntry(virStorageBackendLogicalRefreshes,
+                            vgname, refresh) < 0) {
+            VIR_FREE(refresh);
+            goto cleanup;
+        }
+    }
+
+    if (!refresh->running && !refresh->queued) {
+        if (!(rep = virStorageBackendLogicalReportNew()))
+            goto cleanup;
+        refresh->running = rep;
+        leader = true;
+    } else if (refresh->queued) {
+        VIR_DEBUG("joining queued refresh of volume group '%s'", vgname);
+        rep = refresh->queued;
+        rep->refs++;
+    } else {
+        /* The running refresh may have read LVM's state before we were
+         * asked; queue one to run after it for us and anyone else
+         * turning up meanwhile */
+        if (!(rep = virStorageBackendLogicalReportNew()))
+            goto cleanup;
+        refresh->queued = rep;
+        leader = true;
+
+        prev = refresh->running;
+        prev->refs++;
+        while (!prev->done)
+            ignore_value(virCondWait(&prev->cond,
+                                     &virStorageBackendLogicalReportLock));
+        virStorageBackendLogicalReportUnref(prev);
+
+        refresh->running = rep;
+        refresh->queued = NULL;
+    }
+
+    if (leader) {
+        virMutexUnlock(&virStorageBackendLogicalReportLock);
+        ret = virStorageBackendLogicalReportFetch(rep, vgname);
+        virMutexLock(&virStorageBackendLogicalReportLock);
+
+        rep->ret = ret;
+        if (ret == -1)
+            rep->error = virSaveLastError();
+        rep->done = true;
+        virCondBroadcast(&rep->cond);
+
+        refresh->running = NULL;
+        if (!refresh->queued)
+            virHashRemoveEntry(virStorageBackendLogicalRefreshes, vgname);
+    } else {
+        while (!rep->done)
+            ignore_value(virCondWait(&rep->cond,
+                                     &virStorageBackendLogicalReportLock));
+
+        if ((ret = rep->ret) == -1)
+            virSetError(rep->error);
+    }
+
+    if (ret == 0) {
+        *report = rep;
+        rep = NULL;
+    }
+
+ cleanup:
+    virStorageBackendLogicalReportUnref(rep);
+    virMutexUnlock(&virStorageBackendLogicalReportLock);
+    return ret;
+}
+
+
+/**
+ * virStorageBackendLogicalForEachSeg:
+ * @segs: segment rows of an lvs JSON report
+ * @func: callback taking the same groups as the lvs regex produces
+ * @opaque: data for @func
+ *
+ * Map each segment of an lvs JSON report onto the groups that matching
+ * the text output of lvs against VIR_STORAGE_VOL_LOGICAL_REGEX yields,
+ * and call @func with them.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStorageBackendLogicalForEachSeg(virJSONValuePtr segs,
+                                   virStorageBackendLogicalSegFunc func,
+                                   void *opaque)
+{
+    char *groups[VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT] = { NULL };
+    size_t nsegs;
+    size_t i, j;
+    int ret = -1;
+
+    nsegs = virJSONValueArraySize(segs);
+
+    for (i = 0; i < nsegs; i++) {
+        virJSONValuePtr seg = virJSONValueArrayGet(segs, i);
+        bool skip = false;
+
+        for (j = 0; j < VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT; j++) {
+            const char *key = virStorageBackendLogicalJSONKeys[j];
+            const char *value;
+
+            if (!seg || !(value = virJSONValueObjectGetString(seg, key))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("missing '%s' in lvs output"), key);
+                goto cleanup;
+            }
+
+            /* Like the regex, ignore segments without devices and such;
+             * only the origin may legitimately be empty */
+            if (!*value && j != 1)
+                skip = true;
+
+            if (VIR_STRDUP(groups[j], value) < 0)
+                goto cleanup;
+        }
+
+        if (!skip && func(groups, opaque) < 0)
+            goto cleanup;
+
+        for (j = 0; j < VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT; j++)
+            VIR_FREE(groups[j]);
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (j = 0; j < VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT; j++)
+        VIR_FREE(groups[j]);
+    return ret;
+}
+
+
+static int
+virStorageBackendLogicalRefreshPoolJSON(virStoragePoolObjPtr pool)
+{
+    virStorageBackendLogicalReportPtr report = NULL;
+    struct virStorageBackendLogicalPoolVolData cbdata = {
+        .pool = pool,
+        .vol = NULL,
+    };
+    int ret;
+
+    if ((ret = virStorageBackendLogicalReportGet(pool->def->source.name,
+                                                 &report)) < 0)
+        return ret;
+
+    ret = -1;
+    if (virStorageBackendLogicalForEachSeg(report->segs,
+                                           virStorageBackendLogicalMakeVol,
+                                           &cbdata) < 0)
+        goto cleanup;
+
+    pool->def->capacity = report->capacity;
+    pool->def->available = report->available;
+    pool->def->allocation = pool->def->capacity - pool->def->available;
+
+    ret = 0;
+
+ cleanup:
+    virStorageBackendLogicalReportRelease(report);
+    return ret;
+}
+
+
 static int
 virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
                                     virStoragePoolObjPtr pool)
@@ -779,6 +1274,10 @@ virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     virFileWaitForDevices();
 
+    if ((ret = virStorageBackendLogicalRefreshPoolJSON(pool)) != -2)
+        goto cleanup;
+    ret = -1;
+
     /* Get list of all logical volumes */
     if (virStorageBackendLogicalFindLVs(pool, NULL) < 0)
         goto cleanup;
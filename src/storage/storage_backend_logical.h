@@ -25,7 +25,19 @@
 # define __VIR_STORAGE_BACKEND_LOGICAL_H__
 
 # include "storage_backend.h"
+# include "virjson.h"
 
 extern virStorageBackend virStorageBackendLogical;
 
+typedef int (*virStorageBackendLogicalSegFunc)(char **const groups,
+                                               void *opaque);
+
+int virStorageBackendLogicalParseReport(const char *output,
+                                        virJSONValuePtr *doc,
+                                        virJSONValuePtr *rows);
+
+int virStorageBackendLogicalForEachSeg(virJSONValuePtr segs,
+                                       virStorageBackendLogicalSegFunc func,
+                                       void *opaque);
+
 #endif /* __VIR_STORAGE_BACKEND_LOGICAL_H__ */
@@ -23,6 +23,7 @@
 
 #include <config.h>
 
+#include <fcntl.h>
 #include <inttypes.h>
 #include "datatypes.h"
 #include "virerror.h"
@@ -34,6 +35,10 @@
 #include "viruuid.h"
 #include "virstring.h"
 #include "virrandom.h"
+#include "virhash.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "fdstream.h"
 #include "rados/librados.h"
 #include "rbd/librbd.h"
 
@@ -309,13 +314,205 @@ virStorageBackendRBDRefreshVolInfoCb(uint64_t offset ATTRIBUTE_UNUSED,
     return 0;
 }
 
+# if LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0)
+/*
+ * Walking the object map of every image is what makes refreshing a
+ * big pool slow, so remember the result until the image is written to
+ * again. The modification timestamp kept by librbd lags behind writes
+ * by up to rbd_mtime_update_interval, which bounds how stale a cached
+ * allocation can get. Entries are keyed by "<pool uuid>/<image>".
+ */
+#  define VIR_STORAGE_RBD_ALLOCATION_CACHE_MAX 16384
+
+typedef struct _virStorageBackendRBDAllocation virStorageBackendRBDAllocation;
+typedef virStorageBackendRBDAllocation *virStorageBackendRBDAllocationPtr;
+struct _virStorageBackendRBDAllocation {
+    uint64_t size;
+    struct timespec mtime;
+    time_t scanned;             /* when the object map walk started */
+    unsigned int generation;    /* pool refresh that last saw the image */
+    size_t allocation;
+};
+
+static virMutex virStorageBackendRBDAllocationLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageBackendRBDAllocationCache;
+static unsigned int virStorageBackendRBDAllocationLastGeneration;
+
+static char *
+virStorageBackendRBDAllocationKey(virStoragePoolObjPtr pool,
+                                  virStorageVolDefPtr vol)
+{
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    char *key;
+
+    virUUIDFormat(pool->def->uuid, uuid);
+    ignore_value(virAsprintf(&key, "%s/%s", uuid, vol->name));
+    return key;
+}
+
+static bool
+virStorageBackendRBDAllocationGet(const char *key,
+                                  unsigned int generation,
+                                  rbd_image_info_t *info,
+                                  struct timespec *mtime,
+                                  size_t *allocation)
+{
+    virStorageBackendRBDAllocationPtr entry;
+    bool ret = false;
+
+    virMutexLock(&virStorageBackendRBDAllocationLock);
+
+    /* Allow for a second of clock skew between us and the OSDs */
+    if (virStorageBackendRBDAllocationCache &&
+        (entry = virHashLookup(virStorageBackendRBDAllocationCache, key)) &&
+        entry->size == info->size &&
+        entry->mtime.tv_sec == mtime->tv_sec &&
+        entry->mtime.tv_nsec == mtime->tv_nsec &&
+        mtime->tv_sec + 1 < entry->scanned) {
+        if (generation)
+            entry->generation = generation;
+        *allocation = entry->allocation;
+        ret = true;
+    }
+
+    virMutexUnlock(&virStorageBackendRBDAllocationLock);
+    return ret;
+}
+
+static void
+virStorageBackendRBDAllocationPut(const char *key,
+                                  unsigned int generation,
+                                  rbd_image_info_t *info,
+                                  struct timespec *mtime,
+                                  time_t scanned,
+                                  size_t allocation)
+{
+    virStorageBackendRBDAllocationPtr entry = NULL;
+
+    virMutexLock(&virStorageBackendRBDAllocationLock);
+
+    if (!virStorageBackendRBDAllocationCache &&
+        !(virStorageBackendRBDAllocationCache = virHashCreate(256,
+                                                              virHashValueFree)))
+        goto cleanup;
+
+    if (!(entry = virHashLookup(virStorageBackendRBDAllocationCache, key))) {
+        if (virHashSize(virStorageBackendRBDAllocationCache) >=
+            VIR_STORAGE_RBD_ALLOCATION_CACHE_MAX)
+            virHashRemoveAll(virStorageBackendRBDAllocationCache);
+
+        if (VIR_ALLOC(entry) < 0 ||
+            virHashAddEntry(virStorageBackendRBDAllocationCache,
+                            key, entry) < 0) {
+            VIR_FREE(entry);
+            goto cleanup;
+        }
+    }
+
+    entry->size = info->size;
+    entry->mtime = *mtime;
+    entry->scanned = scanned;
+    if (generation)
+        entry->generation = generation;
+    entry->allocation = allocation;
+
+ cleanup:
+    virResetLastError();
+    virMutexUnlock(&virStorageBackendRBDAllocationLock);
+}
+
+/* Every full refresh tags the images it sees with a generation of its
+ * own, so that refreshes of different pools running at the same time
+ * don't take each other's images for stale. Zero is left for refreshes
+ * of single volumes, which don't tag anything. */
+static unsigned int
+virStorageBackendRBDAllocationNewGeneration(void)
+{
+    unsigned int generation;
+
+    virMutexLock(&virStorageBackendRBDAllocationLock);
+    if (!++virStorageBackendRBDAllocationLastGeneration)
+        ++virStorageBackendRBDAllocationLastGeneration;
+    generation = virStorageBackendRBDAllocationLastGeneration;
+    virMutexUnlock(&virStorageBackendRBDAllocationLock);
+
+    return generation;
+}
+
+struct virStorageBackendRBDAllocationPruneData {
+    const char *prefix;
+    unsigned int generation;
+};
+
+static int
+virStorageBackendRBDAllocationIsStale(const void *payload,
+                                      const void *name,
+                                      const void *opaque)
+{
+    const virStorageBackendRBDAllocation *entry = payload;
+    const struct virStorageBackendRBDAllocationPruneData *data = opaque;
+
+    return STRPREFIX(name, data->prefix) &&
+        entry->generation != data->generation;
+}
+
+/* Forget the images of @pool which the full refresh tagging them with
+ * @generation didn't see */
+static void
+virStorageBackendRBDAllocationPrune(virStoragePoolObjPtr pool,
+                                    unsigned int generation)
+{
+    char uuid[VIR_UUID_STRING_BUFLEN + 1];
+    struct virStorageBackendRBDAllocationPruneData data = { uuid, generation };
+
+    virUUIDFormat(pool->def->uuid, uuid);
+    strcat(uuid, "/");
+
+    virMutexLock(&virStorageBackendRBDAllocationLock);
+    if (virStorageBackendRBDAllocationCache)
+        virHashRemoveSet(virStorageBackendRBDAllocationCache,
+                         virStorageBackendRBDAllocationIsStale, &data);
+    virMutexUnlock(&virStorageBackendRBDAllocationLock);
+}
+# else /* LIBRBD_VERSION_CODE < LIBRBD_VER(1, 12, 0) */
+static unsigned int
+virStorageBackendRBDAllocationNewGeneration(void)
+{
+    return 0;
+}
+
+static void
+virStorageBackendRBDAllocationPrune(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                                    unsigned int generation ATTRIBUTE_UNUSED)
+{
+}
+# endif /* LIBRBD_VERSION_CODE < LIBRBD_VER(1, 12, 0) */
+
 static int
-virStorageBackendRBDSetAllocation(virStorageVolDefPtr vol,
+virStorageBackendRBDSetAllocation(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                                  virStorageVolDefPtr vol,
+                                  unsigned int generation ATTRIBUTE_UNUSED,
                                   rbd_image_t *image,
                                   rbd_image_info_t *info)
 {
     int r, ret = -1;
     size_t allocation = 0;
+# if LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0)
+    struct timespec mtime;
+    time_t scanned = time(NULL);
+    char *key = NULL;
+
+    if ((r = rbd_get_modify_timestamp(image, &mtime)) < 0) {
+        VIR_DEBUG("Cannot get modification time of RBD image %s: %d",
+                  vol->name, r);
+    } else if (!(key = virStorageBackendRBDAllocationKey(pool, vol))) {
+        goto cleanup;
+    } else if (virStorageBackendRBDAllocationGet(key, generation, info,
+                                                 &mtime, &allocation)) {
+        VIR_DEBUG("Using cached allocation of RBD image %s", vol->name);
+        goto done;
+    }
+# endif
 
     if ((r = rbd_diff_iterate2(image, NULL, 0, info->size, 0, 1,
                                &virStorageBackendRBDRefreshVolInfoCb,
@@ -325,6 +522,13 @@ virStorageBackendRBDSetAllocation(virStorageVolDefPtr vol,
         goto cleanup;
     }
 
+# if LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0)
+    if (key)
+        virStorageBackendRBDAllocationPut(key, generation, info, &mtime,
+                                          scanned, allocation);
+
+ done:
+# endif
     VIR_DEBUG("Found %zu bytes allocated for RBD image %s",
               allocation, vol->name);
 
@@ -332,6 +536,9 @@ virStorageBackendRBDSetAllocation(virStorageVolDefPtr vol,
     ret = 0;
 
  cleanup:
+# if LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0)
+    VIR_FREE(key);
+# endif
     return ret;
 }
 
@@ -342,8 +549,22 @@ volStorageBackendRBDUseFastDiff(uint64_t features ATTRIBUTE_UNUSED)
     return false;
 }
 
+static unsigned int
+virStorageBackendRBDAllocationNewGeneration(void)
+{
+    return 0;
+}
+
+static void
+virStorageBackendRBDAllocationPrune(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                                    unsigned int generation ATTRIBUTE_UNUSED)
+{
+}
+
 static int
-virStorageBackendRBDSetAllocation(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
+virStorageBackendRBDSetAllocation(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                                  virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
+                                  unsigned int generation ATTRIBUTE_UNUSED,
                                   rbd_image_t *image ATTRIBUTE_UNUSED,
                                   rbd_image_info_t *info ATTRIBUTE_UNUSED)
 {
@@ -354,7 +575,8 @@ virStorageBackendRBDSetAllocation(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
 static int
 volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
                                    virStoragePoolObjPtr pool,
-                                   virStorageBackendRBDStatePtr ptr)
+                                   virStorageBackendRBDStatePtr ptr,
+                                   unsigned int generation)
 {
     int ret = -1;
     int r = 0;
@@ -363,14 +585,14 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     uint64_t features;
 
     if ((r = rbd_open_read_only(ptr->ioctx, vol->name, &image, NULL)) < 0) {
-        ret = -r;
+        ret = r;
         virReportSystemError(-r, _("failed to open the RBD image '%s'"),
                              vol->name);
         goto cleanup;
     }
 
     if ((r = rbd_stat(image, &info, sizeof(info))) < 0) {
-        ret = -r;
+        ret = r;
         virReportSystemError(-r, _("failed to stat the RBD image '%s'"),
                              vol->name);
         goto cleanup;
@@ -388,7 +610,8 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
                   "Querying for actual allocation",
                   pool->def->source.name, vol->name);
 
-        if (virStorageBackendRBDSetAllocation(vol, image, &info) < 0)
+        if (virStorageBackendRBDSetAllocation(pool, vol, generation,
+                                              image, &info) < 0)
             goto cleanup;
     } else {
         vol->target.allocation = info.obj_size * info.num_objs;
@@ -419,6 +642,69 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     return ret;
 }
 
+/* Images are opened by this many threads at once, sharing the RADOS
+ * connection of the refresh */
+#define VIR_STORAGE_RBD_REFRESH_WORKERS 8
+
+typedef struct _virStorageBackendRBDRefreshJob virStorageBackendRBDRefreshJob;
+typedef virStorageBackendRBDRefreshJob *virStorageBackendRBDRefreshJobPtr;
+struct _virStorageBackendRBDRefreshJob {
+    virMutex lock;
+    virStoragePoolObjPtr pool;
+    virStorageBackendRBDStatePtr ptr;
+    unsigned int generation;    /* tag of the images in the allocation cache */
+    virStorageVolDefPtr *vols;  /* NULL once found to be gone */
+    size_t nvols;
+    size_t next;                /* first image nobody looked at yet */
+    virErrorPtr err;            /* first failure */
+};
+
+static void
+virStorageBackendRBDRefreshWorker(void *opaque)
+{
+    virStorageBackendRBDRefreshJobPtr job = opaque;
+
+    while (true) {
+        virStorageVolDefPtr vol;
+        size_t i;
+        int r;
+
+        virMutexLock(&job->lock);
+        if (job->err || job->next >= job->nvols) {
+            virMutexUnlock(&job->lock);
+            break;
+        }
+        i = job->next++;
+        vol = job->vols[i];
+        virMutexUnlock(&job->lock);
+
+        r = volStorageBackendRBDRefreshVolInfo(vol, job->pool, job->ptr,
+                                               job->generation);
+
+        /* It could be that a volume has been deleted through a different route
+         * then libvirt and that will cause a -ENOENT to be returned.
+         *
+         * Another possibility is that there is something wrong with the placement
+         * group (PG) that RBD image's header is in and that causes -ETIMEDOUT
+         * to be returned.
+         *
+         * Do not error out and simply ignore the volume
+         */
+        if (r == -ENOENT || r == -ETIMEDOUT) {
+            virResetLastError();
+            virMutexLock(&job->lock);
+            job->vols[i] = NULL;
+            virMutexUnlock(&job->lock);
+            virStorageVolDefFree(vol);
+        } else if (r < 0) {
+            virMutexLock(&job->lock);
+            if (!job->err)
+                job->err = virSaveLastError();
+            virMutexUnlock(&job->lock);
+        }
+    }
+}
+
 static int
 virStorageBackendRBDRefreshPool(virConnectPtr conn,
                                 virStoragePoolObjPtr pool)
@@ -433,6 +719,17 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
     ptr.ioctx = NULL;
     struct rados_cluster_stat_t clusterstat;
     struct rados_pool_stat_t poolstat;
+    virStorageBackendRBDRefreshJob job;
+    virThread workers[VIR_STORAGE_RBD_REFRESH_WORKERS];
+    size_t nworkers = 0;
+    size_t i;
+
+    memset(&job, 0, sizeof(job));
+    if (virMutexInit(&job.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
 
     if (virStorageBackendRBDOpenRADOSConn(&ptr, conn, &pool->def->source) < 0)
         goto cleanup;
@@ -483,45 +780,64 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
         if (VIR_ALLOC(vol) < 0)
             goto cleanup;
 
-        if (VIR_STRDUP(vol->name, name) < 0) {
-            VIR_FREE(vol);
+        if (VIR_STRDUP(vol->name, name) < 0 ||
+            VIR_APPEND_ELEMENT(job.vols, job.nvols, vol) < 0) {
+            virStorageVolDefFree(vol);
             goto cleanup;
         }
 
         name += strlen(name) + 1;
+    }
 
-        r = volStorageBackendRBDRefreshVolInfo(vol, pool, &ptr);
+    job.pool = pool;
+    job.ptr = &ptr;
+    job.generation = virStorageBackendRBDAllocationNewGeneration();
 
-        /* It could be that a volume has been deleted through a different route
-         * then libvirt and that will cause a -ENOENT to be returned.
-         *
-         * Another possibility is that there is something wrong with the placement
-         * group (PG) that RBD image's header is in and that causes -ETIMEDOUT
-         * to be returned.
-         *
-         * Do not error out and simply ignore the volume
-         */
-        if (r < 0) {
-            if (r == -ENOENT || r == -ETIMEDOUT)
-                continue;
-
-            virStorageVolDefFree(vol);
-            goto cleanup;
+    for (i = 0; i < VIR_STORAGE_RBD_REFRESH_WORKERS - 1 &&
+         i + 1 < job.nvols; i++) {
+        if (virThreadCreate(&workers[nworkers], true,
+                            virStorageBackendRBDRefreshWorker, &job) < 0) {
+            virResetLastError();
+            break;
         }
+        nworkers++;
+    }
 
-        if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0) {
-            virStorageVolDefFree(vol);
+    /* Also covers the case where no thread could be started */
+    virStorageBackendRBDRefreshWorker(&job);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (job.err) {
+        virSetError(job.err);
+        goto cleanup;
+    }
+
+    for (i = 0; i < job.nvols; i++) {
+        if (!job.vols[i])
+            continue;
+
+        if (virStoragePoolObjAddVol(pool, job.vols[i]) < 0) {
             virStoragePoolObjClearVols(pool);
             goto cleanup;
         }
+        job.vols[i] = NULL;
     }
 
+    virStorageBackendRBDAllocationPrune(pool, job.generation);
+
     VIR_DEBUG("Found %zu images in RBD pool %s",
               pool->volumes.count, pool->def->source.name);
 
     ret = 0;
 
  cleanup:
+    for (i = 0; i < job.nvols; i++)
+        virStorageVolDefFree(job.vols[i]);
+    VIR_FREE(job.vols);
+    virFreeError(job.err);
+    virMutexDestroy(&job.lock);
     VIR_FREE(names);
     virStorageBackendRBDCloseRADOSConn(&ptr);
     return ret;
@@ -1100,7 +1416,7 @@ virStorageBackendRBDRefreshVol(virConnectPtr conn,
     if (virStorageBackendRBDOpenIoCTX(&ptr, pool) < 0)
         goto cleanup;
 
-    if (volStorageBackendRBDRefreshVolInfo(vol, pool, &ptr) < 0)
+    if (volStorageBackendRBDRefreshVolInfo(vol, pool, &ptr, 0) < 0)
         goto cleanup;
 
     ret = 0;
@@ -1314,6 +1630,228 @@ virStorageBackendRBDVolWipe(virConnectPtr conn,
     return ret;
 }
 
+typedef struct _virStorageBackendRBDStream virStorageBackendRBDStream;
+typedef virStorageBackendRBDStream *virStorageBackendRBDStreamPtr;
+struct _virStorageBackendRBDStream {
+    virStorageBackendRBDState ptr;
+    rbd_image_t image;
+    char *name;
+    rbd_completion_t *comps;    /* one per slot */
+    size_t *lens;
+    bool *writes;
+    virStorageBackendStreamAIO aio;
+};
+
+static void
+virStorageBackendRBDStreamFree(void *opaque)
+{
+    virStorageBackendRBDStreamPtr data = opaque;
+
+    if (!data)
+        return;
+
+    if (data->image)
+        rbd_close(data->image);
+    virStorageBackendRBDCloseRADOSConn(&data->ptr);
+    VIR_FREE(data->comps);
+    VIR_FREE(data->lens);
+    VIR_FREE(data->writes);
+    VIR_FREE(data->name);
+    VIR_FREE(data);
+}
+
+static int
+virStorageBackendRBDStreamSubmit(void *opaque,
+                                 size_t slot,
+                                 bool write,
+                                 char *buf,
+                                 size_t len,
+                                 unsigned long long offset)
+{
+    virStorageBackendRBDStreamPtr data = opaque;
+    int r;
+
+    if ((r = rbd_aio_create_completion(NULL, NULL, &data->comps[slot])) < 0)
+        return r;
+
+    if (write)
+        r = rbd_aio_write(data->image, offset, len, buf, data->comps[slot]);
+    else
+        r = rbd_aio_read(data->image, offset, len, buf, data->comps[slot]);
+
+    if (r < 0) {
+        rbd_aio_release(data->comps[slot]);
+        return r;
+    }
+
+    data->lens[slot] = len;
+    data->writes[slot] = write;
+    return 0;
+}
+
+static ssize_t
+virStorageBackendRBDStreamWait(void *opaque,
+                               size_t slot)
+{
+    virStorageBackendRBDStreamPtr data = opaque;
+    ssize_t r;
+
+    rbd_aio_wait_for_complete(data->comps[slot]);
+    r = rbd_aio_get_return_value(data->comps[slot]);
+    rbd_aio_release(data->comps[slot]);
+
+    /* Depending on the version, librbd reports 0 for a complete write */
+    if (r >= 0 && data->writes[slot])
+        r = data->lens[slot];
+    return r;
+}
+
+static int
+virStorageBackendRBDStreamUpload(int fd,
+                                 void *opaque)
+{
+    virStorageBackendRBDStreamPtr data = opaque;
+    int r;
+
+    if (virStorageBackendStreamAIOUpload(fd, &data->aio) < 0)
+        return -1;
+
+    if ((r = rbd_flush(data->image)) < 0) {
+        virReportSystemError(-r, _("failed to flush the RBD image '%s'"),
+                             data->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+virStorageBackendRBDStreamDownload(int fd,
+                                   void *opaque)
+{
+    virStorageBackendRBDStreamPtr data = opaque;
+
+    return virStorageBackendStreamAIODownload(fd, &data->aio);
+}
+
+/*
+ * Stream the image with librbd's asynchronous I/O. The RADOS
+ * connection is set up here, so that any error in doing so is
+ * reported to the caller, and then handed over to the stream thread.
+ */
+static int
+virStorageBackendRBDVolStream(virConnectPtr conn,
+                              virStoragePoolObjPtr pool,
+                              virStorageVolDefPtr vol,
+                              virStreamPtr stream,
+                              unsigned long long offset,
+                              unsigned long long len,
+                              bool upload)
+{
+    virStorageBackendRBDStreamPtr data = NULL;
+    rbd_image_info_t info;
+    size_t depth = pool->def->streamQueue;
+    int r;
+
+    if (!depth)
+        depth = VIR_STORAGE_BACKEND_STREAM_QUEUE_DEFAULT;
+
+    if (VIR_ALLOC(data) < 0 ||
+        VIR_ALLOC_N(data->comps, depth) < 0 ||
+        VIR_ALLOC_N(data->lens, depth) < 0 ||
+        VIR_ALLOC_N(data->writes, depth) < 0 ||
+        VIR_STRDUP(data->name, vol->name) < 0)
+        goto error;
+
+    if (virStorageBackendRBDOpenRADOSConn(&data->ptr, conn,
+                                          &pool->def->source) < 0)
+        goto error;
+
+    if (virStorageBackendRBDOpenIoCTX(&data->ptr, pool) < 0)
+        goto error;
+
+    if (upload)
+        r = rbd_open(data->ptr.ioctx, vol->name, &data->image, NULL);
+    else
+        r = rbd_open_read_only(data->ptr.ioctx, vol->name, &data->image, NULL);
+    if (r < 0) {
+        data->image = NULL;
+        virReportSystemError(-r, _("failed to open the RBD image '%s'"),
+                             vol->name);
+        goto error;
+    }
+
+    if ((r = rbd_stat(data->image, &info, sizeof(info))) < 0) {
+        virReportSystemError(-r, _("failed to stat the RBD image '%s'"),
+                             vol->name);
+        goto error;
+    }
+
+    if (offset > info.size) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("offset %llu is beyond the end of RBD image '%s'"),
+                       offset, vol->name);
+        goto error;
+    }
+
+    data->aio.path = data->name;
+    data->aio.offset = offset;
+    data->aio.end = info.size;
+    if (len && len < info.size - offset)
+        data->aio.end = offset + len;
+    data->aio.depth = depth;
+    data->aio.submit = virStorageBackendRBDStreamSubmit;
+    data->aio.wait = virStorageBackendRBDStreamWait;
+    data->aio.opaque = data;
+
+    VIR_DEBUG("Streaming RBD image %s/%s from offset %llu to %llu "
+              "with %zu requests in flight",
+              pool->def->source.name, vol->name,
+              offset, data->aio.end, depth);
+
+    if (virFDStreamOpenThread(stream, len, upload ? O_WRONLY : O_RDONLY,
+                              upload ? virStorageBackendRBDStreamUpload :
+                                       virStorageBackendRBDStreamDownload,
+                              data, virStorageBackendRBDStreamFree) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virStorageBackendRBDStreamFree(data);
+    return -1;
+}
+
+static int
+virStorageBackendRBDVolUpload(virConnectPtr conn,
+                              virStoragePoolObjPtr pool,
+                              virStorageVolDefPtr vol,
+                              virStreamPtr stream,
+                              unsigned long long offset,
+                              unsigned long long len,
+                              unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    return virStorageBackendRBDVolStream(conn, pool, vol, stream,
+                                         offset, len, true);
+}
+
+static int
+virStorageBackendRBDVolDownload(virConnectPtr conn,
+                                virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr vol,
+                                virStreamPtr stream,
+                                unsigned long long offset,
+                                unsigned long long len,
+                                unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    return virStorageBackendRBDVolStream(conn, pool, vol, stream,
+                                         offset, len, false);
+}
+
 virStorageBackend virStorageBackendRBD = {
     .type = VIR_STORAGE_POOL_RBD,
 
@@ -1324,5 +1862,7 @@ virStorageBackend virStorageBackendRBD = {
     .refreshVol = virStorageBackendRBDRefreshVol,
     .deleteVol = virStorageBackendRBDDeleteVol,
     .resizeVol = virStorageBackendRBDResizeVol,
+    .uploadVol = virStorageBackendRBDVolUpload,
+    .downloadVol = virStorageBackendRBDVolDownload,
     .wipeVol = virStorageBackendRBDVolWipe
 };
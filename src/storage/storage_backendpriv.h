@@ -0,0 +1,44 @@
+/*
+ * storage_backendpriv.h: private declarations for the storage backend
+ *                        helpers
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_STORAGE_BACKENDPRIV_H__
+# define __VIR_STORAGE_BACKENDPRIV_H__
+
+# include <sys/types.h>
+
+# include "storage_conf.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+int virStorageBackendCopyRange(virStorageVolDefPtr vol,
+                               virStorageVolDefPtr inputvol,
+                               int inputfd,
+                               int fd,
+                               off_t offset,
+                               off_t len,
+                               bool *use_copy_range,
+                               char *buf,
+                               size_t buflen);
+
+#endif /* __VIR_STORAGE_BACKENDPRIV_H__ */
@@ -35,11 +35,15 @@
 #endif
 #include <errno.h>
 #include <string.h>
+#ifdef __linux__
+# include <sys/inotify.h>
+#endif
 
 #include "virerror.h"
 #include "datatypes.h"
 #include "driver.h"
 #include "storage_driver.h"
+#include "storage_driverpriv.h"
 #include "storage_conf.h"
 #include "viralloc.h"
 #include "storage_backend.h"
@@ -50,6 +54,9 @@
 #include "virstring.h"
 #include "viraccessapicheck.h"
 #include "dirname.h"
+#include "virevent.h"
+#include "viratomic.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -57,13 +64,21 @@ VIR_LOG_INIT("storage.storage_driver");
 
 static virStorageDriverStatePtr driver;
 
-static int storageStateCleanup(void);
+static int storagePoolWatchValidate(virStoragePoolDefPtr def,
+                                    virStorageBackendPtr backend);
+static void storagePoolWatchStart(virStoragePoolObjPtr pool,
+                                  virStorageBackendPtr backend);
+static void storagePoolWatchStop(virStoragePoolObjPtr pool);
+static virStoragePoolObjPtr storagePoolWatchWait(virStoragePoolObjPtr pool,
+                                                 virStoragePoolPtr obj);
 
 typedef struct _virStorageVolStreamInfo virStorageVolStreamInfo;
 typedef virStorageVolStreamInfo *virStorageVolStreamInfoPtr;
 struct _virStorageVolStreamInfo {
     char *pool_name;
+    char *vol_name; /* refresh just this volume, NULL for the whole pool */
     char *vol_path;
+    bool watch;     /* refresh started by the directory watch */
 };
 
 static void storageDriverLock(void)
@@ -75,6 +90,125 @@ static void storageDriverUnlock(void)
     virMutexUnlock(&driver->lock);
 }
 
+/*
+ * Refresh the volume list of the active @pool. If the backend can
+ * update the pool in place, the driver lock is released meanwhile and
+ * the current volumes stay visible until the new list is ready.
+ * Called, and returns, with the driver and @pool locked.
+ */
+static int
+storagePoolRefreshVols(virConnectPtr conn,
+                       virStoragePoolObjPtr pool,
+                       virStorageBackendPtr backend)
+{
+    int ret;
+
+    if (!backend->updatePool) {
+        virStoragePoolObjClearVols(pool);
+        return backend->refreshPool(conn, pool);
+    }
+
+    /* The async job keeps the pool from being stopped or removed
+     * while we do not hold the driver lock */
+    pool->asyncjobs++;
+    storageDriverUnlock();
+
+    ret = backend->updatePool(conn, pool);
+
+    virStoragePoolObjUnlock(pool);
+    storageDriverLock();
+    virStoragePoolObjLock(pool);
+    pool->asyncjobs--;
+
+    /* The update read the pool usage afresh */
+    if (ret == 0 && virTimeMillisNow(&pool->statsTime) < 0)
+        virResetLastError();
+
+    return ret;
+}
+
+/*
+ * Account for a volume of @pool whose allocation went from @oldalloc to
+ * @newalloc, keeping the pool usage current between refreshes. The disk
+ * backend updates the pool values itself.
+ */
+void
+storagePoolUpdateUsage(virStoragePoolObjPtr pool,
+                       unsigned long long oldalloc,
+                       unsigned long long newalloc)
+{
+    virStoragePoolDefPtr def = pool->def;
+    unsigned long long delta;
+
+    if (def->type == VIR_STORAGE_POOL_DISK)
+        return;
+
+    /* The numbers are estimates until the pool is read again, never let
+     * them wrap around or exceed what the pool holds */
+    if (newalloc >= oldalloc) {
+        delta = newalloc - oldalloc;
+        def->allocation += delta;
+        def->available -= MIN(delta, def->available);
+    } else {
+        delta = oldalloc - newalloc;
+        def->allocation -= MIN(delta, def->allocation);
+        def->available += delta;
+        if (def->capacity && def->allocation <= def->capacity)
+            def->available = MIN(def->available,
+                                 def->capacity - def->allocation);
+    }
+}
+
+static int
+storagePoolStatsValidate(virStoragePoolDefPtr def,
+                         virStorageBackendPtr backend)
+{
+    if (def->refreshStats && !backend->statPool) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("storage pool type '%s' does not support "
+                         "polling its usage"),
+                       virStoragePoolTypeToString(def->type));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Re-read the usage of the active @pool from the backend if it asks to
+ * be polled and the last reading is older than the configured period.
+ * Failing to do so is not fatal, the accounted numbers are still there.
+ */
+static void
+storagePoolStatsUpdate(virConnectPtr conn,
+                       virStoragePoolObjPtr pool,
+                       virStorageBackendPtr backend)
+{
+    unsigned long long now;
+
+    if (!pool->def->refreshStats || !backend->statPool ||
+        !virStoragePoolObjIsActive(pool))
+        return;
+
+    if (virTimeMillisNow(&now) < 0)
+        goto error;
+
+    if (pool->statsTime &&
+        now - pool->statsTime < pool->def->refreshStats * 1000ULL)
+        return;
+
+    if (backend->statPool(conn, pool) < 0)
+        goto error;
+
+    pool->statsTime = now;
+    return;
+
+ error:
+    VIR_WARN("Failed to read usage of storage pool '%s': %s",
+             pool->def->name, virGetLastErrorMessage());
+    virResetLastError();
+}
+
 static void
 storagePoolUpdateState(virStoragePoolObjPtr pool)
 {
@@ -93,6 +227,18 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
         goto error;
     }
 
+    /* Configs loaded from disk did not go through the define checks */
+    if (storagePoolStatsValidate(pool->def, backend) < 0 ||
+        (pool->newDef &&
+         storagePoolStatsValidate(pool->newDef, backend) < 0)) {
+        VIR_WARN("Not polling usage of storage pool '%s': %s",
+                 pool->def->name, virGetLastErrorMessage());
+        virResetLastError();
+        pool->def->refreshStats = 0;
+        if (pool->newDef)
+            pool->newDef->refreshStats = 0;
+    }
+
     /* Backends which do not support 'checkPool' are considered
      * inactive by default.
      */
@@ -122,6 +268,8 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
     }
 
     pool->active = active;
+    if (active)
+        storagePoolWatchStart(pool, backend);
     ret = 0;
  error:
     if (ret < 0) {
@@ -202,6 +350,7 @@ storageDriverAutostart(void)
                                pool->def->name, virGetLastErrorMessage());
             } else {
                 pool->active = true;
+                storagePoolWatchStart(pool, backend);
             }
             VIR_FREE(stateFile);
         }
@@ -216,7 +365,7 @@ storageDriverAutostart(void)
  *
  * Initialization function for the Storage Driver
  */
-static int
+int
 storageStateInitialize(bool privileged,
                        virStateInhibitCallback callback ATTRIBUTE_UNUSED,
                        void *opaque ATTRIBUTE_UNUSED)
@@ -232,6 +381,11 @@ storageStateInitialize(bool privileged,
         VIR_FREE(driver);
         return ret;
     }
+    if (virCondInit(&driver->jobsCond) < 0) {
+        virMutexDestroy(&driver->lock);
+        VIR_FREE(driver);
+        return ret;
+    }
     storageDriverLock();
 
     if (privileged) {
@@ -258,6 +412,9 @@ storageStateInitialize(bool privileged,
     }
     driver->privileged = privileged;
 
+    if (!(driver->volKeyPools = virHashCreate(32, virHashValueFree)))
+        goto error;
+
     if (virFileMakePath(driver->stateDir) < 0) {
         virReportError(errno,
                        _("cannot create directory %s"),
@@ -336,21 +493,35 @@ storageStateReload(void)
  *
  * Shutdown the storage driver, it will stop all active storage pools
  */
-static int
+int
 storageStateCleanup(void)
 {
+    size_t i;
+
     if (!driver)
         return -1;
 
     storageDriverLock();
 
+    /* Background volume jobs hold on to pools, ask them to stop */
+    for (i = 0; i < driver->njobs; i++)
+        virAtomicIntSet(&driver->jobs[i]->cancelled, 1);
+    while (driver->njobs)
+        ignore_value(virCondWait(&driver->jobsCond, &driver->lock));
+    VIR_FREE(driver->jobs);
+
+    for (i = 0; i < driver->pools.count; i++)
+        storagePoolWatchStop(driver->pools.objs[i]);
+
     /* free inactive pools */
     virStoragePoolObjListFree(&driver->pools);
+    virHashFree(driver->volKeyPools);
 
     VIR_FREE(driver->configDir);
     VIR_FREE(driver->autostartDir);
     VIR_FREE(driver->stateDir);
     storageDriverUnlock();
+    virCondDestroy(&driver->jobsCond);
     virMutexDestroy(&driver->lock);
     VIR_FREE(driver);
 
@@ -694,6 +865,10 @@ storagePoolCreateXML(virConnectPtr conn,
     if ((backend = virStorageBackendForType(def->type)) == NULL)
         goto cleanup;
 
+    if (storagePoolWatchValidate(def, backend) < 0 ||
+        storagePoolStatsValidate(def, backend) < 0)
+        goto cleanup;
+
     if (!(pool = virStoragePoolObjAssignDef(&driver->pools, def)))
         goto cleanup;
     def = NULL;
@@ -737,6 +912,7 @@ storagePoolCreateXML(virConnectPtr conn,
     }
     VIR_INFO("Creating storage pool '%s'", pool->def->name);
     pool->active = true;
+    storagePoolWatchStart(pool, backend);
 
     ret = virGetStoragePool(conn, pool->def->name, pool->def->uuid,
                             NULL, NULL);
@@ -758,6 +934,7 @@ storagePoolDefineXML(virConnectPtr conn,
     virStoragePoolDefPtr def;
     virStoragePoolObjPtr pool = NULL;
     virStoragePoolPtr ret = NULL;
+    virStorageBackendPtr backend;
 
     virCheckFlags(0, NULL);
 
@@ -774,7 +951,11 @@ storagePoolDefineXML(virConnectPtr conn,
     if (virStoragePoolSourceFindDuplicate(conn, &driver->pools, def) < 0)
         goto cleanup;
 
-    if (virStorageBackendForType(def->type) == NULL)
+    if ((backend = virStorageBackendForType(def->type)) == NULL)
+        goto cleanup;
+
+    if (storagePoolWatchValidate(def, backend) < 0 ||
+        storagePoolStatsValidate(def, backend) < 0)
         goto cleanup;
 
     if (!(pool = virStoragePoolObjAssignDef(&driver->pools, def)))
@@ -927,6 +1108,7 @@ storagePoolCreate(virStoragePoolPtr obj,
     }
 
     pool->active = true;
+    storagePoolWatchStart(pool, backend);
     ret = 0;
 
  cleanup:
@@ -992,6 +1174,9 @@ storagePoolDestroy(virStoragePoolPtr obj)
     if (virStoragePoolDestroyEnsureACL(obj->conn, pool->def) < 0)
         goto cleanup;
 
+    if (!(pool = storagePoolWatchWait(pool, obj)))
+        goto cleanup;
+
     if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
         goto cleanup;
 
@@ -1018,6 +1203,8 @@ storagePoolDestroy(virStoragePoolPtr obj)
     unlink(stateFile);
     VIR_FREE(stateFile);
 
+    storagePoolWatchStop(pool);
+
     if (backend->stopPool &&
         backend->stopPool(obj->conn, pool) < 0)
         goto cleanup;
@@ -1125,6 +1312,9 @@ storagePoolRefresh(virStoragePoolPtr obj,
     if (virStoragePoolRefreshEnsureACL(obj->conn, pool->def) < 0)
         goto cleanup;
 
+    if (!(pool = storagePoolWatchWait(pool, obj)))
+        goto cleanup;
+
     if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
         goto cleanup;
 
@@ -1141,8 +1331,8 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(pool);
-    if (backend->refreshPool(obj->conn, pool) < 0) {
+    if (storagePoolRefreshVols(obj->conn, pool, backend) < 0) {
+        storagePoolWatchStop(pool);
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
 
@@ -1169,6 +1359,7 @@ storagePoolGetInfo(virStoragePoolPtr obj,
                    virStoragePoolInfoPtr info)
 {
     virStoragePoolObjPtr pool;
+    virStorageBackendPtr backend;
     int ret = -1;
 
     if (!(pool = virStoragePoolObjFromStoragePool(obj)))
@@ -1177,9 +1368,11 @@ storagePoolGetInfo(virStoragePoolPtr obj,
     if (virStoragePoolGetInfoEnsureACL(obj->conn, pool->def) < 0)
         goto cleanup;
 
-    if (virStorageBackendForType(pool->def->type) == NULL)
+    if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
         goto cleanup;
 
+    storagePoolStatsUpdate(obj->conn, pool, backend);
+
     memset(info, 0, sizeof(virStoragePoolInfo));
     if (pool->active)
         info->state = VIR_STORAGE_POOL_RUNNING;
@@ -1201,6 +1394,7 @@ storagePoolGetXMLDesc(virStoragePoolPtr obj,
 {
     virStoragePoolObjPtr pool;
     virStoragePoolDefPtr def;
+    virStorageBackendPtr backend;
     char *ret = NULL;
 
     virCheckFlags(VIR_STORAGE_XML_INACTIVE, NULL);
@@ -1211,6 +1405,11 @@ storagePoolGetXMLDesc(virStoragePoolPtr obj,
     if (virStoragePoolGetXMLDescEnsureACL(obj->conn, pool->def) < 0)
         goto cleanup;
 
+    if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
+        goto cleanup;
+
+    storagePoolStatsUpdate(obj->conn, pool, backend);
+
     if ((flags & VIR_STORAGE_XML_INACTIVE) && pool->newDef)
         def = pool->newDef;
     else
@@ -1488,42 +1687,75 @@ storageVolLookupByName(virStoragePoolPtr obj,
 }
 
 
-static virStorageVolPtr
-storageVolLookupByKey(virConnectPtr conn,
-                      const char *key)
+/*
+ * Find the active pool holding a volume with @key, trying the pool
+ * recorded in the driver's key index first. Returns the pool locked,
+ * with @vol set, or NULL if no pool has such volume.
+ */
+static virStoragePoolObjPtr
+storageVolLookupPoolByKey(const char *key,
+                          virStorageVolDefPtr *vol)
 {
+    virStoragePoolObjPtr pool;
+    const char *poolname;
+    char *name = NULL;
     size_t i;
-    virStorageVolPtr ret = NULL;
 
-    storageDriverLock();
-    for (i = 0; i < driver->pools.count && !ret; i++) {
-        virStoragePoolObjLock(driver->pools.objs[i]);
-        if (virStoragePoolObjIsActive(driver->pools.objs[i])) {
-            virStorageVolDefPtr vol =
-                virStorageVolDefFindByKey(driver->pools.objs[i], key);
-
-            if (vol) {
-                virStoragePoolDefPtr def = driver->pools.objs[i]->def;
-                if (virStorageVolLookupByKeyEnsureACL(conn, def, vol) < 0) {
-                    virStoragePoolObjUnlock(driver->pools.objs[i]);
-                    goto cleanup;
-                }
+    if ((poolname = virHashLookup(driver->volKeyPools, key)) &&
+        (pool = virStoragePoolObjFindByName(&driver->pools, poolname))) {
+        if (virStoragePoolObjIsActive(pool) &&
+            (*vol = virStorageVolDefFindByKey(pool, key)))
+            return pool;
+        virStoragePoolObjUnlock(pool);
+    }
+
+    for (i = 0; i < driver->pools.count; i++) {
+        pool = driver->pools.objs[i];
 
-                ret = virGetStorageVol(conn,
-                                       def->name,
-                                       vol->name,
-                                       vol->key,
-                                       NULL, NULL);
+        virStoragePoolObjLock(pool);
+        if (virStoragePoolObjIsActive(pool) &&
+            (*vol = virStorageVolDefFindByKey(pool, key))) {
+            if (VIR_STRDUP_QUIET(name, pool->def->name) < 0 ||
+                virHashUpdateEntry(driver->volKeyPools, key, name) < 0) {
+                /* The index is only a hint, don't fail the lookup */
+                VIR_FREE(name);
+                virResetLastError();
             }
+            return pool;
         }
-        virStoragePoolObjUnlock(driver->pools.objs[i]);
+        virStoragePoolObjUnlock(pool);
     }
 
-    if (!ret)
+    if (poolname)
+        ignore_value(virHashRemoveEntry(driver->volKeyPools, key));
+
+    return NULL;
+}
+
+static virStorageVolPtr
+storageVolLookupByKey(virConnectPtr conn,
+                      const char *key)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
+    virStorageVolPtr ret = NULL;
+
+    storageDriverLock();
+    if (!(pool = storageVolLookupPoolByKey(key, &vol))) {
         virReportError(VIR_ERR_NO_STORAGE_VOL,
                        _("no storage vol with matching key %s"), key);
+        goto cleanup;
+    }
+
+    if (virStorageVolLookupByKeyEnsureACL(conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    ret = virGetStorageVol(conn, pool->def->name, vol->name, vol->key,
+                           NULL, NULL);
 
  cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
     storageDriverUnlock();
     return ret;
 }
@@ -1669,18 +1901,11 @@ static void
 storageVolRemoveFromPool(virStoragePoolObjPtr pool,
                          virStorageVolDefPtr vol)
 {
-    size_t i;
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             vol->name, pool->def->name);
 
-    for (i = 0; i < pool->volumes.count; i++) {
-        if (pool->volumes.objs[i] == vol) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     vol->name, pool->def->name);
-            virStorageVolDefFree(vol);
-
-            VIR_DELETE_ELEMENT(pool->volumes.objs, i, pool->volumes.count);
-            break;
-        }
-    }
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
 }
 
 
@@ -1706,14 +1931,9 @@ storageVolDeleteInternal(virStorageVolPtr obj,
 
     /* Update pool metadata - don't update meta data from error paths
      * in this module since the allocation/available weren't adjusted yet.
-     * Ignore the disk backend since it updates the pool values.
      */
-    if (updateMeta) {
-        if (pool->def->type != VIR_STORAGE_POOL_DISK) {
-            pool->def->allocation -= vol->target.allocation;
-            pool->def->available += vol->target.allocation;
-        }
-    }
+    if (updateMeta)
+        storagePoolUpdateUsage(pool, vol->target.allocation, 0);
 
     storageVolRemoveFromPool(pool, vol);
     ret = 0;
@@ -1772,6 +1992,42 @@ virStorageVolDefFromVol(virStorageVolPtr obj,
 }
 
 
+/*
+ * Check whether @vol of the locked @pool can be deleted right away.
+ * A background job on @vol is cancelled instead and removes the volume
+ * once it stopped. Returns 1 in that case, 0 if nothing runs on @vol,
+ * or -1 with an error if a call somebody waits for uses it.
+ */
+int
+storageVolDeletePrepare(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    if (vol->job && vol->job->background) {
+        VIR_INFO("Cancelling job on volume '%s' in storage pool '%s'",
+                 vol->name, pool->def->name);
+        vol->job->remove = true;
+        virAtomicIntSet(&vol->job->cancelled, 1);
+        return 1;
+    }
+
+    if (vol->in_use) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is still in use."),
+                       vol->name);
+        return -1;
+    }
+
+    if (vol->building) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is still being allocated."),
+                       vol->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
 storageVolDelete(virStorageVolPtr obj,
                  unsigned int flags)
@@ -1779,6 +2035,7 @@ storageVolDelete(virStorageVolPtr obj,
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     virStorageVolDefPtr vol = NULL;
+    int rc;
     int ret = -1;
 
     if (!(vol = virStorageVolDefFromVol(obj, &pool, &backend)))
@@ -1787,21 +2044,11 @@ storageVolDelete(virStorageVolPtr obj,
     if (virStorageVolDeleteEnsureACL(obj->conn, pool->def, vol) < 0)
         goto cleanup;
 
-    if (vol->in_use) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still in use."),
-                       vol->name);
-        goto cleanup;
-    }
-
-    if (vol->building) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still being allocated."),
-                       vol->name);
+    if ((rc = storageVolDeletePrepare(pool, vol)) < 0)
         goto cleanup;
-    }
 
-    if (storageVolDeleteInternal(obj, backend, pool, vol, flags, true) < 0)
+    if (rc == 0 &&
+        storageVolDeleteInternal(obj, backend, pool, vol, flags, true) < 0)
         goto cleanup;
 
     ret = 0;
@@ -1812,131 +2059,374 @@ storageVolDelete(virStorageVolPtr obj,
 }
 
 
-static virStorageVolPtr
-storageVolCreateXML(virStoragePoolPtr obj,
-                    const char *xmldesc,
-                    unsigned int flags)
+/* ----------- long running volume operations ---------- */
+
+static const char *storageVolJobTypeNames[] = {
+    "build", "clone", "wipe",
+};
+
+
+void
+storageVolJobFree(storageVolJobPtr job)
 {
-    virStoragePoolObjPtr pool;
-    virStorageBackendPtr backend;
-    virStorageVolDefPtr voldef = NULL;
-    virStorageVolPtr ret = NULL, volobj = NULL;
+    if (!job)
+        return;
 
-    virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA, NULL);
+    virObjectUnref(job->volobj);
+    VIR_FREE(job->shadowvol);
+    VIR_FREE(job);
+}
 
-    if (!(pool = virStoragePoolObjFromStoragePool(obj)))
-        return NULL;
 
-    if (!virStoragePoolObjIsActive(pool)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("storage pool '%s' is not active"), pool->def->name);
-        goto cleanup;
+/* Mark the volumes and pools involved in @job as busy. Called with
+ * the pools locked. */
+void
+storageVolJobBegin(storageVolJobPtr job)
+{
+    job->pool->asyncjobs++;
+    if (job->origpool)
+        job->origpool->asyncjobs++;
+
+    switch (job->type) {
+    case STORAGE_VOL_JOB_BUILD:
+        job->vol->building = true;
+        break;
+    case STORAGE_VOL_JOB_BUILD_FROM:
+        job->vol->building = true;
+        job->origvol->in_use++;
+        break;
+    case STORAGE_VOL_JOB_WIPE:
+        job->vol->in_use++;
+        break;
     }
 
-    if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
-        goto cleanup;
+    job->vol->job = &job->job;
+    job->shadowvol->job = &job->job;
+}
 
-    voldef = virStorageVolDefParseString(pool->def, xmldesc,
-                                         VIR_VOL_XML_PARSE_OPT_CAPACITY);
-    if (voldef == NULL)
-        goto cleanup;
 
-    if (!voldef->target.capacity && !backend->buildVol) {
-        virReportError(VIR_ERR_NO_SUPPORT,
-                       "%s", _("volume capacity required for this "
-                               "storage pool"));
-        goto cleanup;
-    }
+/* Undo storageVolJobBegin once the backend returned @ret and finish
+ * the operation. Called with the pools locked, returns with only
+ * job->pool locked. */
+static int
+storageVolJobEnd(storageVolJobPtr job,
+                 int ret)
+{
+    virStoragePoolObjPtr pool = job->pool;
+    virStorageVolDefPtr vol = job->vol;
+    virStorageBackendPtr backend = job->backend;
+    virConnectPtr conn = job->volobj->conn;
+    unsigned long long oldalloc = vol->target.allocation;
 
-    if (virStorageVolCreateXMLEnsureACL(obj->conn, pool->def, voldef) < 0)
-        goto cleanup;
+    vol->job = NULL;
+    pool->asyncjobs--;
 
-    if (virStorageVolDefFindByName(pool, voldef->name)) {
-        virReportError(VIR_ERR_STORAGE_VOL_EXIST,
-                       _("'%s'"), voldef->name);
-        goto cleanup;
+    if (job->origpool) {
+        job->origpool->asyncjobs--;
+        virStoragePoolObjUnlock(job->origpool);
     }
 
-    if (!backend->createVol) {
-        virReportError(VIR_ERR_NO_SUPPORT,
-                       "%s", _("storage pool does not support volume "
-                               "creation"));
-        goto cleanup;
+    switch (job->type) {
+    case STORAGE_VOL_JOB_BUILD:
+        vol->building = false;
+        if (ret < 0) {
+            /* buildVol handles deleting volume on failure */
+            storageVolRemoveFromPool(pool, vol);
+            return ret;
+        }
+        break;
+    case STORAGE_VOL_JOB_BUILD_FROM:
+        vol->building = false;
+        job->origvol->in_use--;
+        break;
+    case STORAGE_VOL_JOB_WIPE:
+        vol->in_use--;
+        break;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
-        goto cleanup;
+    if (ret == 0 &&
+        backend->refreshVol &&
+        backend->refreshVol(conn, pool, vol) < 0)
+        ret = -1;
 
-    /* Wipe any key the user may have suggested, as volume creation
-     * will generate the canonical key.  */
-    VIR_FREE(voldef->key);
-    if (backend->createVol(obj->conn, pool, voldef) < 0)
-        goto cleanup;
+    if (job->type != STORAGE_VOL_JOB_WIPE) {
+        if (ret < 0) {
+            storageVolDeleteInternal(job->volobj, backend, pool, vol,
+                                     0, false);
+            return ret;
+        }
 
-    pool->volumes.objs[pool->volumes.count++] = voldef;
-    volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
-                              voldef->key, NULL, NULL);
-    if (!volobj) {
-        pool->volumes.count--;
-        goto cleanup;
+        /* Update pool metadata ignoring the disk backend since
+         * it updates the pool values.
+         */
+        storagePoolUpdateUsage(pool, 0, vol->target.allocation);
+    } else if (ret == 0) {
+        /* Wiping may trim or fill in a sparse volume */
+        storagePoolUpdateUsage(pool, oldalloc, vol->target.allocation);
     }
 
+    if (job->job.remove) {
+        if (storageVolDeleteInternal(job->volobj, backend, pool, vol,
+                                     0, true) == 0)
+            virReportError(VIR_ERR_OPERATION_ABORTED,
+                           _("volume '%s' was deleted during %s"),
+                           job->volobj->name,
+                           storageVolJobTypeNames[job->type]);
+        ret = -1;
+    }
 
-    if (backend->buildVol) {
-        int buildret;
-        virStorageVolDefPtr buildvoldef = NULL;
+    return ret;
+}
 
-        if (VIR_ALLOC(buildvoldef) < 0) {
-            voldef = NULL;
-            goto cleanup;
+
+/* Let the backend do the work of @job */
+static int
+storageVolJobCall(storageVolJobPtr job)
+{
+    virConnectPtr conn = job->volobj->conn;
+    int ret = -1;
+
+    switch (job->type) {
+    case STORAGE_VOL_JOB_BUILD:
+        ret = job->backend->buildVol(conn, job->pool, job->shadowvol,
+                                     job->flags);
+        break;
+    case STORAGE_VOL_JOB_BUILD_FROM:
+        ret = job->backend->buildVolFrom(conn, job->pool, job->shadowvol,
+                                         job->origvol, job->flags);
+        break;
+    case STORAGE_VOL_JOB_WIPE:
+        ret = job->backend->wipeVol(conn, job->pool, job->shadowvol,
+                                    job->algorithm, job->flags);
+        break;
+    }
+
+    return ret;
+}
+
+
+/* Do the work of @job with the pools unlocked, then relock them and
+ * finish it. Returns with job->pool locked. */
+static int
+storageVolJobWork(storageVolJobPtr job)
+{
+    int ret = storageVolJobCall(job);
+
+    storageDriverLock();
+    virStoragePoolObjLock(job->pool);
+    if (job->origpool)
+        virStoragePoolObjLock(job->origpool);
+    storageDriverUnlock();
+
+    return storageVolJobEnd(job, ret);
+}
+
+
+static void
+storageVolJobThread(void *opaque)
+{
+    storageVolJobPtr job = opaque;
+    size_t i;
+
+    if (storageVolJobWork(job) < 0)
+        VIR_WARN("Background %s of volume '%s' in storage pool '%s' "
+                 "failed: %s",
+                 storageVolJobTypeNames[job->type], job->volobj->name,
+                 job->volobj->pool, virGetLastErrorMessage());
+    else
+        VIR_INFO("Background %s of volume '%s' in storage pool '%s' "
+                 "completed",
+                 storageVolJobTypeNames[job->type], job->volobj->name,
+                 job->volobj->pool);
+
+    virStoragePoolObjUnlock(job->pool);
+
+    storageDriverLock();
+    for (i = 0; i < driver->njobs; i++) {
+        if (driver->jobs[i] == &job->job) {
+            VIR_DELETE_ELEMENT(driver->jobs, i, driver->njobs);
+            break;
         }
+    }
+    virCondBroadcast(&driver->jobsCond);
+    storageDriverUnlock();
 
-        /* Make a shallow copy of the 'defined' volume definition, since the
-         * original allocation value will change as the user polls 'info',
-         * but we only need the initial requested values
-         */
-        memcpy(buildvoldef, voldef, sizeof(*voldef));
+    storageVolJobFree(job);
+}
 
-        /* Drop the pool lock during volume allocation */
-        pool->asyncjobs++;
-        voldef->building = true;
-        virStoragePoolObjUnlock(pool);
 
-        buildret = backend->buildVol(obj->conn, pool, buildvoldef, flags);
+/*
+ * Run @job, set up by storageVolJobBegin, whose pools are locked.
+ *
+ * If @background is true, a thread takes over the job and 1 is
+ * returned with the pools unlocked; the caller must no longer touch
+ * the job or the pools. Otherwise, or if no thread can be started,
+ * the job runs right here and its result is returned with job->pool
+ * locked again.
+ */
+int
+storageVolJobRun(storageVolJobPtr job,
+                 bool background)
+{
+    virStorageVolJobPtr tracked = &job->job;
+    virThread thread;
 
-        VIR_FREE(buildvoldef);
+    /* A wipe the caller waits for keeps the pool locked as it always
+     * did, other calls on the volume wait for it instead of failing */
+    if (!background && job->type == STORAGE_VOL_JOB_WIPE)
+        return storageVolJobEnd(job, storageVolJobCall(job));
 
-        storageDriverLock();
-        virStoragePoolObjLock(pool);
-        storageDriverUnlock();
+    /* Deleting the volume cancels a job nobody waits for. If it has to
+     * run in the foreground after all, the caller sees the abort. */
+    tracked->background = background;
 
-        voldef->building = false;
-        pool->asyncjobs--;
+    virStoragePoolObjUnlock(job->pool);
+    if (job->origpool)
+        virStoragePoolObjUnlock(job->origpool);
 
-        if (buildret < 0) {
-            /* buildVol handles deleting volume on failure */
-            storageVolRemoveFromPool(pool, voldef);
-            voldef = NULL;
-            goto cleanup;
+    if (!background)
+        return storageVolJobWork(job);
+
+    storageDriverLock();
+    if (VIR_APPEND_ELEMENT(driver->jobs, driver->njobs, tracked) == 0) {
+        if (virThreadCreate(&thread, false, storageVolJobThread, job) == 0) {
+            storageDriverUnlock();
+            return 1;
         }
+        VIR_DELETE_ELEMENT(driver->jobs, driver->njobs - 1, driver->njobs);
+    }
+    storageDriverUnlock();
 
+    VIR_WARN("Unable to run %s of volume '%s' in the background",
+             storageVolJobTypeNames[job->type], job->volobj->name);
+    virResetLastError();
+
+    return storageVolJobWork(job);
+}
+
+
+static virStorageVolPtr
+storageVolCreateXML(virStoragePoolPtr obj,
+                    const char *xmldesc,
+                    unsigned int flags)
+{
+    virStoragePoolObjPtr pool;
+    virStorageBackendPtr backend;
+    virStorageVolDefPtr voldef = NULL;
+    virStorageVolPtr ret = NULL, volobj = NULL;
+    storageVolJobPtr job = NULL;
+
+    virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA |
+                  VIR_STORAGE_VOL_CREATE_BACKGROUND, NULL);
+
+    if (!(pool = virStoragePoolObjFromStoragePool(obj)))
+        return NULL;
+
+    if (!virStoragePoolObjIsActive(pool)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("storage pool '%s' is not active"), pool->def->name);
+        goto cleanup;
     }
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, voldef) < 0) {
-        storageVolDeleteInternal(volobj, backend, pool, voldef,
-                                 0, false);
-        voldef = NULL;
+    if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
+        goto cleanup;
+
+    voldef = virStorageVolDefParseString(pool->def, xmldesc,
+                                         VIR_VOL_XML_PARSE_OPT_CAPACITY);
+    if (voldef == NULL)
+        goto cleanup;
+
+    if (!voldef->target.capacity && !backend->buildVol) {
+        virReportError(VIR_ERR_NO_SUPPORT,
+                       "%s", _("volume capacity required for this "
+                               "storage pool"));
         goto cleanup;
     }
 
-    /* Update pool metadata ignoring the disk backend since
-     * it updates the pool values.
-     */
-    if (pool->def->type != VIR_STORAGE_POOL_DISK) {
-        pool->def->allocation += voldef->target.allocation;
-        pool->def->available -= voldef->target.allocation;
+    if (virStorageVolCreateXMLEnsureACL(obj->conn, pool->def, voldef) < 0)
+        goto cleanup;
+
+    if (virStorageVolDefFindByName(pool, voldef->name)) {
+        virReportError(VIR_ERR_STORAGE_VOL_EXIST,
+                       _("'%s'"), voldef->name);
+        goto cleanup;
+    }
+
+    if (!backend->createVol) {
+        virReportError(VIR_ERR_NO_SUPPORT,
+                       "%s", _("storage pool does not support volume "
+                               "creation"));
+        goto cleanup;
+    }
+
+    /* Wipe any key the user may have suggested, as volume creation
+     * will generate the canonical key.  */
+    VIR_FREE(voldef->key);
+    if (backend->createVol(obj->conn, pool, voldef) < 0)
+        goto cleanup;
+
+    if (virStoragePoolObjAddVol(pool, voldef) < 0)
+        goto cleanup;
+    volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
+                              voldef->key, NULL, NULL);
+    if (!volobj) {
+        virStoragePoolObjRemoveVol(pool, voldef);
+        goto cleanup;
+    }
+
+
+    if (backend->buildVol) {
+        int buildret;
+
+        if (VIR_ALLOC(job) < 0 ||
+            VIR_ALLOC(job->shadowvol) < 0) {
+            voldef = NULL;
+            goto cleanup;
+        }
+
+        /* Make a shallow copy of the 'defined' volume definition, since the
+         * original allocation value will change as the user polls 'info',
+         * but we only need the initial requested values
+         */
+        memcpy(job->shadowvol, voldef, sizeof(*voldef));
+
+        job->type = STORAGE_VOL_JOB_BUILD;
+        job->volobj = virObjectRef(volobj);
+        job->backend = backend;
+        job->pool = pool;
+        job->vol = voldef;
+        job->flags = flags & ~VIR_STORAGE_VOL_CREATE_BACKGROUND;
+
+        /* Drop the pool lock during volume allocation */
+        storageVolJobBegin(job);
+        buildret = storageVolJobRun(job,
+                                    flags & VIR_STORAGE_VOL_CREATE_BACKGROUND);
+
+        if (buildret == 1) {
+            VIR_INFO("Building volume '%s' in storage pool '%s' "
+                     "in the background", volobj->name, volobj->pool);
+            job = NULL;
+            pool = NULL;
+            ret = volobj;
+            volobj = NULL;
+            voldef = NULL;
+            goto cleanup;
+        }
+
+        if (buildret < 0) {
+            voldef = NULL;
+            goto cleanup;
+        }
+    } else {
+        if (backend->refreshVol &&
+            backend->refreshVol(obj->conn, pool, voldef) < 0) {
+            storageVolDeleteInternal(volobj, backend, pool, voldef,
+                                     0, false);
+            voldef = NULL;
+            goto cleanup;
+        }
+
+        storagePoolUpdateUsage(pool, 0, voldef->target.allocation);
     }
 
     VIR_INFO("Creating volume '%s' in storage pool '%s'",
@@ -1946,6 +2436,7 @@ storageVolCreateXML(virStoragePoolPtr obj,
     voldef = NULL;
 
  cleanup:
+    storageVolJobFree(job);
     virObjectUnref(volobj);
     virStorageVolDefFree(voldef);
     if (pool)
@@ -1961,12 +2452,14 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
 {
     virStoragePoolObjPtr pool, origpool = NULL;
     virStorageBackendPtr backend;
-    virStorageVolDefPtr origvol = NULL, newvol = NULL, shadowvol = NULL;
+    virStorageVolDefPtr origvol = NULL, newvol = NULL;
     virStorageVolPtr ret = NULL, volobj = NULL;
+    storageVolJobPtr job = NULL;
     int buildret;
 
     virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA |
-                  VIR_STORAGE_VOL_CREATE_REFLINK,
+                  VIR_STORAGE_VOL_CREATE_REFLINK |
+                  VIR_STORAGE_VOL_CREATE_BACKGROUND,
                   NULL);
 
     storageDriverLock();
@@ -2059,12 +2552,17 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, origvol) < 0)
+    /* Other clones may read the volume too, but it must not be copied
+     * while a wipe is overwriting it */
+    if (origvol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is still in use."),
+                       origvol->name);
         goto cleanup;
+    }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
+    if (backend->refreshVol &&
+        backend->refreshVol(obj->conn, pool, origvol) < 0)
         goto cleanup;
 
     /* 'Define' the new volume so we get async progress reporting.
@@ -2078,74 +2576,59 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
      * original allocation value will change as the user polls 'info',
      * but we only need the initial requested values
      */
-    if (VIR_ALLOC(shadowvol) < 0)
+    if (VIR_ALLOC(job) < 0 ||
+        VIR_ALLOC(job->shadowvol) < 0)
         goto cleanup;
 
-    memcpy(shadowvol, newvol, sizeof(*newvol));
+    memcpy(job->shadowvol, newvol, sizeof(*newvol));
 
-    pool->volumes.objs[pool->volumes.count++] = newvol;
+    if (virStoragePoolObjAddVol(pool, newvol) < 0)
+        goto cleanup;
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, newvol);
         goto cleanup;
     }
 
-    /* Drop the pool lock during volume allocation */
-    pool->asyncjobs++;
-    newvol->building = true;
-    origvol->in_use++;
-    virStoragePoolObjUnlock(pool);
-
-    if (origpool) {
-        origpool->asyncjobs++;
-        virStoragePoolObjUnlock(origpool);
-    }
-
-    buildret = backend->buildVolFrom(obj->conn, pool, shadowvol, origvol, flags);
+    job->type = STORAGE_VOL_JOB_BUILD_FROM;
+    job->volobj = virObjectRef(volobj);
+    job->backend = backend;
+    job->pool = pool;
+    job->vol = newvol;
+    job->origpool = origpool;
+    job->origvol = origvol;
+    job->flags = flags & ~VIR_STORAGE_VOL_CREATE_BACKGROUND;
 
-    storageDriverLock();
-    virStoragePoolObjLock(pool);
-    if (origpool)
-        virStoragePoolObjLock(origpool);
-    storageDriverUnlock();
-
-    origvol->in_use--;
-    newvol->building = false;
-    pool->asyncjobs--;
-
-    if (origpool) {
-        origpool->asyncjobs--;
-        virStoragePoolObjUnlock(origpool);
-        origpool = NULL;
-    }
+    /* Drop the pool lock during volume allocation */
+    storageVolJobBegin(job);
+    buildret = storageVolJobRun(job,
+                                flags & VIR_STORAGE_VOL_CREATE_BACKGROUND);
+    origpool = NULL;
+    newvol = NULL;
 
-    if (buildret < 0 ||
-        (backend->refreshVol &&
-         backend->refreshVol(obj->conn, pool, newvol) < 0)) {
-        storageVolDeleteInternal(volobj, backend, pool, newvol, 0, false);
-        newvol = NULL;
+    if (buildret == 1) {
+        VIR_INFO("Cloning volume '%s' in storage pool '%s' "
+                 "in the background", volobj->name, volobj->pool);
+        job = NULL;
+        pool = NULL;
+        ret = volobj;
+        volobj = NULL;
         goto cleanup;
     }
 
-    /* Updating pool metadata ignoring the disk backend since
-     * it updates the pool values
-     */
-    if (pool->def->type != VIR_STORAGE_POOL_DISK) {
-        pool->def->allocation += newvol->target.allocation;
-        pool->def->available -= newvol->target.allocation;
-    }
+    if (buildret < 0)
+        goto cleanup;
 
     VIR_INFO("Creating volume '%s' in storage pool '%s'",
              volobj->name, pool->def->name);
     ret = volobj;
     volobj = NULL;
-    newvol = NULL;
 
  cleanup:
+    storageVolJobFree(job);
     virObjectUnref(volobj);
     virStorageVolDefFree(newvol);
-    VIR_FREE(shadowvol);
     if (pool)
         virStoragePoolObjUnlock(pool);
     if (origpool)
@@ -2174,6 +2657,15 @@ storageVolDownload(virStorageVolPtr obj,
     if (virStorageVolDownloadEnsureACL(obj->conn, pool->def, vol) < 0)
         goto cleanup;
 
+    /* Reading a volume while it is cloned is fine, not while a job
+     * rewrites it */
+    if (vol->job) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is still in use."),
+                       vol->name);
+        goto cleanup;
+    }
+
     if (vol->building) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        _("volume '%s' is still being allocated."),
@@ -2208,6 +2700,8 @@ virStorageVolPoolRefreshDataFree(void *opaque)
     virStorageVolStreamInfoPtr cbdata = opaque;
 
     VIR_FREE(cbdata->pool_name);
+    VIR_FREE(cbdata->vol_name);
+    VIR_FREE(cbdata->vol_path);
     VIR_FREE(cbdata);
 }
 
@@ -2253,6 +2747,112 @@ virStorageBackendPloopRestoreDesc(char *path)
 
 
 
+/* How long a watched pool has to be quiet before it is refreshed (ms) */
+#define STORAGE_POOL_WATCH_DELAY 1000
+
+typedef struct _virStoragePoolWatch virStoragePoolWatch;
+typedef virStoragePoolWatch *virStoragePoolWatchPtr;
+struct _virStoragePoolWatch {
+    int fd;
+    int watch;  /* event handle of @fd */
+    int timer;  /* coalesces bursts of changes into one refresh */
+    bool refreshing;    /* a refresh thread was started by @timer */
+};
+
+/*
+ * The watch refresh of @pool could not run because of other jobs,
+ * try again once the pool was quiet for a while.
+ */
+static void
+storagePoolWatchRetry(virStoragePoolObjPtr pool)
+{
+    virStoragePoolWatchPtr w = pool->watch;
+
+    if (w && w->timer > 0)
+        virEventUpdateTimeout(w->timer, STORAGE_POOL_WATCH_DELAY);
+}
+
+/* The watch refresh of @pool is over, wake up storagePoolWatchWait */
+static void
+storagePoolWatchDone(virStoragePoolObjPtr pool)
+{
+    virStoragePoolWatchPtr w = pool->watch;
+
+    if (w)
+        w->refreshing = false;
+    virCondBroadcast(&driver->jobsCond);
+}
+
+/*
+ * Wait for a refresh of @pool started by its directory watch, so that
+ * an explicit refresh or destroy follows it instead of failing on its
+ * async job. Called with the driver and @pool locked. Returns the pool
+ * found again and locked, or NULL if it went away meanwhile.
+ */
+static virStoragePoolObjPtr
+storagePoolWatchWait(virStoragePoolObjPtr pool,
+                     virStoragePoolPtr obj)
+{
+    virStoragePoolWatchPtr w;
+
+    while ((w = pool->watch) && w->refreshing) {
+        VIR_DEBUG("Waiting for the watch refresh of storage pool '%s'",
+                  pool->def->name);
+        virStoragePoolObjUnlock(pool);
+        ignore_value(virCondWait(&driver->jobsCond, &driver->lock));
+
+        if (!(pool = virStoragePoolObjFindByUUID(&driver->pools,
+                                                 obj->uuid))) {
+            char uuidstr[VIR_UUID_STRING_BUFLEN];
+            virUUIDFormat(obj->uuid, uuidstr);
+            virReportError(VIR_ERR_NO_STORAGE_POOL,
+                           _("no storage pool with matching uuid '%s' (%s)"),
+                           uuidstr, obj->name);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+/*
+ * Re-read the volume @name of @pool after an upload to it finished and
+ * account for its new allocation. An upload can change the format and
+ * backing store of a file, which only probing it again picks up, so
+ * files are left to the pool refresh; file system pools only probe the
+ * files which changed anyway. Returns 1 if the pool has to be refreshed
+ * instead, 0 otherwise.
+ */
+int
+storageVolRefreshUploaded(virStoragePoolObjPtr pool,
+                          virStorageBackendPtr backend,
+                          const char *name)
+{
+    virStorageVolDefPtr vol;
+    unsigned long long oldalloc;
+
+    if (!backend->refreshVol)
+        return 1;
+
+    if (!(vol = virStorageVolDefFindByName(pool, name)) ||
+        vol->building || vol->in_use)
+        return 0;
+
+    if (vol->type == VIR_STORAGE_VOL_FILE ||
+        vol->type == VIR_STORAGE_VOL_DIR ||
+        vol->type == VIR_STORAGE_VOL_PLOOP)
+        return 1;
+
+    oldalloc = vol->target.allocation;
+    if (backend->refreshVol(NULL, pool, vol) < 0) {
+        VIR_DEBUG("Failed to refresh storage volume '%s'", vol->name);
+        return 0;
+    }
+    storagePoolUpdateUsage(pool, oldalloc, vol->target.allocation);
+
+    return 0;
+}
+
 /**
  * Thread to handle the pool refresh
  *
@@ -2276,14 +2876,32 @@ virStorageVolPoolRefreshThread(void *opaque)
                                              cbdata->pool_name)))
         goto cleanup;
 
+    if (!virStoragePoolObjIsActive(pool))
+        goto cleanup;
+
     if (!(backend = virStorageBackendForType(pool->def->type)))
         goto cleanup;
 
-    virStoragePoolObjClearVols(pool);
-    if (backend->refreshPool(NULL, pool) < 0)
+    /* An upload only changes the one volume, no need to rescan the pool */
+    if (cbdata->vol_name &&
+        storageVolRefreshUploaded(pool, backend, cbdata->vol_name) == 0)
+        goto cleanup;
+
+    /* Volumes being built or wiped must not be freed under the job */
+    if (pool->asyncjobs > 0) {
+        VIR_DEBUG("Not refreshing pool '%s' with jobs running",
+                  pool->def->name);
+        if (cbdata->watch)
+            storagePoolWatchRetry(pool);
+        goto cleanup;
+    }
+
+    if (storagePoolRefreshVols(NULL, pool, backend) < 0)
         VIR_DEBUG("Failed to refresh storage pool");
 
  cleanup:
+    if (pool && cbdata->watch)
+        storagePoolWatchDone(pool);
     if (pool)
         virStoragePoolObjUnlock(pool);
     storageDriverUnlock();
@@ -2292,7 +2910,7 @@ virStorageVolPoolRefreshThread(void *opaque)
 
 /**
  * Callback being called if a FDstream is closed. Will spin off a thread
- * to perform a pool refresh.
+ * to refresh the uploaded volume, or the whole pool.
  *
  * @st Pointer to stream being closed.
  * @opaque Buffer to hold the pool name to be refreshed
@@ -2315,6 +2933,282 @@ virStorageVolFDStreamCloseCb(virStreamPtr st ATTRIBUTE_UNUSED,
     virStorageVolPoolRefreshDataFree(opaque);
 }
 
+
+/* ----------- watching the target directory of running pools ---------- */
+
+#ifdef __linux__
+static int
+storagePoolWatchValidate(virStoragePoolDefPtr def,
+                         virStorageBackendPtr backend)
+{
+    if (def->refreshWatch != VIR_TRISTATE_BOOL_YES)
+        return 0;
+
+    /* Changes are applied through an in-place update of the pool */
+    if (!backend->updatePool) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("storage pool type '%s' does not support "
+                         "watching for changes"),
+                       virStoragePoolTypeToString(def->type));
+        return -1;
+    }
+
+    return 0;
+}
+#else /* !__linux__ */
+static int
+storagePoolWatchValidate(virStoragePoolDefPtr def,
+                         virStorageBackendPtr backend ATTRIBUTE_UNUSED)
+{
+    if (def->refreshWatch != VIR_TRISTATE_BOOL_YES)
+        return 0;
+
+    virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                   _("watching storage pools for changes is not "
+                     "supported on this platform"));
+    return -1;
+}
+#endif /* !__linux__ */
+
+#ifdef __linux__
+static void
+storagePoolWatchNameFree(void *opaque)
+{
+    char *name = opaque;
+
+    VIR_FREE(name);
+}
+
+/*
+ * Find the pool named @name if it is still watched through the event
+ * handle @watch or the timer @timer. Returns the pool locked.
+ */
+static virStoragePoolObjPtr
+storagePoolWatchFindPool(const char *name,
+                         int watch,
+                         int timer)
+{
+    virStoragePoolObjPtr pool;
+    virStoragePoolWatchPtr w;
+
+    if (!(pool = virStoragePoolObjFindByName(&driver->pools, name)))
+        return NULL;
+
+    if (!(w = pool->watch) ||
+        (watch >= 0 && w->watch != watch) ||
+        (timer >= 0 && w->timer != timer)) {
+        virStoragePoolObjUnlock(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+static void
+storagePoolWatchEvent(int watch,
+                      int fd,
+                      int events ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    const char *name = opaque;
+    virStoragePoolObjPtr pool;
+    virStoragePoolWatchPtr w;
+    char buf[2048];
+    struct inotify_event e;
+    bool changed = false;
+    ssize_t got;
+
+    storageDriverLock();
+    if (!(pool = storagePoolWatchFindPool(name, watch, -1)))
+        goto cleanup;
+    w = pool->watch;
+
+    while ((got = read(fd, buf, sizeof(buf))) > 0) {
+        char *tmp = buf;
+
+        while (tmp + sizeof(e) <= buf + got) {
+            memcpy(&e, tmp, sizeof(e));
+            VIR_DEBUG("pool '%s': change 0x%x on '%s'",
+                      name, e.mask, e.len ? tmp + sizeof(e) : "");
+            tmp += sizeof(e) + e.len;
+        }
+        changed = true;
+    }
+
+    /* Restart the delay on every change so that a file being copied
+     * into the pool is only probed once it is complete */
+    if (changed)
+        virEventUpdateTimeout(w->timer, STORAGE_POOL_WATCH_DELAY);
+
+ cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    storageDriverUnlock();
+}
+
+static void
+storagePoolWatchTimer(int timer,
+                      void *opaque)
+{
+    const char *name = opaque;
+    virStoragePoolObjPtr pool;
+    virStoragePoolWatchPtr w;
+    virStorageVolStreamInfoPtr cbdata = NULL;
+    virThread thread;
+
+    storageDriverLock();
+    if (!(pool = storagePoolWatchFindPool(name, -1, timer)))
+        goto cleanup;
+
+    w = pool->watch;
+
+    /* Volumes being built or wiped must not be freed under the job,
+     * the changes are picked up once the pool is quiet */
+    if (w->refreshing || pool->asyncjobs > 0) {
+        VIR_DEBUG("Delaying refresh of storage pool '%s' with jobs running",
+                  name);
+        virEventUpdateTimeout(timer, STORAGE_POOL_WATCH_DELAY);
+        goto cleanup;
+    }
+
+    virEventUpdateTimeout(timer, -1);
+
+    VIR_INFO("Refreshing storage pool '%s' after changes in '%s'",
+             name, pool->def->target.path);
+
+    /* Probing may take a while, keep it off the event loop */
+    if (VIR_ALLOC(cbdata) < 0 ||
+        VIR_STRDUP(cbdata->pool_name, name) < 0) {
+        VIR_WARN("Failed to refresh storage pool '%s': %s",
+                 name, virGetLastErrorMessage());
+        if (cbdata)
+            virStorageVolPoolRefreshDataFree(cbdata);
+        goto cleanup;
+    }
+    cbdata->watch = true;
+
+    w->refreshing = true;
+    if (virThreadCreate(&thread, false, virStorageVolPoolRefreshThread,
+                        cbdata) < 0) {
+        VIR_WARN("Failed to refresh storage pool '%s': %s",
+                 name, virGetLastErrorMessage());
+        w->refreshing = false;
+        virStorageVolPoolRefreshDataFree(cbdata);
+    }
+
+ cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    storageDriverUnlock();
+}
+#endif /* __linux__ */
+
+static void
+storagePoolWatchFree(virStoragePoolWatchPtr w)
+{
+    if (!w)
+        return;
+
+    if (w->watch > 0)
+        virEventRemoveHandle(w->watch);
+    if (w->timer > 0)
+        virEventRemoveTimeout(w->timer);
+    VIR_FORCE_CLOSE(w->fd);
+    VIR_FREE(w);
+}
+
+#ifdef __linux__
+/*
+ * Start watching the target directory of the running @pool if its
+ * config asks for it. Failing to do so is not fatal for the pool,
+ * it just has to be refreshed explicitly.
+ */
+static void
+storagePoolWatchStart(virStoragePoolObjPtr pool,
+                      virStorageBackendPtr backend)
+{
+    virStoragePoolWatchPtr w = NULL;
+    char *name = NULL;
+
+    if (pool->def->refreshWatch != VIR_TRISTATE_BOOL_YES || pool->watch)
+        return;
+
+    /* Configs loaded from disk did not go through the define checks */
+    if (storagePoolWatchValidate(pool->def, backend) < 0)
+        goto error;
+
+    if (VIR_ALLOC(w) < 0)
+        goto error;
+    w->watch = -1;
+    w->timer = -1;
+
+    if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize inotify"));
+        goto error;
+    }
+
+    if (inotify_add_watch(w->fd, pool->def->target.path,
+                          IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                          IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB) < 0) {
+        virReportSystemError(errno,
+                             _("cannot watch directory '%s'"),
+                             pool->def->target.path);
+        goto error;
+    }
+
+    if (VIR_STRDUP(name, pool->def->name) < 0)
+        goto error;
+    if ((w->timer = virEventAddTimeout(-1, storagePoolWatchTimer, name,
+                                       storagePoolWatchNameFree)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot register pool watch timer"));
+        goto error;
+    }
+    name = NULL;
+
+    if (VIR_STRDUP(name, pool->def->name) < 0)
+        goto error;
+    if ((w->watch = virEventAddHandle(w->fd, VIR_EVENT_HANDLE_READABLE,
+                                      storagePoolWatchEvent, name,
+                                      storagePoolWatchNameFree)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot register pool watch handle"));
+        goto error;
+    }
+    name = NULL;
+
+    VIR_DEBUG("Watching '%s' for storage pool '%s'",
+              pool->def->target.path, pool->def->name);
+    pool->watch = w;
+    return;
+
+ error:
+    VIR_WARN("Failed to watch storage pool '%s': %s",
+             pool->def->name, virGetLastErrorMessage());
+    VIR_FREE(name);
+    storagePoolWatchFree(w);
+}
+#else /* !__linux__ */
+static void
+storagePoolWatchStart(virStoragePoolObjPtr pool,
+                      virStorageBackendPtr backend)
+{
+    /* Configs loaded from disk did not go through the define checks */
+    if (storagePoolWatchValidate(pool->def, backend) < 0) {
+        VIR_WARN("Failed to watch storage pool '%s': %s",
+                 pool->def->name, virGetLastErrorMessage());
+        virResetLastError();
+    }
+}
+#endif /* !__linux__ */
+
+static void
+storagePoolWatchStop(virStoragePoolObjPtr pool)
+{
+    storagePoolWatchFree(pool->watch);
+    pool->watch = NULL;
+}
+
 static int
 storageVolUpload(virStorageVolPtr obj,
                  virStreamPtr stream,
@@ -2366,9 +3260,13 @@ storageVolUpload(virStorageVolPtr obj,
         if (VIR_ALLOC(cbdata) < 0 ||
             VIR_STRDUP(cbdata->pool_name, pool->def->name) < 0)
             goto cleanup;
-        if (vol->target.type == VIR_STORAGE_VOL_PLOOP &&
-            VIR_STRDUP(cbdata->vol_path, vol->target.path) < 0)
+        if (vol->target.type == VIR_STORAGE_VOL_PLOOP) {
+            /* The descriptor is rebuilt, then the pool rescanned */
+            if (VIR_STRDUP(cbdata->vol_path, vol->target.path) < 0)
+                goto cleanup;
+        } else if (VIR_STRDUP(cbdata->vol_name, vol->name) < 0) {
             goto cleanup;
+        }
     }
 
     if ((ret = backend->uploadVol(obj->conn, pool, vol, stream,
@@ -2478,9 +3376,8 @@ storageVolResize(virStorageVolPtr obj,
      * capacity value different and potentially much larger than available
      */
     if (flags & VIR_STORAGE_VOL_RESIZE_ALLOCATE) {
+        storagePoolUpdateUsage(pool, vol->target.allocation, abs_capacity);
         vol->target.allocation = abs_capacity;
-        pool->def->allocation += delta;
-        pool->def->available -= delta;
     }
 
     ret = 0;
@@ -2500,9 +3397,11 @@ storageVolWipePattern(virStorageVolPtr obj,
     virStorageBackendPtr backend;
     virStoragePoolObjPtr pool = NULL;
     virStorageVolDefPtr vol = NULL;
+    storageVolJobPtr job = NULL;
+    int rc;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_WIPE_BACKGROUND, -1);
 
     if (algorithm >= VIR_STORAGE_VOL_WIPE_ALG_LAST) {
         virReportError(VIR_ERR_INVALID_ARG,
@@ -2538,17 +3437,37 @@ storageVolWipePattern(virStorageVolPtr obj,
         goto cleanup;
     }
 
-    if (backend->wipeVol(obj->conn, pool, vol, algorithm, flags) < 0)
+    if (VIR_ALLOC(job) < 0 ||
+        VIR_ALLOC(job->shadowvol) < 0)
         goto cleanup;
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, vol) < 0)
+    memcpy(job->shadowvol, vol, sizeof(*vol));
+
+    job->type = STORAGE_VOL_JOB_WIPE;
+    job->volobj = virObjectRef(obj);
+    job->backend = backend;
+    job->pool = pool;
+    job->vol = vol;
+    job->algorithm = algorithm;
+    job->flags = flags & ~VIR_STORAGE_VOL_WIPE_BACKGROUND;
+
+    /* Only a background wipe drops the pool lock */
+    storageVolJobBegin(job);
+    rc = storageVolJobRun(job, flags & VIR_STORAGE_VOL_WIPE_BACKGROUND);
+
+    if (rc == 1) {
+        job = NULL;
+        pool = NULL;
+    } else if (rc < 0) {
         goto cleanup;
+    }
 
     ret = 0;
 
  cleanup:
-    virStoragePoolObjUnlock(pool);
+    storageVolJobFree(job);
+    if (pool)
+        virStoragePoolObjUnlock(pool);
 
     return ret;
 }
@@ -3092,7 +4011,10 @@ virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
     char *buf = NULL;
     ssize_t headerLen;
     virStorageSourcePtr backingStore = NULL;
-    int backingFormat;
+    int backingFormat = VIR_STORAGE_FILE_AUTO;
+    struct stat st;
+    bool cacheable = false;
+    int rc;
 
     VIR_DEBUG("path=%s format=%d uid=%u gid=%u probe=%d",
               src->path, src->format,
@@ -3136,13 +4058,29 @@ virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
     if (virHashAddEntry(cycle, uniqueName, (void *)1) < 0)
         goto cleanup;
 
-    if ((headerLen = virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER,
-                                              &buf)) < 0)
-        goto cleanup;
+    /* Local images shared by many chains are parsed only once */
+    if (virStorageSourceGetActualType(src) == VIR_STORAGE_TYPE_FILE &&
+        virStorageFileStat(src, &st) == 0)
+        cacheable = true;
 
-    if (virStorageFileGetMetadataInternal(src, buf, headerLen,
-                                          &backingFormat) < 0)
-        goto cleanup;
+    if (cacheable &&
+        (rc = virStorageFileMetadataCacheGet(src, &st, &backingFormat)) != 0) {
+        if (rc < 0)
+            goto cleanup;
+    } else {
+        if ((headerLen = virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER,
+                                                  &buf)) < 0)
+            goto cleanup;
+
+        if (cacheable) {
+            if (virStorageFileMetadataCacheParse(src, &st, buf, headerLen,
+                                                 &backingFormat) < 0)
+                goto cleanup;
+        } else if (virStorageFileGetMetadataInternal(src, buf, headerLen,
+                                                     &backingFormat) < 0) {
+            goto cleanup;
+        }
+    }
 
     /* check whether we need to go deeper */
     if (!src->backingStoreRaw) {
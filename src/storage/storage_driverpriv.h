@@ -0,0 +1,78 @@
+/*
+ * storage_driverpriv.h: private declarations for the storage driver
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_STORAGE_DRIVERPRIV_H__
+# define __VIR_STORAGE_DRIVERPRIV_H__
+
+# include "internal.h"
+# include "libvirt_internal.h"
+# include "storage_backend.h"
+# include "storage_conf.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+typedef enum {
+    STORAGE_VOL_JOB_BUILD,
+    STORAGE_VOL_JOB_BUILD_FROM,
+    STORAGE_VOL_JOB_WIPE,
+} storageVolJobType;
+
+typedef struct _storageVolJob storageVolJob;
+typedef storageVolJob *storageVolJobPtr;
+struct _storageVolJob {
+    virStorageVolJob job; /* seen by the backend through vol->job */
+    storageVolJobType type;
+
+    virStorageVolPtr volobj;
+    virStorageBackendPtr backend;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;       /* the volume as known to @pool */
+    virStorageVolDefPtr shadowvol; /* shallow copy handed to the backend */
+    virStoragePoolObjPtr origpool; /* pool of @origvol if not @pool */
+    virStorageVolDefPtr origvol;   /* source of a clone */
+    unsigned int algorithm;
+    unsigned int flags;
+};
+
+int storageStateInitialize(bool privileged,
+                           virStateInhibitCallback callback,
+                           void *opaque);
+int storageStateCleanup(void);
+
+void storageVolJobFree(storageVolJobPtr job);
+void storageVolJobBegin(storageVolJobPtr job);
+int storageVolJobRun(storageVolJobPtr job,
+                     bool background);
+
+int storageVolDeletePrepare(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol);
+
+void storagePoolUpdateUsage(virStoragePoolObjPtr pool,
+                            unsigned long long oldalloc,
+                            unsigned long long newalloc);
+
+int storageVolRefreshUploaded(virStoragePoolObjPtr pool,
+                              virStorageBackendPtr backend,
+                              const char *name);
+
+#endif /* __VIR_STORAGE_DRIVERPRIV_H__ */
@@ -806,6 +806,145 @@ virCgroupSetValueStr(virCgroupPtr group,
 }
 
 
+/* Statistics files read on every stats poll. These are kept open once
+ * read and re-read with pread() to save an open/close pair per value. */
+static const struct {
+    int controller;
+    const char *key;
+} virCgroupStatFiles[] = {
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage" },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage_percpu" },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.stat" },
+    { VIR_CGROUP_CONTROLLER_BLKIO, "blkio.throttle.io_service_bytes" },
+    { VIR_CGROUP_CONTROLLER_BLKIO, "blkio.throttle.io_serviced" },
+    { VIR_CGROUP_CONTROLLER_MEMORY, "memory.usage_in_bytes" },
+};
+
+
+static void
+virCgroupCloseStatFds(virCgroupPtr group)
+{
+    size_t i;
+
+    virMutexLock(&group->statFdsLock);
+    for (i = 0; i < group->nstatFds; i++)
+        VIR_FORCE_CLOSE(group->statFds[i].fd);
+    VIR_FREE(group->statFds);
+    group->nstatFds = 0;
+    virMutexUnlock(&group->statFdsLock);
+}
+
+
+/* Reads the whole content of @fd from its beginning. Returns the number
+ * of bytes read, or -1 with errno set. */
+static ssize_t
+virCgroupPreadAll(int fd, char **value)
+{
+    char *buf = NULL;
+    size_t alloc = 0;
+    size_t len = 0;
+    ssize_t got;
+
+    for (;;) {
+        if (len >= 1024 * 1024) {
+            errno = EFBIG;
+            goto error;
+        }
+
+        if (VIR_RESIZE_N(buf, alloc, len, 4096 + 1) < 0) {
+            virResetLastError();
+            errno = ENOMEM;
+            goto error;
+        }
+
+        if ((got = pread(fd, buf + len, alloc - len - 1, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            goto error;
+        }
+        if (got == 0)
+            break;
+        len += got;
+    }
+
+    buf[len] = '\0';
+    *value = buf;
+    return len;
+
+ error:
+    VIR_FREE(buf);
+    return -1;
+}
+
+
+/* Reads @key through a file descriptor kept open in @group if it is one
+ * of virCgroupStatFiles. Returns the number of bytes read on success, or
+ * -1 if the caller should read the file the usual way. */
+static ssize_t
+virCgroupGetStatFileValue(virCgroupPtr group,
+                          int controller,
+                          const char *key,
+                          char **value)
+{
+    struct virCgroupStatFd statfd = { .fd = -1 };
+    char *keypath = NULL;
+    size_t i;
+    ssize_t rc;
+    ssize_t ret = -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virCgroupStatFiles); i++) {
+        if (virCgroupStatFiles[i].controller == controller &&
+            STREQ(virCgroupStatFiles[i].key, key))
+            break;
+    }
+    if (i == ARRAY_CARDINALITY(virCgroupStatFiles))
+        return -1;
+    statfd.file = i;
+
+    virMutexLock(&group->statFdsLock);
+
+    for (i = 0; i < group->nstatFds; i++) {
+        if (group->statFds[i].file != statfd.file)
+            continue;
+
+        if ((rc = virCgroupPreadAll(group->statFds[i].fd, value)) >= 0) {
+            ret = rc;
+            goto cleanup;
+        }
+
+        /* The file may have gone away with the group, start afresh */
+        VIR_DEBUG("Dropping stale fd %d of %s",
+                  group->statFds[i].fd, key);
+        VIR_FORCE_CLOSE(group->statFds[i].fd);
+        VIR_DELETE_ELEMENT(group->statFds, i, group->nstatFds);
+        goto cleanup;
+    }
+
+    if (virCgroupPathOfController(group, controller, key, &keypath) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+
+    if ((statfd.fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0 ||
+        (rc = virCgroupPreadAll(statfd.fd, value)) < 0) {
+        VIR_FORCE_CLOSE(statfd.fd);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Keeping %s open as fd %d", keypath, statfd.fd);
+    if (VIR_APPEND_ELEMENT(group->statFds, group->nstatFds, statfd) < 0) {
+        virResetLastError();
+        VIR_FORCE_CLOSE(statfd.fd);
+    }
+    ret = rc;
+
+ cleanup:
+    virMutexUnlock(&group->statFdsLock);
+    VIR_FREE(keypath);
+    return ret;
+}
+
+
 static int
 virCgroupGetValueStr(virCgroupPtr group,
                      int controller,
@@ -817,6 +956,9 @@ virCgroupGetValueStr(virCgroupPtr group,
 
     *value = NULL;
 
+    if ((rc = virCgroupGetStatFileValue(group, controller, key, value)) >= 0)
+        goto done;
+
     if (virCgroupPathOfController(group, controller, key, &keypath) < 0)
         return -1;
 
@@ -828,6 +970,7 @@ virCgroupGetValueStr(virCgroupPtr group,
         goto cleanup;
     }
 
+ done:
     /* Terminated with '\n' has sometimes harmful effects to the caller */
     if (rc > 0 && (*value)[rc - 1] == '\n')
         (*value)[rc - 1] = '\0';
@@ -1152,6 +1295,12 @@ virCgroupNew(pid_t pid,
     if (VIR_ALLOC((*group)) < 0)
         goto error;
 
+    if (virMutexInit(&(*group)->statFdsLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize cgroup mutex"));
+        goto error;
+    }
+
     if (path[0] == '/' || !parent) {
         if (VIR_STRDUP((*group)->path, path) < 0)
             goto error;
@@ -1758,6 +1907,8 @@ virCgroupFree(virCgroupPtr *group)
     if (*group == NULL)
         return;
 
+    virCgroupCloseStatFds(*group);
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         VIR_FREE((*group)->controllers[i].mountPoint);
         VIR_FREE((*group)->controllers[i].linkPoint);
@@ -1765,6 +1916,7 @@ virCgroupFree(virCgroupPtr *group)
     }
 
     VIR_FREE((*group)->path);
+    virMutexDestroy(&(*group)->statFdsLock);
     VIR_FREE(*group);
 }
 
@@ -1840,6 +1992,56 @@ virCgroupPathOfController(virCgroupPtr group,
 }
 
 
+/* Sums up the "Read" and "Write" entries of all devices in the content
+ * of a blkio.throttle.io_service* file in a single pass. Lines look like
+ * "8:0 Read 1234". */
+static int
+virCgroupParseBlkioStat(const char *str,
+                        long long *reads,
+                        long long *writes)
+{
+    const char *line = str;
+    const char *p;
+    char *end;
+    long long *sum;
+    long long val;
+
+    *reads = 0;
+    *writes = 0;
+
+    for (; line && *line; line = (p = strchr(line, '\n')) ? p + 1 : NULL) {
+        if (!(p = strchr(line, ' ')))
+            continue;
+        p++;
+
+        if (STRPREFIX(p, "Read ")) {
+            sum = reads;
+            p += strlen("Read ");
+        } else if (STRPREFIX(p, "Write ")) {
+            sum = writes;
+            p += strlen("Write ");
+        } else {
+            continue;
+        }
+
+        if (virStrToLong_ll(p, &end, 10, &val) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Cannot parse blkio stat '%s'"), p);
+            return -1;
+        }
+
+        if (val < 0 || (val > 0 && *sum > (LLONG_MAX - val))) {
+            virReportError(VIR_ERR_OVERFLOW, "%s",
+                           _("Sum of blkio stat overflows"));
+            return -1;
+        }
+        *sum += val;
+    }
+
+    return 0;
+}
+
+
 /**
  * virCgroupGetBlkioIoServiced:
  *
@@ -1858,24 +2060,9 @@ virCgroupGetBlkioIoServiced(virCgroupPtr group,
                             long long *requests_read,
                             long long *requests_write)
 {
-    long long stats_val;
-    char *str1 = NULL, *str2 = NULL, *p1, *p2;
-    size_t i;
+    char *str1 = NULL, *str2 = NULL;
     int ret = -1;
 
-    const char *value_names[] = {
-        "Read ",
-        "Write "
-    };
-    long long *bytes_ptrs[] = {
-        bytes_read,
-        bytes_write
-    };
-    long long *requests_ptrs[] = {
-        requests_read,
-        requests_write
-    };
-
     *bytes_read = 0;
     *bytes_write = 0;
     *requests_read = 0;
@@ -1892,52 +2079,9 @@ virCgroupGetBlkioIoServiced(virCgroupPtr group,
         goto cleanup;
 
     /* sum up all entries of the same kind, from all devices */
-    for (i = 0; i < ARRAY_CARDINALITY(value_names); i++) {
-        p1 = str1;
-        p2 = str2;
-
-        while ((p1 = strstr(p1, value_names[i]))) {
-            p1 += strlen(value_names[i]);
-            if (virStrToLong_ll(p1, &p1, 10, &stats_val) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Cannot parse byte %sstat '%s'"),
-                               value_names[i],
-                               p1);
-                goto cleanup;
-            }
-
-            if (stats_val < 0 ||
-                (stats_val > 0 && *bytes_ptrs[i] > (LLONG_MAX - stats_val)))
-            {
-                virReportError(VIR_ERR_OVERFLOW,
-                               _("Sum of byte %sstat overflows"),
-                               value_names[i]);
-                goto cleanup;
-            }
-            *bytes_ptrs[i] += stats_val;
-        }
-
-        while ((p2 = strstr(p2, value_names[i]))) {
-            p2 += strlen(value_names[i]);
-            if (virStrToLong_ll(p2, &p2, 10, &stats_val) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Cannot parse %srequest stat '%s'"),
-                               value_names[i],
-                               p2);
-                goto cleanup;
-            }
-
-            if (stats_val < 0 ||
-                (stats_val > 0 && *requests_ptrs[i] > (LLONG_MAX - stats_val)))
-            {
-                virReportError(VIR_ERR_OVERFLOW,
-                               _("Sum of %srequest stat overflows"),
-                               value_names[i]);
-                goto cleanup;
-            }
-            *requests_ptrs[i] += stats_val;
-        }
-    }
+    if (virCgroupParseBlkioStat(str1, bytes_read, bytes_write) < 0 ||
+        virCgroupParseBlkioStat(str2, requests_read, requests_write) < 0)
+        goto cleanup;
 
     ret = 0;
 
@@ -3442,6 +3586,7 @@ virCgroupRemove(virCgroupPtr group)
     char *grppath = NULL;
 
     VIR_DEBUG("Removing cgroup %s", group->path);
+    virCgroupCloseStatFds(group);
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         /* Skip over controllers not mounted */
         if (!group->controllers[i].mountPoint)
@@ -30,6 +30,7 @@
 # define __VIR_CGROUP_PRIV_H__
 
 # include "vircgroup.h"
+# include "virthread.h"
 
 struct virCgroupController {
     int type;
@@ -42,10 +43,22 @@ struct virCgroupController {
     char *placement;
 };
 
+/* An open file descriptor of one of the frequently polled statistics
+ * files, see virCgroupStatFiles */
+struct virCgroupStatFd {
+    size_t file;
+    int fd;
+};
+
 struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    /* Guards statFds, stats of one group may be read concurrently */
+    virMutex statFdsLock;
+    struct virCgroupStatFd *statFds;
+    size_t nstatFds;
 };
 
 int virCgroupDetectMountsFromFile(virCgroupPtr group,
@@ -84,6 +84,7 @@ struct _virNetlinkEventSrvPrivate {
     int netlinkfd;
     virNetlinkHandle *netlinknh;
     /*Events*/
+    unsigned int overruns;
     int handled;
     size_t handlesCount;
     size_t handlesAlloc;
@@ -214,72 +215,87 @@ virNetlinkCreateSocket(int protocol)
 
 
 /**
- * virNetlinkCommand:
- * @nlmsg: pointer to netlink message
- * @respbuf: pointer to pointer where response buffer will be allocated
- * @respbuflen: pointer to integer holding the size of the response buffer
- *      on return of the function.
+ * virNetlinkSendRequest:
+ * @nl_msg: pointer to netlink message
  * @src_pid: the pid of the process to send a message
- * @dst_pid: the pid of the process to talk to, i.e., pid = 0 for kernel
+ * @nladdr: destination address, filled in by the caller
  * @protocol: netlink protocol
  * @groups: the group identifier
+ * @fd: filled in with the fd of the returned socket
  *
- * Send the given message to the netlink layer and receive response.
- * Returns 0 on success, -1 on error. In case of error, no response
- * buffer will be returned.
+ * Open a netlink socket for @protocol and send @nl_msg to @nladdr over it.
+ *
+ * Returns the socket the response can be read from, or NULL on error.
  */
-int virNetlinkCommand(struct nl_msg *nl_msg,
-                      struct nlmsghdr **resp, unsigned int *respbuflen,
-                      uint32_t src_pid, uint32_t dst_pid,
-                      unsigned int protocol, unsigned int groups)
+static virNetlinkHandle *
+virNetlinkSendRequest(struct nl_msg *nl_msg, uint32_t src_pid,
+                      struct sockaddr_nl *nladdr,
+                      unsigned int protocol, unsigned int groups,
+                      int *fd)
 {
-    int ret = -1;
-    struct sockaddr_nl nladdr = {
-            .nl_family = AF_NETLINK,
-            .nl_pid    = dst_pid,
-            .nl_groups = 0,
-    };
-    ssize_t nbytes;
-    struct pollfd fds[1];
-    int fd;
-    int n;
     struct nlmsghdr *nlmsg = nlmsg_hdr(nl_msg);
     virNetlinkHandle *nlhandle = NULL;
-    int len = 0;
 
     if (protocol >= MAX_LINKS) {
         virReportSystemError(EINVAL,
                              _("invalid protocol argument: %d"), protocol);
-        goto cleanup;
+        goto error;
     }
 
     if (!(nlhandle = virNetlinkCreateSocket(protocol)))
-        goto cleanup;
+        goto error;
 
-    fd = nl_socket_get_fd(nlhandle);
-    if (fd < 0) {
+    *fd = nl_socket_get_fd(nlhandle);
+    if (*fd < 0) {
         virReportSystemError(errno,
                              "%s", _("cannot get netlink socket fd"));
-        goto cleanup;
+        goto error;
     }
 
     if (groups && nl_socket_add_membership(nlhandle, groups) < 0) {
         virReportSystemError(errno,
                              "%s", _("cannot add netlink membership"));
-        goto cleanup;
+        goto error;
     }
 
-    nlmsg_set_dst(nl_msg, &nladdr);
+    nlmsg_set_dst(nl_msg, nladdr);
 
     nlmsg->nlmsg_pid = src_pid ? src_pid : getpid();
 
-    nbytes = nl_send_auto_complete(nlhandle, nl_msg);
-    if (nbytes < 0) {
+    if (nl_send_auto_complete(nlhandle, nl_msg) < 0) {
         virReportSystemError(errno,
                              "%s", _("cannot send to netlink socket"));
-        goto cleanup;
+        goto error;
     }
 
+    return nlhandle;
+
+ error:
+    virNetlinkFree(nlhandle);
+    return NULL;
+}
+
+
+/**
+ * virNetlinkRecvResponse:
+ * @nlhandle: socket returned by virNetlinkSendRequest
+ * @fd: fd of @nlhandle
+ * @nladdr: address the request was sent to
+ * @resp: pointer to pointer where the response buffer will be allocated
+ *
+ * Wait for the next response on @nlhandle and read it.
+ *
+ * Returns the length of the response, or -1 on error.
+ */
+static int
+virNetlinkRecvResponse(virNetlinkHandle *nlhandle, int fd,
+                       struct sockaddr_nl *nladdr,
+                       struct nlmsghdr **resp)
+{
+    struct pollfd fds[1];
+    int n;
+    int len;
+
     memset(fds, 0, sizeof(fds));
     fds[0].fd = fd;
     fds[0].events = POLLIN;
@@ -292,20 +308,61 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
         if (n == 0)
             virReportSystemError(ETIMEDOUT, "%s",
                                  _("no valid netlink response was received"));
-        goto cleanup;
+        return -1;
     }
 
-    len = nl_recv(nlhandle, &nladdr, (unsigned char **)resp, NULL);
+    len = nl_recv(nlhandle, nladdr, (unsigned char **)resp, NULL);
     if (len == 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("nl_recv failed - returned 0 bytes"));
-        goto cleanup;
+        return -1;
     }
     if (len < 0) {
         virReportSystemError(errno, "%s", _("nl_recv failed"));
-        goto cleanup;
+        return -1;
     }
 
+    return len;
+}
+
+
+/**
+ * virNetlinkCommand:
+ * @nlmsg: pointer to netlink message
+ * @respbuf: pointer to pointer where response buffer will be allocated
+ * @respbuflen: pointer to integer holding the size of the response buffer
+ *      on return of the function.
+ * @src_pid: the pid of the process to send a message
+ * @dst_pid: the pid of the process to talk to, i.e., pid = 0 for kernel
+ * @protocol: netlink protocol
+ * @groups: the group identifier
+ *
+ * Send the given message to the netlink layer and receive response.
+ * Returns 0 on success, -1 on error. In case of error, no response
+ * buffer will be returned.
+ */
+int virNetlinkCommand(struct nl_msg *nl_msg,
+                      struct nlmsghdr **resp, unsigned int *respbuflen,
+                      uint32_t src_pid, uint32_t dst_pid,
+                      unsigned int protocol, unsigned int groups)
+{
+    int ret = -1;
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = dst_pid,
+            .nl_groups = 0,
+    };
+    int fd;
+    virNetlinkHandle *nlhandle = NULL;
+    int len = 0;
+
+    if (!(nlhandle = virNetlinkSendRequest(nl_msg, src_pid, &nladdr,
+                                           protocol, groups, &fd)))
+        goto cleanup;
+
+    if ((len = virNetlinkRecvResponse(nlhandle, fd, &nladdr, resp)) < 0)
+        goto cleanup;
+
     ret = 0;
     *respbuflen = len;
  cleanup:
@@ -319,6 +376,120 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
 }
 
 
+/**
+ * virNetlinkDumpProcess:
+ * @resp: one response buffer of a netlink dump
+ * @len: length of @resp
+ * @callback: function called for every message of @resp
+ * @opaque: data passed to @callback
+ * @end: set to true once the message ending the dump was seen
+ *
+ * Pass each message of @resp to @callback, stopping at NLMSG_DONE.
+ * Acknowledgements are skipped, error messages fail the dump.
+ *
+ * Returns 0 on success, -1 on error or if @callback failed.
+ */
+int
+virNetlinkDumpProcess(struct nlmsghdr *resp,
+                      unsigned int len,
+                      virNetlinkDumpCallback callback,
+                      void *opaque,
+                      bool *end)
+{
+    struct nlmsghdr *msg;
+
+    for (msg = resp; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+        if (msg->nlmsg_type == NLMSG_DONE) {
+            *end = true;
+            return 0;
+        }
+
+        if (msg->nlmsg_type == NLMSG_ERROR) {
+            struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(msg);
+
+            if (msg->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("malformed netlink response message"));
+                return -1;
+            }
+            if (err->error) {
+                virReportSystemError(-err->error, "%s",
+                                     _("netlink dump request failed"));
+                return -1;
+            }
+            continue;
+        }
+
+        if (callback(msg, opaque) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNetlinkDumpCommand:
+ * @nl_msg: pointer to netlink message, NLM_F_DUMP is added to its flags
+ * @callback: function called for every message of the reply
+ * @src_pid: the pid of the process to send a message
+ * @dst_pid: the pid of the process to talk to, i.e., pid = 0 for kernel
+ * @protocol: netlink protocol
+ * @groups: the group identifier
+ * @opaque: data passed to @callback
+ *
+ * Send the given dump request to the netlink layer and pass each message
+ * of the (possibly multipart) response to @callback until the kernel
+ * signals the end of the dump. The whole reply is gathered over a single
+ * socket, so e.g. RTM_GETLINK returns every interface of the host in one
+ * round trip instead of one request per interface.
+ *
+ * Returns 0 on success, -1 on error or if @callback failed.
+ */
+int
+virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                      virNetlinkDumpCallback callback,
+                      uint32_t src_pid, uint32_t dst_pid,
+                      unsigned int protocol, unsigned int groups,
+                      void *opaque)
+{
+    int ret = -1;
+    bool end = false;
+    int len = 0;
+    struct nlmsghdr *resp = NULL;
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = dst_pid,
+            .nl_groups = 0,
+    };
+    int fd;
+    virNetlinkHandle *nlhandle = NULL;
+
+    nlmsg_hdr(nl_msg)->nlmsg_flags |= NLM_F_DUMP;
+
+    if (!(nlhandle = virNetlinkSendRequest(nl_msg, src_pid, &nladdr,
+                                           protocol, groups, &fd)))
+        goto cleanup;
+
+    while (!end) {
+        if ((len = virNetlinkRecvResponse(nlhandle, fd, &nladdr, &resp)) < 0)
+            goto cleanup;
+
+        if (virNetlinkDumpProcess(resp, len, callback, opaque, &end) < 0)
+            goto cleanup;
+
+        VIR_FREE(resp);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(resp);
+    virNetlinkFree(nlhandle);
+    return ret;
+}
+
+
 /**
  * virNetlinkDelLink:
  *
@@ -513,6 +684,15 @@ virNetlinkEventCallback(int watch,
     if (length == 0)
         return;
     if (length < 0) {
+        if (errno == ENOBUFS) {
+            /* The socket buffer overflowed and events were dropped,
+             * clients keeping state based on them need to know */
+            VIR_WARN("netlink event socket overrun, events were lost");
+            virNetlinkEventServerLock(srv);
+            srv->overruns++;
+            virNetlinkEventServerUnlock(srv);
+            return;
+        }
         virReportSystemError(errno,
                              "%s", _("nl_recv returned with error"));
         return;
@@ -643,6 +823,32 @@ virNetlinkEventServiceIsRunning(unsigned int protocol)
     return server[protocol] != NULL;
 }
 
+/**
+ * virNetlinkEventServiceOverruns:
+ *
+ * @protocol: netlink protocol
+ *
+ * Returns how many times events of the netlink event service were lost
+ * because its socket buffer overflowed, 0 if the service is not running.
+ * Clients caching state derived from events must drop it whenever this
+ * changes.
+ */
+unsigned int
+virNetlinkEventServiceOverruns(unsigned int protocol)
+{
+    virNetlinkEventSrvPrivatePtr srv;
+    unsigned int ret;
+
+    if (protocol >= MAX_LINKS || !(srv = server[protocol]))
+        return 0;
+
+    virNetlinkEventServerLock(srv);
+    ret = srv->overruns;
+    virNetlinkEventServerUnlock(srv);
+
+    return ret;
+}
+
 /**
  * virNetlinkEventServiceLocalPid:
  *
@@ -926,6 +1132,32 @@ int virNetlinkCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
 }
 
 
+int
+virNetlinkDumpProcess(struct nlmsghdr *resp ATTRIBUTE_UNUSED,
+                      unsigned int len ATTRIBUTE_UNUSED,
+                      virNetlinkDumpCallback callback ATTRIBUTE_UNUSED,
+                      void *opaque ATTRIBUTE_UNUSED,
+                      bool *end ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+
+int
+virNetlinkDumpCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
+                      virNetlinkDumpCallback callback ATTRIBUTE_UNUSED,
+                      uint32_t src_pid ATTRIBUTE_UNUSED,
+                      uint32_t dst_pid ATTRIBUTE_UNUSED,
+                      unsigned int protocol ATTRIBUTE_UNUSED,
+                      unsigned int groups ATTRIBUTE_UNUSED,
+                      void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+
 int
 virNetlinkDelLink(const char *ifname ATTRIBUTE_UNUSED,
                   virNetlinkDelLinkFallback fallback ATTRIBUTE_UNUSED)
@@ -975,6 +1207,12 @@ bool virNetlinkEventServiceIsRunning(unsigned int protocol ATTRIBUTE_UNUSED)
     return 0;
 }
 
+unsigned int
+virNetlinkEventServiceOverruns(unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
 int virNetlinkEventServiceLocalPid(unsigned int protocol ATTRIBUTE_UNUSED)
 {
     virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
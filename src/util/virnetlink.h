@@ -52,6 +52,21 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
                       uint32_t src_pid, uint32_t dst_pid,
                       unsigned int protocol, unsigned int groups);
 
+typedef int (*virNetlinkDumpCallback)(const struct nlmsghdr *resp,
+                                      void *opaque);
+
+int virNetlinkDumpProcess(struct nlmsghdr *resp,
+                          unsigned int len,
+                          virNetlinkDumpCallback callback,
+                          void *opaque,
+                          bool *end);
+
+int virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                          virNetlinkDumpCallback callback,
+                          uint32_t src_pid, uint32_t dst_pid,
+                          unsigned int protocol, unsigned int groups,
+                          void *opaque);
+
 typedef int (*virNetlinkDelLinkFallback)(const char *ifname);
 
 int virNetlinkDelLink(const char *ifname, virNetlinkDelLinkFallback fallback);
@@ -88,6 +103,11 @@ int virNetlinkEventServiceStart(unsigned int protocol, unsigned int groups);
  */
 bool virNetlinkEventServiceIsRunning(unsigned int protocol);
 
+/**
+ * virNetlinkEventServiceOverruns: returns how often events were lost
+ */
+unsigned int virNetlinkEventServiceOverruns(unsigned int protocol);
+
 /**
  * virNetlinkEventServiceLocalPid: returns nl_pid used to bind() netlink socket
  */
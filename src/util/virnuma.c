@@ -1021,3 +1021,203 @@ virNumaGetHostNodeset(void)
 
     return nodeset;
 }
+
+
+typedef struct _virNumaPlacementNode virNumaPlacementNode;
+typedef virNumaPlacementNode *virNumaPlacementNodePtr;
+struct _virNumaPlacementNode {
+    size_t node;
+    int ncpus;
+    unsigned long long free;    /* KiB */
+    unsigned long long load;    /* average load of the node's CPUs */
+    bool preferred;
+};
+
+static int
+virNumaPlacementCompareLoad(const void *a,
+                            const void *b)
+{
+    const virNumaPlacementNode *na = a;
+    const virNumaPlacementNode *nb = b;
+
+    if (na->load != nb->load)
+        return na->load < nb->load ? -1 : 1;
+    if (na->preferred != nb->preferred)
+        return na->preferred ? -1 : 1;
+    if (na->free != nb->free)
+        return na->free > nb->free ? -1 : 1;
+    return 0;
+}
+
+static int
+virNumaPlacementCompareFree(const void *a,
+                            const void *b)
+{
+    const virNumaPlacementNode *na = a;
+    const virNumaPlacementNode *nb = b;
+
+    if (na->free != nb->free)
+        return na->free > nb->free ? -1 : 1;
+    return virNumaPlacementCompareLoad(a, b);
+}
+
+
+/**
+ * virNumaGetPlacement:
+ * @vcpus: number of vCPUs to place
+ * @memory: amount of memory to place in KiB
+ * @pagesize: size of the huge pages backing @memory in KiB, 0 for
+ *            ordinary memory
+ * @cpuload: load already put on each host CPU, or NULL
+ * @ncpuload: number of items in @cpuload
+ * @current: nodes the domain currently runs on, or NULL
+ *
+ * Picks host NUMA nodes for a domain using automatic placement. @cpuload
+ * holds, for each host CPU, the sum of the shares of vCPUs of other
+ * domains pinned to it, in units of 1/VIR_NUMA_PLACEMENT_LOAD_SCALE of
+ * a vCPU.
+ *
+ * A single node with enough free memory (or free huge pages of
+ * @pagesize) is preferred, the least loaded one with enough CPUs for all
+ * vCPUs first. If no node can hold @memory on its own, nodes with most
+ * free memory are combined, and if all of them can't hold it either,
+ * all nodes are used.
+ *
+ * When re-placing a running domain, @current lets the domain's own memory
+ * count as free on the nodes it occupies, assumed to be spread evenly,
+ * and favours these nodes by a quarter of a vCPU of load per host CPU so
+ * that the domain is only moved for a clear gain.
+ *
+ * Returns the nodeset or NULL on error.
+ */
+virBitmapPtr
+virNumaGetPlacement(unsigned int vcpus,
+                    unsigned long long memory,
+                    unsigned int pagesize,
+                    const unsigned int *cpuload,
+                    size_t ncpuload,
+                    virBitmapPtr current)
+{
+    virNumaPlacementNodePtr nodes = NULL;
+    size_t nnodes = 0;
+    virBitmapPtr cpus = NULL;
+    virBitmapPtr ret = NULL;
+    unsigned long long total = 0;
+    int maxnode;
+    int ncpus;
+    ssize_t cpu;
+    size_t i;
+    size_t pick = 0;
+    size_t ncurrent = current ? virBitmapCountBits(current) : 0;
+
+    if (!virNumaIsAvailable()) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("NUMA is not available on this host"));
+        return NULL;
+    }
+
+    if ((maxnode = virNumaGetMaxNode()) < 0)
+        return NULL;
+
+    if (VIR_ALLOC_N(nodes, maxnode + 1) < 0)
+        return NULL;
+
+    for (i = 0; i <= maxnode; i++) {
+        virNumaPlacementNodePtr node = &nodes[nnodes];
+        unsigned long long memfree = 0;
+        unsigned int pagefree = 0;
+
+        if ((ncpus = virNumaGetNodeCPUs(i, &cpus)) < 0) {
+            if (ncpus == -2)
+                continue;
+            goto cleanup;
+        }
+
+        /* memory only nodes are not worth placing a domain on */
+        if (ncpus == 0) {
+            virBitmapFree(cpus);
+            cpus = NULL;
+            continue;
+        }
+
+        node->node = i;
+        node->ncpus = ncpus;
+
+        if (pagesize) {
+            /* the node may lack huge pages of this size altogether */
+            if (virNumaGetPageInfo(i, pagesize, 0, NULL, &pagefree) < 0)
+                virResetLastError();
+            node->free = (unsigned long long) pagefree * pagesize;
+        } else {
+            ignore_value(virNumaGetNodeMemory(i, NULL, &memfree));
+            node->free = memfree / 1024;
+        }
+
+        cpu = -1;
+        while (cpuload && (cpu = virBitmapNextSetBit(cpus, cpu)) >= 0 &&
+               cpu < ncpuload)
+            node->load += cpuload[cpu];
+        node->load /= ncpus;
+
+        if (ncurrent && virBitmapIsBitSet(current, i)) {
+            node->preferred = true;
+            node->free += memory / ncurrent;
+            if (node->load > VIR_NUMA_PLACEMENT_LOAD_SCALE / 4)
+                node->load -= VIR_NUMA_PLACEMENT_LOAD_SCALE / 4;
+            else
+                node->load = 0;
+        }
+
+        VIR_DEBUG("node=%zu cpus=%d free=%llu load=%llu",
+                  node->node, node->ncpus, node->free, node->load);
+
+        virBitmapFree(cpus);
+        cpus = NULL;
+        nnodes++;
+    }
+
+    if (!nnodes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("no usable NUMA node found"));
+        goto cleanup;
+    }
+
+    if (!(ret = virBitmapNew(maxnode + 1)))
+        goto cleanup;
+
+    qsort(nodes, nnodes, sizeof(*nodes), virNumaPlacementCompareLoad);
+
+    for (i = 0; i < nnodes; i++) {
+        if (nodes[i].free < memory)
+            continue;
+        if (nodes[i].ncpus >= vcpus) {
+            pick = i + 1;
+            break;
+        }
+        if (!pick)
+            pick = i + 1;
+    }
+
+    if (pick) {
+        ignore_value(virBitmapSetBit(ret, nodes[pick - 1].node));
+        goto cleanup;
+    }
+
+    qsort(nodes, nnodes, sizeof(*nodes), virNumaPlacementCompareFree);
+
+    for (i = 0; i < nnodes && total < memory; i++) {
+        ignore_value(virBitmapSetBit(ret, nodes[i].node));
+        total += nodes[i].free;
+    }
+
+    if (total < memory) {
+        VIR_DEBUG("Not enough free memory on any set of nodes, using all");
+        for (i = 0; i < nnodes; i++)
+            ignore_value(virBitmapSetBit(ret, nodes[i].node));
+    }
+
+ cleanup:
+    virBitmapFree(cpus);
+    VIR_FREE(nodes);
+    return ret;
+}
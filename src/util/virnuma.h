@@ -30,6 +30,16 @@
 char *virNumaGetAutoPlacementAdvice(unsigned short vcups,
                                     unsigned long long balloon);
 
+/* Unit of the per host CPU load passed to virNumaGetPlacement */
+# define VIR_NUMA_PLACEMENT_LOAD_SCALE 1000
+
+virBitmapPtr virNumaGetPlacement(unsigned int vcpus,
+                                 unsigned long long memory,
+                                 unsigned int pagesize,
+                                 const unsigned int *cpuload,
+                                 size_t ncpuload,
+                                 virBitmapPtr current);
+
 int virNumaSetupMemoryPolicy(virDomainNumatuneMemMode mode,
                              virBitmapPtr nodeset);
 
@@ -40,6 +40,9 @@ VIR_LOG_INIT("util.perf");
 VIR_ENUM_IMPL(virPerfEvent, VIR_PERF_EVENT_LAST,
               "cmt", "mbmt", "mbml");
 
+VIR_ENUM_IMPL(virPerfCounter, VIR_PERF_COUNTER_LAST,
+              "cycles", "instructions", "cache_misses", "stalled_cycles");
+
 struct virPerfEvent {
     int type;
     int fd;
@@ -57,6 +60,15 @@ struct virPerf {
     struct virPerfEvent events[VIR_PERF_EVENT_LAST];
 };
 
+struct virPerfCounters {
+    pid_t tid;
+    int fds[VIR_PERF_COUNTER_LAST];   /* -1 if not supported by the host */
+    /* Counter type of each value returned by a group read, in the
+     * order the counters were added to the group */
+    int order[VIR_PERF_COUNTER_LAST];
+    size_t norder;
+};
+
 virPerfPtr
 virPerfNew(void)
 {
@@ -272,6 +284,178 @@ virPerfReadEvent(virPerfPtr perf,
     return 0;
 }
 
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} virPerfCounterAttrs[VIR_PERF_COUNTER_LAST] = {
+    [VIR_PERF_COUNTER_CYCLES] = {
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [VIR_PERF_COUNTER_INSTRUCTIONS] = {
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [VIR_PERF_COUNTER_CACHE_MISSES] = {
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [VIR_PERF_COUNTER_STALLED_CYCLES] = {
+        PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+};
+
+
+/**
+ * virPerfCountersNew:
+ * @tid: thread to count events of
+ *
+ * Opens the hardware counters of @tid as a single perf event group so
+ * that all of them are scheduled together and can be read with one
+ * read(2). Counters the host doesn't support are left out.
+ *
+ * Returns the counters, or NULL if none of them could be opened.
+ */
+virPerfCountersPtr
+virPerfCountersNew(pid_t tid)
+{
+    virPerfCountersPtr counters;
+    struct perf_event_attr attr;
+    int leader = -1;
+    size_t i;
+
+    if (VIR_ALLOC(counters) < 0)
+        return NULL;
+
+    counters->tid = tid;
+    for (i = 0; i < VIR_PERF_COUNTER_LAST; i++)
+        counters->fds[i] = -1;
+
+    for (i = 0; i < VIR_PERF_COUNTER_LAST; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = virPerfCounterAttrs[i].type;
+        attr.config = virPerfCounterAttrs[i].config;
+        attr.read_format = PERF_FORMAT_GROUP |
+                           PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_hv = 1;
+        /* only the leader starts disabled, the group is enabled at once */
+        attr.disabled = leader < 0;
+
+        counters->fds[i] = syscall(__NR_perf_event_open, &attr,
+                                   tid, -1, leader, 0);
+        if (counters->fds[i] < 0) {
+            VIR_DEBUG("Counter %s not available for tid=%d: %d",
+                      virPerfCounterTypeToString(i), (int) tid, errno);
+            continue;
+        }
+
+        if (leader < 0)
+            leader = counters->fds[i];
+        counters->order[counters->norder++] = i;
+    }
+
+    if (leader < 0) {
+        virReportSystemError(errno,
+                             _("Unable to open perf counters for tid=%d"),
+                             (int) tid);
+        goto error;
+    }
+
+    if (ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to enable perf counters for tid=%d"),
+                             (int) tid);
+        goto error;
+    }
+
+    return counters;
+
+ error:
+    virPerfCountersFree(counters);
+    return NULL;
+}
+
+
+void
+virPerfCountersFree(virPerfCountersPtr counters)
+{
+    size_t i;
+
+    if (!counters)
+        return;
+
+    for (i = 0; i < VIR_PERF_COUNTER_LAST; i++)
+        VIR_FORCE_CLOSE(counters->fds[i]);
+
+    VIR_FREE(counters);
+}
+
+
+bool
+virPerfCountersHas(virPerfCountersPtr counters,
+                   virPerfCounterType type)
+{
+    return type < VIR_PERF_COUNTER_LAST && counters->fds[type] >= 0;
+}
+
+
+/**
+ * virPerfCountersRead:
+ * @counters: counters to read
+ * @values: array of VIR_PERF_COUNTER_LAST items to fill
+ *
+ * Reads all counters of the group with a single read(2). Items of
+ * @values for counters the host doesn't support are set to 0.
+ *
+ * When the PMU has fewer counters than are in use on the CPU, the kernel
+ * multiplexes the groups and only counts ours for part of the time. The
+ * values are then extrapolated to the whole time the group was enabled.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virPerfCountersRead(virPerfCountersPtr counters,
+                    uint64_t *values)
+{
+    /* Read layout: the number of values, the time the group was enabled
+     * and the time it was actually counting, followed by the values */
+    uint64_t buf[3 + VIR_PERF_COUNTER_LAST];
+    ssize_t len = sizeof(uint64_t) * (3 + counters->norder);
+    uint64_t enabled;
+    uint64_t running;
+    size_t i;
+
+    memset(values, 0, sizeof(*values) * VIR_PERF_COUNTER_LAST);
+
+    if (saferead(counters->fds[counters->order[0]], buf, len) != len) {
+        virReportSystemError(errno,
+                             _("Unable to read perf counters for tid=%d"),
+                             (int) counters->tid);
+        return -1;
+    }
+
+    enabled = buf[1];
+    running = buf[2];
+
+    /* Not scheduled at all yet, there is nothing to extrapolate from */
+    if (!running)
+        return 0;
+
+    if (running < enabled)
+        VIR_DEBUG("Perf counters of tid=%d multiplexed, "
+                  "running %llu of %llu ns",
+                  (int) counters->tid,
+                  (unsigned long long) running,
+                  (unsigned long long) enabled);
+
+    for (i = 0; i < counters->norder && i < buf[0]; i++) {
+        uint64_t value = buf[3 + i];
+
+        if (running < enabled)
+            value = (double) value * enabled / running;
+
+        values[counters->order[i]] = value;
+    }
+
+    return 0;
+}
+
 #else
 int
 virPerfEventEnable(virPerfPtr perf ATTRIBUTE_UNUSED,
@@ -318,4 +502,33 @@ virPerfReadEvent(virPerfPtr perf ATTRIBUTE_UNUSED,
     return -1;
 }
 
+virPerfCountersPtr
+virPerfCountersNew(pid_t tid ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENXIO, "%s",
+                         _("Perf not supported on this platform"));
+    return NULL;
+}
+
+void
+virPerfCountersFree(virPerfCountersPtr counters ATTRIBUTE_UNUSED)
+{
+}
+
+bool
+virPerfCountersHas(virPerfCountersPtr counters ATTRIBUTE_UNUSED,
+                   virPerfCounterType type ATTRIBUTE_UNUSED)
+{
+    return false;
+}
+
+int
+virPerfCountersRead(virPerfCountersPtr counters ATTRIBUTE_UNUSED,
+                    uint64_t *values ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENXIO, "%s",
+                         _("Perf not supported on this platform"));
+    return -1;
+}
+
 #endif
@@ -58,4 +58,29 @@ int virPerfReadEvent(virPerfPtr perf,
                      virPerfEventType type,
                      uint64_t *value);
 
+/* Hardware counters sampled per thread as one perf event group */
+typedef enum {
+    VIR_PERF_COUNTER_CYCLES,
+    VIR_PERF_COUNTER_INSTRUCTIONS,
+    VIR_PERF_COUNTER_CACHE_MISSES,
+    VIR_PERF_COUNTER_STALLED_CYCLES,
+
+    VIR_PERF_COUNTER_LAST
+} virPerfCounterType;
+
+VIR_ENUM_DECL(virPerfCounter);
+
+struct virPerfCounters;
+typedef struct virPerfCounters *virPerfCountersPtr;
+
+virPerfCountersPtr virPerfCountersNew(pid_t tid);
+
+void virPerfCountersFree(virPerfCountersPtr counters);
+
+bool virPerfCountersHas(virPerfCountersPtr counters,
+                        virPerfCounterType type);
+
+int virPerfCountersRead(virPerfCountersPtr counters,
+                        uint64_t *values);
+
 #endif /* __VIR_PERF_H__ */
@@ -39,9 +39,18 @@
 #include "virstats.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virlog.h"
+#include "virnetlink.h"
+#include "c-ctype.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/rtnetlink.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_STATS_LINUX
 
+VIR_LOG_INIT("util.stats");
+
 
 /*-------------------- interface stats --------------------*/
 /* Just reads the named interface, so not Xen or QEMU-specific.
@@ -49,13 +58,69 @@
  * the interface of a domain they own.  We do no such checking.
  */
 #ifdef __linux__
+/* Parses one line of /proc/net/dev. On success @line is split so that
+ * @name points to the interface name within it. */
+static int
+virNetInterfaceStatsParseLine(char *line,
+                              char **name,
+                              virDomainInterfaceStatsPtr stats)
+{
+    long long dummy;
+    long long rx_bytes;
+    long long rx_packets;
+    long long rx_errs;
+    long long rx_drop;
+    long long tx_bytes;
+    long long tx_packets;
+    long long tx_errs;
+    long long tx_drop;
+    char *colon;
+
+    /* The line looks like:
+     *   "   eth0:..."
+     * Split it at the colon.
+     */
+    if (!(colon = strchr(line, ':')))
+        return -1;
+    *colon = '\0';
+
+    /* IMPORTANT NOTE!
+     * /proc/net/dev vif<domid>.nn sees the network from the point
+     * of view of dom0 / hypervisor.  So bytes TRANSMITTED by dom0
+     * are bytes RECEIVED by the domain.  That's why the TX/RX fields
+     * appear to be swapped here.
+     */
+    if (sscanf(colon+1,
+               "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
+               &tx_bytes, &tx_packets, &tx_errs, &tx_drop,
+               &dummy, &dummy, &dummy, &dummy,
+               &rx_bytes, &rx_packets, &rx_errs, &rx_drop,
+               &dummy, &dummy, &dummy, &dummy) != 16)
+        return -1;
+
+    stats->rx_bytes = rx_bytes;
+    stats->rx_packets = rx_packets;
+    stats->rx_errs = rx_errs;
+    stats->rx_drop = rx_drop;
+    stats->tx_bytes = tx_bytes;
+    stats->tx_packets = tx_packets;
+    stats->tx_errs = tx_errs;
+    stats->tx_drop = tx_drop;
+
+    *name = line;
+    while (c_isspace(**name))
+        (*name)++;
+
+    return 0;
+}
+
+
 int
 virNetInterfaceStats(const char *path,
                      virDomainInterfaceStatsPtr stats)
 {
-    int path_len;
     FILE *fp;
-    char line[256], *colon;
+    char line[256], *name;
 
     fp = fopen("/proc/net/dev", "r");
     if (!fp) {
@@ -64,52 +129,12 @@ virNetInterfaceStats(const char *path,
         return -1;
     }
 
-    path_len = strlen(path);
-
     while (fgets(line, sizeof(line), fp)) {
-        long long dummy;
-        long long rx_bytes;
-        long long rx_packets;
-        long long rx_errs;
-        long long rx_drop;
-        long long tx_bytes;
-        long long tx_packets;
-        long long tx_errs;
-        long long tx_drop;
-
-        /* The line looks like:
-         *   "   eth0:..."
-         * Split it at the colon.
-         */
-        colon = strchr(line, ':');
-        if (!colon) continue;
-        *colon = '\0';
-        if (colon-path_len >= line &&
-            STREQ(colon-path_len, path)) {
-            /* IMPORTANT NOTE!
-             * /proc/net/dev vif<domid>.nn sees the network from the point
-             * of view of dom0 / hypervisor.  So bytes TRANSMITTED by dom0
-             * are bytes RECEIVED by the domain.  That's why the TX/RX fields
-             * appear to be swapped here.
-             */
-            if (sscanf(colon+1,
-                       "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
-                       &tx_bytes, &tx_packets, &tx_errs, &tx_drop,
-                       &dummy, &dummy, &dummy, &dummy,
-                       &rx_bytes, &rx_packets, &rx_errs, &rx_drop,
-                       &dummy, &dummy, &dummy, &dummy) != 16)
-                continue;
-
-            stats->rx_bytes = rx_bytes;
-            stats->rx_packets = rx_packets;
-            stats->rx_errs = rx_errs;
-            stats->rx_drop = rx_drop;
-            stats->tx_bytes = tx_bytes;
-            stats->tx_packets = tx_packets;
-            stats->tx_errs = tx_errs;
-            stats->tx_drop = tx_drop;
-            VIR_FORCE_FCLOSE(fp);
+        if (virNetInterfaceStatsParseLine(line, &name, stats) < 0)
+            continue;
 
+        if (STREQ(name, path)) {
+            VIR_FORCE_FCLOSE(fp);
             return 0;
         }
     }
@@ -119,6 +144,177 @@ virNetInterfaceStats(const char *path,
                    _("/proc/net/dev: Interface not found"));
     return -1;
 }
+
+
+static int
+virNetInterfaceStatsAdd(virHashTablePtr table,
+                        const char *name,
+                        virDomainInterfaceStatsPtr stats)
+{
+    virDomainInterfaceStatsPtr copy;
+
+    if (VIR_ALLOC(copy) < 0)
+        return -1;
+
+    *copy = *stats;
+
+    if (virHashUpdateEntry(table, name, copy) < 0) {
+        VIR_FREE(copy);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+# ifdef HAVE_LIBNL
+static int
+virNetInterfaceStatsDumpCallback(const struct nlmsghdr *resp,
+                                 void *opaque)
+{
+    virHashTablePtr table = opaque;
+    struct nlattr *tb[IFLA_MAX + 1];
+    struct _virDomainInterfaceStats stats;
+    const char *name;
+
+    if (resp->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    if (nlmsg_parse((struct nlmsghdr *)resp, sizeof(struct ifinfomsg),
+                    tb, IFLA_MAX, NULL) < 0 ||
+        !tb[IFLA_IFNAME])
+        return 0;
+
+    name = nla_get_string(tb[IFLA_IFNAME]);
+
+    /* Swapped for the same reason as in virNetInterfaceStatsParseLine */
+    if (tb[IFLA_STATS64] &&
+        nla_len(tb[IFLA_STATS64]) >= sizeof(struct rtnl_link_stats64)) {
+        struct rtnl_link_stats64 link;
+
+        memcpy(&link, nla_data(tb[IFLA_STATS64]), sizeof(link));
+        stats.rx_bytes = link.tx_bytes;
+        stats.rx_packets = link.tx_packets;
+        stats.rx_errs = link.tx_errors;
+        stats.rx_drop = link.tx_dropped;
+        stats.tx_bytes = link.rx_bytes;
+        stats.tx_packets = link.rx_packets;
+        stats.tx_errs = link.rx_errors;
+        stats.tx_drop = link.rx_dropped;
+    } else if (tb[IFLA_STATS] &&
+               nla_len(tb[IFLA_STATS]) >= sizeof(struct rtnl_link_stats)) {
+        struct rtnl_link_stats link;
+
+        memcpy(&link, nla_data(tb[IFLA_STATS]), sizeof(link));
+        stats.rx_bytes = link.tx_bytes;
+        stats.rx_packets = link.tx_packets;
+        stats.rx_errs = link.tx_errors;
+        stats.rx_drop = link.tx_dropped;
+        stats.tx_bytes = link.rx_bytes;
+        stats.tx_packets = link.rx_packets;
+        stats.tx_errs = link.rx_errors;
+        stats.tx_drop = link.rx_dropped;
+    } else {
+        return 0;
+    }
+
+    return virNetInterfaceStatsAdd(table, name, &stats);
+}
+
+
+static int
+virNetInterfaceStatsGetAllNetlink(virHashTablePtr table)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    int ret = -1;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto cleanup;
+    }
+
+    ret = virNetlinkDumpCommand(nl_msg, virNetInterfaceStatsDumpCallback,
+                                0, 0, NETLINK_ROUTE, 0, table);
+
+ cleanup:
+    nlmsg_free(nl_msg);
+    return ret;
+}
+# endif /* HAVE_LIBNL */
+
+
+static int
+virNetInterfaceStatsGetAllProc(virHashTablePtr table)
+{
+    FILE *fp;
+    char line[256], *name;
+    struct _virDomainInterfaceStats stats;
+    int ret = -1;
+
+    fp = fopen("/proc/net/dev", "r");
+    if (!fp) {
+        virReportSystemError(errno, "%s",
+                             _("Could not open /proc/net/dev"));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (virNetInterfaceStatsParseLine(line, &name, &stats) < 0)
+            continue;
+
+        if (virNetInterfaceStatsAdd(table, name, &stats) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_FCLOSE(fp);
+    return ret;
+}
+
+
+/**
+ * virNetInterfaceStatsGetAll:
+ *
+ * Gathers the counters of all network interfaces of the host at once,
+ * using a single netlink RTM_GETLINK dump when possible and one pass
+ * over /proc/net/dev otherwise. Callers looking up many interfaces, e.g.
+ * those of all domains, should use this and virNetInterfaceStatsLookup()
+ * instead of calling virNetInterfaceStats() for each of them.
+ *
+ * Returns a hash table keyed by interface name, or NULL on error.
+ */
+virHashTablePtr
+virNetInterfaceStatsGetAll(void)
+{
+    virHashTablePtr table;
+
+    if (!(table = virHashCreate(64, virHashValueFree)))
+        return NULL;
+
+# ifdef HAVE_LIBNL
+    if (virNetInterfaceStatsGetAllNetlink(table) == 0)
+        return table;
+
+    VIR_DEBUG("Falling back to /proc/net/dev for interface stats");
+    virResetLastError();
+    virHashRemoveAll(table);
+# endif
+
+    if (virNetInterfaceStatsGetAllProc(table) < 0) {
+        virHashFree(table);
+        return NULL;
+    }
+
+    return table;
+}
 #elif defined(HAVE_GETIFADDRS) && defined(AF_LINK)
 int
 virNetInterfaceStats(const char *path,
@@ -165,6 +361,14 @@ virNetInterfaceStats(const char *path,
     freeifaddrs(ifap);
     return ret;
 }
+
+virHashTablePtr
+virNetInterfaceStatsGetAll(void)
+{
+    virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                   _("interface stats not implemented on this platform"));
+    return NULL;
+}
 #else
 int
 virNetInterfaceStats(const char *path ATTRIBUTE_UNUSED,
@@ -175,4 +379,40 @@ virNetInterfaceStats(const char *path ATTRIBUTE_UNUSED,
     return -1;
 }
 
+
+virHashTablePtr
+virNetInterfaceStatsGetAll(void)
+{
+    virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                   _("interface stats not implemented on this platform"));
+    return NULL;
+}
+
 #endif /* __linux__ */
+
+
+/**
+ * virNetInterfaceStatsLookup:
+ * @table: counters gathered by virNetInterfaceStatsGetAll()
+ * @path: name of the interface
+ * @stats: filled with the counters of @path
+ *
+ * Returns 0 on success, -1 with an error reported if @path was not
+ * present on the host when @table was gathered.
+ */
+int
+virNetInterfaceStatsLookup(virHashTablePtr table,
+                           const char *path,
+                           virDomainInterfaceStatsPtr stats)
+{
+    virDomainInterfaceStatsPtr found;
+
+    if (!(found = virHashLookup(table, path))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Interface '%s' not found"), path);
+        return -1;
+    }
+
+    *stats = *found;
+    return 0;
+}
@@ -24,8 +24,16 @@
 # define __STATS_LINUX_H__
 
 # include "internal.h"
+# include "virhash.h"
 
 int virNetInterfaceStats(const char *path,
                          virDomainInterfaceStatsPtr stats);
 
+virHashTablePtr virNetInterfaceStatsGetAll(void);
+
+int virNetInterfaceStatsLookup(virHashTablePtr table,
+                               const char *path,
+                               virDomainInterfaceStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
 #endif /* __STATS_LINUX_H__ */
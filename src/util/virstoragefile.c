@@ -43,6 +43,8 @@
 #include "viruri.h"
 #include "dirname.h"
 #include "virbuffer.h"
+#include "virthread.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -764,19 +766,30 @@ qcow2GetFeatures(virBitmapPtr *features,
 }
 
 
-/* Given a header in BUF with length LEN, as parsed from the storage file
- * assuming it has the given FORMAT, populate information into META
- * with information about the file and its backing store. Return format
- * of the backing store as BACKING_FORMAT. PATH and FORMAT have to be
- * pre-populated in META */
-int
-virStorageFileGetMetadataInternal(virStorageSourcePtr meta,
-                                  char *buf,
-                                  size_t len,
-                                  int *backingFormat)
+/* Fields of a virStorageSource set from the image header, the others
+ * keep whatever the caller put there */
+enum {
+    VIR_STORAGE_FILE_PARSED_CAPACITY = 1 << 0,
+    VIR_STORAGE_FILE_PARSED_ENCRYPTED = 1 << 1,
+    VIR_STORAGE_FILE_PARSED_BACKING = 1 << 2,
+    VIR_STORAGE_FILE_PARSED_FEATURES = 1 << 3,
+    VIR_STORAGE_FILE_PARSED_COMPAT = 1 << 4,
+};
+
+/* virStorageFileGetMetadataInternal, also telling in PARSED which
+ * fields of META come from the header */
+static int
+virStorageFileParseHeader(virStorageSourcePtr meta,
+                          char *buf,
+                          size_t len,
+                          int *backingFormat,
+                          unsigned int *parsed)
 {
+    virBitmapPtr features = meta->features;
     int ret = -1;
 
+    *parsed = 0;
+
     VIR_DEBUG("path=%s, buf=%p, len=%zu, meta->format=%d",
               meta->path, buf, len, meta->format);
 
@@ -807,6 +820,7 @@ virStorageFileGetMetadataInternal(virStorageSourcePtr meta,
         else
             meta->capacity = virReadBufInt64BE(buf +
                                                fileTypeInfo[meta->format].sizeOffset);
+        *parsed |= VIR_STORAGE_FILE_PARSED_CAPACITY;
         /* Avoid unlikely, but theoretically possible overflow */
         if (meta->capacity > (ULLONG_MAX /
                               fileTypeInfo[meta->format].sizeMultiplier))
@@ -819,12 +833,15 @@ virStorageFileGetMetadataInternal(virStorageSourcePtr meta,
 
         crypt_format = virReadBufInt32BE(buf +
                                          fileTypeInfo[meta->format].qcowCryptOffset);
+        if (crypt_format)
+            *parsed |= VIR_STORAGE_FILE_PARSED_ENCRYPTED;
         if (crypt_format && !meta->encryption &&
             VIR_ALLOC(meta->encryption) < 0)
             goto cleanup;
     }
 
     VIR_FREE(meta->backingStoreRaw);
+    *parsed |= VIR_STORAGE_FILE_PARSED_BACKING;
     if (fileTypeInfo[meta->format].getBackingStore != NULL) {
         int store = fileTypeInfo[meta->format].getBackingStore(&meta->backingStoreRaw,
                                                          backingFormat,
@@ -839,10 +856,14 @@ virStorageFileGetMetadataInternal(virStorageSourcePtr meta,
     if (fileTypeInfo[meta->format].getFeatures != NULL &&
         fileTypeInfo[meta->format].getFeatures(&meta->features, meta->format, buf, len) < 0)
         goto cleanup;
+    if (meta->features != features)
+        *parsed |= VIR_STORAGE_FILE_PARSED_FEATURES;
 
-    if (meta->format == VIR_STORAGE_FILE_QCOW2 && meta->features &&
-        VIR_STRDUP(meta->compat, "1.1") < 0)
-        goto cleanup;
+    if (meta->format == VIR_STORAGE_FILE_QCOW2 && meta->features) {
+        if (VIR_STRDUP(meta->compat, "1.1") < 0)
+            goto cleanup;
+        *parsed |= VIR_STORAGE_FILE_PARSED_COMPAT;
+    }
 
  done:
     ret = 0;
@@ -852,6 +873,314 @@ virStorageFileGetMetadataInternal(virStorageSourcePtr meta,
 }
 
 
+/* Given a header in BUF with length LEN, as parsed from the storage file
+ * assuming it has the given FORMAT, populate information into META
+ * with information about the file and its backing store. Return format
+ * of the backing store as BACKING_FORMAT. PATH and FORMAT have to be
+ * pre-populated in META */
+int
+virStorageFileGetMetadataInternal(virStorageSourcePtr meta,
+                                  char *buf,
+                                  size_t len,
+                                  int *backingFormat)
+{
+    unsigned int parsed;
+
+    return virStorageFileParseHeader(meta, buf, len, backingFormat, &parsed);
+}
+
+
+/* Header metadata of image files shared by many backing chains (such
+ * as a base image used by thousands of overlays) is parsed once and
+ * then reused for as long as the file looks unchanged. Entries are
+ * keyed by device, inode and the format the caller asked for; the
+ * size and timestamps stored alongside decide whether they are still
+ * valid. Only the fields the header parse set are kept, a source that
+ * comes with its own capacity or features keeps them on a cache hit
+ * exactly as it would after parsing the header. */
+#define VIR_STORAGE_FILE_METADATA_CACHE_MAX 4096
+
+typedef struct _virStorageFileMetadataCacheEntry virStorageFileMetadataCacheEntry;
+typedef virStorageFileMetadataCacheEntry *virStorageFileMetadataCacheEntryPtr;
+struct _virStorageFileMetadataCacheEntry {
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+
+    unsigned int parsed;        /* VIR_STORAGE_FILE_PARSED_* */
+    int format;
+    unsigned long long capacity;
+    char *backingStoreRaw;
+    int backingFormat;
+    virBitmapPtr features;
+    char *compat;
+};
+
+static virMutex virStorageFileMetadataCacheLock = VIR_MUTEX_INITIALIZER;
+static virHashTablePtr virStorageFileMetadataCache;
+
+
+static void
+virStorageFileMetadataCacheEntryFree(void *payload,
+                                     const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileMetadataCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->backingStoreRaw);
+    virBitmapFree(entry->features);
+    VIR_FREE(entry->compat);
+    VIR_FREE(entry);
+}
+
+
+static char *
+virStorageFileMetadataCacheKey(const struct stat *st,
+                               int format)
+{
+    char *key;
+
+    ignore_value(virAsprintf(&key, "%llu:%llu:%d",
+                             (unsigned long long)st->st_dev,
+                             (unsigned long long)st->st_ino,
+                             format));
+    return key;
+}
+
+
+static bool
+virStorageFileMetadataCacheEntryValid(virStorageFileMetadataCacheEntryPtr entry,
+                                      const struct stat *st)
+{
+    struct timespec mtime = get_stat_mtime(st);
+    struct timespec ctime = get_stat_ctime(st);
+
+    return entry->size == st->st_size &&
+        entry->mtime.tv_sec == mtime.tv_sec &&
+        entry->mtime.tv_nsec == mtime.tv_nsec &&
+        entry->ctime.tv_sec == ctime.tv_sec &&
+        entry->ctime.tv_nsec == ctime.tv_nsec;
+}
+
+
+/* Fill @meta with what the header parse stored in @entry */
+static int
+virStorageFileMetadataCacheEntryApply(virStorageFileMetadataCacheEntryPtr entry,
+                                      virStorageSourcePtr meta,
+                                      int *backingFormat)
+{
+    virBitmapPtr features = NULL;
+    char *backingStoreRaw = NULL;
+    char *compat = NULL;
+
+    if (VIR_STRDUP(backingStoreRaw, entry->backingStoreRaw) < 0 ||
+        VIR_STRDUP(compat, entry->compat) < 0)
+        goto error;
+
+    if (entry->features &&
+        !(features = virBitmapNewCopy(entry->features)))
+        goto error;
+
+    if (entry->parsed & VIR_STORAGE_FILE_PARSED_ENCRYPTED &&
+        !meta->encryption && VIR_ALLOC(meta->encryption) < 0)
+        goto error;
+
+    meta->format = entry->format;
+    if (entry->parsed & VIR_STORAGE_FILE_PARSED_CAPACITY)
+        meta->capacity = entry->capacity;
+    if (entry->parsed & VIR_STORAGE_FILE_PARSED_BACKING) {
+        VIR_FREE(meta->backingStoreRaw);
+        meta->backingStoreRaw = backingStoreRaw;
+        backingStoreRaw = NULL;
+        *backingFormat = entry->backingFormat;
+    }
+    if (entry->parsed & VIR_STORAGE_FILE_PARSED_FEATURES) {
+        virBitmapFree(meta->features);
+        meta->features = features;
+        features = NULL;
+    }
+    if (entry->parsed & VIR_STORAGE_FILE_PARSED_COMPAT) {
+        VIR_FREE(meta->compat);
+        meta->compat = compat;
+        compat = NULL;
+    }
+
+    VIR_FREE(backingStoreRaw);
+    return 0;
+
+ error:
+    VIR_FREE(backingStoreRaw);
+    VIR_FREE(compat);
+    virBitmapFree(features);
+    return -1;
+}
+
+
+/**
+ * virStorageFileMetadataCacheGet:
+ * @meta: storage source with path and requested format filled in
+ * @st: result of stat() on the file described by @meta
+ * @backingFormat: filled with the format of the backing store
+ *
+ * Look up the header metadata of a regular file parsed earlier by
+ * virStorageFileMetadataCacheParse and, if the file has not changed
+ * since, fill @meta and @backingFormat the same way parsing the header
+ * would have.
+ *
+ * Returns 1 on a cache hit, 0 on a miss and -1 on error.
+ */
+int
+virStorageFileMetadataCacheGet(virStorageSourcePtr meta,
+                               const struct stat *st,
+                               int *backingFormat)
+{
+    virStorageFileMetadataCacheEntryPtr entry;
+    char *key = NULL;
+    int ret = -1;
+
+    if (!S_ISREG(st->st_mode))
+        return 0;
+
+    if (!(key = virStorageFileMetadataCacheKey(st, meta->format)))
+        return -1;
+
+    virMutexLock(&virStorageFileMetadataCacheLock);
+
+    if (!virStorageFileMetadataCache ||
+        !(entry = virHashLookup(virStorageFileMetadataCache, key))) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!virStorageFileMetadataCacheEntryValid(entry, st)) {
+        VIR_DEBUG("cached metadata of '%s' is stale", meta->path);
+        virHashRemoveEntry(virStorageFileMetadataCache, key);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virStorageFileMetadataCacheEntryApply(entry, meta, backingFormat) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("using cached metadata of '%s'", meta->path);
+    ret = 1;
+
+ cleanup:
+    virMutexUnlock(&virStorageFileMetadataCacheLock);
+    VIR_FREE(key);
+    return ret;
+}
+
+
+/**
+ * virStorageFileMetadataCacheParse:
+ * @meta: storage source with path and requested format filled in
+ * @st: result of stat() on the file taken before its header was read
+ * @buf: header of the file
+ * @len: length of @buf
+ * @backingFormat: filled with the format of the backing store
+ *
+ * Parse the header in @buf into @meta like
+ * virStorageFileGetMetadataInternal does and remember the fields it
+ * set, so that following virStorageFileMetadataCacheGet calls for the
+ * same regular file need not read it again.
+ *
+ * Returns 0 on success (including when the file is not cacheable),
+ * -1 on error.
+ */
+int
+virStorageFileMetadataCacheParse(virStorageSourcePtr meta,
+                                 const struct stat *st,
+                                 char *buf,
+                                 size_t len,
+                                 int *backingFormat)
+{
+    virStorageFileMetadataCacheEntryPtr entry = NULL;
+    int format = meta->format;
+    unsigned int parsed;
+    char *key = NULL;
+    int ret = -1;
+
+    if (virStorageFileParseHeader(meta, buf, len, backingFormat, &parsed) < 0)
+        return -1;
+
+    if (!S_ISREG(st->st_mode))
+        return 0;
+
+    if (VIR_ALLOC(entry) < 0)
+        goto cleanup;
+
+    entry->size = st->st_size;
+    entry->mtime = get_stat_mtime(st);
+    entry->ctime = get_stat_ctime(st);
+    entry->parsed = parsed;
+    entry->format = meta->format;
+
+    if (parsed & VIR_STORAGE_FILE_PARSED_CAPACITY)
+        entry->capacity = meta->capacity;
+    if (parsed & VIR_STORAGE_FILE_PARSED_BACKING) {
+        if (VIR_STRDUP(entry->backingStoreRaw, meta->backingStoreRaw) < 0)
+            goto cleanup;
+        entry->backingFormat = *backingFormat;
+    }
+    if (parsed & VIR_STORAGE_FILE_PARSED_FEATURES && meta->features &&
+        !(entry->features = virBitmapNewCopy(meta->features)))
+        goto cleanup;
+    if (parsed & VIR_STORAGE_FILE_PARSED_COMPAT &&
+        VIR_STRDUP(entry->compat, meta->compat) < 0)
+        goto cleanup;
+
+    if (!(key = virStorageFileMetadataCacheKey(st, format)))
+        goto cleanup;
+
+    virMutexLock(&virStorageFileMetadataCacheLock);
+
+    if (!virStorageFileMetadataCache &&
+        !(virStorageFileMetadataCache =
+          virHashCreate(64, virStorageFileMetadataCacheEntryFree))) {
+        virMutexUnlock(&virStorageFileMetadataCacheLock);
+        goto cleanup;
+    }
+
+    /* Files come and go; rather than tracking their use just start
+     * over once the cache grows out of bounds */
+    if (virHashSize(virStorageFileMetadataCache) >=
+        VIR_STORAGE_FILE_METADATA_CACHE_MAX)
+        virHashRemoveAll(virStorageFileMetadataCache);
+
+    if (virHashUpdateEntry(virStorageFileMetadataCache, key, entry) < 0) {
+        virMutexUnlock(&virStorageFileMetadataCacheLock);
+        goto cleanup;
+    }
+    entry = NULL;
+
+    virMutexUnlock(&virStorageFileMetadataCacheLock);
+    ret = 0;
+
+ cleanup:
+    virStorageFileMetadataCacheEntryFree(entry, NULL);
+    VIR_FREE(key);
+    return ret;
+}
+
+
+/**
+ * virStorageFileMetadataCacheClear:
+ *
+ * Drop all cached image header metadata.
+ */
+void
+virStorageFileMetadataCacheClear(void)
+{
+    virMutexLock(&virStorageFileMetadataCacheLock);
+    virHashFree(virStorageFileMetadataCache);
+    virStorageFileMetadataCache = NULL;
+    virMutexUnlock(&virStorageFileMetadataCacheLock);
+}
+
+
 /**
  * virStorageFileProbeFormat:
  *
@@ -24,6 +24,8 @@
 #ifndef __VIR_STORAGE_FILE_H__
 # define __VIR_STORAGE_FILE_H__
 
+# include <sys/stat.h>
+
 # include "virbitmap.h"
 # include "virseclabel.h"
 # include "virstorageencryption.h"
@@ -302,6 +304,19 @@ int virStorageFileGetMetadataInternal(virStorageSourcePtr meta,
                                       int *backingFormat)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
 
+int virStorageFileMetadataCacheGet(virStorageSourcePtr meta,
+                                   const struct stat *st,
+                                   int *backingFormat)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int virStorageFileMetadataCacheParse(virStorageSourcePtr meta,
+                                     const struct stat *st,
+                                     char *buf,
+                                     size_t len,
+                                     int *backingFormat)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(5);
+void virStorageFileMetadataCacheClear(void);
+
 virStorageSourcePtr virStorageFileGetMetadataFromFD(const char *path,
                                                     int fd,
                                                     int format,
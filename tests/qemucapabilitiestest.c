@@ -132,6 +132,74 @@ testQemuCaps(const void *opaque)
     return ret;
 }
 
+
+static int
+testQemuCapsCopy(const void *opaque)
+{
+    int ret = -1;
+    const testQemuData *data = opaque;
+    char *repliesFile = NULL;
+    char *replies = NULL;
+    qemuMonitorTestPtr mon = NULL;
+    virQEMUCapsPtr orig = NULL;
+    virQEMUCapsPtr copy = NULL;
+    char **origModels = NULL;
+    char **copyModels = NULL;
+    size_t nmodels;
+    bool kvm;
+
+    if (virAsprintf(&repliesFile, "%s/qemucapabilitiesdata/%s.%s.replies",
+                    abs_srcdir, data->base, data->archName) < 0)
+        goto cleanup;
+
+    if (virtTestLoadFile(repliesFile, &replies) < 0)
+        goto cleanup;
+
+    if (!(mon = testQemuFeedMonitor(replies, data->xmlopt)))
+        goto cleanup;
+
+    if (!(orig = virQEMUCapsNew()) ||
+        virQEMUCapsInitQMPMonitor(orig,
+                                  qemuMonitorTestGetMonitor(mon)) < 0)
+        goto cleanup;
+
+    if (!(copy = virQEMUCapsNewCopy(orig)))
+        goto cleanup;
+
+    nmodels = virQEMUCapsGetCPUDefinitions(orig, &origModels);
+    kvm = virQEMUCapsGet(orig, QEMU_CAPS_KVM);
+
+    /* Modifying the copy must not change the original */
+    virQEMUCapsClear(copy, QEMU_CAPS_KVM);
+    if (virQEMUCapsAddCPUDefinition(copy, "libvirt-test-model") < 0)
+        goto cleanup;
+
+    if (virQEMUCapsGetCPUDefinitions(orig, &origModels) != nmodels ||
+        virQEMUCapsGet(orig, QEMU_CAPS_KVM) != kvm) {
+        fprintf(stderr, "modifying a copy changed the original\n");
+        goto cleanup;
+    }
+
+    /* The copy must stay valid once the original is gone */
+    virObjectUnref(orig);
+    orig = NULL;
+
+    if (virQEMUCapsGetCPUDefinitions(copy, &copyModels) != nmodels + 1 ||
+        STRNEQ(copyModels[nmodels], "libvirt-test-model")) {
+        fprintf(stderr, "CPU models of the copy were not updated\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(repliesFile);
+    VIR_FREE(replies);
+    qemuMonitorTestFree(mon);
+    virObjectUnref(orig);
+    virObjectUnref(copy);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -158,6 +226,9 @@ mymain(void)
         data.base = name;                                               \
         if (virtTestRun(name "(" arch ")", testQemuCaps, &data) < 0)    \
             ret = -1;                                                   \
+        if (virtTestRun(name "(" arch ") copy",                         \
+                        testQemuCapsCopy, &data) < 0)                   \
+            ret = -1;                                                   \
     } while (0)
 
     DO_TEST("x86_64", "caps_1.2.2");
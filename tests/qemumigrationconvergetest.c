@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "testutilsqemu.h"
+#include "qemu/qemu_migrationpriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define MiB (1024ull * 1024)
+#define PAGESIZE 4096
+
+static virQEMUDriver driver;
+
+struct testConvergeData {
+    int policy;                 /* qemuMigrationConvergePolicy */
+    bool xbzrle;                /* XBZRLE compression was requested */
+    unsigned long flags;        /* migration flags */
+    bool canThrottle;
+    bool postcopyEnabled;
+    const int *steps;           /* expected decisions */
+    size_t nsteps;
+};
+
+static void
+testConvergeInit(qemuMigrationConvergePtr conv,
+                 int policy,
+                 bool xbzrle,
+                 unsigned long flags)
+{
+    qemuMigrationCompression compression;
+
+    memset(&compression, 0, sizeof(compression));
+    if (xbzrle)
+        compression.methods = 1ULL << QEMU_MIGRATION_COMPRESS_XBZRLE;
+
+    driver.config->migrationConvergePolicy = policy;
+    driver.config->migrationConvergeMaxThrottle = 60;
+    qemuMigrationConvergeInit(conv, driver.config, &compression, flags);
+}
+
+/* A pass over 1 GiB of guest RAM which sends 100 MiB/s while the guest
+ * dirties pages at @dirty MiB/s, @remaining MiB are left to send */
+static void
+testConvergeStats(qemuMonitorMigrationStatsPtr stats,
+                  unsigned long long iteration,
+                  unsigned long long dirty,
+                  unsigned long long remaining)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->status = QEMU_MONITOR_MIGRATION_STATUS_ACTIVE;
+    stats->ram_total = 1024 * MiB;
+    stats->ram_bps = 100 * MiB;
+    stats->ram_dirty_rate = dirty * MiB / PAGESIZE;
+    stats->ram_remaining = remaining * MiB;
+    stats->ram_iteration = iteration;
+    stats->xbzrle_set = true;
+    stats->xbzrle_cache_size = 64 * MiB;
+}
+
+static int
+testConvergeUpdate(const void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuMigrationConverge conv;
+    qemuMonitorMigrationStats stats;
+    size_t i;
+
+    testConvergeInit(&conv, QEMU_MIGRATION_CONVERGE_THROTTLE, false, 0);
+
+    /* Nothing is judged during the first pass over guest memory */
+    for (i = 0; i < 5; i++) {
+        testConvergeStats(&stats, 1, 95, 500);
+        if (qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE) ||
+            conv.stalled) {
+            VIR_TEST_DEBUG("first pass was judged");
+            return -1;
+        }
+    }
+
+    /* Nor while no bandwidth was measured yet */
+    testConvergeStats(&stats, 2, 95, 500);
+    stats.ram_bps = 0;
+    if (qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE) || conv.stalled) {
+        VIR_TEST_DEBUG("sample without bandwidth was judged");
+        return -1;
+    }
+
+    /* A shrinking backlog which outpaces the guest is progress */
+    testConvergeStats(&stats, 2, 10, 500);
+    for (i = 0; i < 5; i++) {
+        stats.ram_remaining -= 50 * MiB;
+        if (qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE) ||
+            conv.stalled) {
+            VIR_TEST_DEBUG("converging migration stalled");
+            return -1;
+        }
+    }
+
+    /* The guest dirties memory nearly as fast as it is sent */
+    for (i = 0; i < 3; i++) {
+        bool escalate;
+
+        stats.ram_dirty_rate = 95 * MiB / PAGESIZE;
+        stats.ram_remaining -= MiB;
+        escalate = qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE);
+        if (escalate != (i == 2)) {
+            VIR_TEST_DEBUG("escalation after %zu stalled samples", i + 1);
+            return -1;
+        }
+    }
+
+    /* A single sample of progress resets the count */
+    stats.ram_dirty_rate = 10 * MiB / PAGESIZE;
+    stats.ram_remaining -= 50 * MiB;
+    if (qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE) || conv.stalled) {
+        VIR_TEST_DEBUG("progress did not reset the stalled count");
+        return -1;
+    }
+
+    /* A backlog which does not shrink is stalled even at a low rate */
+    for (i = 0; i < 2; i++) {
+        if (qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE)) {
+            VIR_TEST_DEBUG("escalation after %zu stalled samples", i + 1);
+            return -1;
+        }
+    }
+    if (!qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE)) {
+        VIR_TEST_DEBUG("stuck backlog did not escalate");
+        return -1;
+    }
+
+    /* After a decision the next one waits for a new pass */
+    qemuMigrationConvergeDecided(&conv, &stats);
+    for (i = 0; i < 5; i++) {
+        if (qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE)) {
+            VIR_TEST_DEBUG("escalated twice within one pass");
+            return -1;
+        }
+    }
+    stats.ram_iteration++;
+    if (!qemuMigrationConvergeUpdate(&conv, &stats, PAGESIZE)) {
+        VIR_TEST_DEBUG("new pass did not escalate");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testConvergeSteps(const void *opaque)
+{
+    const struct testConvergeData *data = opaque;
+    qemuMigrationConverge conv;
+    qemuMonitorMigrationStats stats;
+    size_t i;
+    int step;
+    const char *expected;
+
+    testConvergeInit(&conv, data->policy, data->xbzrle, data->flags);
+    testConvergeStats(&stats, 2, 95, 500);
+
+    for (i = 0; i < data->nsteps; i++) {
+        step = qemuMigrationConvergeNextStep(&conv, &stats,
+                                             data->canThrottle,
+                                             data->postcopyEnabled);
+        if (step != data->steps[i]) {
+            expected = qemuMigrationConvergeStepTypeToString(data->steps[i]);
+            VIR_TEST_DEBUG("decision %zu is '%s', expected '%s'", i,
+                           NULLSTR(qemuMigrationConvergeStepTypeToString(step)),
+                           NULLSTR(expected));
+            return -1;
+        }
+
+        /* Apply the step the way qemuMigrationConvergeCheck does */
+        switch ((qemuMigrationConvergeStep) step) {
+        case QEMU_MIGRATION_CONVERGE_STEP_XBZRLE:
+            stats.xbzrle_cache_size *= 2;
+            break;
+        case QEMU_MIGRATION_CONVERGE_STEP_THROTTLE:
+            conv.throttlePct += 20;
+            break;
+        case QEMU_MIGRATION_CONVERGE_STEP_POSTCOPY:
+        case QEMU_MIGRATION_CONVERGE_STEP_LAST:
+            break;
+        }
+
+        qemuMigrationConvergeDecided(&conv, &stats);
+        stats.ram_iteration++;
+
+        if (conv.iteration != stats.ram_iteration - 1 || conv.stalled) {
+            VIR_TEST_DEBUG("decision %zu was not recorded", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Convergence sampling", testConvergeUpdate, NULL) < 0)
+        ret = -1;
+
+#define XBZRLE QEMU_MIGRATION_CONVERGE_STEP_XBZRLE
+#define THROTTLE QEMU_MIGRATION_CONVERGE_STEP_THROTTLE
+#define POSTCOPY QEMU_MIGRATION_CONVERGE_STEP_POSTCOPY
+#define LAST QEMU_MIGRATION_CONVERGE_STEP_LAST
+
+#define DO_TEST(name, policy, xbzrle, flags, canThrottle, postcopy, ...)     \
+    do {                                                                    \
+        static const int steps[] = { __VA_ARGS__ };                         \
+        struct testConvergeData data = {                                    \
+            QEMU_MIGRATION_CONVERGE_ ## policy, xbzrle, flags,              \
+            canThrottle, postcopy, steps, ARRAY_CARDINALITY(steps)          \
+        };                                                                  \
+        if (virtTestRun("Convergence steps: " name,                         \
+                        testConvergeSteps, &data) < 0)                      \
+            ret = -1;                                                       \
+    } while (0)
+
+    /* The XBZRLE cache grows up to 256 MiB, a quarter of guest RAM, and
+     * vCPUs are throttled in steps of 20 % up to 60 % */
+    DO_TEST("throttle", THROTTLE, true, 0, true, true,
+            XBZRLE, XBZRLE, THROTTLE, THROTTLE, THROTTLE, LAST, LAST);
+    DO_TEST("throttle without xbzrle", THROTTLE, false, 0, true, false,
+            THROTTLE, THROTTLE, THROTTLE, LAST);
+    DO_TEST("throttle unavailable", THROTTLE, true, 0, false, false,
+            XBZRLE, XBZRLE, LAST);
+    DO_TEST("auto-converge", THROTTLE, false, VIR_MIGRATE_AUTO_CONVERGE,
+            true, false,
+            LAST);
+
+    /* Post-copy is the last resort and is only started once */
+    DO_TEST("postcopy", POSTCOPY, true, 0, true, true,
+            XBZRLE, XBZRLE, THROTTLE, THROTTLE, THROTTLE, POSTCOPY, LAST);
+    DO_TEST("postcopy not enabled", POSTCOPY, false, 0, true, false,
+            THROTTLE, THROTTLE, THROTTLE, LAST);
+    DO_TEST("postcopy only", POSTCOPY, false, VIR_MIGRATE_AUTO_CONVERGE,
+            true, true,
+            POSTCOPY, LAST, LAST);
+
+    qemuTestDriverFree(&driver);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -1180,6 +1180,7 @@ GEN_TEST_FUNC(qemuMonitorJSONSaveVirtualMemory, 0, 1024, "/foo/bar")
 GEN_TEST_FUNC(qemuMonitorJSONSavePhysicalMemory, 0, 1024, "/foo/bar")
 GEN_TEST_FUNC(qemuMonitorJSONSetMigrationSpeed, 1024)
 GEN_TEST_FUNC(qemuMonitorJSONSetMigrationDowntime, 1)
+GEN_TEST_FUNC(qemuMonitorJSONSetMigrationParallelConnections, 4)
 GEN_TEST_FUNC(qemuMonitorJSONMigrate, QEMU_MONITOR_MIGRATE_BACKGROUND |
               QEMU_MONITOR_MIGRATE_NON_SHARED_DISK |
               QEMU_MONITOR_MIGRATE_NON_SHARED_INC, "tcp:localhost:12345")
@@ -1549,6 +1550,41 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
         "    \"id\": \"libvirt-11\""
         "}";
 
+    const char *blockReply =
+        "{"
+        "    \"return\": ["
+        "        {"
+        "            \"device\": \"drive-virtio-disk0\","
+        "            \"inserted\": {"
+        "                \"image\": {"
+        "                    \"virtual-size\": 10737418240,"
+        "                    \"actual-size\": 5368709120"
+        "                }"
+        "            }"
+        "        },"
+        "        {"
+        "            \"device\": \"drive-virtio-disk1\","
+        "            \"inserted\": {"
+        "                \"image\": {"
+        "                    \"virtual-size\": 1048576"
+        "                }"
+        "            }"
+        "        },"
+        "        {"
+        "            \"device\": \"drive-ide0-1-0\""
+        "        }"
+        "    ],"
+        "    \"id\": \"libvirt-12\""
+        "}";
+
+    const char *blockError =
+        "{"
+        "  \"error\": {"
+        "    \"class\": \"GenericError\","
+        "    \"desc\": \"query-block failed\""
+        "  }"
+        "}";
+
     if (!test)
         return -1;
 
@@ -1556,7 +1592,11 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     if (qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
-        qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0)
+        qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", blockReply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", blockError) < 0)
         goto cleanup;
 
 #define CHECK0FULL(var, value, varformat, valformat) \
@@ -1603,6 +1643,34 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     CHECK("virtio-disk1", 85, 348160, 8232156, 0, 0, 0, 0, 0, 0ULL, true)
     CHECK("ide0-1-0", 16, 49250, 1004952, 0, 0, 0, 0, 0, 0ULL, false)
 
+    virHashFree(blockstats);
+    blockstats = NULL;
+
+    if (qemuMonitorGetAllBlockStats(qemuMonitorTestGetMonitor(test),
+                                    &blockstats, false, true) < 0)
+        goto cleanup;
+
+    CHECK("virtio-disk0", 1279, 28505088, 640616474, 174, 2845696, 530699221, 0, 0, 5256018944ULL, true)
+    CHECK0FULL(capacity, 10737418240ULL, "%llu", "%llu")
+    CHECK0FULL(physical, 5368709120ULL, "%llu", "%llu")
+    CHECK("virtio-disk1", 85, 348160, 8232156, 0, 0, 0, 0, 0, 0ULL, true)
+    CHECK0FULL(capacity, 1048576ULL, "%llu", "%llu")
+    CHECK0FULL(physical, 1048576ULL, "%llu", "%llu")
+    CHECK("ide0-1-0", 16, 49250, 1004952, 0, 0, 0, 0, 0, 0ULL, false)
+    CHECK0FULL(capacity, 0ULL, "%llu", "%llu")
+
+    virHashFree(blockstats);
+    blockstats = NULL;
+
+    /* A failing query-block only drops the sizes */
+    if (qemuMonitorGetAllBlockStats(qemuMonitorTestGetMonitor(test),
+                                    &blockstats, false, false) < 0)
+        goto cleanup;
+
+    CHECK("virtio-disk0", 1279, 28505088, 640616474, 174, 2845696, 530699221, 0, 0, 5256018944ULL, true)
+    CHECK0FULL(capacity, 0ULL, "%llu", "%llu")
+    CHECK0FULL(physical, 0ULL, "%llu", "%llu")
+
     ret = 0;
 
 #undef CHECK
@@ -2396,6 +2464,7 @@ mymain(void)
     DO_TEST_GEN(qemuMonitorJSONSavePhysicalMemory);
     DO_TEST_GEN(qemuMonitorJSONSetMigrationSpeed);
     DO_TEST_GEN(qemuMonitorJSONSetMigrationDowntime);
+    DO_TEST_GEN(qemuMonitorJSONSetMigrationParallelConnections);
     DO_TEST_GEN(qemuMonitorJSONMigrate);
     DO_TEST_GEN(qemuMonitorJSONDump);
     DO_TEST_GEN(qemuMonitorJSONGraphicsRelocate);
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "testutilsqemu.h"
+#include "qemu/qemu_domain.h"
+#include "virstring.h"
+#include "virtypedparam.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static virQEMUDriver driver;
+
+static virDomainObjPtr
+testStatsCacheNewDomain(void)
+{
+    virDomainObjPtr vm;
+
+    if (!(vm = virDomainObjNew(driver.xmlopt)))
+        return NULL;
+
+    if (!(vm->def = virDomainDefNew()) ||
+        VIR_STRDUP(vm->def->name, "stats") < 0) {
+        virObjectUnref(vm);
+        return NULL;
+    }
+
+    return vm;
+}
+
+/* Stores a balloon group holding just balloon.current = @current */
+static int
+testStatsCacheStoreBalloon(virDomainObjPtr vm,
+                           unsigned long long collected,
+                           unsigned long long current)
+{
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    int maxparams = 0;
+    int ret;
+
+    if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                "balloon.current", current) < 0)
+        return -1;
+
+    ret = qemuDomainStatsCacheStore(vm, VIR_DOMAIN_STATS_BALLOON, 0,
+                                    collected, params, nparams);
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* Checks the balloon group looked up at @now against @current, or that
+ * there is none if @current is 0 */
+static int
+testStatsCacheCheckBalloon(virDomainObjPtr vm,
+                           unsigned long long now,
+                           unsigned long long maxAge,
+                           unsigned long long current)
+{
+    qemuDomainStatsCacheEntryPtr entry;
+    unsigned long long value;
+
+    entry = qemuDomainStatsCacheLookup(vm, VIR_DOMAIN_STATS_BALLOON,
+                                       now, maxAge);
+
+    if (!current) {
+        if (entry) {
+            VIR_TEST_DEBUG("unexpected cache hit at %llu", now);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!entry) {
+        VIR_TEST_DEBUG("unexpected cache miss at %llu", now);
+        return -1;
+    }
+
+    if (virTypedParamsGetULLong(entry->params, entry->nparams,
+                                "balloon.current", &value) != 1 ||
+        value != current) {
+        VIR_TEST_DEBUG("cached balloon.current is wrong at %llu", now);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testStatsCacheLookup(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    int ret = -1;
+
+    if (!(vm = testStatsCacheNewDomain()))
+        return -1;
+
+    if (testStatsCacheCheckBalloon(vm, 1000, 500, 0) < 0 ||
+        testStatsCacheStoreBalloon(vm, 1000, 1024) < 0 ||
+        testStatsCacheCheckBalloon(vm, 1000, 500, 1024) < 0 ||
+        testStatsCacheCheckBalloon(vm, 1500, 500, 1024) < 0)
+        goto cleanup;
+
+    /* Data gathered while the caller waited for its job is fresh */
+    if (testStatsCacheCheckBalloon(vm, 900, 500, 1024) < 0)
+        goto cleanup;
+
+    /* Other groups are cached separately */
+    if (qemuDomainStatsCacheLookup(vm, VIR_DOMAIN_STATS_VCPU, 1000, 500)) {
+        VIR_TEST_DEBUG("vcpu group served from the balloon entry");
+        goto cleanup;
+    }
+
+    /* A newer value replaces the old entry */
+    if (testStatsCacheStoreBalloon(vm, 2000, 2048) < 0 ||
+        testStatsCacheCheckBalloon(vm, 2000, 500, 2048) < 0)
+        goto cleanup;
+
+    if (((qemuDomainObjPrivatePtr) vm->privateData)->nstatsCache != 1) {
+        VIR_TEST_DEBUG("replaced entry was not reused");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(vm);
+    return ret;
+}
+
+static int
+testStatsCacheExpiry(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    int ret = -1;
+
+    if (!(vm = testStatsCacheNewDomain()))
+        return -1;
+
+    if (testStatsCacheStoreBalloon(vm, 1000, 1024) < 0 ||
+        testStatsCacheCheckBalloon(vm, 1500, 500, 1024) < 0 ||
+        testStatsCacheCheckBalloon(vm, 1501, 500, 0) < 0 ||
+        testStatsCacheCheckBalloon(vm, 1501, 1000, 1024) < 0)
+        goto cleanup;
+
+    /* An expired entry is refreshed by the next store */
+    if (testStatsCacheStoreBalloon(vm, 5000, 4096) < 0 ||
+        testStatsCacheCheckBalloon(vm, 5200, 500, 4096) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(vm);
+    return ret;
+}
+
+static int
+testStatsCacheInvalidate(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    int ret = -1;
+
+    if (!(vm = testStatsCacheNewDomain()))
+        return -1;
+    priv = vm->privateData;
+
+    /* Invalidating an empty cache is harmless */
+    qemuDomainStatsCacheInvalidate(vm);
+
+    if (testStatsCacheStoreBalloon(vm, 1000, 1024) < 0 ||
+        qemuDomainStatsCacheStore(vm, VIR_DOMAIN_STATS_VCPU, 0,
+                                  1000, NULL, 0) < 0)
+        goto cleanup;
+
+    qemuDomainStatsCacheInvalidate(vm);
+
+    if (priv->nstatsCache ||
+        testStatsCacheCheckBalloon(vm, 1000, 500, 0) < 0 ||
+        qemuDomainStatsCacheLookup(vm, VIR_DOMAIN_STATS_VCPU, 1000, 500)) {
+        VIR_TEST_DEBUG("cache survived invalidation");
+        goto cleanup;
+    }
+
+    /* The cache is usable again afterwards */
+    if (testStatsCacheStoreBalloon(vm, 2000, 2048) < 0 ||
+        testStatsCacheCheckBalloon(vm, 2000, 500, 2048) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(vm);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Stats cache lookup", testStatsCacheLookup, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stats cache expiry", testStatsCacheExpiry, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stats cache invalidation",
+                    testStatsCacheInvalidate, NULL) < 0)
+        ret = -1;
+
+    qemuTestDriverFree(&driver);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+#if HAVE_COPY_FILE_RANGE
+/* Copies at most this much per call so that the callers have to loop */
+# define COPY_MOCK_CHUNK 1000
+
+/*
+ * $STORAGE_COPY_MOCK picks how the fake copy_file_range behaves:
+ *
+ *   unset   copies the data
+ *   eintr   every other call is interrupted before copying anything
+ *   exdev   fails as if the files were on different file systems
+ *   eio     fails with an I/O error
+ */
+ssize_t
+copy_file_range(int fd_in, loff_t *off_in,
+                int fd_out, loff_t *off_out,
+                size_t len, unsigned int flags ATTRIBUTE_UNUSED)
+{
+    static unsigned int calls;
+    const char *mode = getenv("STORAGE_COPY_MOCK");
+    char buf[COPY_MOCK_CHUNK];
+    ssize_t got;
+
+    if (mode && STREQ(mode, "eintr") && calls++ % 2 == 0) {
+        errno = EINTR;
+        return -1;
+    }
+    if (mode && STREQ(mode, "exdev")) {
+        errno = EXDEV;
+        return -1;
+    }
+    if (mode && STREQ(mode, "eio")) {
+        errno = EIO;
+        return -1;
+    }
+
+    if ((got = pread(fd_in, buf, MIN(len, sizeof(buf)), *off_in)) <= 0)
+        return got;
+
+    if (pwrite(fd_out, buf, got, *off_out) != got)
+        return -1;
+
+    *off_in += got;
+    *off_out += got;
+    return got;
+}
+#endif /* HAVE_COPY_FILE_RANGE */
@@ -0,0 +1,214 @@
+/*
+ * storagebackendcopytest.c: volume data copy loop tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage/storage_backendpriv.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#if HAVE_COPY_FILE_RANGE
+
+# define SCRATCHDIRTEMPLATE abs_builddir "/storagebackendcopydir-XXXXXX"
+
+/* Not a multiple of the chunks of the mock nor of the buffer */
+# define COPY_SIZE 10007
+# define COPY_BUFLEN 512
+
+static char *scratchdir;
+
+struct testCopyData {
+    const char *name;
+    const char *mode;           /* $STORAGE_COPY_MOCK */
+    off_t offset;
+    off_t len;
+    int ret;
+    bool use_copy_range;        /* expected afterwards */
+};
+
+static int
+testCopyCheck(const char *src,
+              const char *dst,
+              const struct testCopyData *data)
+{
+    char *srcbuf = NULL;
+    char *dstbuf = NULL;
+    off_t i;
+    int ret = -1;
+
+    if (virFileReadAll(src, COPY_SIZE, &srcbuf) != COPY_SIZE ||
+        virFileReadAll(dst, COPY_SIZE, &dstbuf) != COPY_SIZE)
+        goto cleanup;
+
+    for (i = 0; i < COPY_SIZE; i++) {
+        char want = 0;
+
+        if (i >= data->offset && i < data->offset + data->len)
+            want = srcbuf[i];
+
+        if (dstbuf[i] != want) {
+            VIR_TEST_DEBUG("byte %lld differs", (long long) i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(srcbuf);
+    VIR_FREE(dstbuf);
+    return ret;
+}
+
+static int
+testCopy(const void *opaque)
+{
+    const struct testCopyData *data = opaque;
+    virStorageVolDef vol;
+    virStorageVolDef inputvol;
+    char *src = NULL;
+    char *dst = NULL;
+    char *srcbuf = NULL;
+    char buf[COPY_BUFLEN];
+    bool use_copy_range = true;
+    int inputfd = -1;
+    int fd = -1;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    memset(&vol, 0, sizeof(vol));
+    memset(&inputvol, 0, sizeof(inputvol));
+
+    if (virAsprintf(&src, "%s/%s.src", scratchdir, data->name) < 0 ||
+        virAsprintf(&dst, "%s/%s.dst", scratchdir, data->name) < 0 ||
+        VIR_ALLOC_N(srcbuf, COPY_SIZE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < COPY_SIZE; i++)
+        srcbuf[i] = 1 + i % 251;
+
+    if ((inputfd = open(src, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        safewrite(inputfd, srcbuf, COPY_SIZE) != COPY_SIZE ||
+        (fd = open(dst, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        ftruncate(fd, COPY_SIZE) < 0)
+        goto cleanup;
+
+    inputvol.name = (char *) "input";
+    inputvol.target.path = src;
+    vol.name = (char *) "output";
+    vol.target.path = dst;
+
+    if (data->mode)
+        setenv("STORAGE_COPY_MOCK", data->mode, 1);
+    else
+        unsetenv("STORAGE_COPY_MOCK");
+
+    rc = virStorageBackendCopyRange(&vol, &inputvol, inputfd, fd,
+                                    data->offset, data->len,
+                                    &use_copy_range, buf, sizeof(buf));
+
+    if (rc != data->ret) {
+        VIR_TEST_DEBUG("copy returned %d, expected %d", rc, data->ret);
+        goto cleanup;
+    }
+
+    if (use_copy_range != data->use_copy_range) {
+        VIR_TEST_DEBUG("copy_file_range is %s for the rest of the copy",
+                       use_copy_range ? "still used" : "no longer used");
+        goto cleanup;
+    }
+
+    if (rc == 0 && testCopyCheck(src, dst, data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (data->ret < 0)
+        virResetLastError();
+    unsetenv("STORAGE_COPY_MOCK");
+    VIR_FORCE_CLOSE(inputfd);
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(srcbuf);
+    VIR_FREE(src);
+    VIR_FREE(dst);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    char template[] = SCRATCHDIRTEMPLATE;
+    int ret = 0;
+
+    if (!(scratchdir = mkdtemp(template))) {
+        fprintf(stderr, "Cannot create scratch directory\n");
+        return EXIT_FAILURE;
+    }
+
+# define DO_TEST(name, mode, offset, len, rc, use_copy_range)                \
+    do {                                                                    \
+        struct testCopyData data = {                                        \
+            name, mode, offset, len, rc, use_copy_range                     \
+        };                                                                  \
+        if (virtTestRun("Copy " name, testCopy, &data) < 0)                 \
+            ret = -1;                                                       \
+    } while (0)
+
+    DO_TEST("whole file", NULL, 0, COPY_SIZE, 0, true);
+    DO_TEST("range", NULL, 3001, 4500, 0, true);
+
+    /* Interrupted calls are retried without giving up on copy_file_range */
+    DO_TEST("interrupted", "eintr", 0, COPY_SIZE, 0, true);
+
+    /* Files copy_file_range cannot handle are copied through the buffer */
+    DO_TEST("fallback", "exdev", 0, COPY_SIZE, 0, false);
+    DO_TEST("fallback range", "exdev", 3001, 4500, 0, false);
+
+    /* Other errors are reported */
+    DO_TEST("error", "eio", 0, COPY_SIZE, -EIO, true);
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/storagebackendcopymock.so")
+
+#else /* !HAVE_COPY_FILE_RANGE */
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* !HAVE_COPY_FILE_RANGE */
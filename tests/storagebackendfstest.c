@@ -0,0 +1,404 @@
+/*
+ * storagebackendfstest.c: directory pool refresh tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage/storage_backend_fspriv.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/storagebackendfsdir-XXXXXX"
+
+/* A refresh of the pool split in the two halves which run with the
+ * pool locked, the test changes the pool and the directory in between
+ * the way other API calls could while the pool is unlocked */
+typedef struct _testRefresh testRefresh;
+typedef testRefresh *testRefreshPtr;
+struct _testRefresh {
+    virStorageBackendFileSystemScan scan;
+    virHashTablePtr known;
+};
+
+static int
+testRefreshStart(virStoragePoolObjPtr pool,
+                 testRefreshPtr refresh)
+{
+    if (virStorageBackendFileSystemScanInit(&refresh->scan,
+                                            pool->def->target.path) < 0)
+        return -1;
+
+    if (!(refresh->known = virStorageBackendFileSystemKnownVols(pool))) {
+        virStorageBackendFileSystemScanFree(&refresh->scan);
+        memset(refresh, 0, sizeof(*refresh));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testRefreshFinish(virStoragePoolObjPtr pool,
+                  testRefreshPtr refresh)
+{
+    int ret = -1;
+
+    if (virStorageBackendFileSystemScanDir(&refresh->scan,
+                                           refresh->known) < 0 ||
+        virStorageBackendFileSystemScanProbe(&refresh->scan) < 0)
+        goto cleanup;
+
+    ret = virStorageBackendFileSystemMergeVols(pool, &refresh->scan,
+                                               refresh->known);
+
+ cleanup:
+    virHashFree(refresh->known);
+    refresh->known = NULL;
+    virStorageBackendFileSystemScanFree(&refresh->scan);
+    return ret;
+}
+
+static int
+testRefreshPool(virStoragePoolObjPtr pool)
+{
+    testRefresh refresh;
+
+    if (testRefreshStart(pool, &refresh) < 0)
+        return -1;
+
+    return testRefreshFinish(pool, &refresh);
+}
+
+static int
+testWriteFile(virStoragePoolObjPtr pool,
+              const char *name,
+              const char *data)
+{
+    char *path = NULL;
+    int ret;
+
+    if (virAsprintf(&path, "%s/%s", pool->def->target.path, name) < 0)
+        return -1;
+
+    ret = virFileWriteStr(path, data, 0600);
+    VIR_FREE(path);
+    return ret;
+}
+
+static int
+testRemoveFile(virStoragePoolObjPtr pool,
+               const char *name)
+{
+    char *path = NULL;
+    int ret;
+
+    if (virAsprintf(&path, "%s/%s", pool->def->target.path, name) < 0)
+        return -1;
+
+    ret = unlink(path);
+    VIR_FREE(path);
+    return ret;
+}
+
+/* Drops the volume from the pool as storageVolDelete does */
+static int
+testDeleteVol(virStoragePoolObjPtr pool,
+              const char *name,
+              bool unlinkFile)
+{
+    virStorageVolDefPtr vol;
+
+    if (!(vol = virStorageVolDefFindByName(pool, name)))
+        return -1;
+
+    if (unlinkFile && testRemoveFile(pool, name) < 0)
+        return -1;
+
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+    return 0;
+}
+
+/* Checks that the volumes of @pool are exactly the comma separated
+ * @names */
+static int
+testCheckVols(virStoragePoolObjPtr pool,
+              const char *names)
+{
+    char **list = NULL;
+    size_t n;
+    size_t i;
+    int ret = -1;
+
+    if (!(list = virStringSplitCount(names, ",", 0, &n)))
+        return -1;
+
+    if (!*names)
+        n = 0;
+
+    if (pool->volumes.count != n) {
+        VIR_TEST_DEBUG("pool has %zu volumes, expected '%s'",
+                       pool->volumes.count, names);
+        goto cleanup;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (!virStorageVolDefFindByName(pool, list[i])) {
+            VIR_TEST_DEBUG("volume '%s' is missing", list[i]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStringFreeList(list);
+    return ret;
+}
+
+static virStoragePoolObjPtr
+testPoolNew(const char *dir,
+            const char *name)
+{
+    virStoragePoolObjPtr pool;
+
+    if (VIR_ALLOC(pool) < 0)
+        return NULL;
+
+    if (virMutexInit(&pool->lock) < 0) {
+        VIR_FREE(pool);
+        return NULL;
+    }
+
+    if (VIR_ALLOC(pool->def) < 0 ||
+        VIR_STRDUP(pool->def->name, name) < 0 ||
+        virAsprintf(&pool->def->target.path, "%s/%s", dir, name) < 0 ||
+        virFileMakePath(pool->def->target.path) < 0) {
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
+
+    if (testWriteFile(pool, "a", "a") < 0 ||
+        testWriteFile(pool, "b", "b") < 0 ||
+        testRefreshPool(pool) < 0 ||
+        testCheckVols(pool, "a,b") < 0) {
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+static int
+testMergeUnchanged(const void *opaque)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr a;
+    int ret = -1;
+
+    if (!(pool = testPoolNew(opaque, "unchanged")))
+        return -1;
+
+    a = virStorageVolDefFindByName(pool, "a");
+
+    if (testWriteFile(pool, "b", "bigger b") < 0 ||
+        testRefreshPool(pool) < 0 ||
+        testCheckVols(pool, "a,b") < 0)
+        goto cleanup;
+
+    /* An unchanged file keeps its volume, a changed one is probed */
+    if (virStorageVolDefFindByName(pool, "a") != a) {
+        VIR_TEST_DEBUG("unchanged volume was replaced");
+        goto cleanup;
+    }
+
+    if (virStorageVolDefFindByName(pool, "b")->target.capacity != 8) {
+        VIR_TEST_DEBUG("changed volume was not probed again");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static int
+testMergeDeleted(const void *opaque)
+{
+    virStoragePoolObjPtr pool;
+    testRefresh refresh;
+    int ret = -1;
+
+    memset(&refresh, 0, sizeof(refresh));
+    if (!(pool = testPoolNew(opaque, "deleted")))
+        return -1;
+
+    /* Changed files are probed while the pool is unlocked, so the scan
+     * holds a new volume for them */
+    if (testWriteFile(pool, "a", "new a") < 0 ||
+        testWriteFile(pool, "b", "new b") < 0 ||
+        testRefreshStart(pool, &refresh) < 0 ||
+        virStorageBackendFileSystemScanDir(&refresh.scan, refresh.known) < 0 ||
+        virStorageBackendFileSystemScanProbe(&refresh.scan) < 0)
+        goto cleanup;
+
+    /* Deleted while the scan ran, the file of 'b' has yet to go */
+    if (testDeleteVol(pool, "a", true) < 0 ||
+        testDeleteVol(pool, "b", false) < 0)
+        goto cleanup;
+
+    if (virStorageBackendFileSystemMergeVols(pool, &refresh.scan,
+                                             refresh.known) < 0 ||
+        testCheckVols(pool, "") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(refresh.known);
+    virStorageBackendFileSystemScanFree(&refresh.scan);
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static int
+testMergeCreated(const void *opaque)
+{
+    virStoragePoolObjPtr pool;
+    testRefresh refresh;
+    int ret = -1;
+
+    memset(&refresh, 0, sizeof(refresh));
+    if (!(pool = testPoolNew(opaque, "created")))
+        return -1;
+
+    if (testRefreshStart(pool, &refresh) < 0)
+        goto cleanup;
+
+    /* 'c' and 'd' appear before the directory is listed, 'd' goes away
+     * again before the pool is locked */
+    if (testWriteFile(pool, "c", "c") < 0 ||
+        testWriteFile(pool, "d", "d") < 0 ||
+        virStorageBackendFileSystemScanDir(&refresh.scan, refresh.known) < 0 ||
+        virStorageBackendFileSystemScanProbe(&refresh.scan) < 0 ||
+        testRemoveFile(pool, "d") < 0)
+        goto cleanup;
+
+    if (virStorageBackendFileSystemMergeVols(pool, &refresh.scan,
+                                             refresh.known) < 0 ||
+        testCheckVols(pool, "a,b,c") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(refresh.known);
+    virStorageBackendFileSystemScanFree(&refresh.scan);
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static int
+testMergeRemoved(const void *opaque)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
+    testRefresh refresh;
+    int ret = -1;
+
+    memset(&refresh, 0, sizeof(refresh));
+    if (!(pool = testPoolNew(opaque, "removed")))
+        return -1;
+
+    /* A file removed behind our back disappears from the pool */
+    if (testRemoveFile(pool, "a") < 0 ||
+        testRefreshPool(pool) < 0 ||
+        testCheckVols(pool, "b") < 0)
+        goto cleanup;
+
+    /* A volume added after the directory was listed stays */
+    if (testRefreshStart(pool, &refresh) < 0 ||
+        virStorageBackendFileSystemScanDir(&refresh.scan, refresh.known) < 0 ||
+        virStorageBackendFileSystemScanProbe(&refresh.scan) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC(vol) < 0 ||
+        VIR_STRDUP(vol->name, "e") < 0 ||
+        virAsprintf(&vol->target.path, "%s/e", pool->def->target.path) < 0 ||
+        VIR_STRDUP(vol->key, vol->target.path) < 0 ||
+        virStoragePoolObjAddVol(pool, vol) < 0)
+        goto cleanup;
+    vol = NULL;
+
+    if (virStorageBackendFileSystemMergeVols(pool, &refresh.scan,
+                                             refresh.known) < 0 ||
+        testCheckVols(pool, "b,e") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virStorageVolDefFree(vol);
+    virHashFree(refresh.known);
+    virStorageBackendFileSystemScanFree(&refresh.scan);
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
+    int ret = 0;
+
+    if (!mkdtemp(scratchdir)) {
+        fprintf(stderr, "Cannot create scratch directory\n");
+        return EXIT_FAILURE;
+    }
+
+    if (virtTestRun("Refresh unchanged files",
+                    testMergeUnchanged, scratchdir) < 0)
+        ret = -1;
+    if (virtTestRun("Refresh with volumes deleted meanwhile",
+                    testMergeDeleted, scratchdir) < 0)
+        ret = -1;
+    if (virtTestRun("Refresh with files created meanwhile",
+                    testMergeCreated, scratchdir) < 0)
+        ret = -1;
+    if (virtTestRun("Refresh with files removed",
+                    testMergeRemoved, scratchdir) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,222 @@
+/*
+ * storagebackendlogicaltest.c: LVM JSON report parsing tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage/storage_backend_logical.h"
+#include "viralloc.h"
+#include "virjson.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define TEST_SEG_FIELDS 10
+
+/* Output of
+ *   lvs --reportformat json --units b --nosuffix --options \
+ *     lv_name,origin,uuid,devices,segtype,stripes,seg_size,\
+ *     vg_extent_size,size,lv_attr vg0
+ * for a linear volume, a striped one, a snapshot of the former and a
+ * thin pool, whose segment has no devices */
+static const char *testLVs =
+    "  {\n"
+    "      \"report\": [\n"
+    "          {\n"
+    "              \"lv\": [\n"
+    "                  {\"lv_name\":\"root\", \"origin\":\"\", "
+    "\"lv_uuid\":\"0aoYfc-bOqM-s4dh-d4Q6-GiiA-FWRD-2lGF4Q\", "
+    "\"devices\":\"/dev/sda2(0)\", \"segtype\":\"linear\", "
+    "\"stripes\":\"1\", \"seg_size\":\"10737418240\", "
+    "\"vg_extent_size\":\"4194304\", \"lv_size\":\"10737418240\", "
+    "\"lv_attr\":\"-wi-ao----\"},\n"
+    "                  {\"lv_name\":\"data\", \"origin\":\"\", "
+    "\"lv_uuid\":\"Rz4P7A-oAGf-Qm1F-o3dB-Nnpp-2qGY-s6Ngwy\", "
+    "\"devices\":\"/dev/sdb1(0),/dev/sdc1(0)\", \"segtype\":\"striped\", "
+    "\"stripes\":\"2\", \"seg_size\":\"2147483648\", "
+    "\"vg_extent_size\":\"4194304\", \"lv_size\":\"2147483648\", "
+    "\"lv_attr\":\"-wi-a-----\"},\n"
+    "                  {\"lv_name\":\"root-snap\", \"origin\":\"root\", "
+    "\"lv_uuid\":\"hl2yUr-k1kV-xW3S-2bfT-6Fgx-qZDe-mRrqAZ\", "
+    "\"devices\":\"/dev/sda2(2560)\", \"segtype\":\"linear\", "
+    "\"stripes\":\"1\", \"seg_size\":\"1073741824\", "
+    "\"vg_extent_size\":\"4194304\", \"lv_size\":\"10737418240\", "
+    "\"lv_attr\":\"swi-a-s---\"},\n"
+    "                  {\"lv_name\":\"thin\", \"origin\":\"\", "
+    "\"lv_uuid\":\"nVRk8t-HNjp-3nHq-ByUW-bo0A-1FyW-0jXkxw\", "
+    "\"devices\":\"\", \"segtype\":\"thin-pool\", "
+    "\"stripes\":\"1\", \"seg_size\":\"1073741824\", "
+    "\"vg_extent_size\":\"4194304\", \"lv_size\":\"1073741824\", "
+    "\"lv_attr\":\"twi-a-tz--\"}\n"
+    "              ]\n"
+    "          }\n"
+    "      ]\n"
+    "  }\n";
+
+/* What matching the text output of lvs against the regex yields */
+static const char *testSegs[][TEST_SEG_FIELDS] = {
+    { "root", "", "0aoYfc-bOqM-s4dh-d4Q6-GiiA-FWRD-2lGF4Q",
+      "/dev/sda2(0)", "linear", "1", "10737418240", "4194304",
+      "10737418240", "-wi-ao----" },
+    { "data", "", "Rz4P7A-oAGf-Qm1F-o3dB-Nnpp-2qGY-s6Ngwy",
+      "/dev/sdb1(0),/dev/sdc1(0)", "striped", "2", "2147483648", "4194304",
+      "2147483648", "-wi-a-----" },
+    { "root-snap", "root", "hl2yUr-k1kV-xW3S-2bfT-6Fgx-qZDe-mRrqAZ",
+      "/dev/sda2(2560)", "linear", "1", "1073741824", "4194304",
+      "10737418240", "swi-a-s---" },
+};
+
+typedef struct _testSegData testSegData;
+struct _testSegData {
+    size_t nsegs;
+    size_t failAt; /* make the callback fail on this segment, 0 never */
+};
+
+static int
+testCheckSeg(char **const groups,
+             void *opaque)
+{
+    testSegData *data = opaque;
+    size_t i;
+
+    if (++data->nsegs == data->failAt)
+        return -1;
+
+    if (data->nsegs > ARRAY_CARDINALITY(testSegs)) {
+        VIR_TEST_DEBUG("unexpected segment of volume '%s'", groups[0]);
+        return -1;
+    }
+
+    for (i = 0; i < TEST_SEG_FIELDS; i++) {
+        if (STRNEQ_NULLABLE(groups[i], testSegs[data->nsegs - 1][i])) {
+            VIR_TEST_DEBUG("segment %zu field %zu: expected '%s', got '%s'",
+                           data->nsegs, i, testSegs[data->nsegs - 1][i],
+                           NULLSTR(groups[i]));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+testLogicalJSONSegs(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr doc = NULL;
+    virJSONValuePtr rows = NULL;
+    testSegData data = { 0 };
+    int ret = -1;
+
+    if (virStorageBackendLogicalParseReport(testLVs, &doc, &rows) < 0 ||
+        virStorageBackendLogicalForEachSeg(rows, testCheckSeg, &data) < 0)
+        goto cleanup;
+
+    /* The thin pool has no devices and is skipped like the regex does */
+    if (data.nsegs != ARRAY_CARDINALITY(testSegs)) {
+        VIR_TEST_DEBUG("expected %zu segments, got %zu",
+                       ARRAY_CARDINALITY(testSegs), data.nsegs);
+        goto cleanup;
+    }
+
+    /* A failing callback stops the walk */
+    memset(&data, 0, sizeof(data));
+    data.failAt = 2;
+    if (virStorageBackendLogicalForEachSeg(rows, testCheckSeg, &data) == 0 ||
+        data.nsegs != 2)
+        goto cleanup;
+
+    virResetLastError();
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(doc);
+    return ret;
+}
+
+static int
+testLogicalJSONMissingField(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr doc = NULL;
+    virJSONValuePtr rows = NULL;
+    testSegData data = { 0 };
+    const char *lvs =
+        "{\"report\": [{\"lv\": [{\"lv_name\":\"root\", \"origin\":\"\"}]}]}";
+    int ret = -1;
+
+    if (virStorageBackendLogicalParseReport(lvs, &doc, &rows) < 0)
+        goto cleanup;
+
+    if (virStorageBackendLogicalForEachSeg(rows, testCheckSeg, &data) == 0 ||
+        data.nsegs != 0)
+        goto cleanup;
+
+    virResetLastError();
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(doc);
+    return ret;
+}
+
+static int
+testLogicalJSONUnusable(const void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *docs[] = {
+        "  Unrecognised command line option --reportformat\n",
+        "{\"report\": []}",
+        "{\"report\": [{\"lv\": {}}]}",
+        "{\"lv\": []}",
+    };
+    virJSONValuePtr doc;
+    virJSONValuePtr rows;
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(docs); i++) {
+        if (virStorageBackendLogicalParseReport(docs[i], &doc, &rows) != -2 ||
+            doc || rows) {
+            VIR_TEST_DEBUG("document %zu was not rejected", i);
+            virJSONValueFree(doc);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("LVM JSON segments", testLogicalJSONSegs, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("LVM JSON missing field",
+                    testLogicalJSONMissingField, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("LVM JSON unusable report",
+                    testLogicalJSONUnusable, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <rbd/librbd.h>
+
+#include "internal.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+/*
+ * A RADOS cluster whose pools hold the images listed, comma separated,
+ * in $STORAGE_RBD_MOCK_<pool>. Images called "gone..." vanish before
+ * they can be opened and images called "broken..." can't be stat'ed.
+ * Every image is 1 GiB with fast-diff and the object map walk of the
+ * n-th call reports n KiB allocated, so that a test can tell a fresh
+ * walk from a cached one. Further variables:
+ *
+ *   STORAGE_RBD_MOCK_MTIME     modification time of the images, 1000
+ *                              seconds after the epoch if unset
+ *   STORAGE_RBD_MOCK_PARALLEL  images are opened only once that many
+ *                              of them are being opened at the same
+ *                              time, failing otherwise
+ *   STORAGE_RBD_MOCK_WAIT      images of this pool are closed only once
+ *                              the refresh of another pool, which
+ *                              waits for this, has finished
+ */
+
+/* How long the mock waits for other threads before giving up */
+#define RBD_MOCK_TIMEOUT 10000
+
+typedef struct _rbdMockIoCtx rbdMockIoCtx;
+typedef rbdMockIoCtx *rbdMockIoCtxPtr;
+struct _rbdMockIoCtx {
+    char *pool;
+};
+
+typedef struct _rbdMockImage rbdMockImage;
+typedef rbdMockImage *rbdMockImagePtr;
+struct _rbdMockImage {
+    char *pool;
+    char *name;
+};
+
+static virMutex rbdMockLock = VIR_MUTEX_INITIALIZER;
+static virCond rbdMockCond;
+static bool rbdMockCondInit;
+static unsigned int rbdMockWalks;
+static unsigned int rbdMockOpening;
+static bool rbdMockParallel;
+static bool rbdMockClosing;
+static bool rbdMockOtherDone;
+static int rbdMockCluster;
+
+static void
+rbdMockLockCond(void)
+{
+    virMutexLock(&rbdMockLock);
+    if (!rbdMockCondInit) {
+        if (virCondInit(&rbdMockCond) < 0)
+            abort();
+        rbdMockCondInit = true;
+    }
+}
+
+/* Wait until @flag is set, false if it took too long */
+static bool
+rbdMockWaitFor(bool *flag)
+{
+    unsigned long long until;
+
+    if (virTimeMillisNow(&until) < 0)
+        return false;
+    until += RBD_MOCK_TIMEOUT;
+
+    while (!*flag) {
+        if (virCondWaitUntil(&rbdMockCond, &rbdMockLock, until) < 0)
+            return *flag;
+    }
+
+    return true;
+}
+
+static const char *
+rbdMockWaitPool(void)
+{
+    return getenv("STORAGE_RBD_MOCK_WAIT");
+}
+
+int
+rados_create(rados_t *cluster,
+             const char * const id ATTRIBUTE_UNUSED)
+{
+    *cluster = &rbdMockCluster;
+    return 0;
+}
+
+int
+rados_conf_set(rados_t cluster ATTRIBUTE_UNUSED,
+               const char *option ATTRIBUTE_UNUSED,
+               const char *value ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+int
+rados_connect(rados_t cluster ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+void
+rados_shutdown(rados_t cluster ATTRIBUTE_UNUSED)
+{
+}
+
+int
+rados_ioctx_create(rados_t cluster ATTRIBUTE_UNUSED,
+                   const char *pool_name,
+                   rados_ioctx_t *ioctx)
+{
+    const char *wait = rbdMockWaitPool();
+    rbdMockIoCtxPtr ctx;
+
+    if (VIR_ALLOC_QUIET(ctx) < 0 ||
+        VIR_STRDUP_QUIET(ctx->pool, pool_name) < 0) {
+        VIR_FREE(ctx);
+        return -ENOMEM;
+    }
+
+    rbdMockLockCond();
+    rbdMockParallel = false;
+    if (wait) {
+        /* The other pool is refreshed while an image of the waiting
+         * pool is being closed */
+        if (STREQ(pool_name, wait)) {
+            rbdMockClosing = false;
+            rbdMockOtherDone = false;
+        } else {
+            rbdMockWaitFor(&rbdMockClosing);
+        }
+    }
+    virMutexUnlock(&rbdMockLock);
+
+    *ioctx = ctx;
+    return 0;
+}
+
+void
+rados_ioctx_destroy(rados_ioctx_t io)
+{
+    rbdMockIoCtxPtr ctx = io;
+    const char *wait = rbdMockWaitPool();
+
+    rbdMockLockCond();
+    if (wait && STRNEQ(ctx->pool, wait)) {
+        rbdMockOtherDone = true;
+        virCondBroadcast(&rbdMockCond);
+    }
+    virMutexUnlock(&rbdMockLock);
+
+    VIR_FREE(ctx->pool);
+    VIR_FREE(ctx);
+}
+
+int
+rados_cluster_stat(rados_t cluster ATTRIBUTE_UNUSED,
+                   struct rados_cluster_stat_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->kb = 1024 * 1024 * 1024;
+    result->kb_avail = 1024 * 1024;
+    return 0;
+}
+
+int
+rados_ioctx_pool_stat(rados_ioctx_t io ATTRIBUTE_UNUSED,
+                      struct rados_pool_stat_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    return 0;
+}
+
+int
+rbd_list(rados_ioctx_t io,
+         char *names,
+         size_t *size)
+{
+    rbdMockIoCtxPtr ctx = io;
+    char *var = NULL;
+    char **images = NULL;
+    const char *value;
+    size_t nimages = 0;
+    size_t needed = 0;
+    size_t i;
+    int ret = -ENOMEM;
+
+    if (virAsprintfQuiet(&var, "STORAGE_RBD_MOCK_%s", ctx->pool) < 0)
+        return -ENOMEM;
+
+    if ((value = getenv(var)) && *value &&
+        !(images = virStringSplitCount(value, ",", 0, &nimages)))
+        goto cleanup;
+
+    for (i = 0; i < nimages; i++)
+        needed += strlen(images[i]) + 1;
+
+    if (*size < needed) {
+        *size = needed;
+        ret = -ERANGE;
+        goto cleanup;
+    }
+
+    memset(names, 0, *size);
+    for (i = 0; i < nimages; i++) {
+        size_t len = strlen(images[i]) + 1;
+
+        memcpy(names, images[i], len);
+        names += len;
+    }
+
+    *size = needed;
+    ret = needed;
+
+ cleanup:
+    virStringFreeList(images);
+    VIR_FREE(var);
+    return ret;
+}
+
+int
+rbd_open_read_only(rados_ioctx_t io,
+                   const char *name,
+                   rbd_image_t *image,
+                   const char *snap_name ATTRIBUTE_UNUSED)
+{
+    rbdMockIoCtxPtr ctx = io;
+    rbdMockImagePtr img;
+    const char *parallel = getenv("STORAGE_RBD_MOCK_PARALLEL");
+    unsigned int want;
+
+    if (parallel && virStrToLong_ui(parallel, NULL, 10, &want) == 0) {
+        bool reached;
+
+        rbdMockLockCond();
+        if (++rbdMockOpening >= want) {
+            rbdMockParallel = true;
+            virCondBroadcast(&rbdMockCond);
+        }
+        reached = rbdMockWaitFor(&rbdMockParallel);
+        rbdMockOpening--;
+        virMutexUnlock(&rbdMockLock);
+
+        if (!reached)
+            return -EIO;
+    }
+
+    if (STRPREFIX(name, "gone"))
+        return -ENOENT;
+
+    if (VIR_ALLOC_QUIET(img) < 0 ||
+        VIR_STRDUP_QUIET(img->pool, ctx->pool) < 0 ||
+        VIR_STRDUP_QUIET(img->name, name) < 0) {
+        if (img)
+            VIR_FREE(img->pool);
+        VIR_FREE(img);
+        return -ENOMEM;
+    }
+
+    *image = img;
+    return 0;
+}
+
+int
+rbd_close(rbd_image_t image)
+{
+    rbdMockImagePtr img = image;
+    const char *wait = rbdMockWaitPool();
+
+    if (wait && STREQ(img->pool, wait)) {
+        rbdMockLockCond();
+        rbdMockClosing = true;
+        virCondBroadcast(&rbdMockCond);
+        rbdMockWaitFor(&rbdMockOtherDone);
+        virMutexUnlock(&rbdMockLock);
+    }
+
+    VIR_FREE(img->pool);
+    VIR_FREE(img->name);
+    VIR_FREE(img);
+    return 0;
+}
+
+int
+rbd_stat(rbd_image_t image,
+         rbd_image_info_t *info,
+         size_t infosize ATTRIBUTE_UNUSED)
+{
+    rbdMockImagePtr img = image;
+
+    if (STRPREFIX(img->name, "broken"))
+        return -EIO;
+
+    memset(info, 0, sizeof(*info));
+    info->size = 1024 * 1024 * 1024;
+    info->obj_size = 4 * 1024 * 1024;
+    info->num_objs = info->size / info->obj_size;
+    info->order = 22;
+    return 0;
+}
+
+int
+rbd_get_features(rbd_image_t image ATTRIBUTE_UNUSED,
+                 uint64_t *features)
+{
+#if LIBRBD_VERSION_CODE > 265
+    *features = RBD_FEATURE_FAST_DIFF;
+#else
+    *features = 0;
+#endif
+    return 0;
+}
+
+#if LIBRBD_VERSION_CODE > 265
+int
+rbd_diff_iterate2(rbd_image_t image ATTRIBUTE_UNUSED,
+                  const char *fromsnapname ATTRIBUTE_UNUSED,
+                  uint64_t ofs ATTRIBUTE_UNUSED,
+                  uint64_t len ATTRIBUTE_UNUSED,
+                  uint8_t include_parent ATTRIBUTE_UNUSED,
+                  uint8_t whole_object ATTRIBUTE_UNUSED,
+                  int (*cb)(uint64_t, size_t, int, void *),
+                  void *arg)
+{
+    unsigned int walk;
+
+    virMutexLock(&rbdMockLock);
+    walk = ++rbdMockWalks;
+    virMutexUnlock(&rbdMockLock);
+
+    return cb(0, walk * 1024, 1, arg);
+}
+#endif
+
+#if LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0)
+int
+rbd_get_modify_timestamp(rbd_image_t image ATTRIBUTE_UNUSED,
+                         struct timespec *timestamp)
+{
+    const char *mtime = getenv("STORAGE_RBD_MOCK_MTIME");
+    long long sec = 1000;
+
+    if (mtime && virStrToLong_ll(mtime, NULL, 10, &sec) < 0)
+        return -EINVAL;
+
+    timestamp->tv_sec = sec;
+    timestamp->tv_nsec = 0;
+    return 0;
+}
+#endif
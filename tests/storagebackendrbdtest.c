@@ -0,0 +1,300 @@
+/*
+ * storagebackendrbdtest.c: RBD pool refresh tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <rbd/librbd.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage/storage_backend_rbd.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define GiB (1024ull * 1024 * 1024)
+
+static virStoragePoolObjPtr
+testPoolNew(const char *name,
+            unsigned char id)
+{
+    virStoragePoolObjPtr pool;
+
+    if (VIR_ALLOC(pool) < 0)
+        return NULL;
+
+    if (virMutexInit(&pool->lock) < 0) {
+        VIR_FREE(pool);
+        return NULL;
+    }
+
+    if (VIR_ALLOC(pool->def) < 0 ||
+        VIR_STRDUP(pool->def->name, name) < 0 ||
+        VIR_STRDUP(pool->def->source.name, name) < 0) {
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
+
+    pool->def->type = VIR_STORAGE_POOL_RBD;
+    memset(pool->def->uuid, id, VIR_UUID_BUFLEN);
+
+    return pool;
+}
+
+/* Refreshes @pool from scratch as storagePoolRefresh does */
+static int
+testRefreshPool(virStoragePoolObjPtr pool)
+{
+    virStoragePoolObjClearVols(pool);
+    return virStorageBackendRBD.refreshPool(NULL, pool);
+}
+
+static int
+testRefreshParallel(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool;
+    const char *names[] = { "a", "b", "c", "d", "e", "f", "g", "h" };
+    virStorageVolDefPtr vol;
+    size_t i;
+    int ret = -1;
+
+    if (!(pool = testPoolNew("parallel", 1)))
+        return -1;
+
+    /* Images are only opened once four workers are at it, and the
+     * ones which went away meanwhile are left out */
+    setenv("STORAGE_RBD_MOCK_parallel", "a,b,gone1,c,d,gone2,e,f,g,h", 1);
+    setenv("STORAGE_RBD_MOCK_PARALLEL", "4", 1);
+
+    if (testRefreshPool(pool) < 0)
+        goto cleanup;
+
+    if (pool->volumes.count != ARRAY_CARDINALITY(names)) {
+        VIR_TEST_DEBUG("pool has %zu volumes, expected %zu",
+                       pool->volumes.count, ARRAY_CARDINALITY(names));
+        goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+        if (!(vol = virStorageVolDefFindByName(pool, names[i]))) {
+            VIR_TEST_DEBUG("volume '%s' is missing", names[i]);
+            goto cleanup;
+        }
+
+        if (vol->target.capacity != GiB ||
+            STRNEQ_NULLABLE(vol->key, vol->target.path) ||
+            !STRPREFIX(vol->key, "parallel/")) {
+            VIR_TEST_DEBUG("volume '%s' was not refreshed", names[i]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    unsetenv("STORAGE_RBD_MOCK_PARALLEL");
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static int
+testRefreshError(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool;
+    int ret = -1;
+
+    if (!(pool = testPoolNew("error", 2)))
+        return -1;
+
+    /* Any other failure of a single image fails the whole refresh */
+    setenv("STORAGE_RBD_MOCK_error", "a,b,broken,c,d", 1);
+
+    if (testRefreshPool(pool) == 0) {
+        VIR_TEST_DEBUG("refresh didn't fail");
+        goto cleanup;
+    }
+
+    if (pool->volumes.count != 0) {
+        VIR_TEST_DEBUG("failed refresh left %zu volumes",
+                       pool->volumes.count);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virResetLastError();
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+#if LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0)
+/* Refreshes @pool and returns the allocation of its only image */
+static int
+testRefreshAllocation(virStoragePoolObjPtr pool,
+                      unsigned long long *allocation)
+{
+    if (testRefreshPool(pool) < 0)
+        return -1;
+
+    if (pool->volumes.count != 1) {
+        VIR_TEST_DEBUG("pool has %zu volumes, expected 1",
+                       pool->volumes.count);
+        return -1;
+    }
+
+    *allocation = pool->volumes.objs[0]->target.allocation;
+    return 0;
+}
+
+static int
+testAllocationCache(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool;
+    unsigned long long first, second;
+    int ret = -1;
+
+    if (!(pool = testPoolNew("cache", 3)))
+        return -1;
+
+    setenv("STORAGE_RBD_MOCK_cache", "disk", 1);
+
+    /* An image which wasn't written to keeps its allocation */
+    if (testRefreshAllocation(pool, &first) < 0 ||
+        testRefreshAllocation(pool, &second) < 0)
+        goto cleanup;
+
+    if (first != second) {
+        VIR_TEST_DEBUG("unchanged image was walked again");
+        goto cleanup;
+    }
+
+    /* A write to it makes the next refresh walk it again */
+    setenv("STORAGE_RBD_MOCK_MTIME", "2000", 1);
+    if (testRefreshAllocation(pool, &second) < 0)
+        goto cleanup;
+
+    if (first == second) {
+        VIR_TEST_DEBUG("written image kept its cached allocation");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    unsetenv("STORAGE_RBD_MOCK_MTIME");
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+struct testConcurrentData {
+    virStoragePoolObjPtr pool;
+    unsigned long long allocation;
+    int ret;
+};
+
+static void
+testConcurrentRefresh(void *opaque)
+{
+    struct testConcurrentData *data = opaque;
+
+    data->ret = testRefreshAllocation(data->pool, &data->allocation);
+}
+
+static int
+testAllocationConcurrent(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool;
+    virStoragePoolObjPtr other = NULL;
+    struct testConcurrentData data = { NULL, 0, -1 };
+    unsigned long long first, last;
+    virThread thread;
+    int rc;
+    int ret = -1;
+
+    if (!(pool = testPoolNew("concurrent", 4)) ||
+        !(other = testPoolNew("other", 5)))
+        goto cleanup;
+
+    setenv("STORAGE_RBD_MOCK_concurrent", "disk", 1);
+    setenv("STORAGE_RBD_MOCK_other", "disk", 1);
+
+    if (testRefreshAllocation(pool, &first) < 0)
+        goto cleanup;
+
+    /* The other pool is refreshed from start to end after the image of
+     * the first one was looked at and before its refresh ends */
+    setenv("STORAGE_RBD_MOCK_WAIT", "concurrent", 1);
+
+    data.pool = pool;
+    if (virThreadCreate(&thread, true, testConcurrentRefresh, &data) < 0)
+        goto cleanup;
+
+    rc = testRefreshAllocation(other, &last);
+    virThreadJoin(&thread);
+    unsetenv("STORAGE_RBD_MOCK_WAIT");
+
+    if (rc < 0 || data.ret < 0)
+        goto cleanup;
+
+    /* Which must not make it forget the image */
+    if (testRefreshAllocation(pool, &last) < 0)
+        goto cleanup;
+
+    if (data.allocation != first || last != first) {
+        VIR_TEST_DEBUG("concurrent refresh dropped the cached allocation");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    unsetenv("STORAGE_RBD_MOCK_WAIT");
+    virStoragePoolObjFree(other);
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+#endif /* LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0) */
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Refresh in parallel", testRefreshParallel, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Refresh with a broken image",
+                    testRefreshError, NULL) < 0)
+        ret = -1;
+#if LIBRBD_VERSION_CODE >= LIBRBD_VER(1, 12, 0)
+    if (virtTestRun("Allocation cache", testAllocationCache, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Allocation cache with concurrent refreshes",
+                    testAllocationConcurrent, NULL) < 0)
+        ret = -1;
+#endif
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/storagebackendrbdmock.so")
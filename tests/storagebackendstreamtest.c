@@ -0,0 +1,411 @@
+/*
+ * storagebackendstreamtest.c: network volume stream I/O tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage/storage_backend.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define MiB (1024 * 1024)
+
+/* Stand-in for librbd: an image in memory whose every request takes
+ * @latency ms to complete, no matter how many are in flight, much like
+ * a request to a remote OSD. */
+typedef struct _testImage testImage;
+typedef testImage *testImagePtr;
+struct _testImage {
+    char *data;
+    size_t size;
+    unsigned long long latency;
+
+    struct {
+        unsigned long long deadline;
+        bool write;
+        char *buf;
+        size_t len;
+        unsigned long long offset;
+    } reqs[VIR_STORAGE_POOL_STREAM_QUEUE_MAX];
+};
+
+static int
+testImageSubmit(void *opaque,
+                size_t slot,
+                bool write,
+                char *buf,
+                size_t len,
+                unsigned long long offset)
+{
+    testImagePtr img = opaque;
+    unsigned long long now;
+
+    if (offset + len > img->size)
+        return -EINVAL;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -EIO;
+
+    img->reqs[slot].deadline = now + img->latency;
+    img->reqs[slot].write = write;
+    img->reqs[slot].buf = buf;
+    img->reqs[slot].len = len;
+    img->reqs[slot].offset = offset;
+    return 0;
+}
+
+static ssize_t
+testImageWait(void *opaque,
+              size_t slot)
+{
+    testImagePtr img = opaque;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -EIO;
+    if (now < img->reqs[slot].deadline)
+        usleep((img->reqs[slot].deadline - now) * 1000);
+
+    if (img->reqs[slot].write)
+        memcpy(img->data + img->reqs[slot].offset,
+               img->reqs[slot].buf, img->reqs[slot].len);
+    else
+        memcpy(img->reqs[slot].buf,
+               img->data + img->reqs[slot].offset, img->reqs[slot].len);
+
+    return img->reqs[slot].len;
+}
+
+static char
+testPattern(unsigned long long i)
+{
+    return (i * 7 + i / 4096) & 0xff;
+}
+
+typedef struct _testPipe testPipe;
+typedef testPipe *testPipePtr;
+struct _testPipe {
+    int fd;
+    unsigned long long len;   /* bytes to write, or bytes read */
+    bool failed;
+};
+
+/* Plays the client uploading a volume */
+static void
+testPipeFeed(void *opaque)
+{
+    testPipePtr p = opaque;
+    char buf[4096];
+    unsigned long long done = 0;
+
+    while (done < p->len) {
+        size_t want = MIN(sizeof(buf), p->len - done);
+        size_t i;
+
+        for (i = 0; i < want; i++)
+            buf[i] = testPattern(done + i);
+
+        /* The reader may legitimately stop early */
+        if (safewrite(p->fd, buf, want) < 0)
+            break;
+        done += want;
+    }
+
+    VIR_FORCE_CLOSE(p->fd);
+}
+
+/* Plays the client downloading a volume */
+static void
+testPipeDrain(void *opaque)
+{
+    testPipePtr p = opaque;
+    char buf[4096];
+    ssize_t got;
+    size_t i;
+
+    p->len = 0;
+    while ((got = saferead(p->fd, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < got; i++) {
+            if (buf[i] != testPattern(p->len + i))
+                p->failed = true;
+        }
+        p->len += got;
+    }
+
+    if (got < 0)
+        p->failed = true;
+    VIR_FORCE_CLOSE(p->fd);
+}
+
+static testImagePtr
+testImageNew(size_t size,
+             unsigned long long latency,
+             bool fill)
+{
+    testImagePtr img;
+    size_t i;
+
+    if (VIR_ALLOC(img) < 0 ||
+        VIR_ALLOC_N(img->data, size) < 0) {
+        VIR_FREE(img);
+        return NULL;
+    }
+
+    img->size = size;
+    img->latency = latency;
+    for (i = 0; fill && i < size; i++)
+        img->data[i] = testPattern(i);
+
+    return img;
+}
+
+static void
+testImageFree(testImagePtr img)
+{
+    if (!img)
+        return;
+    VIR_FREE(img->data);
+    VIR_FREE(img);
+}
+
+static void
+testAIOInit(virStorageBackendStreamAIOPtr aio,
+            testImagePtr img,
+            unsigned long long offset,
+            unsigned long long end,
+            size_t depth)
+{
+    memset(aio, 0, sizeof(*aio));
+    aio->path = "mock";
+    aio->offset = offset;
+    aio->end = end;
+    aio->depth = depth;
+    aio->submit = testImageSubmit;
+    aio->wait = testImageWait;
+    aio->opaque = img;
+}
+
+/* Run an upload of @len bytes, returning the pump's result */
+static int
+testUpload(testImagePtr img,
+           unsigned long long offset,
+           unsigned long long len,
+           size_t depth)
+{
+    virStorageBackendStreamAIO aio;
+    virThread feeder;
+    testPipe p = { .fd = -1, .len = len };
+    int fds[2];
+    int ret;
+
+    if (pipe(fds) < 0)
+        return -1;
+
+    p.fd = fds[1];
+    if (virThreadCreate(&feeder, true, testPipeFeed, &p) < 0) {
+        VIR_FORCE_CLOSE(fds[0]);
+        VIR_FORCE_CLOSE(fds[1]);
+        return -1;
+    }
+
+    testAIOInit(&aio, img, offset, img->size, depth);
+    ret = virStorageBackendStreamAIOUpload(fds[0], &aio);
+
+    VIR_FORCE_CLOSE(fds[0]);
+    virThreadJoin(&feeder);
+    return ret;
+}
+
+static int
+testStreamUpload(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testImagePtr img;
+    unsigned long long len = 5 * MiB + 12345;
+    size_t i;
+    int ret = -1;
+
+    if (!(img = testImageNew(8 * MiB, 0, false)))
+        return -1;
+
+    if (testUpload(img, 4096, len, 4) < 0)
+        goto cleanup;
+
+    for (i = 0; i < len; i++) {
+        if (img->data[4096 + i] != testPattern(i)) {
+            VIR_TEST_DEBUG("mismatch at offset %zu", i);
+            goto cleanup;
+        }
+    }
+
+    if (img->data[0] || img->data[4096 + len])
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    testImageFree(img);
+    return ret;
+}
+
+static int
+testStreamUploadOverflow(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testImagePtr img;
+    int ret = -1;
+
+    if (!(img = testImageNew(2 * MiB, 0, false)))
+        return -1;
+
+    /* Exactly filling the image is fine, one byte more is not */
+    if (testUpload(img, MiB, MiB, 4) < 0 ||
+        testUpload(img, MiB, MiB + 1, 4) == 0)
+        goto cleanup;
+
+    virResetLastError();
+    ret = 0;
+
+ cleanup:
+    testImageFree(img);
+    return ret;
+}
+
+static int
+testDownload(testImagePtr img,
+             unsigned long long offset,
+             unsigned long long end,
+             size_t depth,
+             unsigned long long *len)
+{
+    virStorageBackendStreamAIO aio;
+    virThread drainer;
+    testPipe p = { .fd = -1 };
+    int fds[2];
+    int ret;
+
+    if (pipe(fds) < 0)
+        return -1;
+
+    p.fd = fds[0];
+    if (virThreadCreate(&drainer, true, testPipeDrain, &p) < 0) {
+        VIR_FORCE_CLOSE(fds[0]);
+        VIR_FORCE_CLOSE(fds[1]);
+        return -1;
+    }
+
+    testAIOInit(&aio, img, offset, end, depth);
+    ret = virStorageBackendStreamAIODownload(fds[1], &aio);
+
+    VIR_FORCE_CLOSE(fds[1]);
+    virThreadJoin(&drainer);
+
+    if (p.failed)
+        return -1;
+    *len = p.len;
+    return ret;
+}
+
+static int
+testStreamDownload(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testImagePtr img;
+    unsigned long long len;
+    int ret = -1;
+
+    if (!(img = testImageNew(7 * MiB + 333, 0, true)))
+        return -1;
+
+    if (testDownload(img, 0, img->size, 3, &len) < 0 ||
+        len != img->size)
+        goto cleanup;
+
+    if (testDownload(img, img->size, img->size, 3, &len) < 0 ||
+        len != 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    testImageFree(img);
+    return ret;
+}
+
+/* Stream 32 MiB through a backend with 2 ms of latency per request,
+ * once serially and once with the default queue depth. The timings
+ * depend on the machine running the test, so they are only reported */
+static int
+testStreamBench(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testImagePtr img;
+    size_t depths[] = { 1, VIR_STORAGE_BACKEND_STREAM_QUEUE_DEFAULT };
+    unsigned long long start, download, upload, len;
+    size_t i;
+    int ret = -1;
+
+    if (!(img = testImageNew(32 * MiB, 2, true)))
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(depths); i++) {
+        if (virTimeMillisNow(&start) < 0 ||
+            testDownload(img, 0, img->size, depths[i], &len) < 0 ||
+            len != img->size ||
+            virTimeMillisNow(&download) < 0 ||
+            testUpload(img, 0, img->size, depths[i]) < 0 ||
+            virTimeMillisNow(&upload) < 0)
+            goto cleanup;
+
+        VIR_TEST_DEBUG("queue depth %zu: download %llu ms, upload %llu ms",
+                       depths[i], download - start, upload - download);
+    }
+
+    ret = 0;
+
+ cleanup:
+    testImageFree(img);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Stream upload", testStreamUpload, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stream upload overflow",
+                    testStreamUploadOverflow, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stream download", testStreamDownload, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stream queue depth benchmark",
+                    testStreamBench, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
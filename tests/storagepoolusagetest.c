@@ -0,0 +1,323 @@
+/*
+ * storagepoolusagetest.c: storage pool usage accounting tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "datatypes.h"
+#include "storage/storage_driverpriv.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* A backend whose volumes end up with @testAllocation bytes allocated
+ * whenever they are read again */
+static unsigned long long testAllocation;
+static size_t testRefreshed;
+static bool testWipeFails;
+
+static int
+testBackendWipeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
+                   virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                   virStorageVolDefPtr vol,
+                   unsigned int algorithm ATTRIBUTE_UNUSED,
+                   unsigned int flags ATTRIBUTE_UNUSED)
+{
+    if (testWipeFails) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to wipe volume '%s'"), vol->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testBackendRefreshVol(virConnectPtr conn ATTRIBUTE_UNUSED,
+                      virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                      virStorageVolDefPtr vol)
+{
+    testRefreshed++;
+    vol->target.allocation = testAllocation;
+    return 0;
+}
+
+static virStorageBackend testBackend = {
+    .type = VIR_STORAGE_POOL_LOGICAL,
+
+    .wipeVol = testBackendWipeVol,
+    .refreshVol = testBackendRefreshVol,
+};
+
+/* A pool of 1000 bytes holding a volume of 100 bytes and @type,
+ * @allocated of which are in use */
+static virStoragePoolObjPtr
+testPoolNew(int type,
+            unsigned long long allocated)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
+
+    if (VIR_ALLOC(pool) < 0)
+        return NULL;
+
+    if (virMutexInit(&pool->lock) < 0) {
+        VIR_FREE(pool);
+        return NULL;
+    }
+
+    if (VIR_ALLOC(pool->def) < 0 ||
+        VIR_STRDUP(pool->def->name, "pool") < 0 ||
+        VIR_ALLOC(vol) < 0 ||
+        VIR_STRDUP(vol->name, "vol") < 0 ||
+        VIR_STRDUP(vol->key, "/pool/vol") < 0 ||
+        VIR_STRDUP(vol->target.path, "/pool/vol") < 0 ||
+        virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
+
+    vol->type = type;
+    vol->target.capacity = 100;
+    vol->target.allocation = allocated;
+
+    pool->def->type = VIR_STORAGE_POOL_LOGICAL;
+    pool->def->capacity = 1000;
+    pool->def->allocation = allocated;
+    pool->def->available = 1000 - allocated;
+    pool->active = true;
+
+    testAllocation = allocated;
+    testRefreshed = 0;
+    testWipeFails = false;
+
+    return pool;
+}
+
+static int
+testCheckUsage(virStoragePoolObjPtr pool,
+               unsigned long long allocation,
+               unsigned long long available)
+{
+    if (pool->def->allocation != allocation ||
+        pool->def->available != available) {
+        VIR_TEST_DEBUG("pool allocation %llu available %llu, "
+                       "expected %llu and %llu",
+                       pool->def->allocation, pool->def->available,
+                       allocation, available);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+struct testUsageData {
+    int type;                       /* virStoragePoolType */
+    unsigned long long capacity;
+    unsigned long long allocation;
+    unsigned long long available;
+    unsigned long long oldalloc;
+    unsigned long long newalloc;
+    unsigned long long expectAllocation;
+    unsigned long long expectAvailable;
+};
+
+static int
+testUsageUpdate(const void *opaque)
+{
+    const struct testUsageData *data = opaque;
+    virStoragePoolObj pool;
+    virStoragePoolDef def;
+
+    memset(&pool, 0, sizeof(pool));
+    memset(&def, 0, sizeof(def));
+    pool.def = &def;
+    def.type = data->type;
+    def.capacity = data->capacity;
+    def.allocation = data->allocation;
+    def.available = data->available;
+
+    storagePoolUpdateUsage(&pool, data->oldalloc, data->newalloc);
+
+    return testCheckUsage(&pool, data->expectAllocation,
+                          data->expectAvailable);
+}
+
+/* Wipes the volume of @pool in the foreground as storageVolWipe does */
+static int
+testWipe(virConnectPtr conn,
+         virStoragePoolObjPtr pool)
+{
+    virStorageVolDefPtr vol = pool->volumes.objs[0];
+    storageVolJobPtr job = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC(job) < 0 ||
+        VIR_ALLOC(job->shadowvol) < 0 ||
+        !(job->volobj = virGetStorageVol(conn, "pool", vol->name,
+                                         vol->key, NULL, NULL)))
+        goto cleanup;
+
+    memcpy(job->shadowvol, vol, sizeof(*vol));
+    job->type = STORAGE_VOL_JOB_WIPE;
+    job->backend = &testBackend;
+    job->pool = pool;
+    job->vol = vol;
+
+    virStoragePoolObjLock(pool);
+    storageVolJobBegin(job);
+    ret = storageVolJobRun(job, false);
+    virStoragePoolObjUnlock(pool);
+
+ cleanup:
+    storageVolJobFree(job);
+    return ret;
+}
+
+static int
+testUsageWipe(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virConnectPtr conn;
+    virStoragePoolObjPtr pool = NULL;
+    int ret = -1;
+
+    if (!(conn = virGetConnect()) ||
+        !(pool = testPoolNew(VIR_STORAGE_VOL_BLOCK, 10)))
+        goto cleanup;
+
+    /* Filling in a sparse volume */
+    testAllocation = 100;
+    if (testWipe(conn, pool) < 0 ||
+        testCheckUsage(pool, 100, 900) < 0)
+        goto cleanup;
+
+    /* Trimming it */
+    testAllocation = 0;
+    if (testWipe(conn, pool) < 0 ||
+        testCheckUsage(pool, 0, 1000) < 0)
+        goto cleanup;
+
+    /* A failed wipe doesn't read the volume again */
+    testAllocation = 100;
+    testWipeFails = true;
+    if (testWipe(conn, pool) == 0) {
+        VIR_TEST_DEBUG("failed wipe succeeded");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    if (testCheckUsage(pool, 0, 1000) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjFree(pool);
+    virObjectUnref(conn);
+    return ret;
+}
+
+static int
+testUsageUpload(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool;
+    int ret = -1;
+
+    if (!(pool = testPoolNew(VIR_STORAGE_VOL_BLOCK, 10)))
+        return -1;
+
+    /* Only the uploaded volume is read again */
+    testAllocation = 60;
+    if (storageVolRefreshUploaded(pool, &testBackend, "vol") != 0 ||
+        testRefreshed != 1 ||
+        testCheckUsage(pool, 60, 940) < 0)
+        goto cleanup;
+
+    /* Not while it is used by somebody else */
+    pool->volumes.objs[0]->in_use++;
+    testAllocation = 80;
+    if (storageVolRefreshUploaded(pool, &testBackend, "vol") != 0 ||
+        testRefreshed != 1 ||
+        testCheckUsage(pool, 60, 940) < 0)
+        goto cleanup;
+    pool->volumes.objs[0]->in_use--;
+
+    /* Files are probed again with the whole pool */
+    pool->volumes.objs[0]->type = VIR_STORAGE_VOL_FILE;
+    if (storageVolRefreshUploaded(pool, &testBackend, "vol") != 1 ||
+        testRefreshed != 1 ||
+        testCheckUsage(pool, 60, 940) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name, type, capacity, allocation, available,                \
+                oldalloc, newalloc, expectAllocation, expectAvailable)      \
+    do {                                                                    \
+        struct testUsageData data = {                                       \
+            VIR_STORAGE_POOL_ ## type, capacity, allocation, available,     \
+            oldalloc, newalloc, expectAllocation, expectAvailable           \
+        };                                                                  \
+        if (virtTestRun("Usage update: " name,                              \
+                        testUsageUpdate, &data) < 0)                        \
+            ret = -1;                                                       \
+    } while (0)
+
+    DO_TEST("create", DIR, 1000, 400, 600, 0, 100, 500, 500);
+    DO_TEST("delete", DIR, 1000, 400, 600, 100, 0, 300, 700);
+    DO_TEST("resize with allocation", DIR, 1000, 400, 600, 50, 300, 650, 350);
+    DO_TEST("wipe filling in", DIR, 1000, 400, 600, 10, 100, 490, 510);
+    DO_TEST("wipe trimming", DIR, 1000, 400, 600, 100, 10, 310, 690);
+
+    /* The numbers are estimates, they never wrap around */
+    DO_TEST("beyond available", DIR, 1000, 900, 100, 0, 300, 1200, 0);
+    DO_TEST("beyond allocation", DIR, 1000, 100, 850, 300, 0, 0, 1000);
+    DO_TEST("beyond capacity", DIR, 1000, 400, 900, 100, 0, 300, 700);
+    DO_TEST("over capacity", DIR, 1000, 1300, 0, 300, 100, 1100, 200);
+    DO_TEST("unknown capacity", DIR, 0, 400, 600, 100, 0, 300, 700);
+
+    /* The disk backend keeps its own numbers */
+    DO_TEST("disk", DISK, 1000, 400, 600, 0, 100, 400, 600);
+
+    if (virtTestRun("Usage after wipe", testUsageWipe, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Usage after upload", testUsageUpload, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -75,6 +75,8 @@ mymain(void)
 
     DO_TEST("pool-dir");
     DO_TEST("pool-dir-naming");
+    DO_TEST("pool-dir-watch");
+    DO_TEST("pool-dir-stats");
     DO_TEST("pool-fs");
     DO_TEST("pool-logical");
     DO_TEST("pool-logical-nopath");
@@ -103,6 +105,7 @@ mymain(void)
 #endif
 #ifdef WITH_STORAGE_RBD
     DO_TEST("pool-rbd");
+    DO_TEST("pool-rbd-stream");
 #endif
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
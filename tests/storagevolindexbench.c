@@ -0,0 +1,184 @@
+/*
+ * storagevolindexbench.c: storage volume lookup index benchmark
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Not run by 'make check'. Run it by hand as
+ *
+ *   ./storagevolindexbench [VOLUMES]
+ *
+ * to time adding, looking up and removing VOLUMES volumes (100000 by
+ * default), compared with a lookup walking the volume list.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "internal.h"
+#include "storage_conf.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Lookups done the way virStorageVolDefFindByName did before the
+ * indexes, only a sample of them as they are quadratic overall */
+#define BENCH_SCAN_SAMPLE 1000
+
+static unsigned long long
+benchNow(void)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return 0;
+    return now;
+}
+
+static int
+benchAddVols(virStoragePoolObjPtr pool,
+             size_t count)
+{
+    virStorageVolDefPtr vol;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (VIR_ALLOC(vol) < 0)
+            return -1;
+
+        if (virAsprintf(&vol->name, "vol%zu", i) < 0 ||
+            virAsprintf(&vol->key, "key%zu", i) < 0 ||
+            virAsprintf(&vol->target.path, "/pool/vol%zu", i) < 0 ||
+            virStoragePoolObjAddVol(pool, vol) < 0) {
+            virStorageVolDefFree(vol);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+benchLookupVols(virStoragePoolObjPtr pool,
+                size_t count)
+{
+    char name[64];
+    char key[64];
+    char path[64];
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "vol%zu", i);
+        snprintf(key, sizeof(key), "key%zu", i);
+        snprintf(path, sizeof(path), "/pool/vol%zu", i);
+
+        if (!virStorageVolDefFindByName(pool, name) ||
+            !virStorageVolDefFindByKey(pool, key) ||
+            !virStorageVolDefFindByPath(pool, path))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+benchScanVols(virStoragePoolObjPtr pool,
+              size_t count)
+{
+    char name[64];
+    size_t i, j;
+
+    for (i = 0; i < BENCH_SCAN_SAMPLE; i++) {
+        snprintf(name, sizeof(name), "vol%zu", count - 1 - i % count);
+
+        for (j = 0; j < pool->volumes.count; j++) {
+            if (STREQ(pool->volumes.objs[j]->name, name))
+                break;
+        }
+        if (j == pool->volumes.count)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void
+benchRemoveVols(virStoragePoolObjPtr pool)
+{
+    virStorageVolDefPtr vol;
+
+    while (pool->volumes.count) {
+        vol = pool->volumes.objs[pool->volumes.count / 2];
+        virStoragePoolObjRemoveVol(pool, vol);
+        virStorageVolDefFree(vol);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    virStoragePoolObjPtr pool = NULL;
+    unsigned long long start;
+    unsigned int count = 100000;
+    int ret = EXIT_FAILURE;
+
+    if (argc > 2 ||
+        (argc == 2 &&
+         (virStrToLong_ui(argv[1], NULL, 10, &count) < 0 || !count))) {
+        fprintf(stderr, "%s [VOLUMES]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (VIR_ALLOC(pool) < 0 ||
+        virMutexInit(&pool->lock) < 0) {
+        VIR_FREE(pool);
+        return EXIT_FAILURE;
+    }
+
+    start = benchNow();
+    if (benchAddVols(pool, count) < 0)
+        goto cleanup;
+    printf("add:    %u volumes in %llu ms\n", count, benchNow() - start);
+
+    start = benchNow();
+    if (benchLookupVols(pool, count) < 0)
+        goto cleanup;
+    printf("lookup: %u volumes by name, key and path in %llu ms\n",
+           count, benchNow() - start);
+
+    start = benchNow();
+    if (benchScanVols(pool, count) < 0)
+        goto cleanup;
+    printf("scan:   %d volumes by name in %llu ms\n",
+           BENCH_SCAN_SAMPLE, benchNow() - start);
+
+    start = benchNow();
+    benchRemoveVols(pool);
+    printf("remove: %u volumes in %llu ms\n", count, benchNow() - start);
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "benchmark failed: %s\n", virGetLastErrorMessage());
+    virStoragePoolObjFree(pool);
+    return ret;
+}
@@ -0,0 +1,281 @@
+/*
+ * storagevolindextest.c: storage volume lookup index tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage_conf.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define TEST_VOL_COUNT 1000
+
+static virStoragePoolObjPtr
+testPoolNew(void)
+{
+    virStoragePoolObjPtr pool;
+
+    if (VIR_ALLOC(pool) < 0)
+        return NULL;
+
+    if (virMutexInit(&pool->lock) < 0) {
+        VIR_FREE(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+static virStorageVolDefPtr
+testVolNew(const char *name,
+           const char *key,
+           const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (VIR_ALLOC(vol) < 0)
+        return NULL;
+
+    if (VIR_STRDUP(vol->name, name) < 0 ||
+        VIR_STRDUP(vol->key, key) < 0 ||
+        VIR_STRDUP(vol->target.path, path) < 0) {
+        virStorageVolDefFree(vol);
+        return NULL;
+    }
+
+    return vol;
+}
+
+static int
+testPoolAddVols(virStoragePoolObjPtr pool,
+                size_t count)
+{
+    virStorageVolDefPtr vol = NULL;
+    char name[64];
+    char key[64];
+    char path[64];
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "vol%zu", i);
+        snprintf(key, sizeof(key), "key%zu", i);
+        snprintf(path, sizeof(path), "/pool/vol%zu", i);
+
+        if (!(vol = testVolNew(name, key, path)) ||
+            virStoragePoolObjAddVol(pool, vol) < 0) {
+            virStorageVolDefFree(vol);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+testPoolCheckVol(virStoragePoolObjPtr pool,
+                 size_t i,
+                 bool present)
+{
+    virStorageVolDefPtr byName;
+    virStorageVolDefPtr byKey;
+    virStorageVolDefPtr byPath;
+    char name[64];
+    char key[64];
+    char path[64];
+
+    snprintf(name, sizeof(name), "vol%zu", i);
+    snprintf(key, sizeof(key), "key%zu", i);
+    snprintf(path, sizeof(path), "/pool/vol%zu", i);
+
+    byName = virStorageVolDefFindByName(pool, name);
+    byKey = virStorageVolDefFindByKey(pool, key);
+    byPath = virStorageVolDefFindByPath(pool, path);
+
+    if (!present) {
+        if (byName || byKey || byPath) {
+            VIR_TEST_DEBUG("volume '%s' still found after removal", name);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!byName || byName != byKey || byName != byPath ||
+        STRNEQ(byName->name, name)) {
+        VIR_TEST_DEBUG("lookups for volume '%s' disagree", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testVolIndexLookup(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool;
+    size_t i;
+    int ret = -1;
+
+    if (!(pool = testPoolNew()))
+        return -1;
+
+    if (testPoolAddVols(pool, TEST_VOL_COUNT) < 0 ||
+        pool->volumes.count != TEST_VOL_COUNT)
+        goto cleanup;
+
+    for (i = 0; i < TEST_VOL_COUNT; i++) {
+        if (testPoolCheckVol(pool, i, true) < 0)
+            goto cleanup;
+    }
+
+    if (virStorageVolDefFindByName(pool, "nosuchvol") ||
+        virStorageVolDefFindByKey(pool, "nosuchkey") ||
+        virStorageVolDefFindByPath(pool, "/pool/nosuchvol"))
+        goto cleanup;
+
+    /* Drop every other volume and make sure the indexes follow */
+    for (i = 0; i < TEST_VOL_COUNT; i += 2) {
+        virStorageVolDefPtr vol;
+        char name[64];
+
+        snprintf(name, sizeof(name), "vol%zu", i);
+        if (!(vol = virStorageVolDefFindByName(pool, name)))
+            goto cleanup;
+
+        virStoragePoolObjRemoveVol(pool, vol);
+        virStorageVolDefFree(vol);
+    }
+
+    for (i = 0; i < TEST_VOL_COUNT; i++) {
+        if (testPoolCheckVol(pool, i, i % 2) < 0)
+            goto cleanup;
+    }
+
+    virStoragePoolObjClearVols(pool);
+
+    if (pool->volumes.count ||
+        virStorageVolDefFindByName(pool, "vol1"))
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static virStorageVolDefPtr
+testPoolAddVol(virStoragePoolObjPtr pool,
+               const char *name,
+               const char *key,
+               const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (!(vol = testVolNew(name, key, path)))
+        return NULL;
+
+    if (virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        return NULL;
+    }
+
+    return vol;
+}
+
+static int
+testVolIndexDuplicate(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr first;
+    virStorageVolDefPtr second;
+    virStorageVolDefPtr third;
+    int ret = -1;
+
+    if (!(pool = testPoolNew()))
+        return -1;
+
+    /* Volumes sharing a key: the first one added wins until removed */
+    if (!(first = testPoolAddVol(pool, "first", "shared", "/pool/first")) ||
+        !(second = testPoolAddVol(pool, "second", "shared", "/pool/second")) ||
+        !(third = testPoolAddVol(pool, "third", "shared", "/pool/third")))
+        goto cleanup;
+
+    if (virStorageVolDefFindByKey(pool, "shared") != first)
+        goto cleanup;
+
+    /* The last volume takes the slot of the removed one, which must not
+     * let it overtake the second one */
+    virStoragePoolObjRemoveVol(pool, first);
+    virStorageVolDefFree(first);
+
+    if (virStorageVolDefFindByKey(pool, "shared") != second ||
+        virStorageVolDefFindByName(pool, "first") ||
+        virStorageVolDefFindByPath(pool, "/pool/second") != second) {
+        VIR_TEST_DEBUG("second volume was not promoted");
+        goto cleanup;
+    }
+
+    /* Removing a volume that is shadowed leaves the winner alone */
+    if (!(first = testPoolAddVol(pool, "first", "shared", "/pool/first")))
+        goto cleanup;
+
+    virStoragePoolObjRemoveVol(pool, third);
+    virStorageVolDefFree(third);
+
+    if (virStorageVolDefFindByKey(pool, "shared") != second)
+        goto cleanup;
+
+    virStoragePoolObjRemoveVol(pool, second);
+    virStorageVolDefFree(second);
+
+    if (virStorageVolDefFindByKey(pool, "shared") != first ||
+        pool->volumes.nshadowed) {
+        VIR_TEST_DEBUG("re-added volume was not promoted");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjFree(pool);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Storage vol index lookup",
+                    testVolIndexLookup, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Storage vol index duplicate key",
+                    testVolIndexDuplicate, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
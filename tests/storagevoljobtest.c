@@ -0,0 +1,429 @@
+/*
+ * storagevoljobtest.c: storage volume background job tests
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "datatypes.h"
+#include "storage/storage_driverpriv.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/storagevoljobdir-XXXXXX"
+
+/* A backend whose builds and wipes run until the test releases them
+ * or the job is cancelled */
+static virMutex testLock;
+static virCond testCond;
+static bool testStarted;
+static bool testReleased;
+static size_t testRefreshed;
+static size_t testDeleted;
+
+static int
+testBackendWork(virStorageVolDefPtr vol)
+{
+    unsigned long long now;
+    bool cancelled = false;
+
+    virMutexLock(&testLock);
+    testStarted = true;
+    virCondBroadcast(&testCond);
+
+    while (!testReleased &&
+           !(cancelled = virStorageVolDefJobCancelled(vol))) {
+        if (virTimeMillisNow(&now) < 0)
+            break;
+        ignore_value(virCondWaitUntil(&testCond, &testLock, now + 10));
+    }
+    virMutexUnlock(&testLock);
+
+    if (cancelled) {
+        virReportError(VIR_ERR_OPERATION_ABORTED,
+                       _("operation on volume '%s' was cancelled"),
+                       vol->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testBackendBuildVol(virConnectPtr conn ATTRIBUTE_UNUSED,
+                    virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                    virStorageVolDefPtr vol,
+                    unsigned int flags ATTRIBUTE_UNUSED)
+{
+    return testBackendWork(vol);
+}
+
+static int
+testBackendWipeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
+                   virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                   virStorageVolDefPtr vol,
+                   unsigned int algorithm ATTRIBUTE_UNUSED,
+                   unsigned int flags ATTRIBUTE_UNUSED)
+{
+    return testBackendWork(vol);
+}
+
+static int
+testBackendRefreshVol(virConnectPtr conn ATTRIBUTE_UNUSED,
+                      virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                      virStorageVolDefPtr vol ATTRIBUTE_UNUSED)
+{
+    testRefreshed++;
+    return 0;
+}
+
+static int
+testBackendDeleteVol(virConnectPtr conn ATTRIBUTE_UNUSED,
+                     virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                     virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
+                     unsigned int flags ATTRIBUTE_UNUSED)
+{
+    testDeleted++;
+    return 0;
+}
+
+static virStorageBackend testBackend = {
+    .type = VIR_STORAGE_POOL_DIR,
+
+    .buildVol = testBackendBuildVol,
+    .wipeVol = testBackendWipeVol,
+    .refreshVol = testBackendRefreshVol,
+    .deleteVol = testBackendDeleteVol,
+};
+
+static void
+testBackendWaitStarted(void)
+{
+    virMutexLock(&testLock);
+    while (!testStarted)
+        ignore_value(virCondWait(&testCond, &testLock));
+    virMutexUnlock(&testLock);
+}
+
+static void
+testBackendRelease(void)
+{
+    virMutexLock(&testLock);
+    testReleased = true;
+    virCondBroadcast(&testCond);
+    virMutexUnlock(&testLock);
+}
+
+
+typedef struct _testJobData testJobData;
+typedef testJobData *testJobDataPtr;
+struct _testJobData {
+    virConnectPtr conn;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    storageVolJobPtr job;
+    int rc;                     /* result of a job run in the foreground */
+};
+
+static virStoragePoolObjPtr
+testPoolNew(void)
+{
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
+
+    if (VIR_ALLOC(pool) < 0)
+        return NULL;
+
+    if (virMutexInit(&pool->lock) < 0) {
+        VIR_FREE(pool);
+        return NULL;
+    }
+
+    if (VIR_ALLOC(pool->def) < 0 ||
+        VIR_STRDUP(pool->def->name, "pool") < 0 ||
+        VIR_ALLOC(vol) < 0 ||
+        VIR_STRDUP(vol->name, "vol") < 0 ||
+        VIR_STRDUP(vol->key, "/pool/vol") < 0 ||
+        VIR_STRDUP(vol->target.path, "/pool/vol") < 0 ||
+        virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
+    pool->def->type = VIR_STORAGE_POOL_DIR;
+    pool->active = true;
+
+    return pool;
+}
+
+/* Set up the driver, a pool with one volume and a @type job on it */
+static int
+testJobSetup(testJobDataPtr data,
+             storageVolJobType type)
+{
+    storageVolJobPtr job = NULL;
+
+    memset(data, 0, sizeof(*data));
+    testStarted = testReleased = false;
+    testRefreshed = testDeleted = 0;
+
+    if (storageStateInitialize(false, NULL, NULL) < 0)
+        return -1;
+
+    if (!(data->conn = virGetConnect()) ||
+        !(data->pool = testPoolNew()))
+        return -1;
+    data->vol = data->pool->volumes.objs[0];
+
+    if (VIR_ALLOC(job) < 0 ||
+        VIR_ALLOC(job->shadowvol) < 0 ||
+        !(job->volobj = virGetStorageVol(data->conn, "pool", "vol",
+                                         "/pool/vol", NULL, NULL))) {
+        storageVolJobFree(job);
+        return -1;
+    }
+
+    memcpy(job->shadowvol, data->vol, sizeof(*data->vol));
+    job->type = type;
+    job->backend = &testBackend;
+    job->pool = data->pool;
+    job->vol = data->vol;
+    data->job = job;
+
+    return 0;
+}
+
+static void
+testJobTeardown(testJobDataPtr data)
+{
+    storageStateCleanup();
+    storageVolJobFree(data->job);
+    virStoragePoolObjFree(data->pool);
+    virObjectUnref(data->conn);
+}
+
+/* Start the job in the background, hands it over to the runner */
+static int
+testJobStartBackground(testJobDataPtr data)
+{
+    int rc;
+
+    virStoragePoolObjLock(data->pool);
+    storageVolJobBegin(data->job);
+    rc = storageVolJobRun(data->job, true);
+    if (rc != 1) {
+        VIR_TEST_DEBUG("job did not go to the background: %d", rc);
+        virStoragePoolObjUnlock(data->pool);
+        return -1;
+    }
+    data->job = NULL;
+
+    testBackendWaitStarted();
+    return 0;
+}
+
+static void
+testJobForegroundThread(void *opaque)
+{
+    testJobDataPtr data = opaque;
+
+    virStoragePoolObjLock(data->pool);
+    storageVolJobBegin(data->job);
+    data->rc = storageVolJobRun(data->job, false);
+    virStoragePoolObjUnlock(data->pool);
+}
+
+
+static int
+testJobBackground(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testJobData data;
+    int ret = -1;
+
+    if (testJobSetup(&data, STORAGE_VOL_JOB_BUILD) < 0 ||
+        testJobStartBackground(&data) < 0)
+        goto cleanup;
+
+    virStoragePoolObjLock(data.pool);
+    if (!data.vol->building || !data.vol->job ||
+        data.pool->asyncjobs != 1) {
+        VIR_TEST_DEBUG("running job is not recorded");
+        virStoragePoolObjUnlock(data.pool);
+        goto cleanup;
+    }
+    virStoragePoolObjUnlock(data.pool);
+
+    /* Shutting down waits for the job */
+    testBackendRelease();
+    storageStateCleanup();
+
+    if (data.pool->volumes.count != 1 || data.vol->building ||
+        data.vol->job || data.pool->asyncjobs != 0 || testRefreshed != 1) {
+        VIR_TEST_DEBUG("finished job was not cleaned up");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    testJobTeardown(&data);
+    return ret;
+}
+
+static int
+testJobDeleteBackground(const void *opaque)
+{
+    storageVolJobType type = *(const storageVolJobType *) opaque;
+    testJobData data;
+    int rc;
+    int ret = -1;
+
+    if (testJobSetup(&data, type) < 0 ||
+        testJobStartBackground(&data) < 0)
+        goto cleanup;
+
+    /* The job is cancelled and removes the volume once it stopped */
+    virStoragePoolObjLock(data.pool);
+    rc = storageVolDeletePrepare(data.pool, data.vol);
+    virStoragePoolObjUnlock(data.pool);
+    if (rc != 1) {
+        VIR_TEST_DEBUG("delete was not deferred to the job: %d", rc);
+        goto cleanup;
+    }
+
+    storageStateCleanup();
+
+    if (data.pool->volumes.count != 0 || data.pool->asyncjobs != 0) {
+        VIR_TEST_DEBUG("volume was not removed by the job");
+        goto cleanup;
+    }
+
+    /* A failed build removes what it created, a wipe has to delete */
+    if (testDeleted != (type == STORAGE_VOL_JOB_WIPE)) {
+        VIR_TEST_DEBUG("volume was deleted %zu times", testDeleted);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virResetLastError();
+    testJobTeardown(&data);
+    return ret;
+}
+
+static int
+testJobDeleteForeground(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testJobData data;
+    virThread thread;
+    bool joinable = false;
+    virErrorPtr err;
+    int rc;
+    int ret = -1;
+
+    if (testJobSetup(&data, STORAGE_VOL_JOB_BUILD) < 0 ||
+        virThreadCreate(&thread, true, testJobForegroundThread, &data) < 0)
+        goto cleanup;
+    joinable = true;
+
+    testBackendWaitStarted();
+
+    /* Somebody waits for the build, deleting the volume fails as it
+     * always did */
+    virStoragePoolObjLock(data.pool);
+    rc = storageVolDeletePrepare(data.pool, data.vol);
+    virStoragePoolObjUnlock(data.pool);
+
+    err = virGetLastError();
+    if (rc != -1 || !err || err->code != VIR_ERR_OPERATION_INVALID) {
+        VIR_TEST_DEBUG("delete during a foreground build returned %d", rc);
+        goto cleanup;
+    }
+    virResetLastError();
+
+    testBackendRelease();
+    virThreadJoin(&thread);
+    joinable = false;
+
+    if (data.rc != 0 || data.pool->volumes.count != 1 ||
+        data.vol->building || data.vol->job) {
+        VIR_TEST_DEBUG("foreground build did not complete");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (joinable) {
+        testBackendRelease();
+        virThreadJoin(&thread);
+    }
+    testJobTeardown(&data);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
+    storageVolJobType build = STORAGE_VOL_JOB_BUILD;
+    storageVolJobType wipe = STORAGE_VOL_JOB_WIPE;
+    int ret = 0;
+
+    if (!mkdtemp(scratchdir)) {
+        fprintf(stderr, "Cannot create scratch directory\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Keep the driver state of the unprivileged driver in here */
+    setenv("XDG_CONFIG_HOME", scratchdir, 1);
+    setenv("XDG_RUNTIME_DIR", scratchdir, 1);
+
+    if (virMutexInit(&testLock) < 0 ||
+        virCondInit(&testCond) < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Background job", testJobBackground, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Delete during background build",
+                    testJobDeleteBackground, &build) < 0)
+        ret = -1;
+    if (virtTestRun("Delete during background wipe",
+                    testJobDeleteBackground, &wipe) < 0)
+        ret = -1;
+    if (virtTestRun("Delete during foreground build",
+                    testJobDeleteForeground, NULL) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -774,6 +774,80 @@ static int testCgroupGetBlkioIoServiced(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+/* Reads the blkio stats of @cgroup and checks them and the number of
+ * statistics files @cgroup keeps open afterwards */
+static int testCgroupCheckStatFds(virCgroupPtr cgroup, size_t nstatFds)
+{
+    long long values[4];
+
+    if (virCgroupGetBlkioIoServiced(cgroup, values, &values[1],
+                                    &values[2], &values[3]) < 0) {
+        fprintf(stderr, "Could not retrieve BlkioIoServiced\n");
+        return -1;
+    }
+
+    if (values[0] != 119084214273ULL || values[1] != 822880960513ULL ||
+        values[2] != 9665167 || values[3] != 73283807) {
+        fprintf(stderr, "Wrong values from virCgroupBlkioIoServiced\n");
+        return -1;
+    }
+
+    if (cgroup->nstatFds != nstatFds) {
+        fprintf(stderr, "%zu statistics files open, expected %zu\n",
+                cgroup->nstatFds, nstatFds);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int testCgroupStatFdReuse(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    int fds[2];
+    size_t i;
+    int rv, ret = -1;
+
+    if ((rv = virCgroupNewPartition("/virtualmachines", true,
+                                    (1 << VIR_CGROUP_CONTROLLER_BLKIO),
+                                    &cgroup)) < 0) {
+        fprintf(stderr, "Could not create /virtualmachines cgroup: %d\n", -rv);
+        goto cleanup;
+    }
+
+    /* Both blkio.throttle files are kept open by the first read */
+    if (testCgroupCheckStatFds(cgroup, 2) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 2; i++)
+        fds[i] = cgroup->statFds[i].fd;
+
+    /* and re-read without being opened again */
+    if (testCgroupCheckStatFds(cgroup, 2) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 2; i++) {
+        if (cgroup->statFds[i].fd != fds[i]) {
+            fprintf(stderr, "Statistics file was opened again\n");
+            goto cleanup;
+        }
+    }
+
+    /* A stale descriptor is dropped, the value is still read and the
+     * file is kept open again by the next read */
+    VIR_FORCE_CLOSE(cgroup->statFds[0].fd);
+
+    if (testCgroupCheckStatFds(cgroup, 1) < 0 ||
+        testCgroupCheckStatFds(cgroup, 2) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
 static int testCgroupGetBlkioIoDeviceServiced(const void *args ATTRIBUTE_UNUSED)
 {
     virCgroupPtr cgroup = NULL;
@@ -916,6 +990,9 @@ mymain(void)
     if (virtTestRun("virCgroupGetBlkioIoDeviceServiced works", testCgroupGetBlkioIoDeviceServiced, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Cgroup statistics files are kept open", testCgroupStatFdReuse, NULL) < 0)
+        ret = -1;
+
     if (virtTestRun("virCgroupGetMemoryUsage works", testCgroupGetMemoryUsage, NULL) < 0)
         ret = -1;
 
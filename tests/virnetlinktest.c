@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <linux/rtnetlink.h>
+
+# include "virnetlink.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+# define TEST_MAX_MSGS 8
+
+/* Room for every message of a dump, each carrying at most an nlmsgerr */
+typedef union {
+    char buf[TEST_MAX_MSGS * NLMSG_SPACE(sizeof(struct nlmsgerr))];
+    struct nlmsghdr align;
+} testNetlinkDump;
+
+struct testNetlinkDumpData {
+    const int *types;       /* message types of the dump, -errno for errors */
+    size_t ntypes;
+    int failAt;             /* index of the message the callback rejects */
+    int ret;                /* expected return value */
+    bool end;               /* whether the end of the dump is expected */
+    int ncalls;             /* expected number of callback calls */
+};
+
+struct testNetlinkDumpState {
+    int ncalls;
+    int failAt;
+};
+
+static unsigned int
+testNetlinkDumpBuild(testNetlinkDump *dump,
+                     const int *types,
+                     size_t ntypes)
+{
+    struct nlmsghdr *msg;
+    unsigned int len = 0;
+    size_t i;
+
+    memset(dump, 0, sizeof(*dump));
+
+    for (i = 0; i < ntypes; i++) {
+        msg = (struct nlmsghdr *)(dump->buf + len);
+        msg->nlmsg_flags = NLM_F_MULTI;
+        msg->nlmsg_seq = 1;
+
+        if (types[i] <= 0) {
+            struct nlmsgerr *err = NLMSG_DATA(msg);
+
+            msg->nlmsg_type = NLMSG_ERROR;
+            msg->nlmsg_len = NLMSG_LENGTH(sizeof(*err));
+            err->error = types[i];
+        } else if (types[i] == NLMSG_DONE) {
+            msg->nlmsg_type = NLMSG_DONE;
+            msg->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+        } else {
+            struct ifinfomsg *ifinfo = NLMSG_DATA(msg);
+
+            msg->nlmsg_type = types[i];
+            msg->nlmsg_len = NLMSG_LENGTH(sizeof(*ifinfo));
+            ifinfo->ifi_index = i + 1;
+        }
+
+        len += NLMSG_ALIGN(msg->nlmsg_len);
+    }
+
+    return len;
+}
+
+static int
+testNetlinkDumpCallback(const struct nlmsghdr *resp,
+                        void *opaque)
+{
+    struct testNetlinkDumpState *state = opaque;
+    const struct ifinfomsg *ifinfo = NLMSG_DATA(resp);
+
+    if (resp->nlmsg_type != RTM_NEWLINK) {
+        VIR_TEST_DEBUG("unexpected message type %d", resp->nlmsg_type);
+        return -1;
+    }
+
+    if (ifinfo->ifi_index <= 0) {
+        VIR_TEST_DEBUG("message payload was not passed through");
+        return -1;
+    }
+
+    if (state->ncalls++ == state->failAt)
+        return -1;
+
+    return 0;
+}
+
+static int
+testNetlinkDumpProcess(const void *opaque)
+{
+    const struct testNetlinkDumpData *data = opaque;
+    struct testNetlinkDumpState state = { 0, data->failAt };
+    testNetlinkDump dump;
+    unsigned int len;
+    bool end = false;
+    int rc;
+
+    len = testNetlinkDumpBuild(&dump, data->types, data->ntypes);
+
+    rc = virNetlinkDumpProcess((struct nlmsghdr *)dump.buf, len,
+                               testNetlinkDumpCallback, &state, &end);
+    virResetLastError();
+
+    if (rc != data->ret) {
+        VIR_TEST_DEBUG("returned %d, expected %d", rc, data->ret);
+        return -1;
+    }
+
+    if (end != data->end) {
+        VIR_TEST_DEBUG("end of dump %sdetected", end ? "" : "not ");
+        return -1;
+    }
+
+    if (state.ncalls != data->ncalls) {
+        VIR_TEST_DEBUG("callback called %d times, expected %d",
+                       state.ncalls, data->ncalls);
+        return -1;
+    }
+
+    return 0;
+}
+
+static const int dumpComplete[] = {
+    RTM_NEWLINK, RTM_NEWLINK, RTM_NEWLINK, NLMSG_DONE,
+};
+
+/* The rest of the dump follows in another datagram */
+static const int dumpPartial[] = {
+    RTM_NEWLINK, RTM_NEWLINK,
+};
+
+/* Nothing after the end of the dump is looked at */
+static const int dumpTrailing[] = {
+    RTM_NEWLINK, NLMSG_DONE, RTM_NEWLINK,
+};
+
+static const int dumpAck[] = {
+    RTM_NEWLINK, 0, RTM_NEWLINK, NLMSG_DONE,
+};
+
+static const int dumpError[] = {
+    RTM_NEWLINK, -EOPNOTSUPP, RTM_NEWLINK, NLMSG_DONE,
+};
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST(name, msgs, failAt, rc, end, ncalls)                       \
+    do {                                                                    \
+        struct testNetlinkDumpData data = {                                 \
+            msgs, ARRAY_CARDINALITY(msgs), failAt, rc, end, ncalls          \
+        };                                                                  \
+        if (virtTestRun("Dump " name, testNetlinkDumpProcess, &data) < 0)   \
+            ret = -1;                                                       \
+    } while (0)
+
+    DO_TEST("complete", dumpComplete, -1, 0, true, 3);
+    DO_TEST("partial", dumpPartial, -1, 0, false, 2);
+    DO_TEST("trailing", dumpTrailing, -1, 0, true, 1);
+    DO_TEST("ack", dumpAck, -1, 0, true, 2);
+    DO_TEST("error", dumpError, -1, -1, false, 1);
+    DO_TEST("callback failure", dumpComplete, 1, -1, false, 2);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+#else
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "internal.h"
+#include "virbitmap.h"
+#include "virerror.h"
+#include "virnuma.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define GiB (1024ull * 1024 * 1024)
+
+/* Fake host of 16 CPUs in four nodes, plus a node 4 that is within the
+ * node range but has no topology:
+ *
+ *   node  cpus   free memory  free 2 MiB pages
+ *   0     0-3    4 GiB        512
+ *   1     4-7    16 GiB       2048
+ *   2     -      64 GiB       0
+ *   3     8-15   8 GiB        none of this size
+ */
+static const struct {
+    int firstcpu;
+    int ncpus;
+    unsigned long long memfree;     /* bytes */
+    int hugepages;                  /* free 2 MiB pages, -1 for no pool */
+} nodes[] = {
+    { 0, 4, 4 * GiB, 512 },
+    { 4, 4, 16 * GiB, 2048 },
+    { 0, 0, 64 * GiB, 0 },
+    { 8, 8, 8 * GiB, -1 },
+};
+
+#define NUMA_MOCK_MAX_CPUS 16
+#define NUMA_MOCK_HUGEPAGE_SIZE 2048
+
+bool
+virNumaIsAvailable(void)
+{
+    return true;
+}
+
+int
+virNumaGetMaxNode(void)
+{
+    return ARRAY_CARDINALITY(nodes);
+}
+
+int
+virNumaGetNodeCPUs(int node,
+                   virBitmapPtr *cpus)
+{
+    size_t i;
+
+    *cpus = NULL;
+
+    if (node < 0 || node >= ARRAY_CARDINALITY(nodes))
+        return -2;
+
+    if (!(*cpus = virBitmapNew(NUMA_MOCK_MAX_CPUS)))
+        return -1;
+
+    for (i = 0; i < nodes[node].ncpus; i++)
+        ignore_value(virBitmapSetBit(*cpus, nodes[node].firstcpu + i));
+
+    return nodes[node].ncpus;
+}
+
+int
+virNumaGetNodeMemory(int node,
+                     unsigned long long *memsize,
+                     unsigned long long *memfree)
+{
+    if (node < 0 || node >= ARRAY_CARDINALITY(nodes))
+        return -1;
+
+    if (memsize)
+        *memsize = nodes[node].memfree * 2;
+    if (memfree)
+        *memfree = nodes[node].memfree;
+
+    return 0;
+}
+
+int
+virNumaGetPageInfo(int node,
+                   unsigned int page_size,
+                   unsigned long long huge_page_sum ATTRIBUTE_UNUSED,
+                   unsigned int *page_avail,
+                   unsigned int *page_free)
+{
+    if (node < 0 || node >= ARRAY_CARDINALITY(nodes) ||
+        page_size != NUMA_MOCK_HUGEPAGE_SIZE ||
+        nodes[node].hugepages < 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("no %u KiB pages on node %d"), page_size, node);
+        return -1;
+    }
+
+    if (page_avail)
+        *page_avail = nodes[node].hugepages;
+    if (page_free)
+        *page_free = nodes[node].hugepages;
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#ifdef __linux__
+
+# include "viralloc.h"
+# include "virbitmap.h"
+# include "virnuma.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Memory sizes are in KiB */
+# define GiB (1024ull * 1024)
+
+struct testVirNumaGetPlacementData {
+    unsigned int vcpus;
+    unsigned long long memory;      /* KiB */
+    unsigned int pagesize;
+    const unsigned int *cpuload;
+    size_t ncpuload;
+    const char *current;
+    const char *nodes;              /* expected nodeset */
+    const char *cpus;               /* expected CPUs of the nodeset */
+};
+
+/* Load on the host CPUs of virnumamock, in vCPU shares */
+static const unsigned int loadBusyNode3[] = {
+    0, 0, 0, 0,
+    500, 500, 500, 500,
+    1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000,
+};
+
+static const unsigned int loadLightNode0[] = {
+    200, 200, 200, 200,
+};
+
+static int
+testVirNumaGetPlacement(const void *opaque)
+{
+    const struct testVirNumaGetPlacementData *data = opaque;
+    virBitmapPtr current = NULL;
+    virBitmapPtr nodes = NULL;
+    virBitmapPtr cpus = NULL;
+    virBitmapPtr nodecpus = NULL;
+    char *nodestr = NULL;
+    char *cpustr = NULL;
+    ssize_t node = -1;
+    ssize_t cpu;
+    int ret = -1;
+
+    if (data->current &&
+        virBitmapParse(data->current, 0, &current,
+                       virNumaGetMaxNode() + 1) < 0)
+        goto cleanup;
+
+    if (!(nodes = virNumaGetPlacement(data->vcpus, data->memory,
+                                      data->pagesize, data->cpuload,
+                                      data->ncpuload, current)))
+        goto cleanup;
+
+    while ((node = virBitmapNextSetBit(nodes, node)) >= 0) {
+        if (virNumaGetNodeCPUs(node, &nodecpus) < 0)
+            goto cleanup;
+
+        if (!cpus) {
+            cpus = nodecpus;
+        } else {
+            cpu = -1;
+            while ((cpu = virBitmapNextSetBit(nodecpus, cpu)) >= 0)
+                ignore_value(virBitmapSetBit(cpus, cpu));
+            virBitmapFree(nodecpus);
+        }
+        nodecpus = NULL;
+    }
+
+    if (!cpus) {
+        VIR_TEST_DEBUG("no node was picked");
+        goto cleanup;
+    }
+
+    if (!(nodestr = virBitmapFormat(nodes)) ||
+        !(cpustr = virBitmapFormat(cpus)))
+        goto cleanup;
+
+    if (STRNEQ(nodestr, data->nodes)) {
+        VIR_TEST_DEBUG("placed on nodes '%s', expected '%s'",
+                       nodestr, data->nodes);
+        goto cleanup;
+    }
+
+    if (STRNEQ(cpustr, data->cpus)) {
+        VIR_TEST_DEBUG("placed on CPUs '%s', expected '%s'",
+                       cpustr, data->cpus);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(current);
+    virBitmapFree(nodes);
+    virBitmapFree(cpus);
+    virBitmapFree(nodecpus);
+    VIR_FREE(nodestr);
+    VIR_FREE(cpustr);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST_FULL(name, vcpus, memory, pagesize, load, nload, current,   \
+                      nodes, cpus)                                          \
+    do {                                                                    \
+        struct testVirNumaGetPlacementData data = {                         \
+            vcpus, memory, pagesize, load, nload, current, nodes, cpus      \
+        };                                                                  \
+        if (virtTestRun("Placement: " name,                                 \
+                        testVirNumaGetPlacement, &data) < 0)                \
+            ret = -1;                                                       \
+    } while (0)
+
+# define DO_TEST(name, vcpus, memory, nodes, cpus)                          \
+    DO_TEST_FULL(name, vcpus, memory, 0, NULL, 0, NULL, nodes, cpus)
+
+# define DO_TEST_LOAD(name, vcpus, memory, load, current, nodes, cpus)      \
+    DO_TEST_FULL(name, vcpus, memory, 0, load, ARRAY_CARDINALITY(load),     \
+                 current, nodes, cpus)
+
+# define DO_TEST_HUGEPAGES(name, vcpus, memory, pagesize, nodes, cpus)      \
+    DO_TEST_FULL(name, vcpus, memory, pagesize, NULL, 0, NULL, nodes, cpus)
+
+    /* Most free memory wins when nothing else is running, the memory only
+     * node 2 is never used */
+    DO_TEST("idle host", 2, 2 * GiB, "1", "4-7");
+    DO_TEST("more vCPUs than node CPUs", 6, 2 * GiB, "3", "8-15");
+    DO_TEST("single node memory", 2, 12 * GiB, "1", "4-7");
+    DO_TEST("spread memory", 2, 20 * GiB, "1,3", "4-15");
+    DO_TEST("not enough memory", 2, 100 * GiB, "0-1,3", "0-15");
+
+    DO_TEST_LOAD("least loaded node", 2, 2 * GiB,
+                 loadBusyNode3, NULL, "0", "0-3");
+
+    /* Node 3 has no pool of 2 MiB pages */
+    DO_TEST_HUGEPAGES("huge pages", 2, 3 * GiB, 2048, "1", "4-7");
+    DO_TEST_HUGEPAGES("spread huge pages", 2, 9 * GiB / 2, 2048,
+                      "0-1", "0-7");
+
+    /* Node 0 alone only fits the domain with its own memory counted as
+     * free, and only wins over the idle node 1 as the current node */
+    DO_TEST_LOAD("move from loaded node", 2, 6 * GiB,
+                 loadLightNode0, NULL, "1", "4-7");
+    DO_TEST_LOAD("stay on current node", 2, 6 * GiB,
+                 loadLightNode0, "0", "0", "0-3");
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/virnumamock.so")
+#else
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+#endif
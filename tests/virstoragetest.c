@@ -29,6 +29,7 @@
 #include "virlog.h"
 #include "virstoragefile.h"
 #include "virstring.h"
+#include "virtime.h"
 #include "dirname.h"
 
 #include "storage/storage_driver.h"
@@ -416,6 +417,144 @@ testStorageChain(const void *args)
     return ret;
 }
 
+#define TEST_CHAIN_CACHE_DOMAINS 1000
+
+/* Resolve the same chain once per simulated domain start, as happens
+ * when many overlays share one base image, and check the cached
+ * header metadata matches what a fresh parse returns. */
+static int
+testStorageChainCache(const void *args)
+{
+    const char *start = args;
+    virStorageSourcePtr expect = NULL;
+    virStorageSourcePtr meta = NULL;
+    virStorageSourcePtr a;
+    virStorageSourcePtr b;
+    unsigned long long then, now;
+    size_t i;
+    int ret = -1;
+
+    virStorageFileMetadataCacheClear();
+
+    if (!(expect = testStorageFileGetMetadata(start, VIR_STORAGE_FILE_QCOW2,
+                                              -1, -1, false)))
+        goto cleanup;
+
+    if (virTimeMillisNow(&then) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_CHAIN_CACHE_DOMAINS; i++) {
+        virStorageSourceFree(meta);
+        if (!(meta = testStorageFileGetMetadata(start, VIR_STORAGE_FILE_QCOW2,
+                                                -1, -1, false)))
+            goto cleanup;
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    VIR_TEST_DEBUG("resolved chain of '%s' %d times in %llu ms",
+                   start, TEST_CHAIN_CACHE_DOMAINS, now - then);
+
+    for (a = expect, b = meta; a || b;
+         a = a->backingStore, b = b->backingStore) {
+        if (!a || !b ||
+            a->format != b->format ||
+            a->capacity != b->capacity ||
+            STRNEQ_NULLABLE(a->path, b->path) ||
+            STRNEQ_NULLABLE(a->backingStoreRaw, b->backingStoreRaw) ||
+            STRNEQ_NULLABLE(a->compat, b->compat) ||
+            !a->encryption != !b->encryption) {
+            fprintf(stderr, "cached chain of '%s' differs\n", start);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStorageSourceFree(expect);
+    virStorageSourceFree(meta);
+    return ret;
+}
+
+/* Resolve @path as a source of @format that comes with @capacity and
+ * optionally features already set, as a volume definition would */
+static virStorageSourcePtr
+testStorageChainCacheResolve(const char *path,
+                             int format,
+                             unsigned long long capacity,
+                             bool features)
+{
+    virStorageSourcePtr src;
+
+    if (VIR_ALLOC(src) < 0)
+        return NULL;
+
+    src->type = VIR_STORAGE_TYPE_FILE;
+    src->format = format;
+    src->capacity = capacity;
+
+    if (VIR_STRDUP(src->path, path) < 0 ||
+        (features &&
+         !(src->features = virBitmapNew(VIR_STORAGE_FILE_FEATURE_LAST))) ||
+        virStorageFileGetMetadata(src, -1, -1, false, false) < 0) {
+        virStorageSourceFree(src);
+        return NULL;
+    }
+
+    return src;
+}
+
+/* Only what the header says may come from the cache, the values a
+ * source brings along for anything else must survive a cache hit */
+static int
+testStorageChainCachePresets(const void *args ATTRIBUTE_UNUSED)
+{
+    virStorageSourcePtr first = NULL;
+    virStorageSourcePtr second = NULL;
+    int ret = -1;
+
+    virStorageFileMetadataCacheClear();
+
+    /* Raw images have no header to take the capacity from */
+    if (!(first = testStorageChainCacheResolve(absraw, VIR_STORAGE_FILE_RAW,
+                                               111, false)) ||
+        !(second = testStorageChainCacheResolve(absraw, VIR_STORAGE_FILE_RAW,
+                                                222, true)))
+        goto cleanup;
+
+    if (first->capacity != 111 || second->capacity != 222 ||
+        first->features || !second->features) {
+        fprintf(stderr, "cache hit replaced values of a raw source\n");
+        goto cleanup;
+    }
+
+    virStorageSourceFree(first);
+    virStorageSourceFree(second);
+    second = NULL;
+
+    /* A qcow2 header has a capacity which wins over the preset one */
+    if (!(first = testStorageChainCacheResolve(abswrap, VIR_STORAGE_FILE_QCOW2,
+                                               111, false)) ||
+        !(second = testStorageChainCacheResolve(abswrap,
+                                                VIR_STORAGE_FILE_QCOW2,
+                                                222, false)))
+        goto cleanup;
+
+    if (first->capacity != 1024 || second->capacity != 1024) {
+        fprintf(stderr, "cache hit lost the capacity of a qcow2 header\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStorageSourceFree(first);
+    virStorageSourceFree(second);
+    return ret;
+}
+
 struct testLookupData
 {
     virStorageSourcePtr chain;
@@ -776,6 +915,14 @@ mymain(void)
                (&wrap, &qcow2, &raw), EXP_PASS,
                (&wrap, &qcow2, &raw), ALLOW_PROBE | EXP_PASS);
 
+    /* Same chain resolved repeatedly through the metadata cache */
+    if (virtTestRun("Storage backing chain metadata cache",
+                    testStorageChainCache, abswrap) < 0)
+        ret = -1;
+    if (virtTestRun("Storage backing chain metadata cache presets",
+                    testStorageChainCachePresets, NULL) < 0)
+        ret = -1;
+
     /* Rewrite qcow2 and wrap file to omit backing file type */
     virCommandFree(cmd);
     cmd = virCommandNewArgList(qemuimg, "rebase", "-u", "-f", "qcow2",
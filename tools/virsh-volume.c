@@ -383,6 +383,10 @@ static const vshCmdOptDef opts_vol_create[] = {
      .type = VSH_OT_BOOL,
      .help = N_("preallocate metadata (for qcow2 instead of full allocation)")
     },
+    {.name = "background",
+     .type = VSH_OT_BOOL,
+     .help = N_("return once the volume is defined and fill it in the background")
+    },
     {.name = NULL}
 };
 
@@ -399,6 +403,9 @@ cmdVolCreate(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "prealloc-metadata"))
         flags |= VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA;
 
+    if (vshCommandOptBool(cmd, "background"))
+        flags |= VIR_STORAGE_VOL_CREATE_BACKGROUND;
+
     if (!(pool = virshCommandOptPool(ctl, cmd, "pool", NULL)))
         return false;
 
@@ -454,6 +461,10 @@ static const vshCmdOptDef opts_vol_create_from[] = {
      .type = VSH_OT_BOOL,
      .help = N_("use btrfs COW lightweight copy")
     },
+    {.name = "background",
+     .type = VSH_OT_BOOL,
+     .help = N_("return once the volume is defined and fill it in the background")
+    },
     {.name = NULL}
 };
 
@@ -476,6 +487,9 @@ cmdVolCreateFrom(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "reflink"))
         flags |= VIR_STORAGE_VOL_CREATE_REFLINK;
 
+    if (vshCommandOptBool(cmd, "background"))
+        flags |= VIR_STORAGE_VOL_CREATE_BACKGROUND;
+
     if (vshCommandOptStringReq(ctl, cmd, "file", &from) < 0)
         goto cleanup;
 
@@ -567,6 +581,10 @@ static const vshCmdOptDef opts_vol_clone[] = {
      .type = VSH_OT_BOOL,
      .help = N_("use btrfs COW lightweight copy")
     },
+    {.name = "background",
+     .type = VSH_OT_BOOL,
+     .help = N_("return once the volume is defined and fill it in the background")
+    },
     {.name = NULL}
 };
 
@@ -590,6 +608,9 @@ cmdVolClone(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "reflink"))
         flags |= VIR_STORAGE_VOL_CREATE_REFLINK;
 
+    if (vshCommandOptBool(cmd, "background"))
+        flags |= VIR_STORAGE_VOL_CREATE_BACKGROUND;
+
     origpool = virStoragePoolLookupByVolume(origvol);
     if (!origpool) {
         vshError(ctl, "%s", _("failed to get parent pool"));
@@ -909,6 +930,10 @@ static const vshCmdOptDef opts_vol_wipe[] = {
      .type = VSH_OT_STRING,
      .help = N_("perform selected wiping algorithm")
     },
+    {.name = "background",
+     .type = VSH_OT_BOOL,
+     .help = N_("return immediately and wipe the volume in the background")
+    },
     {.name = NULL}
 };
 
@@ -926,6 +951,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
     const char *algorithm_str = NULL;
     int algorithm = VIR_STORAGE_VOL_WIPE_ALG_ZERO;
     int funcRet;
+    unsigned int flags = 0;
+
+    if (vshCommandOptBool(cmd, "background"))
+        flags |= VIR_STORAGE_VOL_WIPE_BACKGROUND;
 
     if (!(vol = virshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
         return false;
@@ -939,10 +968,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
         goto out;
     }
 
-    if ((funcRet = virStorageVolWipePattern(vol, algorithm, 0)) < 0) {
+    if ((funcRet = virStorageVolWipePattern(vol, algorithm, flags)) < 0) {
         if (last_error->code == VIR_ERR_NO_SUPPORT &&
             algorithm == VIR_STORAGE_VOL_WIPE_ALG_ZERO)
-            funcRet = virStorageVolWipe(vol, 0);
+            funcRet = virStorageVolWipe(vol, flags);
     }
 
     if (funcRet < 0) {
@@ -950,7 +979,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
         goto out;
     }
 
-    vshPrint(ctl, _("Vol %s wiped\n"), name);
+    if (flags & VIR_STORAGE_VOL_WIPE_BACKGROUND)
+        vshPrint(ctl, _("Wiping of vol %s started\n"), name);
+    else
+        vshPrint(ctl, _("Vol %s wiped\n"), name);
     ret = true;
  out:
     virStorageVolFree(vol);